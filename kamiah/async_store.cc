@@ -0,0 +1,144 @@
+/**
+ * @file async_store.cc
+ * @brief Implementation of an AsyncDocumentStore.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "async_store.h"
+
+namespace kamiah {
+
+class AsyncDocumentStore::ApplyTask : public Task {
+ public:
+  ApplyTask(AsyncDocumentStore *owner, DocID doc_id, const Diff& diff,
+            ApplyCallback *callback)
+      : owner_(owner), doc_id_(doc_id), diff_(diff), callback_(callback) {
+  }
+
+  virtual void Run() {
+    owner_->DoApply(doc_id_, &diff_, callback_);
+  }
+
+ private:
+  AsyncDocumentStore *owner_;
+  DocID doc_id_;
+  Diff diff_;
+  ApplyCallback *callback_;
+};
+
+class AsyncDocumentStore::ResolveTask : public Task {
+ public:
+  ResolveTask(AsyncDocumentStore *owner, DocID doc_id)
+      : owner_(owner), doc_id_(doc_id) {
+  }
+
+  virtual void Run() {
+    owner_->Resolve(doc_id_);
+  }
+
+ private:
+  AsyncDocumentStore *owner_;
+  DocID doc_id_;
+};
+
+AsyncDocumentStore::AsyncDocumentStore(DocumentStore *store,
+                                       Scheduler *scheduler)
+    : store_(store), scheduler_(scheduler), num_waiters_(0) {
+}
+
+void AsyncDocumentStore::Apply(DocID doc_id, const Diff& diff,
+                               ApplyCallback *callback) {
+  scheduler_->Schedule(new ApplyTask(this, doc_id, diff, callback));
+}
+
+void AsyncDocumentStore::NextUpdates(DocID doc_id, Version from_version,
+                                     UpdatesCallback *callback) {
+  Waiter waiter;
+  waiter.from_version = from_version;
+  waiter.callback = callback;
+  waiters_[doc_id].push_back(waiter);
+  ++num_waiters_;
+
+  // The updates may already be there
+  scheduler_->Schedule(new ResolveTask(this, doc_id));
+}
+
+bool AsyncDocumentStore::Cancel(DocID doc_id, UpdatesCallback *callback) {
+  map<DocID, list<Waiter> >::iterator doc_it = waiters_.find(doc_id);
+  if (doc_it == waiters_.end()) {
+    return false;
+  }
+
+  list<Waiter> *waiters = &doc_it->second;
+  for (list<Waiter>::iterator it = waiters->begin(); it != waiters->end();
+       ++it) {
+    if (it->callback == callback) {
+      waiters->erase(it);
+      --num_waiters_;
+      if (waiters->empty()) {
+        waiters_.erase(doc_it);
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+size_t AsyncDocumentStore::num_waiters() const {
+  return num_waiters_;
+}
+
+void AsyncDocumentStore::DoApply(DocID doc_id, Diff *diff,
+                                 ApplyCallback *callback) {
+  bool applied = store_->ApplyDiff(doc_id, diff);
+  if (callback != NULL) {
+    callback->OnApplied(doc_id, applied, *diff);
+  }
+
+  if (applied && (waiters_.find(doc_id) != waiters_.end())) {
+    scheduler_->Schedule(new ResolveTask(this, doc_id));
+  }
+}
+
+void AsyncDocumentStore::Resolve(DocID doc_id) {
+  map<DocID, list<Waiter> >::iterator doc_it = waiters_.find(doc_id);
+  if (doc_it == waiters_.end()) {
+    return;
+  }
+
+  // Take out all the waiters that can be resumed before resuming any of them
+  // since they are likely to start waiting again on this same Document.
+  const Document *doc = store_->Get(doc_id);
+  list<Waiter> *waiters = &doc_it->second;
+  list<Waiter> ready;
+  list<Waiter>::iterator it = waiters->begin();
+  while (it != waiters->end()) {
+    if ((doc == NULL) || (it->from_version <= doc->version())) {
+      list<Waiter>::iterator next = it;
+      ++next;
+      ready.splice(ready.end(), *waiters, it);
+      it = next;
+    } else {
+      ++it;
+    }
+  }
+  num_waiters_ -= ready.size();
+  if (waiters->empty()) {
+    waiters_.erase(doc_it);
+  }
+
+  for (it = ready.begin(); it != ready.end(); ++it) {
+    // A resumed callback may have removed the Document
+    doc = store_->Get(doc_id);
+    list<Diff> updates;
+    bool available = false;
+    if (doc != NULL) {
+      available = doc->GetUpdates(it->from_version, &updates);
+    }
+    it->callback->OnUpdates(doc_id, available, updates);
+  }
+}
+
+}  // namespace kamiah
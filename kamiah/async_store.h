@@ -0,0 +1,156 @@
+/**
+ * @file async_store.h
+ * @brief Definition of an AsyncDocumentStore.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_ASYNC_STORE_H_
+#define KAMIAH_ASYNC_STORE_H_
+
+#include <list>
+#include <map>
+
+#include "diff.h"
+#include "document_store.h"
+#include "scheduler.h"
+#include "types.h"
+
+using std::list;
+using std::map;
+
+namespace kamiah {
+
+/**
+ * @brief Callback resumed when an asynchronous Apply() completes.
+ */
+class ApplyCallback {
+ public:
+  virtual ~ApplyCallback() {}
+
+  /**
+   * @brief Called once the diff has been applied (or failed to apply).
+   *
+   * @param doc_id The ID of the Document the diff was applied to.
+   * @param applied True iff the diff was applied successfully.
+   * @param diff The diff, with its version set if it was applied.
+   */
+  virtual void OnApplied(DocID doc_id, bool applied, const Diff& diff) = 0;
+};
+
+/**
+ * @brief Callback resumed when an asynchronous NextUpdates() completes.
+ */
+class UpdatesCallback {
+ public:
+  virtual ~UpdatesCallback() {}
+
+  /**
+   * @brief Called once updates are available for the Document.
+   *
+   * @param doc_id The ID of the Document.
+   * @param available True if the updates were populated. False if the
+   *     Document does not exist or the diffs are no longer cached, in which
+   *     case the full data should be requested instead.
+   * @param updates The diffs from the requested version to the latest
+   *     Document version.
+   */
+  virtual void OnUpdates(DocID doc_id, bool available,
+                         const list<Diff>& updates) = 0;
+};
+
+/**
+ * @brief An AsyncDocumentStore exposes the operations of a DocumentStore as
+ *     asynchronous operations that are resumed on a Scheduler.
+ *
+ * Each editing session is represented by the callback it is waiting on rather
+ * than by a thread: a session waiting for updates costs one entry in a list
+ * until the Document it watches changes. Callbacks are never run inline, they
+ * are always resumed from a task on the Scheduler, in the order in which the
+ * operations completed.
+ *
+ * Callbacks are not owned by the AsyncDocumentStore and must outlive the
+ * operation they were passed to (or be cancelled). The Scheduler must not run
+ * tasks after the AsyncDocumentStore is destroyed.
+ *
+ * This class is thread-compatible.
+ */
+class AsyncDocumentStore {
+ public:
+  /**
+   * @brief Constructs an AsyncDocumentStore.
+   *
+   * @param store The store holding the Documents. Not owned.
+   * @param scheduler The scheduler on which to run operations. Not owned.
+   */
+  AsyncDocumentStore(DocumentStore *store, Scheduler *scheduler);
+
+  /**
+   * @brief Applies the specified diff to the Document with the specified ID.
+   *
+   * Waiters on the Document are resumed once the diff is applied.
+   *
+   * @param doc_id The ID of the Document to apply the diff to.
+   * @param diff The diff to apply. It is copied.
+   * @param callback Callback to resume when the diff is applied. May be NULL.
+   */
+  void Apply(DocID doc_id, const Diff& diff, ApplyCallback *callback);
+
+  /**
+   * @brief Waits for updates to the Document with the specified ID starting
+   *     at the specified version.
+   *
+   * The callback is resumed as soon as the Document's version is at least
+   * from_version. This is right away if the Document is already there.
+   *
+   * @param doc_id The ID of the Document to wait on.
+   * @param from_version The version from which to start getting updates.
+   * @param callback Callback to resume with the updates.
+   */
+  void NextUpdates(DocID doc_id, Version from_version,
+                   UpdatesCallback *callback);
+
+  /**
+   * @brief Cancels a pending NextUpdates() operation.
+   *
+   * @param doc_id The ID of the Document being waited on.
+   * @param callback The callback passed to NextUpdates().
+   * @return True iff the operation was pending and is now cancelled.
+   */
+  bool Cancel(DocID doc_id, UpdatesCallback *callback);
+
+  /**
+   * @brief Gets the number of pending NextUpdates() operations.
+   *
+   * @return The number of pending NextUpdates() operations.
+   */
+  size_t num_waiters() const;
+
+ private:
+  class ApplyTask;
+  class ResolveTask;
+
+  struct Waiter {
+    Version from_version;
+    UpdatesCallback *callback;
+  };
+
+  // Applies the diff and schedules the resolution of the Document's waiters.
+  void DoApply(DocID doc_id, Diff *diff, ApplyCallback *callback);
+
+  // Resumes all the waiters of the Document whose updates are available.
+  void Resolve(DocID doc_id);
+
+  DocumentStore *store_;
+  Scheduler *scheduler_;
+  map<DocID, list<Waiter> > waiters_;
+  size_t num_waiters_;
+
+  // Not copyable.
+  AsyncDocumentStore(const AsyncDocumentStore&);
+  void operator=(const AsyncDocumentStore&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_ASYNC_STORE_H_
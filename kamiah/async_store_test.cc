@@ -0,0 +1,225 @@
+/**
+ * @file async_store_test.cc
+ * @brief Unit tests for an AsyncDocumentStore.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "async_store.h"
+
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+class RecordingApplyCallback : public ApplyCallback {
+ public:
+  RecordingApplyCallback() : calls_(0), applied_(false), version_(-1) {}
+
+  virtual void OnApplied(DocID doc_id, bool applied, const Diff& diff) {
+    ++calls_;
+    doc_id_ = doc_id;
+    applied_ = applied;
+    version_ = diff.version();
+  }
+
+  int calls_;
+  DocID doc_id_;
+  bool applied_;
+  Version version_;
+};
+
+class RecordingUpdatesCallback : public UpdatesCallback {
+ public:
+  RecordingUpdatesCallback() : calls_(0), available_(false) {}
+
+  virtual void OnUpdates(DocID doc_id, bool available,
+                         const list<Diff>& updates) {
+    ++calls_;
+    doc_id_ = doc_id;
+    available_ = available;
+    updates_ = updates;
+  }
+
+  int calls_;
+  DocID doc_id_;
+  bool available_;
+  list<Diff> updates_;
+};
+
+// Waits for the next update every time it is resumed.
+class FollowingCallback : public UpdatesCallback {
+ public:
+  explicit FollowingCallback(AsyncDocumentStore *async_store)
+      : async_store_(async_store), seen_(0) {}
+
+  virtual void OnUpdates(DocID doc_id, bool available,
+                         const list<Diff>& updates) {
+    ASSERT_TRUE(available);
+    seen_ = updates.back().version();
+    async_store_->NextUpdates(doc_id, seen_ + 1, this);
+  }
+
+  AsyncDocumentStore *async_store_;
+  Version seen_;
+};
+
+class AsyncDocumentStoreTest : public ::testing::Test {
+ protected:
+  AsyncDocumentStoreTest() : async_store_(&store_, &scheduler_) {
+    store_.GetOrCreate(1);
+  }
+
+  DocumentStore store_;
+  Scheduler scheduler_;
+  AsyncDocumentStore async_store_;
+};
+
+TEST_F(AsyncDocumentStoreTest, Apply) {
+  RecordingApplyCallback callback;
+  async_store_.Apply(1, Diff(0, "papaya"), &callback);
+
+  // Nothing happens until the scheduler runs
+  EXPECT_EQ(0, callback.calls_);
+  EXPECT_EQ(0, store_.Get(1)->version());
+
+  scheduler_.RunUntilIdle();
+  EXPECT_EQ(1, callback.calls_);
+  EXPECT_EQ(1, callback.doc_id_);
+  EXPECT_TRUE(callback.applied_);
+  EXPECT_EQ(1, callback.version_);
+
+  string data;
+  store_.Get(1)->GetData(&data);
+  EXPECT_EQ("papaya", data);
+}
+
+TEST_F(AsyncDocumentStoreTest, ApplyFails) {
+  RecordingApplyCallback bad_index;
+  RecordingApplyCallback bad_doc;
+  async_store_.Apply(1, Diff(10, "papaya"), &bad_index);
+  async_store_.Apply(2, Diff(0, "papaya"), &bad_doc);
+  async_store_.Apply(1, Diff(0, "papaya"), NULL);
+  scheduler_.RunUntilIdle();
+
+  EXPECT_EQ(1, bad_index.calls_);
+  EXPECT_FALSE(bad_index.applied_);
+  EXPECT_EQ(1, bad_doc.calls_);
+  EXPECT_FALSE(bad_doc.applied_);
+  EXPECT_EQ(1, store_.Get(1)->version());
+}
+
+TEST_F(AsyncDocumentStoreTest, NextUpdatesAlreadyAvailable) {
+  Diff diff(0, "papaya");
+  store_.ApplyDiff(1, &diff);
+
+  RecordingUpdatesCallback callback;
+  async_store_.NextUpdates(1, 1, &callback);
+  EXPECT_EQ(0, callback.calls_);
+  scheduler_.RunUntilIdle();
+
+  EXPECT_EQ(1, callback.calls_);
+  EXPECT_TRUE(callback.available_);
+  ASSERT_EQ(1U, callback.updates_.size());
+  EXPECT_EQ(1, callback.updates_.front().version());
+  EXPECT_EQ(0U, async_store_.num_waiters());
+}
+
+TEST_F(AsyncDocumentStoreTest, NextUpdatesWaits) {
+  RecordingUpdatesCallback callback;
+  async_store_.NextUpdates(1, 1, &callback);
+  scheduler_.RunUntilIdle();
+  EXPECT_EQ(0, callback.calls_);
+  EXPECT_EQ(1U, async_store_.num_waiters());
+
+  async_store_.Apply(1, Diff(0, "papaya"), NULL);
+  async_store_.Apply(1, Diff(0, "papaya"), NULL);
+  scheduler_.RunUntilIdle();
+
+  EXPECT_EQ(1, callback.calls_);
+  EXPECT_TRUE(callback.available_);
+  ASSERT_EQ(2U, callback.updates_.size());
+  EXPECT_EQ(1, callback.updates_.front().version());
+  EXPECT_EQ(2, callback.updates_.back().version());
+  EXPECT_EQ(0U, async_store_.num_waiters());
+}
+
+TEST_F(AsyncDocumentStoreTest, NextUpdatesOnlyResumesSatisfiedWaiters) {
+  RecordingUpdatesCallback first;
+  RecordingUpdatesCallback second;
+  async_store_.NextUpdates(1, 1, &first);
+  async_store_.NextUpdates(1, 2, &second);
+
+  async_store_.Apply(1, Diff(0, "papaya"), NULL);
+  scheduler_.RunUntilIdle();
+  EXPECT_EQ(1, first.calls_);
+  EXPECT_EQ(0, second.calls_);
+  EXPECT_EQ(1U, async_store_.num_waiters());
+
+  async_store_.Apply(1, Diff(0, "papaya"), NULL);
+  scheduler_.RunUntilIdle();
+  EXPECT_EQ(1, first.calls_);
+  EXPECT_EQ(1, second.calls_);
+  ASSERT_EQ(1U, second.updates_.size());
+  EXPECT_EQ(2, second.updates_.front().version());
+}
+
+TEST_F(AsyncDocumentStoreTest, NextUpdatesUnknownDocument) {
+  RecordingUpdatesCallback callback;
+  async_store_.NextUpdates(2, 1, &callback);
+  scheduler_.RunUntilIdle();
+
+  EXPECT_EQ(1, callback.calls_);
+  EXPECT_EQ(2, callback.doc_id_);
+  EXPECT_FALSE(callback.available_);
+  EXPECT_EQ(0U, async_store_.num_waiters());
+}
+
+TEST_F(AsyncDocumentStoreTest, NextUpdatesNoLongerCached) {
+  for (size_t i = 0; i < Document::kMaxCacheSize + 1; ++i) {
+    async_store_.Apply(1, Diff(0, "papaya"), NULL);
+  }
+  scheduler_.RunUntilIdle();
+
+  RecordingUpdatesCallback callback;
+  async_store_.NextUpdates(1, 1, &callback);
+  scheduler_.RunUntilIdle();
+
+  EXPECT_EQ(1, callback.calls_);
+  EXPECT_FALSE(callback.available_);
+  EXPECT_TRUE(callback.updates_.empty());
+}
+
+TEST_F(AsyncDocumentStoreTest, Cancel) {
+  RecordingUpdatesCallback callback;
+  async_store_.NextUpdates(1, 1, &callback);
+  EXPECT_TRUE(async_store_.Cancel(1, &callback));
+  EXPECT_FALSE(async_store_.Cancel(1, &callback));
+  EXPECT_EQ(0U, async_store_.num_waiters());
+
+  async_store_.Apply(1, Diff(0, "papaya"), NULL);
+  scheduler_.RunUntilIdle();
+  EXPECT_EQ(0, callback.calls_);
+}
+
+TEST_F(AsyncDocumentStoreTest, ManySessionsFollowingADocument) {
+  const int kNumSessions = 1000;
+  vector<FollowingCallback*> sessions;
+  for (int i = 0; i < kNumSessions; ++i) {
+    sessions.push_back(new FollowingCallback(&async_store_));
+    async_store_.NextUpdates(1, 1, sessions.back());
+  }
+
+  for (int i = 0; i < 5; ++i) {
+    async_store_.Apply(1, Diff(0, "papaya"), NULL);
+    scheduler_.RunUntilIdle();
+  }
+
+  EXPECT_EQ((size_t) kNumSessions, async_store_.num_waiters());
+  for (int i = 0; i < kNumSessions; ++i) {
+    EXPECT_EQ(5, sessions[i]->seen_);
+    EXPECT_TRUE(async_store_.Cancel(1, sessions[i]));
+    delete sessions[i];
+  }
+}
+
+}  // namespace kamiah
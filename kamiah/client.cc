@@ -0,0 +1,286 @@
+/**
+ * @file client.cc
+ * @brief Implementation of a Client of a Kamiah Server.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "client.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "shm_channel.h"
+#include "wire_format.h"
+
+namespace kamiah {
+
+Client::Client() : fd_(-1), shm_(NULL) {
+}
+
+Client::~Client() {
+  Close();
+}
+
+bool Client::Connect(const string& address, int port) {
+  Close();
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+    return false;
+  }
+
+  fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd_ < 0) {
+    return false;
+  }
+  if (connect(fd_, reinterpret_cast<struct sockaddr*>(&addr),
+              sizeof(addr)) < 0) {
+    Close();
+    return false;
+  }
+
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return true;
+}
+
+bool Client::ConnectShm(const string& path) {
+  Close();
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+
+  fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd_ < 0) {
+    return false;
+  }
+  if (connect(fd_, reinterpret_cast<struct sockaddr*>(&addr),
+              sizeof(addr)) < 0) {
+    Close();
+    return false;
+  }
+
+  shm_ = ShmChannel::Attach(fd_);
+  if (shm_ == NULL) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void Client::Close() {
+  delete shm_;
+  shm_ = NULL;
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  input_.clear();
+}
+
+bool Client::Apply(DocID doc_id, const Diff& diff) {
+  string payload;
+  PutVarint64(doc_id, &payload);
+  EncodeDiff(diff, &payload);
+  return Send(MSG_APPLY, payload);
+}
+
+bool Client::Subscribe(DocID doc_id, Version from_version) {
+  string payload;
+  PutVarint64(doc_id, &payload);
+  PutSignedVarint64(from_version, &payload);
+  return Send(MSG_SUBSCRIBE, payload);
+}
+
+bool Client::Unsubscribe(DocID doc_id) {
+  string payload;
+  PutVarint64(doc_id, &payload);
+  return Send(MSG_UNSUBSCRIBE, payload);
+}
+
+bool Client::ReadMessage(int timeout_ms, ServerMessage *message) {
+  for (;;) {
+    Frame frame;
+    FrameStatus status = ParseFrame(input_.data(), input_.size(), &frame);
+    if (status == FRAME_OK) {
+      bool ok = DecodeMessage(frame, message);
+      input_.erase(0, frame.frame_size);
+      return ok;
+    } else if ((status == FRAME_INVALID) || (fd_ < 0)) {
+      return false;
+    }
+
+    if (!ReadInput(timeout_ms)) {
+      return false;
+    }
+  }
+}
+
+bool Client::ReadInput(int timeout_ms) {
+  char buf[16 * 1024];
+  if (shm_ != NULL) {
+    for (;;) {
+      size_t bytes_read = shm_->Read(buf, sizeof(buf));
+      if (bytes_read > 0) {
+        input_.append(buf, bytes_read);
+        return true;
+      } else if (shm_->broken() ||
+                 (shm_->PrepareWaitForData() && !WaitShm(timeout_ms))) {
+        return false;
+      }
+    }
+  }
+
+  for (;;) {
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready == 0) {
+      return false;
+    } else if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+
+    ssize_t bytes_read = read(fd_, buf, sizeof(buf));
+    if (bytes_read > 0) {
+      input_.append(buf, bytes_read);
+      return true;
+    } else if ((bytes_read == 0) || (errno != EINTR)) {
+      return false;
+    }
+  }
+}
+
+bool Client::WaitShm(int timeout_ms) {
+  struct pollfd pfds[2];
+  pfds[0].fd = shm_->event_fd();
+  pfds[0].events = POLLIN;
+  pfds[1].fd = fd_;
+  pfds[1].events = POLLIN;
+  int ready;
+  do {
+    ready = poll(pfds, 2, timeout_ms);
+  } while ((ready < 0) && (errno == EINTR));
+  if (ready <= 0) {
+    return false;
+  }
+
+  // The server never writes to the socket, it is only readable once the
+  // server is gone
+  if (pfds[1].revents != 0) {
+    return false;
+  }
+  shm_->ClearEvent();
+  return true;
+}
+
+bool Client::Send(MessageType type, const string& payload) {
+  if (fd_ < 0) {
+    return false;
+  }
+
+  string frame;
+  AppendFrame(type, payload, &frame);
+  size_t sent = 0;
+  if (shm_ != NULL) {
+    while (sent < frame.size()) {
+      size_t written = shm_->Write(frame.data() + sent, frame.size() - sent);
+      sent += written;
+      if ((written == 0) &&
+          (shm_->broken() ||
+           (shm_->PrepareWaitForSpace() && !WaitShm(-1)))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  while (sent < frame.size()) {
+    ssize_t written = send(fd_, frame.data() + sent, frame.size() - sent,
+                           MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    sent += written;
+  }
+  return true;
+}
+
+bool Client::DecodeMessage(const Frame& frame, ServerMessage *message) {
+  const char *p = frame.payload;
+  const char *limit = p + frame.payload_size;
+  uint64_t doc_id;
+  if (!GetVarint64(&p, limit, &doc_id)) {
+    return false;
+  }
+
+  message->type = frame.type;
+  message->doc_id = doc_id;
+  message->version = -1;
+  message->diffs.clear();
+  message->data.clear();
+  switch (frame.type) {
+    case MSG_APPLIED:
+      if (!GetSignedVarint64(&p, limit, &message->version)) {
+        return false;
+      }
+      break;
+    case MSG_UPDATE: {
+      DiffView view;
+      if (!DecodeDiff(&p, limit, &view)) {
+        return false;
+      }
+      message->diffs.push_back(view.ToDiff());
+      break;
+    }
+    case MSG_UPDATES: {
+      vector<DiffView> views;
+      if (!DecodeUpdates(&p, limit, &views)) {
+        return false;
+      }
+      for (size_t i = 0; i < views.size(); ++i) {
+        message->diffs.push_back(views[i].ToDiff());
+      }
+      break;
+    }
+    case MSG_DATA: {
+      uint64_t size;
+      if (!GetSignedVarint64(&p, limit, &message->version) ||
+          !GetVarint64(&p, limit, &size) ||
+          (size > static_cast<uint64_t>(limit - p))) {
+        return false;
+      }
+      message->data.assign(p, size);
+      p += size;
+      break;
+    }
+    default:
+      return false;
+  }
+  return p == limit;
+}
+
+}  // namespace kamiah
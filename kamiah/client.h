@@ -0,0 +1,145 @@
+/**
+ * @file client.h
+ * @brief Definition of a Client of a Kamiah Server.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_CLIENT_H_
+#define KAMIAH_CLIENT_H_
+
+#include <string>
+#include <vector>
+
+#include "diff.h"
+#include "protocol.h"
+#include "types.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+class ShmChannel;
+
+/**
+ * @brief A message received from a Server.
+ */
+struct ServerMessage {
+  MessageType type;
+  DocID doc_id;
+
+  // Version of the applied diff for MSG_APPLIED (-1 if it was not applied)
+  // and of the data for MSG_DATA.
+  Version version;
+
+  // Diffs of MSG_UPDATE and MSG_UPDATES.
+  vector<Diff> diffs;
+
+  // Data of MSG_DATA.
+  string data;
+};
+
+/**
+ * @brief A Client is a blocking connection to a Kamiah Server.
+ *
+ * Requests are sent right away and their responses, as well as the updates
+ * of subscribed Documents, are read in order with ReadMessage().
+ *
+ * Clients on the same host as the server can use ConnectShm() instead of
+ * Connect() to exchange messages through shared memory.
+ *
+ * This class is thread-compatible.
+ */
+class Client {
+ public:
+  Client();
+  ~Client();
+
+  /**
+   * @brief Connects to a Server.
+   *
+   * @param address The IPv4 address of the server.
+   * @param port The port of the server.
+   * @return True iff the connection was established.
+   */
+  bool Connect(const string& address, int port);
+
+  /**
+   * @brief Connects to a Server on the same host through shared memory.
+   *
+   * @param path The ServerOptions::shm_path of the server.
+   * @return True iff the connection was established.
+   */
+  bool ConnectShm(const string& path);
+
+  /**
+   * @brief Closes the connection.
+   */
+  void Close();
+
+  /**
+   * @brief Sends a diff to be applied. The server responds with MSG_APPLIED.
+   *
+   * @param doc_id The ID of the Document to apply the diff to.
+   * @param diff The diff to apply.
+   * @return True iff the request was sent.
+   */
+  bool Apply(DocID doc_id, const Diff& diff);
+
+  /**
+   * @brief Subscribes to the updates of a Document. The server responds with
+   *     MSG_UPDATES or MSG_DATA if the Document has changed since the
+   *     requested version, and then sends an MSG_UPDATE for every update.
+   *
+   * @param doc_id The ID of the Document.
+   * @param from_version The version from which to start getting updates.
+   * @return True iff the request was sent.
+   */
+  bool Subscribe(DocID doc_id, Version from_version);
+
+  /**
+   * @brief Unsubscribes from the updates of a Document.
+   *
+   * @param doc_id The ID of the Document.
+   * @return True iff the request was sent.
+   */
+  bool Unsubscribe(DocID doc_id);
+
+  /**
+   * @brief Reads the next message from the server.
+   *
+   * @param timeout_ms Maximum time to wait for the message, -1 to wait
+   *     forever.
+   * @param message Where to write the message.
+   * @return True iff a well-formed message was read.
+   */
+  bool ReadMessage(int timeout_ms, ServerMessage *message);
+
+ private:
+  // Sends a frame, blocking until it is all written.
+  bool Send(MessageType type, const string& payload);
+
+  // Decodes a frame received from the server into a message.
+  bool DecodeMessage(const Frame& frame, ServerMessage *message);
+
+  // Reads some bytes from the server into input_. Returns false on timeout
+  // or if the connection is closed.
+  bool ReadInput(int timeout_ms);
+
+  // Waits for a notification of the ShmChannel. Returns false on timeout or
+  // if the server went away.
+  bool WaitShm(int timeout_ms);
+
+  int fd_;
+  ShmChannel *shm_;
+  string input_;
+
+  // Not copyable.
+  Client(const Client&);
+  void operator=(const Client&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_CLIENT_H_
@@ -41,4 +41,17 @@ const string& Diff::text() const {
   return text_;
 }
 
+Index Diff::MapIndex(Index index, Bias bias) const {
+  if (type_ == INSERT) {
+    if ((index > index_) || ((index == index_) && (bias == BIAS_RIGHT))) {
+      return index + text_.size();
+    }
+    return index;
+  }
+  if (index <= index_) {
+    return index;
+  }
+  return (index - index_ < length_) ? index_ : index - length_;
+}
+
 }  // namespace kamiah
@@ -5,6 +5,9 @@
  * @author Victor Marmol (vmarmol@gmail.com)
  */
 
+#ifndef KAMIAH_DIFF_H_
+#define KAMIAH_DIFF_H_
+
 #include <string>
 
 #include "types.h"
@@ -88,6 +91,20 @@ class Diff {
    */
   const string& text() const;
 
+  /**
+   * @brief Maps an index in the text before this diff to where it is in the
+   *     text after it.
+   *
+   * An index where text is inserted stays before the text with BIAS_LEFT
+   * and moves after it with BIAS_RIGHT. An index in deleted text moves to
+   * the start of the deletion.
+   *
+   * @param index The index before the diff.
+   * @param bias Which way the index goes when text is inserted at it.
+   * @return The index after the diff.
+   */
+  Index MapIndex(Index index, Bias bias) const;
+
  private:
   Version version_;
   Type type_;
@@ -97,3 +114,5 @@ class Diff {
 };
 
 }  // namespace kamiah
+
+#endif  // KAMIAH_DIFF_H_
@@ -0,0 +1,42 @@
+/**
+ * @file diff_encoder.h
+ * @brief Defines the interface of a DiffEncoder.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_DIFF_ENCODER_H_
+#define KAMIAH_DIFF_ENCODER_H_
+
+#include <string>
+
+#include "diff.h"
+#include "types.h"
+
+using std::string;
+
+namespace kamiah {
+
+/**
+ * @brief A DiffEncoder serializes a Diff into the format spoken by a set of
+ *     clients.
+ *
+ * Implementations must be thread-safe.
+ */
+class DiffEncoder {
+ public:
+  virtual ~DiffEncoder() {}
+
+  /**
+   * @brief Serializes the specified diff.
+   *
+   * @param doc_id The ID of the Document the diff was applied to.
+   * @param diff The diff to serialize.
+   * @param out String to append the serialized diff to.
+   */
+  virtual void Encode(DocID doc_id, const Diff& diff, string *out) const = 0;
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_DIFF_ENCODER_H_
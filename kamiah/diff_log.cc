@@ -0,0 +1,435 @@
+/**
+ * @file diff_log.cc
+ * @brief Implementation of a DiffLog and a DiffLogReader.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "diff_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "util.h"
+
+namespace kamiah {
+
+namespace {
+
+// Size of the CRC at the start of each record.
+const size_t kCrcSize = 4;
+
+// Largest size of the varint with the size of a record.
+const size_t kMaxVarintSize = 10;
+
+void EncodeFixed32(uint32_t value, char *out) {
+  for (size_t i = 0; i < kCrcSize; ++i) {
+    out[i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+uint32_t DecodeFixed32(const char *data) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < kCrcSize; ++i) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+  }
+  return value;
+}
+
+}  // namespace
+
+DiffLogOptions::DiffLogOptions()
+    : durability(SYNC_INTERVAL), sync_interval_micros(10000), writer(NULL) {
+}
+
+DiffLog::DiffLog(const string& path, int fd, uint64_t offset,
+                 const DiffLogOptions& options)
+    : path_(path), fd_(fd), options_(options), writer_(options.writer),
+      owns_writer_(options.writer == NULL), offset_(offset),
+      flusher_started_(false),
+      work_cv_(&mu_), synced_cv_(&mu_), appended_(0), synced_(0),
+      sync_requested_(0), num_syncs_(0), failed_(false), closing_(false),
+      next_fd_(-1), rotate_at_(0), rotated_fd_(-1) {
+}
+
+DiffLog* DiffLog::Open(const string& path, const DiffLogOptions& options) {
+  // Find the end of the last complete record and drop a torn record after
+  // it. Records after a corrupted one were acknowledged, so they are kept
+  // and the log is not opened.
+  DiffLogReader *reader = DiffLogReader::Open(path);
+  if (reader == NULL) {
+    return NULL;
+  }
+  DocID doc_id;
+  DiffView diff;
+  while (reader->Next(&doc_id, &diff)) {
+  }
+  uint64_t end = reader->offset();
+  bool corrupted = reader->corrupted();
+  delete reader;
+  if (corrupted) {
+    return NULL;
+  }
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+  if (fd < 0) {
+    return NULL;
+  }
+  if (ftruncate(fd, end) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  DiffLog *log = new DiffLog(path, fd, end, options);
+  if (log->owns_writer_) {
+    log->writer_ = FileWriter::NewDefault();
+  }
+  if (pthread_create(&log->flusher_, NULL, &FlushThread, log) != 0) {
+    delete log;
+    return NULL;
+  }
+  log->flusher_started_ = true;
+  return log;
+}
+
+DiffLog::~DiffLog() {
+  if (flusher_started_) {
+    {
+      MutexLock l(&mu_);
+      closing_ = true;
+      work_cv_.Signal();
+    }
+    pthread_join(flusher_, NULL);
+  }
+  if (owns_writer_) {
+    delete writer_;
+  }
+  close(fd_);
+  if (rotated_fd_ >= 0) {
+    close(rotated_fd_);
+  }
+}
+
+void DiffLog::OnDiffApplied(const Document& doc, const Diff& diff) {
+  Append(doc.doc_id(), diff);
+}
+
+int64_t DiffLog::Append(DocID doc_id, const Diff& diff) {
+  MutexLock l(&mu_);
+  scratch_.clear();
+  encoder_.Encode(doc_id, diff, &scratch_);
+
+  // The CRC covers the size and the payload
+  size_t start = pending_.size();
+  pending_.append(kCrcSize, '\0');
+  PutVarint64(scratch_.size(), &pending_);
+  pending_.append(scratch_);
+  EncodeFixed32(ExtendCrc32(0, pending_.data() + start + kCrcSize,
+                            pending_.size() - start - kCrcSize),
+                &pending_[start]);
+
+  // The flusher only sleeps without a timeout when there is nothing to write
+  if (start == 0) {
+    work_cv_.Signal();
+  }
+  return ++appended_;
+}
+
+bool DiffLog::WaitForSync(int64_t sequence) {
+  MutexLock l(&mu_);
+  if (sequence > sync_requested_) {
+    sync_requested_ = sequence;
+    work_cv_.Signal();
+  }
+  while ((synced_ < sequence) && !failed_) {
+    synced_cv_.Wait();
+  }
+  return !failed_;
+}
+
+bool DiffLog::Flush() {
+  if (!WaitForSync(last_sequence())) {
+    return false;
+  }
+  if (options_.durability != DiffLogOptions::NO_SYNC) {
+    return true;
+  }
+
+  // The records were only written, some of them maybe to the file the log
+  // rotated away from. Nothing else is written there, so it only needs a
+  // sync once
+  int fd;
+  int rotated_fd;
+  {
+    MutexLock l(&mu_);
+    fd = fd_;
+    rotated_fd = rotated_fd_;
+    rotated_fd_ = -1;
+  }
+  bool synced = true;
+  if (rotated_fd >= 0) {
+    synced = writer_->WriteAndWait(rotated_fd, 0, NULL, 0, true);
+    close(rotated_fd);
+  }
+  synced = writer_->WriteAndWait(fd, 0, NULL, 0, true) && synced;
+  MutexLock l(&mu_);
+  num_syncs_ += (rotated_fd >= 0) ? 2 : 1;
+  if (!synced) {
+    failed_ = true;
+  }
+  return synced;
+}
+
+bool DiffLog::Rotate() {
+  MutexLock l(&mu_);
+  string rotated_path = RotatedPath(path_);
+  if ((next_fd_ >= 0) || (access(rotated_path.c_str(), F_OK) == 0) ||
+      (rename(path_.c_str(), rotated_path.c_str()) != 0)) {
+    return false;
+  }
+  int fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    rename(rotated_path.c_str(), path_.c_str());
+    return false;
+  }
+
+  // Everything appended so far stays in the rotated file
+  next_fd_ = fd;
+  rotate_at_ = pending_.size();
+  work_cv_.Signal();
+  return true;
+}
+
+string DiffLog::RotatedPath(const string& path) {
+  return path + ".old";
+}
+
+const string& DiffLog::path() const {
+  return path_;
+}
+
+int64_t DiffLog::last_sequence() const {
+  MutexLock l(&mu_);
+  return appended_;
+}
+
+DiffLogOptions::Durability DiffLog::durability() const {
+  return options_.durability;
+}
+
+int64_t DiffLog::num_syncs() const {
+  MutexLock l(&mu_);
+  return num_syncs_;
+}
+
+void *DiffLog::FlushThread(void *log) {
+  static_cast<DiffLog*>(log)->FlushLoop();
+  return NULL;
+}
+
+void DiffLog::FlushLoop() {
+  bool sync = (options_.durability != DiffLogOptions::NO_SYNC);
+  MutexLock l(&mu_);
+  while (true) {
+    if (pending_.empty() && (next_fd_ < 0)) {
+      if (closing_) {
+        return;
+      }
+      work_cv_.Wait();
+      continue;
+    }
+
+    // Unless someone is waiting, let the records of an interval pile up and
+    // commit them together
+    if ((options_.durability != DiffLogOptions::SYNC_EACH) && !closing_ &&
+        (sync_requested_ <= synced_)) {
+      work_cv_.TimedWait(options_.sync_interval_micros);
+    }
+    WritePending(sync);
+  }
+}
+
+void DiffLog::WritePending(bool sync) {
+  string data;
+  data.swap(pending_);
+  int64_t sequence = appended_;
+  int fd = fd_;
+  int next_fd = next_fd_;
+  size_t split = (next_fd >= 0) ? rotate_at_ : data.size();
+  next_fd_ = -1;
+
+  // Only the flusher writes, so offset_ can be used without the lock
+  mu_.Unlock();
+  bool written = writer_->WriteAndWait(fd, offset_, data.data(), split, sync);
+  offset_ += split;
+  if (next_fd >= 0) {
+    // The new file must survive a crash before records are acknowledged
+    // from it
+    written = SyncDirectory(path_) && written;
+    offset_ = data.size() - split;
+    written = writer_->WriteAndWait(next_fd, 0, data.data() + split,
+                                    data.size() - split, sync) && written;
+  }
+  mu_.Lock();
+
+  if (next_fd >= 0) {
+    if (rotated_fd_ >= 0) {
+      close(rotated_fd_);
+    }
+    rotated_fd_ = fd;
+    fd_ = next_fd;
+  }
+  if (sync) {
+    ++num_syncs_;
+  }
+  if (!written) {
+    failed_ = true;
+  }
+  synced_ = sequence;
+  synced_cv_.SignalAll();
+
+  // Keep the buffer around for the next records
+  if (pending_.empty()) {
+    data.clear();
+    pending_.swap(data);
+  }
+}
+
+DiffLogReader::DiffLogReader(const string& contents)
+    : contents_(contents), offset_(0), torn_(false), corrupted_(false) {
+}
+
+DiffLogReader* DiffLogReader::Open(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return (errno == ENOENT) ? new DiffLogReader("") : NULL;
+  }
+
+  string contents;
+  char buffer[64 * 1024];
+  ssize_t bytes;
+  while ((bytes = read(fd, buffer, sizeof(buffer))) != 0) {
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      return NULL;
+    }
+    contents.append(buffer, bytes);
+  }
+  close(fd);
+  return new DiffLogReader(contents);
+}
+
+bool DiffLogReader::Next(DocID *doc_id, DiffView *diff) {
+  if (torn_ || corrupted_ || (offset_ == contents_.size())) {
+    return false;
+  }
+
+  // A record that does not fit in the rest of the log was torn by a crash
+  const char *start = contents_.data() + offset_;
+  const char *limit = contents_.data() + contents_.size();
+  const char *p = start + kCrcSize;
+  uint64_t size;
+  uint64_t id;
+  if (static_cast<size_t>(limit - start) < kCrcSize) {
+    torn_ = true;
+    return false;
+  } else if (!GetVarint64(&p, limit, &size)) {
+    StopAt((static_cast<size_t>(limit - p) < kMaxVarintSize) ? limit : p);
+    return false;
+  } else if (size > static_cast<uint64_t>(limit - p)) {
+    torn_ = true;
+    return false;
+  } else if (ExtendCrc32(0, start + kCrcSize,
+                         p + size - start - kCrcSize) !=
+             DecodeFixed32(start)) {
+    StopAt(p + size);
+    return false;
+  }
+
+  const char *record_limit = p + size;
+  if (!GetVarint64(&p, record_limit, &id) ||
+      !DecodeDiff(&p, record_limit, diff) || (p != record_limit)) {
+    corrupted_ = true;
+    return false;
+  }
+  *doc_id = id;
+  offset_ = record_limit - contents_.data();
+  return true;
+}
+
+bool DiffLogReader::torn() const {
+  return torn_;
+}
+
+bool DiffLogReader::corrupted() const {
+  return corrupted_;
+}
+
+void DiffLogReader::StopAt(const char *end) {
+  // Only zeros after the record are the rest of a torn write
+  const char *limit = contents_.data() + contents_.size();
+  while ((end < limit) && (*end == '\0')) {
+    ++end;
+  }
+  if (end == limit) {
+    torn_ = true;
+  } else {
+    corrupted_ = true;
+  }
+}
+
+uint64_t DiffLogReader::offset() const {
+  return offset_;
+}
+
+namespace {
+
+// Replays a single file of a log. See ReplayDiffLog().
+int64_t ReplayFile(const string& path, DocumentStore *store) {
+  DiffLogReader *reader = DiffLogReader::Open(path);
+  if (reader == NULL) {
+    return -1;
+  }
+
+  int64_t applied = 0;
+  DocID doc_id;
+  DiffView view;
+  while (reader->Next(&doc_id, &view)) {
+    Document *doc = store->GetOrCreate(doc_id);
+    if (doc == NULL) {
+      applied = -1;
+      break;
+    } else if (view.version <= doc->version()) {
+      continue;
+    }
+    Diff diff = view.ToDiff();
+    if ((view.version != doc->version() + 1) || !doc->ApplyDiff(&diff)) {
+      applied = -1;
+      break;
+    }
+    ++applied;
+  }
+  if (reader->corrupted()) {
+    applied = -1;
+  }
+  delete reader;
+  return applied;
+}
+
+}  // namespace
+
+int64_t ReplayDiffLog(const string& path, DocumentStore *store) {
+  int64_t rotated = ReplayFile(DiffLog::RotatedPath(path), store);
+  if (rotated < 0) {
+    return -1;
+  }
+  int64_t applied = ReplayFile(path, store);
+  return (applied < 0) ? -1 : rotated + applied;
+}
+
+}  // namespace kamiah
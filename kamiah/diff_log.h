@@ -0,0 +1,338 @@
+/**
+ * @file diff_log.h
+ * @brief Definition of a DiffLog, a write-ahead log of applied diffs, and a
+ *     DiffLogReader.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_DIFF_LOG_H_
+#define KAMIAH_DIFF_LOG_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "diff.h"
+#include "document.h"
+#include "document_store.h"
+#include "file_writer.h"
+#include "mutex.h"
+#include "types.h"
+#include "wire_format.h"
+
+using std::string;
+
+namespace kamiah {
+
+/**
+ * @brief Options of a DiffLog.
+ */
+struct DiffLogOptions {
+  enum Durability {
+    // Every diff is synced before it is acknowledged. Owners of the log call
+    // WaitForSync() before acknowledging, and all the diffs appended while a
+    // sync is in progress are committed together by the next one.
+    SYNC_EACH,
+
+    // Diffs are written and synced every sync_interval_micros. A crash loses
+    // at most the diffs of the last interval.
+    SYNC_INTERVAL,
+
+    // Diffs are written every sync_interval_micros but never synced, the
+    // operating system decides when they reach the disk.
+    NO_SYNC
+  };
+
+  DiffLogOptions();
+
+  Durability durability;
+  int64_t sync_interval_micros;
+
+  // Writer used to write and sync the log, so that neither blocks the
+  // threads applying diffs. Not owned. If NULL, the log creates its own
+  // with FileWriter::NewDefault().
+  FileWriter *writer;
+};
+
+/**
+ * @brief A DiffLog is an append-only log of every diff applied to the
+ *     Documents of a node, from which they can be recovered after a crash.
+ *
+ * A DiffLog observes Documents (usually all those of a DocumentStore, see
+ * DocumentStore::AddObserver()) and appends a record with the DocID and the
+ * diff for each diff applied to them. Appending only copies the record into
+ * memory. A background flusher thread hands the records to a FileWriter,
+ * which writes them and syncs the file with a single fdatasync() no matter
+ * how many records or Documents they span, according to the durability of
+ * the log.
+ *
+ * Each record is a fixed 32-bit CRC of the rest of the record, the varint
+ * size of its payload and the payload, which is the DocID and diff encoded by
+ * a WireFormatEncoder. A torn record at the end of the file, from a crash in
+ * the middle of a write, is dropped when the log is opened again. A record
+ * that cannot be read followed by more records means the file is corrupted.
+ * The records after it were acknowledged, so the log is neither opened nor
+ * replayed rather than dropping them.
+ *
+ * Once the Documents are in a Snapshot, the records before it are no longer
+ * needed. Rotate() moves them to a separate file that is deleted once the
+ * snapshot is durable, without blocking appends.
+ *
+ * This class is thread-safe.
+ */
+class DiffLog : public DocumentObserver {
+ public:
+  /**
+   * @brief Opens a log for appending, creating it if it does not exist.
+   *
+   * @param path The path of the log.
+   * @param options The options of the log.
+   * @return The log, or NULL if it could not be opened or is corrupted.
+   *     Owned by the caller.
+   */
+  static DiffLog* Open(const string& path, const DiffLogOptions& options);
+
+  /**
+   * @brief Writes all the appended records, syncs them unless the log is
+   *     NO_SYNC, and closes the log.
+   */
+  virtual ~DiffLog();
+
+  /**
+   * @brief Appends the diff to the log.
+   */
+  virtual void OnDiffApplied(const Document& doc, const Diff& diff);
+
+  /**
+   * @brief Appends a record to the log. Does not wait for it to be written.
+   *
+   * @param doc_id The ID of the Document the diff was applied to.
+   * @param diff The diff, with its version set.
+   * @return The sequence number of the record, increasing from 1.
+   */
+  int64_t Append(DocID doc_id, const Diff& diff);
+
+  /**
+   * @brief Waits until a record and all those before it are durable, or only
+   *     written for NO_SYNC logs. If the log does not sync on its own right
+   *     away, this makes it.
+   *
+   * @param sequence The sequence number of the record.
+   * @return True iff the records are durable, false if writing or syncing the
+   *     log failed.
+   */
+  bool WaitForSync(int64_t sequence);
+
+  /**
+   * @brief Waits until all the appended records are durable, regardless of
+   *     the durability of the log.
+   *
+   * @return True iff the records are durable.
+   */
+  bool Flush();
+
+  /**
+   * @brief Starts a new file for the log. The current file is renamed to
+   *     RotatedPath() and gets all the records appended before this call,
+   *     while those appended after it go to a new file at the path of the
+   *     log. The flusher switches files in the background.
+   *
+   * @return True iff the log was rotated. False if a rotated file already
+   *     exists or a new file could not be created.
+   */
+  bool Rotate();
+
+  /**
+   * @brief Gets the path of the file a log is rotated to.
+   *
+   * @param path The path of the log.
+   * @return The path of the rotated file of the log.
+   */
+  static string RotatedPath(const string& path);
+
+  /**
+   * @brief Gets the path of the log.
+   *
+   * @return The path of the log.
+   */
+  const string& path() const;
+
+  /**
+   * @brief Gets the sequence number of the last appended record.
+   *
+   * @return The sequence number of the last record, 0 if there are none.
+   */
+  int64_t last_sequence() const;
+
+  /**
+   * @brief Gets the durability of the log.
+   *
+   * @return The durability of the log.
+   */
+  DiffLogOptions::Durability durability() const;
+
+  /**
+   * @brief Gets the number of times the log has been synced.
+   *
+   * @return The number of calls to fdatasync() so far.
+   */
+  int64_t num_syncs() const;
+
+ private:
+  DiffLog(const string& path, int fd, uint64_t offset,
+          const DiffLogOptions& options);
+
+  static void *FlushThread(void *log);
+
+  // Writes and syncs pending records until the log is closed.
+  void FlushLoop();
+
+  // Writes out the pending records and syncs them if needed, switching files
+  // if the log was rotated. Called with mu_ held, which is released while
+  // writing.
+  void WritePending(bool sync);
+
+  const string path_;
+
+  // The file the flusher writes to. Only changed by the flusher, with mu_
+  // held.
+  int fd_;
+
+  const DiffLogOptions options_;
+  FileWriter *writer_;
+  bool owns_writer_;
+
+  // Offset at which the flusher writes the next records.
+  uint64_t offset_;
+
+  pthread_t flusher_;
+  bool flusher_started_;
+
+  mutable Mutex mu_;
+
+  // Signalled when there are records to write or a sync is requested.
+  CondVar work_cv_;
+
+  // Signalled when records are written.
+  CondVar synced_cv_;
+
+  // Records not yet handed to the flusher and the sequence number of the
+  // last of them.
+  string pending_;
+  int64_t appended_;
+
+  // Sequence number up to which records are written, and synced if
+  // requested.
+  int64_t synced_;
+
+  // Sequence number up to which a waiter wants records synced.
+  int64_t sync_requested_;
+
+  int64_t num_syncs_;
+  bool failed_;
+  bool closing_;
+
+  // The file to switch to after writing the first rotate_at_ bytes of
+  // pending_, -1 if the log is not being rotated.
+  int next_fd_;
+  size_t rotate_at_;
+
+  // The file the log last rotated away from. Kept open until Flush() syncs
+  // it.
+  int rotated_fd_;
+
+  // Reused to encode each record.
+  WireFormatEncoder encoder_;
+  string scratch_;
+
+  // Not copyable.
+  DiffLog(const DiffLog&);
+  void operator=(const DiffLog&);
+};
+
+/**
+ * @brief A DiffLogReader reads the records of a DiffLog in order.
+ *
+ * This class is thread-compatible.
+ */
+class DiffLogReader {
+ public:
+  /**
+   * @brief Opens a log for reading.
+   *
+   * @param path The path of the log. A log that does not exist is empty.
+   * @return The reader, or NULL if the log could not be read. Owned by the
+   *     caller.
+   */
+  static DiffLogReader* Open(const string& path);
+
+  /**
+   * @brief Reads the next record.
+   *
+   * @param doc_id Where to write the ID of the Document of the record.
+   * @param diff Where to write the diff of the record. Its text is valid for
+   *     as long as the reader is.
+   * @return True iff a record was read. False at the end of the log or at
+   *     the first record that is torn or corrupted.
+   */
+  bool Next(DocID *doc_id, DiffView *diff);
+
+  /**
+   * @brief Whether reading stopped at a record torn by a crash: one that does
+   *     not fit in the rest of the log, or only followed by zeros. It is
+   *     safe to drop.
+   *
+   * @return True iff the rest of the log from offset() is a torn record.
+   */
+  bool torn() const;
+
+  /**
+   * @brief Whether reading stopped at a record that cannot be read and is
+   *     followed by more data, which may be acknowledged records.
+   *
+   * @return True iff the rest of the log from offset() is unreadable.
+   */
+  bool corrupted() const;
+
+  /**
+   * @brief Gets the offset in the log just past the last record read.
+   *
+   * @return The offset of the next record.
+   */
+  uint64_t offset() const;
+
+ private:
+  explicit DiffLogReader(const string& contents);
+
+  // Stops reading at the record at offset_, which cannot be read and ends at
+  // end. It is torn if nothing but zeros follows it, and corrupted otherwise.
+  void StopAt(const char *end);
+
+  string contents_;
+  uint64_t offset_;
+  bool torn_;
+  bool corrupted_;
+
+  // Not copyable.
+  DiffLogReader(const DiffLogReader&);
+  void operator=(const DiffLogReader&);
+};
+
+/**
+ * @brief Applies the records of a log to the Documents of a store, creating
+ *     the Documents as needed. Records of versions a Document already has
+ *     are skipped. The rotated file of the log, if any, is replayed first.
+ *
+ * @param path The path of the log.
+ * @param store The store to recover the Documents into.
+ * @return The number of diffs applied, or -1 if the log could not be read,
+ *     is corrupted, a record did not follow the version of its Document or
+ *     its Document is corrupted in the snapshot of the store.
+ */
+int64_t ReplayDiffLog(const string& path, DocumentStore *store);
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_DIFF_LOG_H_
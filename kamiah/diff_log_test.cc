@@ -0,0 +1,428 @@
+/**
+ * @file diff_log_test.cc
+ * @brief Unit tests for a DiffLog and a DiffLogReader.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "diff_log.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace kamiah {
+
+namespace {
+
+const int kNumThreads = 4;
+const int kDiffsPerThread = 200;
+
+struct AppendArgs {
+  DiffLog *log;
+  DocID doc_id;
+  bool synced;
+};
+
+// Appends diffs to a log one by one, waiting for each to be durable.
+void *AppendAndWait(void *arg) {
+  AppendArgs *args = static_cast<AppendArgs*>(arg);
+  args->synced = true;
+  for (int i = 0; i < kDiffsPerThread; ++i) {
+    Diff diff(0, "x");
+    diff.set_version(i + 1);
+    int64_t sequence = args->log->Append(args->doc_id, diff);
+    args->synced = args->log->WaitForSync(sequence) && args->synced;
+  }
+  return NULL;
+}
+
+}  // namespace
+
+class DiffLogTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/kamiah_diff_log_test.%d",
+             static_cast<int>(getpid()));
+    path_ = path;
+    unlink(path_.c_str());
+    unlink(DiffLog::RotatedPath(path_).c_str());
+  }
+
+  virtual void TearDown() {
+    unlink(path_.c_str());
+    unlink(DiffLog::RotatedPath(path_).c_str());
+  }
+
+  DiffLog* Open(DiffLogOptions::Durability durability) {
+    DiffLogOptions options;
+    options.durability = durability;
+    return DiffLog::Open(path_, options);
+  }
+
+  // Appends a diff with the specified version to the log.
+  static int64_t Append(DiffLog *log, DocID doc_id, Version version,
+                        const string& text) {
+    Diff diff(0, text);
+    diff.set_version(version);
+    return log->Append(doc_id, diff);
+  }
+
+  // Reads all the records of the log as "doc_id:version:text" strings.
+  string ReadAll(bool *corrupted) {
+    return ReadAll(path_, corrupted);
+  }
+
+  static string ReadAll(const string& path, bool *corrupted) {
+    DiffLogReader *reader = DiffLogReader::Open(path);
+    EXPECT_TRUE(reader != NULL);
+    string records;
+    DocID doc_id;
+    DiffView diff;
+    while (reader->Next(&doc_id, &diff)) {
+      char record[64];
+      snprintf(record, sizeof(record), "%d:%d:",
+               static_cast<int>(doc_id), static_cast<int>(diff.version));
+      records += record;
+      records += string(diff.text, diff.text_size) + " ";
+    }
+    *corrupted = reader->corrupted();
+    delete reader;
+    return records;
+  }
+
+  // Whether reading the log stops at a torn record.
+  bool ReadsTornRecord() {
+    DiffLogReader *reader = DiffLogReader::Open(path_);
+    EXPECT_TRUE(reader != NULL);
+    DocID doc_id;
+    DiffView diff;
+    while (reader->Next(&doc_id, &diff)) {
+    }
+    bool torn = reader->torn();
+    delete reader;
+    return torn;
+  }
+
+  // Overwrites bytes of the log.
+  void Overwrite(off_t offset, const string& bytes) {
+    int fd = open(path_.c_str(), O_RDWR);
+    ASSERT_EQ(static_cast<ssize_t>(bytes.size()),
+              pwrite(fd, bytes.data(), bytes.size(), offset));
+    close(fd);
+  }
+
+  off_t FileSize() {
+    int fd = open(path_.c_str(), O_RDONLY);
+    off_t size = lseek(fd, 0, SEEK_END);
+    close(fd);
+    return size;
+  }
+
+  string path_;
+};
+
+TEST_F(DiffLogTest, AppendAndRead) {
+  bool corrupted;
+  EXPECT_EQ("", ReadAll(&corrupted));
+  EXPECT_FALSE(corrupted);
+
+  DiffLog *log = Open(DiffLogOptions::SYNC_EACH);
+  ASSERT_TRUE(log != NULL);
+  EXPECT_EQ(0, log->last_sequence());
+  EXPECT_EQ(1, Append(log, 1, 1, "papaya"));
+  EXPECT_EQ(2, Append(log, 2, 1, "kamiah"));
+  EXPECT_EQ(3, Append(log, 1, 2, "kapoho"));
+  EXPECT_EQ(3, log->last_sequence());
+  EXPECT_TRUE(log->WaitForSync(3));
+  EXPECT_EQ("1:1:papaya 2:1:kamiah 1:2:kapoho ", ReadAll(&corrupted));
+  EXPECT_FALSE(corrupted);
+  delete log;
+
+  // Reopening appends
+  log = Open(DiffLogOptions::SYNC_INTERVAL);
+  ASSERT_TRUE(log != NULL);
+  Append(log, 2, 2, "ide");
+  delete log;
+  EXPECT_EQ("1:1:papaya 2:1:kamiah 1:2:kapoho 2:2:ide ",
+            ReadAll(&corrupted));
+  EXPECT_FALSE(corrupted);
+}
+
+TEST_F(DiffLogTest, TornRecordIsDropped) {
+  DiffLog *log = Open(DiffLogOptions::SYNC_EACH);
+  ASSERT_TRUE(log != NULL);
+  Append(log, 1, 1, "papaya");
+  Append(log, 1, 2, "kamiah");
+  delete log;
+
+  // Lose the end of the last record
+  ASSERT_EQ(0, truncate(path_.c_str(), FileSize() - 2));
+  bool corrupted;
+  EXPECT_EQ("1:1:papaya ", ReadAll(&corrupted));
+  EXPECT_FALSE(corrupted);
+  EXPECT_TRUE(ReadsTornRecord());
+
+  // The torn record is dropped so new records can be read
+  log = Open(DiffLogOptions::SYNC_EACH);
+  ASSERT_TRUE(log != NULL);
+  Append(log, 1, 2, "kapoho");
+  delete log;
+  EXPECT_EQ("1:1:papaya 1:2:kapoho ", ReadAll(&corrupted));
+  EXPECT_FALSE(corrupted);
+  EXPECT_FALSE(ReadsTornRecord());
+
+  // So is a last record that was partly written, followed by zeros
+  off_t size = FileSize();
+  Overwrite(size - 6, string(10, '\0'));
+  EXPECT_EQ("1:1:papaya ", ReadAll(&corrupted));
+  EXPECT_FALSE(corrupted);
+  EXPECT_TRUE(ReadsTornRecord());
+  log = Open(DiffLogOptions::SYNC_EACH);
+  ASSERT_TRUE(log != NULL);
+  delete log;
+  EXPECT_GT(size, FileSize());
+}
+
+TEST_F(DiffLogTest, CorruptedRecord) {
+  DiffLog *log = Open(DiffLogOptions::SYNC_EACH);
+  ASSERT_TRUE(log != NULL);
+  Append(log, 1, 1, "papaya");
+  Append(log, 1, 2, "kamiah");
+  Append(log, 1, 3, "kapoho");
+  delete log;
+
+  // Flip a byte of the text of the second record
+  off_t size = FileSize();
+  Overwrite(size - size / 3 - 6, "K");
+  bool corrupted;
+  EXPECT_EQ("1:1:papaya ", ReadAll(&corrupted));
+  EXPECT_TRUE(corrupted);
+  EXPECT_FALSE(ReadsTornRecord());
+
+  // The records after it are neither dropped nor replayed
+  EXPECT_TRUE(Open(DiffLogOptions::SYNC_EACH) == NULL);
+  EXPECT_EQ(size, FileSize());
+  DocumentStore store;
+  EXPECT_EQ(-1, ReplayDiffLog(path_, &store));
+}
+
+TEST_F(DiffLogTest, GroupCommit) {
+  // With a long interval, waiting syncs all the pending records at once
+  DiffLogOptions options;
+  options.sync_interval_micros = 60 * 1000000LL;
+  DiffLog *log = DiffLog::Open(path_, options);
+  ASSERT_TRUE(log != NULL);
+  for (int i = 0; i < 100; ++i) {
+    Append(log, i % 7, i / 7 + 1, "x");
+  }
+  EXPECT_EQ(0, log->num_syncs());
+  EXPECT_TRUE(log->WaitForSync(100));
+  EXPECT_EQ(1, log->num_syncs());
+  delete log;
+}
+
+TEST_F(DiffLogTest, SyncEachFromManyThreads) {
+  DiffLog *log = Open(DiffLogOptions::SYNC_EACH);
+  ASSERT_TRUE(log != NULL);
+
+  pthread_t threads[kNumThreads];
+  AppendArgs args[kNumThreads];
+  for (int i = 0; i < kNumThreads; ++i) {
+    args[i].log = log;
+    args[i].doc_id = i;
+    ASSERT_EQ(0, pthread_create(&threads[i], NULL, &AppendAndWait, &args[i]));
+  }
+  for (int i = 0; i < kNumThreads; ++i) {
+    pthread_join(threads[i], NULL);
+    EXPECT_TRUE(args[i].synced);
+  }
+
+  // Every diff was synced before it was acknowledged, but not one by one
+  EXPECT_EQ(kNumThreads * kDiffsPerThread, log->last_sequence());
+  EXPECT_LE(log->num_syncs(), kNumThreads * kDiffsPerThread);
+  delete log;
+
+  DiffLogReader *reader = DiffLogReader::Open(path_);
+  ASSERT_TRUE(reader != NULL);
+  int records = 0;
+  DocID doc_id;
+  DiffView diff;
+  while (reader->Next(&doc_id, &diff)) {
+    ++records;
+  }
+  EXPECT_FALSE(reader->corrupted());
+  EXPECT_EQ(kNumThreads * kDiffsPerThread, records);
+  delete reader;
+}
+
+TEST_F(DiffLogTest, SyncInterval) {
+  DiffLogOptions options;
+  options.sync_interval_micros = 1000;
+  DiffLog *log = DiffLog::Open(path_, options);
+  ASSERT_TRUE(log != NULL);
+  Append(log, 1, 1, "papaya");
+
+  // Written and synced without anyone waiting
+  for (int i = 0; (i < 1000) && (log->num_syncs() == 0); ++i) {
+    usleep(1000);
+  }
+  EXPECT_EQ(1, log->num_syncs());
+  bool corrupted;
+  EXPECT_EQ("1:1:papaya ", ReadAll(&corrupted));
+  delete log;
+}
+
+TEST_F(DiffLogTest, NoSync) {
+  DiffLog *log = Open(DiffLogOptions::NO_SYNC);
+  ASSERT_TRUE(log != NULL);
+  Append(log, 1, 1, "papaya");
+  EXPECT_TRUE(log->WaitForSync(1));
+  EXPECT_EQ(0, log->num_syncs());
+  bool corrupted;
+  EXPECT_EQ("1:1:papaya ", ReadAll(&corrupted));
+
+  EXPECT_TRUE(log->Flush());
+  EXPECT_EQ(1, log->num_syncs());
+  delete log;
+}
+
+TEST_F(DiffLogTest, NoSyncRotate) {
+  DiffLog *log = Open(DiffLogOptions::NO_SYNC);
+  ASSERT_TRUE(log != NULL);
+  Append(log, 1, 1, "papaya");
+  EXPECT_TRUE(log->Rotate());
+  EXPECT_TRUE(log->WaitForSync(Append(log, 1, 2, "kamiah")));
+  EXPECT_EQ(0, log->num_syncs());
+
+  // Both files are synced, the rotated one only once
+  EXPECT_TRUE(log->Flush());
+  EXPECT_EQ(2, log->num_syncs());
+  EXPECT_TRUE(log->Flush());
+  EXPECT_EQ(3, log->num_syncs());
+  delete log;
+  bool corrupted;
+  EXPECT_EQ("1:1:papaya ", ReadAll(DiffLog::RotatedPath(path_), &corrupted));
+  EXPECT_EQ("1:2:kamiah ", ReadAll(&corrupted));
+}
+
+TEST_F(DiffLogTest, SharedWriter) {
+  FileWriter *writer = FileWriter::New(FileWriter::THREAD_POOL);
+  ASSERT_TRUE(writer != NULL);
+  DiffLogOptions options;
+  options.durability = DiffLogOptions::SYNC_EACH;
+  options.writer = writer;
+  DiffLog *log = DiffLog::Open(path_, options);
+  ASSERT_TRUE(log != NULL);
+  Append(log, 1, 1, "papaya");
+  EXPECT_TRUE(log->WaitForSync(Append(log, 1, 2, "kamiah")));
+  delete log;
+
+  // The writer is not owned by the log
+  delete writer;
+  bool corrupted;
+  EXPECT_EQ("1:1:papaya 1:2:kamiah ", ReadAll(&corrupted));
+  EXPECT_FALSE(corrupted);
+}
+
+TEST_F(DiffLogTest, Rotate) {
+  DiffLogOptions options;
+  options.sync_interval_micros = 60 * 1000000LL;
+  DiffLog *log = DiffLog::Open(path_, options);
+  ASSERT_TRUE(log != NULL);
+  EXPECT_EQ(path_, log->path());
+  Append(log, 1, 1, "papaya");
+  EXPECT_TRUE(log->WaitForSync(1));
+  Append(log, 1, 2, "kamiah");
+
+  // Pending records are written to the rotated file
+  EXPECT_TRUE(log->Rotate());
+  Append(log, 1, 3, "kapoho");
+  EXPECT_TRUE(log->WaitForSync(3));
+  bool corrupted;
+  EXPECT_EQ("1:1:papaya 1:2:kamiah ",
+            ReadAll(DiffLog::RotatedPath(path_), &corrupted));
+  EXPECT_FALSE(corrupted);
+  EXPECT_EQ("1:3:kapoho ", ReadAll(&corrupted));
+  EXPECT_FALSE(corrupted);
+
+  // Only once the rotated file is gone can the log rotate again
+  EXPECT_FALSE(log->Rotate());
+  Append(log, 1, 4, "ide");
+  ASSERT_EQ(0, unlink(DiffLog::RotatedPath(path_).c_str()));
+  EXPECT_TRUE(log->Rotate());
+  EXPECT_FALSE(log->Rotate());
+  delete log;
+  EXPECT_EQ("1:3:kapoho 1:4:ide ",
+            ReadAll(DiffLog::RotatedPath(path_), &corrupted));
+  EXPECT_EQ("", ReadAll(&corrupted));
+
+  // Both files are replayed, oldest first
+  ASSERT_EQ(0, rename(DiffLog::RotatedPath(path_).c_str(), path_.c_str()));
+  log = Open(DiffLogOptions::SYNC_EACH);
+  ASSERT_TRUE(log != NULL);
+  EXPECT_TRUE(log->Rotate());
+  Append(log, 1, 5, "!");
+  delete log;
+  DocumentStore store;
+  store.GetOrCreate(1);
+  Diff diff1(0, "papaya");
+  EXPECT_TRUE(store.ApplyDiff(1, &diff1));
+  Diff diff2(0, "kamiah");
+  EXPECT_TRUE(store.ApplyDiff(1, &diff2));
+  EXPECT_EQ(3, ReplayDiffLog(path_, &store));
+  string data;
+  store.Get(1)->GetData(&data);
+  EXPECT_EQ("!idekapohokamiahpapaya", data);
+}
+
+TEST_F(DiffLogTest, Replay) {
+  DocumentStore store;
+  DiffLog *log = Open(DiffLogOptions::SYNC_EACH);
+  ASSERT_TRUE(log != NULL);
+  store.AddObserver(log);
+
+  Diff diff1(0, "papaya");
+  EXPECT_TRUE(store.GetOrCreate(1)->ApplyDiff(&diff1));
+  Diff diff2(0, "kamiah");
+  EXPECT_TRUE(store.GetOrCreate(2)->ApplyDiff(&diff2));
+  Diff diff3(0, 2);
+  EXPECT_TRUE(store.ApplyDiff(1, &diff3));
+  store.RemoveObserver(log);
+  delete log;
+
+  DocumentStore recovered;
+  EXPECT_EQ(3, ReplayDiffLog(path_, &recovered));
+  ASSERT_EQ(2U, recovered.size());
+  string data;
+  recovered.Get(1)->GetData(&data);
+  EXPECT_EQ("paya", data);
+  EXPECT_EQ(2, recovered.Get(1)->version());
+  recovered.Get(2)->GetData(&data);
+  EXPECT_EQ("kamiah", data);
+  EXPECT_EQ(1, recovered.Get(2)->version());
+
+  // Already applied diffs are skipped
+  EXPECT_EQ(0, ReplayDiffLog(path_, &recovered));
+}
+
+TEST_F(DiffLogTest, ReplayMissingVersion) {
+  DiffLog *log = Open(DiffLogOptions::SYNC_EACH);
+  ASSERT_TRUE(log != NULL);
+  Append(log, 1, 1, "papaya");
+  Append(log, 1, 3, "kamiah");
+  delete log;
+
+  DocumentStore store;
+  EXPECT_EQ(-1, ReplayDiffLog(path_, &store));
+}
+
+}  // namespace kamiah
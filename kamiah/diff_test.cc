@@ -46,4 +46,18 @@ TEST(DiffTest, SetVersion) {
   EXPECT_EQ(18, delete_diff.version());
 }
 
+TEST(DiffTest, MapIndex) {
+  Diff insert_diff(12, "papaya");
+  Diff delete_diff(12, 10);
+
+  EXPECT_EQ(11, insert_diff.MapIndex(11, BIAS_RIGHT));
+  EXPECT_EQ(12, insert_diff.MapIndex(12, BIAS_LEFT));
+  EXPECT_EQ(18, insert_diff.MapIndex(12, BIAS_RIGHT));
+  EXPECT_EQ(19, insert_diff.MapIndex(13, BIAS_LEFT));
+  EXPECT_EQ(12, delete_diff.MapIndex(12, BIAS_RIGHT));
+  EXPECT_EQ(12, delete_diff.MapIndex(17, BIAS_LEFT));
+  EXPECT_EQ(12, delete_diff.MapIndex(22, BIAS_LEFT));
+  EXPECT_EQ(13, delete_diff.MapIndex(23, BIAS_LEFT));
+}
+
 }  // namespace kamiah
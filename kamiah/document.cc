@@ -7,21 +7,82 @@
 
 #include "document.h"
 
+#include <regex.h>
+
+#include <algorithm>
+
+#include "text_kernels.h"
+
+using std::min;
+
 namespace kamiah {
 
+DocumentImage::DocumentImage() : doc_id(0), version(0) {
+}
+
+Position::Position() : line(0), column(0) {
+}
+
+Position::Position(Index position_line, Index position_column)
+    : line(position_line), column(position_column) {
+}
+
+bool Position::operator==(const Position& other) const {
+  return (line == other.line) && (column == other.column);
+}
+
 Document::Document(DocID doc_id)
-    : doc_id_(doc_id), version_(0), last_cached_diff_(-1) {
+    : doc_id_(doc_id), version_(0), last_cached_diff_(-1),
+      search_index_(NULL) {
+}
+
+Document::Document(DocID doc_id, Version version, const char *data,
+                   Length size, const list<Diff>& diffs)
+    : doc_id_(doc_id), version_(version), data_(data, size), diffs_(diffs),
+      last_cached_diff_(-1), search_index_(NULL) {
+  while (diffs_.size() > kMaxCacheSize) {
+    diffs_.pop_front();
+  }
+  if (!diffs_.empty()) {
+    last_cached_diff_ = diffs_.front().version();
+  }
+}
+
+Document::~Document() {
+  delete search_index_;
 }
 
 bool Document::ApplyDiff(Diff *diff) {
   // Check for invalid index.
-  if ((diff->index() < 0) || (diff->index() > (Length) data_.size())) {
+  if ((diff->index() < 0) || (diff->index() > data_.size())) {
     return false;
   }
 
-  // Increment and set version
+  // Check for invalid length.
+  if ((diff->type() == Diff::DELETE) && (diff->length() < 0)) {
+    return false;
+  }
+
+  // Keep the text valid UTF-8: no invalid text and no edits that split a
+  // character
+  Index end = diff->index();
+  if (diff->type() == Diff::INSERT) {
+    if (!IsValidUtf8(diff->text().data(), diff->text().size())) {
+      return false;
+    }
+  } else {
+    end = min(diff->index() + diff->length(), data_.size());
+  }
+  if (!IsCharBoundary(diff->index()) || !IsCharBoundary(end)) {
+    return false;
+  }
+
+  // Set the version, letting observers see the text before the diff
+  diff->set_version(version_ + 1);
+  for (size_t i = 0; i < observers_.size(); ++i) {
+    observers_[i]->OnDiffApplying(*this, *diff);
+  }
   ++version_;
-  diff->set_version(version_);
 
   // Add to our cache 
   diffs_.push_back(*diff);
@@ -36,18 +97,35 @@ bool Document::ApplyDiff(Diff *diff) {
   }
 
   // Apply to the document
+  Length inserted = 0;
   switch (diff->type()) {
     case Diff::INSERT:
-      data_.insert(diff->index(), diff->text());
+      inserted = diff->text().size();
+      data_.Insert(diff->index(), diff->text().data(), inserted);
+      markers_.Insert(diff->index(), inserted);
       break;
     case Diff::DELETE:
-      data_.erase(diff->index(), diff->length());
+      data_.Erase(diff->index(), diff->length());
+      markers_.Erase(diff->index(), end - diff->index());
       break;
   }
+  if (search_index_ != NULL) {
+    search_index_->Update(data_, diff->index(), end - diff->index(),
+                          inserted);
+  }
+
+  // Let everyone know
+  for (size_t i = 0; i < observers_.size(); ++i) {
+    observers_[i]->OnDiffApplied(*this, *diff);
+  }
 
   return true;
 }
 
+bool Document::IsCharBoundary(Index index) const {
+  return (index == data_.size()) || ((data_.at(index) & 0xC0) != 0x80);
+}
+
 bool Document::GetUpdates(Version from_version, list<Diff> *updates) const {
   // Check if the requested updates are no longer cached or we don't have any
   // diffs.
@@ -73,8 +151,281 @@ bool Document::GetUpdates(Version from_version, list<Diff> *updates) const {
   return true;
 }
 
+void Document::GetCachedDiffs(list<Diff> *diffs) const {
+  diffs->insert(diffs->end(), diffs_.begin(), diffs_.end());
+}
+
+bool Document::MapPosition(Index index, Version from_version,
+                           Version to_version, Bias bias,
+                           Index *mapped) const {
+  if (index < 0) {
+    return false;
+  }
+  vector<Index> indices(1, index);
+  if (!MapPositions(from_version, to_version, bias, &indices)) {
+    return false;
+  }
+  *mapped = indices[0];
+  return true;
+}
+
+bool Document::MapPositions(Version from_version, Version to_version,
+                            Bias bias, vector<Index> *indices) const {
+  list<Diff>::const_iterator it;
+  if (!FindDiffsAfter(from_version, to_version, &it)) {
+    return false;
+  }
+  for (; (it != diffs_.end()) && (it->version() <= to_version); ++it) {
+    for (size_t i = 0; i < indices->size(); ++i) {
+      (*indices)[i] = it->MapIndex((*indices)[i], bias);
+    }
+  }
+  return true;
+}
+
+bool Document::FindDiffsAfter(Version from_version, Version to_version,
+                              list<Diff>::const_iterator *first) const {
+  if ((from_version < 0) || (to_version < from_version) ||
+      (to_version > version_)) {
+    return false;
+  }
+  if (from_version == to_version) {
+    *first = diffs_.end();
+    return true;
+  }
+
+  // The diff after from_version must still be cached
+  if ((last_cached_diff_ == -1) || (from_version + 1 < last_cached_diff_)) {
+    return false;
+  }
+  *first = diffs_.begin();
+  while ((*first)->version() <= from_version) {
+    ++*first;
+  }
+  return true;
+}
+
 void Document::GetData(string *data) const {
-  *data = data_;
+  data->clear();
+  data_.AppendTo(data);
+}
+
+void Document::GetData(char *data) const {
+  data_.CopyTo(data);
+}
+
+bool Document::GetLines(Index first_line, Index end_line,
+                        string *lines) const {
+  if ((first_line < 0) || (first_line > end_line)) {
+    return false;
+  }
+  lines->clear();
+  if (first_line >= data_.num_lines()) {
+    return true;
+  }
+  Index start = data_.LineStart(first_line);
+  Index end = (end_line >= data_.num_lines()) ? data_.size()
+                                              : data_.LineStart(end_line);
+  data_.AppendRangeTo(start, end - start, lines);
+  return true;
+}
+
+bool Document::GetPosition(Index index, Position *position) const {
+  if ((index < 0) || (index > data_.size())) {
+    return false;
+  }
+  position->line = data_.LineOf(index);
+  position->column = index - data_.LineStart(position->line);
+  return true;
+}
+
+bool Document::GetPosition(Index index, Unit unit,
+                           Position *position) const {
+  if (!GetPosition(index, position)) {
+    return false;
+  }
+  Index line_start = index - position->column;
+  position->column =
+      data_.FromBytes(unit, index) - data_.FromBytes(unit, line_start);
+  return true;
+}
+
+bool Document::GetIndex(const Position& position, Index *index) const {
+  if ((position.line < 0) || (position.line >= data_.num_lines()) ||
+      (position.column < 0)) {
+    return false;
+  }
+
+  // The column can be at the '\n' that ends the line, but not past it
+  Index start = data_.LineStart(position.line);
+  Index end = (position.line + 1 == data_.num_lines())
+      ? data_.size() : data_.LineStart(position.line + 1) - 1;
+  if (position.column > end - start) {
+    return false;
+  }
+  *index = start + position.column;
+  return true;
+}
+
+bool Document::ToByteIndex(Unit unit, Index offset, Index *index) const {
+  return data_.ToBytes(unit, offset, index);
+}
+
+bool Document::FromByteIndex(Unit unit, Index index, Index *offset) const {
+  if ((index < 0) || (index > data_.size()) || !IsCharBoundary(index)) {
+    return false;
+  }
+  *offset = data_.FromBytes(unit, index);
+  return true;
+}
+
+bool Document::ToByteDiff(Unit unit, const Diff& diff,
+                          Diff *byte_diff) const {
+  Index index;
+  if (!ToByteIndex(unit, diff.index(), &index)) {
+    return false;
+  }
+  if (diff.type() == Diff::INSERT) {
+    *byte_diff = Diff(index, diff.text());
+  } else {
+    // Deleting past the end deletes up to the end
+    Index end = data_.size();
+    Index offset_end = diff.index() + diff.length();
+    if ((offset_end < data_.length(unit)) &&
+        !ToByteIndex(unit, offset_end, &end)) {
+      return false;
+    }
+    *byte_diff = Diff(index, end - index);
+  }
+  byte_diff->set_version(diff.version());
+  return true;
+}
+
+void Document::EnableSearchIndex() {
+  if (search_index_ == NULL) {
+    search_index_ = new TrigramIndex(data_);
+  }
+}
+
+bool Document::has_search_index() const {
+  return search_index_ != NULL;
+}
+
+void Document::Find(const string& text, vector<Index> *matches) const {
+  if (text.empty()) {
+    return;
+  }
+  if (search_index_ != NULL) {
+    search_index_->Find(data_, text, matches);
+  } else {
+    FindInText(data_, text, 0, data_.size(), matches);
+  }
+}
+
+bool Document::FindRegex(const string& regex,
+                         vector<TextMatch> *matches) const {
+  regex_t compiled;
+  if (regcomp(&compiled, regex.c_str(), REG_EXTENDED | REG_NEWLINE) != 0) {
+    return false;
+  }
+
+  // Only the lines with the string every match has can match
+  vector<Index> lines;
+  string literal = GetRequiredLiteral(regex);
+  if ((search_index_ != NULL) && (literal.size() >= 3)) {
+    vector<Index> literal_matches;
+    search_index_->Find(data_, literal, &literal_matches);
+    for (size_t i = 0; i < literal_matches.size(); ++i) {
+      Index line = data_.LineOf(literal_matches[i]);
+      if (lines.empty() || (lines.back() != line)) {
+        lines.push_back(line);
+      }
+    }
+  } else {
+    for (Index line = 0; line < data_.num_lines(); ++line) {
+      lines.push_back(line);
+    }
+  }
+
+  string text;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    text.clear();
+    GetLines(lines[i], lines[i] + 1, &text);
+    if (!text.empty() && (text[text.size() - 1] == '\n')) {
+      text.erase(text.size() - 1);
+    }
+    Index line_start = data_.LineStart(lines[i]);
+    size_t offset = 0;
+    regmatch_t match;
+    while ((offset <= text.size()) &&
+           (regexec(&compiled, text.c_str() + offset, 1, &match,
+                    (offset > 0) ? REG_NOTBOL : 0) == 0)) {
+      TextMatch text_match;
+      text_match.index = line_start + offset + match.rm_so;
+      text_match.length = match.rm_eo - match.rm_so;
+      matches->push_back(text_match);
+
+      if (match.rm_eo > match.rm_so) {
+        offset += match.rm_eo;
+      } else {
+        // Empty matches move on by a character, never into the middle of one
+        offset += match.rm_so + 1;
+        while ((offset < text.size()) &&
+               !IsCharBoundary(line_start + offset)) {
+          ++offset;
+        }
+      }
+    }
+  }
+  regfree(&compiled);
+  return true;
+}
+
+void Document::GetImage(DocumentImage *image) const {
+  image->doc_id = doc_id_;
+  image->version = version_;
+  image->text = data_;
+  image->diffs = diffs_;
+}
+
+const Text& Document::text() const {
+  return data_;
+}
+
+Length Document::size() const {
+  return data_.size();
+}
+
+Length Document::num_lines() const {
+  return data_.num_lines();
+}
+
+MarkerID Document::AddMarker(Index index, Bias bias) {
+  if ((index < 0) || (index > data_.size())) {
+    return -1;
+  }
+  return markers_.Add(index, bias);
+}
+
+bool Document::RemoveMarker(MarkerID id) {
+  return markers_.Remove(id);
+}
+
+bool Document::GetMarker(MarkerID id, Index *index) const {
+  return markers_.Get(id, index);
+}
+
+void Document::GetMarkers(Index start, Index end,
+                          vector<Marker> *markers) const {
+  markers_.GetRange(start, end, markers);
+}
+
+size_t Document::num_markers() const {
+  return markers_.size();
+}
+
+Length Document::length(Unit unit) const {
+  return data_.length(unit);
 }
 
 DocID Document::doc_id() const {
@@ -85,4 +436,19 @@ Version Document::version() const {
   return version_;
 }
 
+void Document::AddObserver(DocumentObserver *observer) {
+  observers_.push_back(observer);
+}
+
+bool Document::RemoveObserver(DocumentObserver *observer) {
+  for (vector<DocumentObserver*>::iterator it = observers_.begin();
+       it != observers_.end(); ++it) {
+    if (*it == observer) {
+      observers_.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace kamiah
@@ -5,28 +5,114 @@
  * @author Victor Marmol (vmarmol@gmail.com)
  */
 
+#ifndef KAMIAH_DOCUMENT_H_
+#define KAMIAH_DOCUMENT_H_
+
 #include <list>
 #include <string>
+#include <vector>
 
 #include "diff.h"
+#include "marker_tree.h"
+#include "text.h"
+#include "trigram_index.h"
 #include "types.h"
 
 using std::list;
 using std::string;
+using std::vector;
 
 namespace kamiah {
 
+class Document;
+
+/**
+ * @brief A DocumentObserver is notified of every diff applied to the
+ *     Documents it observes.
+ */
+class DocumentObserver {
+ public:
+  virtual ~DocumentObserver() {}
+
+  /**
+   * @brief Called before a diff that is valid is applied to a Document, for
+   *     observers that need the text the diff replaces.
+   *
+   * @param doc The Document the diff is about to be applied to, still at the
+   *     version before the diff.
+   * @param diff The diff, with its version set.
+   */
+  virtual void OnDiffApplying(const Document& /* doc */,
+                              const Diff& /* diff */) {}
+
+  /**
+   * @brief Called after a diff has been applied to a Document.
+   *
+   * @param doc The Document the diff was applied to.
+   * @param diff The diff that was applied, with its version set.
+   */
+  virtual void OnDiffApplied(const Document& doc, const Diff& diff) = 0;
+};
+
 // TODO(vmarmol): Optimizations: 
 //   - diffs_: array-backed circular buffer.
-//   - data_: Rope.
 //   - We copy a lot of data both here and in Diff.
 
+/**
+ * @brief A point-in-time image of a Document.
+ */
+struct DocumentImage {
+  DocumentImage();
+
+  DocID doc_id;
+  Version version;
+
+  // Shares its chunks with the Document it was taken from.
+  Text text;
+
+  // The diff cache of the Document, oldest first.
+  list<Diff> diffs;
+};
+
+/**
+ * @brief A position in a Document as a line and a column, both from 0.
+ *     Lines end with '\n' and columns count characters from the start of
+ *     the line.
+ */
+struct Position {
+  Position();
+  Position(Index position_line, Index position_column);
+
+  bool operator==(const Position& other) const;
+
+  Index line;
+  Index column;
+};
+
+/**
+ * @brief A match of a search in a Document.
+ */
+struct TextMatch {
+  Index index;
+  Length length;
+};
+
 /**
  * @brief A Document is the datastructure that backs a file that is being
  *     concurrently edited in PapayaIDE.
  *
  * A Document keeps a cache of the last kMaxCacheSize diffs that have been
- * applied to the document. It also keeps the full text of the file.
+ * applied to the document. It also keeps the full text of the file as a Text,
+ * so that images of it can be taken without copying the text. Diffs keep the
+ * text valid UTF-8.
+ *
+ * Markers (cursors, breakpoints, the ends of diagnostics) can be placed in
+ * the text and are shifted by every diff applied (see MarkerTree). They are
+ * local to the process: they are not part of images, snapshots or updates.
+ *
+ * Large Documents that are searched often can keep a TrigramIndex, updated
+ * by every diff applied, so that searches only look at the parts of the
+ * text that can match.
  *
  * This class is thread-compatible.
  */
@@ -42,12 +128,29 @@ class Document {
    */
   explicit Document(DocID doc_id);
 
+  /**
+   * @brief Constructor of a Document restored from a previous state, usually
+   *     a Snapshot.
+   *
+   * @param doc_id The ID of this document.
+   * @param version The Version of the document.
+   * @param data The text of the document.
+   * @param size The number of characters in data.
+   * @param diffs The cached diffs of the document, in order and ending at
+   *     version. Only the last kMaxCacheSize are kept.
+   */
+  Document(DocID doc_id, Version version, const char *data, Length size,
+           const list<Diff>& diffs);
+  ~Document();
+
   /**
    * @brief Applies the specified diff to the document.
    *
    * @param diff The diff to apply to the document.
-   * @return True iff the diff was applied successfully. One possible failure
-   *     scenario is a diff with an out of bounds index.
+   * @return True iff the diff was applied successfully. Diffs with an out of
+   *     bounds index or a negative length, that insert text that is not
+   *     valid UTF-8, or that insert or delete in the middle of a UTF-8
+   *     character fail.
    */
   bool ApplyDiff(Diff *diff);
 
@@ -67,6 +170,44 @@ class Document {
    */
   bool GetUpdates(Version from_version, list<Diff> *updates) const;
 
+  /**
+   * @brief Gets all the diffs in the Document's cache.
+   *
+   * @param diffs List in which to write the cached diffs, oldest first.
+   */
+  void GetCachedDiffs(list<Diff> *diffs) const;
+
+  /**
+   * @brief Maps an index in the Document at one version to the same place
+   *     in the Document at a later version, for example the cursor of a
+   *     client that has not yet seen the latest diffs.
+   *
+   * @param index The index at from_version.
+   * @param from_version The version the index is at.
+   * @param to_version The version to map the index to, at most version().
+   * @param bias Which way the index goes when text is inserted at it.
+   * @param mapped Where to write the index at to_version.
+   * @return True iff the index was mapped. False if to_version is before
+   *     from_version or after version(), or the diffs in between are no
+   *     longer cached.
+   */
+  bool MapPosition(Index index, Version from_version, Version to_version,
+                   Bias bias, Index *mapped) const;
+
+  /**
+   * @brief Same as the above for many indices at once, for example the
+   *     cursors of all the collaborators on the Document. The cached diffs
+   *     are only looked up once.
+   *
+   * @param from_version The version the indices are at.
+   * @param to_version The version to map the indices to, at most version().
+   * @param bias Which way the indices go when text is inserted at them.
+   * @param indices The indices to map, replaced by the mapped indices.
+   * @return True iff the indices were mapped, false otherwise (see above).
+   */
+  bool MapPositions(Version from_version, Version to_version, Bias bias,
+                    vector<Index> *indices) const;
+
   /**
    * @brief Get a Document's underlying data (the file contents).
    *
@@ -74,6 +215,164 @@ class Document {
    */
   void GetData(string *data) const;
 
+  /**
+   * @brief Copies a Document's underlying data into a caller-owned buffer.
+   *
+   * @param data Buffer of at least size() bytes to write the data to.
+   */
+  void GetData(char *data) const;
+
+  /**
+   * @brief Gets some of the lines of the Document, for example those in
+   *     view in an editor. Lines past the last one are empty.
+   *
+   * @param first_line The first line to get.
+   * @param end_line The line after the last one to get.
+   * @param lines String to write the lines to, including the '\n' that end
+   *     them.
+   * @return True iff the lines were written. False if first_line is
+   *     negative or after end_line.
+   */
+  bool GetLines(Index first_line, Index end_line, string *lines) const;
+
+  /**
+   * @brief Converts an index in the Document to a line and column.
+   *
+   * @param index The index, between 0 and size().
+   * @param position Where to write the position of the index.
+   * @return True iff the index is in the Document.
+   */
+  bool GetPosition(Index index, Position *position) const;
+
+  /**
+   * @brief Same as the above, with the column in some unit. Language servers
+   *     count columns in UTF-16 code units.
+   *
+   * @param index The index, between 0 and size().
+   * @param unit The unit of the column.
+   * @param position Where to write the position of the index.
+   * @return True iff the index is in the Document.
+   */
+  bool GetPosition(Index index, Unit unit, Position *position) const;
+
+  /**
+   * @brief Converts a line and column to an index in the Document.
+   *
+   * @param position The position. The column can be at most the length of
+   *     the line without its '\n'.
+   * @param index Where to write the index of the position.
+   * @return True iff the position is in the Document.
+   */
+  bool GetIndex(const Position& position, Index *index) const;
+
+  /**
+   * @brief Converts an offset in some unit to a byte index in the Document,
+   *     for example one from a browser that counts UTF-16 code units.
+   *
+   * @param unit The unit of the offset.
+   * @param offset The offset, between 0 and length(unit).
+   * @param index Where to write the byte index of the offset.
+   * @return True iff the offset is in the Document and not in the middle of
+   *     a UTF-16 surrogate pair.
+   */
+  bool ToByteIndex(Unit unit, Index offset, Index *index) const;
+
+  /**
+   * @brief Converts a byte index in the Document to an offset in some unit.
+   *
+   * @param unit The unit of the offset.
+   * @param index The byte index, between 0 and size().
+   * @param offset Where to write the offset of the index.
+   * @return True iff the index is in the Document and not in the middle of a
+   *     character.
+   */
+  bool FromByteIndex(Unit unit, Index index, Index *offset) const;
+
+  /**
+   * @brief Converts a diff with an index and length in some unit into one in
+   *     bytes that can be applied to the Document.
+   *
+   * @param unit The unit of the index and length of the diff.
+   * @param diff The diff to convert.
+   * @param byte_diff Where to write the converted diff.
+   * @return True iff the diff is in the Document.
+   */
+  bool ToByteDiff(Unit unit, const Diff& diff, Diff *byte_diff) const;
+
+  /**
+   * @brief Builds a TrigramIndex of the Document, which Find() and
+   *     FindRegex() use from then on. Does nothing if there is one already.
+   */
+  void EnableSearchIndex();
+
+  /**
+   * @brief Whether the Document has a TrigramIndex.
+   *
+   * @return True iff EnableSearchIndex() was called.
+   */
+  bool has_search_index() const;
+
+  /**
+   * @brief Finds all the occurrences of a string in the Document,
+   *     overlapping ones included.
+   *
+   * @param text The string to find.
+   * @param matches Vector to append the index of every occurrence to, in
+   *     order.
+   */
+  void Find(const string& text, vector<Index> *matches) const;
+
+  /**
+   * @brief Finds all the matches of a POSIX extended regular expression in
+   *     the Document. Like grep, the lines of the Document are matched one
+   *     at a time, so matches do not span lines.
+   *
+   * @param regex The regular expression.
+   * @param matches Vector to append the matches to, in order.
+   * @return True iff the regular expression is valid.
+   */
+  bool FindRegex(const string& regex, vector<TextMatch> *matches) const;
+
+  /**
+   * @brief Takes a point-in-time image of the Document. This only copies the
+   *     diff cache and references to the chunks of the text, so it is cheap
+   *     even for large Documents. The image can be used from any thread.
+   *
+   * @param image Where to write the image.
+   */
+  void GetImage(DocumentImage *image) const;
+
+  /**
+   * @brief Gets the text of the Document. Valid until the Document is next
+   *     modified.
+   *
+   * @return The text of the Document.
+   */
+  const Text& text() const;
+
+  /**
+   * @brief Gets the size of the Document's underlying data.
+   *
+   * @return The number of characters in the Document.
+   */
+  Length size() const;
+
+  /**
+   * @brief Gets the number of lines in the Document. An empty Document has
+   *     one empty line.
+   *
+   * @return The number of lines in the Document.
+   */
+  Length num_lines() const;
+
+  /**
+   * @brief Gets the length of the Document's underlying data in some unit.
+   *
+   * @param unit The unit to count.
+   * @return The number of units in the Document.
+   */
+  Length length(Unit unit) const;
+
   /**
    * @brief Gets the DocID of the Document.
    *
@@ -88,12 +387,91 @@ class Document {
    */
   Version version() const;
 
+  /**
+   * @brief Adds a marker that follows the text around it as diffs are
+   *     applied.
+   *
+   * @param index The position of the marker, between 0 and size().
+   * @param bias Which way the marker goes when text is inserted at it.
+   * @return The ID of the marker, -1 if the index is not in the Document.
+   */
+  MarkerID AddMarker(Index index, Bias bias);
+
+  /**
+   * @brief Removes a marker.
+   *
+   * @param id The ID of the marker.
+   * @return True iff the marker existed.
+   */
+  bool RemoveMarker(MarkerID id);
+
+  /**
+   * @brief Gets the current position of a marker.
+   *
+   * @param id The ID of the marker.
+   * @param index Where to write the position of the marker.
+   * @return True iff the marker exists.
+   */
+  bool GetMarker(MarkerID id, Index *index) const;
+
+  /**
+   * @brief Gets the markers in a range of the Document.
+   *
+   * @param start The first position to get markers at.
+   * @param end The position after the last one to get markers at.
+   * @param markers Vector to append the markers to, ordered by position.
+   */
+  void GetMarkers(Index start, Index end, vector<Marker> *markers) const;
+
+  /**
+   * @brief Gets the number of markers in the Document.
+   *
+   * @return The number of markers.
+   */
+  size_t num_markers() const;
+
+  /**
+   * @brief Registers an observer to be notified of every diff applied to the
+   *     Document from now on. Observers are notified in the order in which
+   *     they were added.
+   *
+   * @param observer The observer to add. Not owned.
+   */
+  void AddObserver(DocumentObserver *observer);
+
+  /**
+   * @brief Unregisters an observer.
+   *
+   * @param observer The observer to remove.
+   * @return True iff the observer was registered.
+   */
+  bool RemoveObserver(DocumentObserver *observer);
+
  private:
+  // Whether an index is not in the middle of a UTF-8 character.
+  bool IsCharBoundary(Index index) const;
+
+  // Finds the first cached diff after from_version. Returns false if the
+  // diffs up to to_version are not all cached.
+  bool FindDiffsAfter(Version from_version, Version to_version,
+                      list<Diff>::const_iterator *first) const;
+
   DocID doc_id_;
   Version version_;
-  string data_;
+  Text data_;
   list<Diff> diffs_;
   Version last_cached_diff_;
+  vector<DocumentObserver*> observers_;
+  MarkerTree markers_;
+
+  // NULL unless EnableSearchIndex() was called.
+  TrigramIndex *search_index_;
+
+  // Not copyable.
+  Document(const Document&);
+  void operator=(const Document&);
 };
 
 }  // namespace kamiah
+
+#endif  // KAMIAH_DOCUMENT_H_
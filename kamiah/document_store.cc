@@ -0,0 +1,182 @@
+/**
+ * @file document_store.cc
+ * @brief Implementation of a DocumentStore.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "document_store.h"
+
+#include <utility>
+
+using std::make_pair;
+
+namespace kamiah {
+
+DocumentStore::DocumentStore() : snapshot_(NULL) {
+}
+
+DocumentStore::~DocumentStore() {
+  for (map<DocID, Document*>::iterator it = documents_.begin();
+       it != documents_.end(); ++it) {
+    delete it->second;
+  }
+  delete snapshot_;
+}
+
+Document* DocumentStore::GetOrCreate(DocID doc_id) {
+  Document *doc = Get(doc_id);
+  if ((doc == NULL) && !IsCorrupted(doc_id)) {
+    doc = new Document(doc_id);
+    AddObservers(doc);
+    documents_[doc_id] = doc;
+  }
+  return doc;
+}
+
+Document* DocumentStore::Get(DocID doc_id) const {
+  map<DocID, Document*>::iterator it = documents_.find(doc_id);
+  if (it == documents_.end()) {
+    return NULL;
+  }
+
+  // First access to a Document of the snapshot. A corrupted one is kept so
+  // that it is neither created again nor left out of the next snapshot.
+  if ((it->second == NULL) && (corrupted_.count(doc_id) == 0)) {
+    it->second = snapshot_->Load(doc_id);
+    if (it->second == NULL) {
+      corrupted_.insert(doc_id);
+      return NULL;
+    }
+    AddObservers(it->second);
+  }
+  return it->second;
+}
+
+bool DocumentStore::IsCorrupted(DocID doc_id) const {
+  Get(doc_id);
+  return corrupted_.count(doc_id) != 0;
+}
+
+bool DocumentStore::Add(Document *doc) {
+  // Replaces the placeholder of a Document of the snapshot
+  Document *&entry = documents_[doc->doc_id()];
+  if ((entry != NULL) || (corrupted_.count(doc->doc_id()) != 0)) {
+    return false;
+  }
+  entry = doc;
+  AddObservers(doc);
+  return true;
+}
+
+bool DocumentStore::Remove(DocID doc_id) {
+  map<DocID, Document*>::iterator it = documents_.find(doc_id);
+  if (it == documents_.end()) {
+    return false;
+  }
+
+  delete it->second;
+  documents_.erase(it);
+  corrupted_.erase(doc_id);
+  return true;
+}
+
+bool DocumentStore::ApplyDiff(DocID doc_id, Diff *diff) {
+  Document *doc = Get(doc_id);
+  if (doc == NULL) {
+    return false;
+  }
+  return doc->ApplyDiff(diff);
+}
+
+void DocumentStore::GetDocIDs(vector<DocID> *doc_ids) const {
+  for (map<DocID, Document*>::const_iterator it = documents_.begin();
+       it != documents_.end(); ++it) {
+    doc_ids->push_back(it->first);
+  }
+}
+
+size_t DocumentStore::size() const {
+  return documents_.size();
+}
+
+size_t DocumentStore::num_loaded() const {
+  size_t loaded = 0;
+  for (map<DocID, Document*>::const_iterator it = documents_.begin();
+       it != documents_.end(); ++it) {
+    if (it->second != NULL) {
+      ++loaded;
+    }
+  }
+  return loaded;
+}
+
+bool DocumentStore::LoadSnapshot(Snapshot *snapshot) {
+  if (!documents_.empty()) {
+    return false;
+  }
+
+  // The IDs are sorted, so every insertion is at the end
+  vector<DocID> doc_ids;
+  snapshot->GetDocIDs(&doc_ids);
+  Document *not_loaded = NULL;
+  for (size_t i = 0; i < doc_ids.size(); ++i) {
+    documents_.insert(documents_.end(), make_pair(doc_ids[i], not_loaded));
+  }
+  delete snapshot_;
+  snapshot_ = snapshot;
+  return true;
+}
+
+void DocumentStore::GetImages(vector<DocumentImage> *images,
+                              vector<DocID> *not_loaded) const {
+  images->reserve(images->size() + documents_.size());
+  for (map<DocID, Document*>::const_iterator it = documents_.begin();
+       it != documents_.end(); ++it) {
+    if (it->second == NULL) {
+      not_loaded->push_back(it->first);
+    } else {
+      images->push_back(DocumentImage());
+      it->second->GetImage(&images->back());
+    }
+  }
+}
+
+const Snapshot* DocumentStore::snapshot() const {
+  return snapshot_;
+}
+
+void DocumentStore::AddObserver(DocumentObserver *observer) {
+  observers_.push_back(observer);
+  for (map<DocID, Document*>::iterator it = documents_.begin();
+       it != documents_.end(); ++it) {
+    if (it->second != NULL) {
+      it->second->AddObserver(observer);
+    }
+  }
+}
+
+bool DocumentStore::RemoveObserver(DocumentObserver *observer) {
+  for (vector<DocumentObserver*>::iterator it = observers_.begin();
+       it != observers_.end(); ++it) {
+    if (*it == observer) {
+      observers_.erase(it);
+      for (map<DocID, Document*>::iterator doc = documents_.begin();
+           doc != documents_.end(); ++doc) {
+        if (doc->second != NULL) {
+          doc->second->RemoveObserver(observer);
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void DocumentStore::AddObservers(Document *doc) const {
+  for (size_t i = 0; i < observers_.size(); ++i) {
+    doc->AddObserver(observers_[i]);
+  }
+}
+
+}  // namespace kamiah
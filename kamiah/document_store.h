@@ -0,0 +1,185 @@
+/**
+ * @file document_store.h
+ * @brief Definition of a DocumentStore.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_DOCUMENT_STORE_H_
+#define KAMIAH_DOCUMENT_STORE_H_
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "diff.h"
+#include "document.h"
+#include "snapshot.h"
+#include "types.h"
+
+using std::map;
+using std::set;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief A DocumentStore holds all the Documents loaded on a Kamiah node,
+ *     indexed by their DocID.
+ *
+ * The store owns the Documents it holds. A store can also serve the Documents
+ * of a Snapshot, which are only loaded the first time they are accessed. A
+ * Document whose entry of the snapshot is corrupted stays in the store but
+ * cannot be accessed, replaced or created again (see IsCorrupted()) until it
+ * is removed.
+ *
+ * This class is thread-compatible. Note that Get() may load a Document from
+ * the snapshot, so it is not safe to call it concurrently either.
+ */
+class DocumentStore {
+ public:
+  DocumentStore();
+  ~DocumentStore();
+
+  /**
+   * @brief Gets the Document with the specified ID, creating an empty one if
+   *     it does not exist.
+   *
+   * @param doc_id The ID of the Document.
+   * @return The Document with the specified ID, or NULL if it is corrupted.
+   *     Owned by the store.
+   */
+  Document* GetOrCreate(DocID doc_id);
+
+  /**
+   * @brief Gets the Document with the specified ID.
+   *
+   * @param doc_id The ID of the Document.
+   * @return The Document with the specified ID or NULL if it does not exist
+   *     or is corrupted. Owned by the store.
+   */
+  Document* Get(DocID doc_id) const;
+
+  /**
+   * @brief Checks whether a Document of the snapshot cannot be loaded
+   *     because its entry is corrupted. Loads the Document if it was not.
+   *
+   * @param doc_id The ID of the Document.
+   * @return True iff the Document is corrupted.
+   */
+  bool IsCorrupted(DocID doc_id) const;
+
+  /**
+   * @brief Adds a Document that was created or loaded outside of the store,
+   *     usually from the snapshot by another thread.
+   *
+   * @param doc The Document to add. Owned by the store if it was added.
+   * @return True iff the Document was added. False if a Document with its ID
+   *     is already in memory or is corrupted.
+   */
+  bool Add(Document *doc);
+
+  /**
+   * @brief Removes and deletes the Document with the specified ID.
+   *
+   * @param doc_id The ID of the Document.
+   * @return True iff the Document existed.
+   */
+  bool Remove(DocID doc_id);
+
+  /**
+   * @brief Applies the specified diff to the Document with the specified ID.
+   *
+   * @param doc_id The ID of the Document to apply the diff to.
+   * @param diff The diff to apply.
+   * @return True iff the Document exists and the diff was applied
+   *     successfully.
+   */
+  bool ApplyDiff(DocID doc_id, Diff *diff);
+
+  /**
+   * @brief Gets the IDs of all the Documents in the store in increasing order.
+   *
+   * @param doc_ids Vector in which to write the IDs.
+   */
+  void GetDocIDs(vector<DocID> *doc_ids) const;
+
+  /**
+   * @brief Gets the number of Documents in the store.
+   *
+   * @return The number of Documents in the store.
+   */
+  size_t size() const;
+
+  /**
+   * @brief Gets the number of Documents in memory, which excludes those of
+   *     the snapshot that were not accessed yet.
+   *
+   * @return The number of Documents in memory.
+   */
+  size_t num_loaded() const;
+
+  /**
+   * @brief Adds all the Documents of a snapshot to the store without loading
+   *     them. The store must be empty.
+   *
+   * @param snapshot The snapshot to serve the Documents of. Owned by the store
+   *     if it was loaded.
+   * @return True iff the snapshot was loaded. False if the store is not empty.
+   */
+  bool LoadSnapshot(Snapshot *snapshot);
+
+  /**
+   * @brief Takes an image of every Document in memory. See
+   *     Document::GetImage().
+   *
+   * @param images Vector in which to write the images, sorted by DocID.
+   * @param not_loaded Vector in which to write the IDs of the Documents that
+   *     are still only in the snapshot, in increasing order.
+   */
+  void GetImages(vector<DocumentImage> *images,
+                 vector<DocID> *not_loaded) const;
+
+  /**
+   * @brief Gets the snapshot the store serves Documents from.
+   *
+   * @return The snapshot, or NULL if none was loaded. Owned by the store.
+   */
+  const Snapshot* snapshot() const;
+
+  /**
+   * @brief Registers an observer on every Document in the store, including
+   *     those created from now on. See Document::AddObserver().
+   *
+   * @param observer The observer to add. Not owned.
+   */
+  void AddObserver(DocumentObserver *observer);
+
+  /**
+   * @brief Unregisters an observer from every Document in the store.
+   *
+   * @param observer The observer to remove.
+   * @return True iff the observer was registered.
+   */
+  bool RemoveObserver(DocumentObserver *observer);
+
+ private:
+  // Registers all the observers of the store on a new Document.
+  void AddObservers(Document *doc) const;
+
+  // Documents of the snapshot map to NULL until they are loaded.
+  mutable map<DocID, Document*> documents_;
+
+  // Documents of the snapshot that could not be loaded.
+  mutable set<DocID> corrupted_;
+  vector<DocumentObserver*> observers_;
+  Snapshot *snapshot_;
+
+  // Not copyable.
+  DocumentStore(const DocumentStore&);
+  void operator=(const DocumentStore&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_DOCUMENT_STORE_H_
@@ -0,0 +1,136 @@
+/**
+ * @file document_store_test.cc
+ * @brief Unit tests for a DocumentStore.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "document_store.h"
+
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+TEST(DocumentStoreTest, InitiallyEmpty) {
+  DocumentStore store;
+
+  EXPECT_EQ(0U, store.size());
+  EXPECT_TRUE(store.Get(1) == NULL);
+
+  vector<DocID> doc_ids;
+  store.GetDocIDs(&doc_ids);
+  EXPECT_TRUE(doc_ids.empty());
+}
+
+TEST(DocumentStoreTest, GetOrCreate) {
+  DocumentStore store;
+
+  Document *doc = store.GetOrCreate(13);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ(13, doc->doc_id());
+  EXPECT_EQ(1U, store.size());
+
+  // Same document is returned the second time
+  EXPECT_EQ(doc, store.GetOrCreate(13));
+  EXPECT_EQ(doc, store.Get(13));
+  EXPECT_EQ(1U, store.size());
+}
+
+TEST(DocumentStoreTest, Remove) {
+  DocumentStore store;
+  store.GetOrCreate(1);
+  store.GetOrCreate(2);
+
+  EXPECT_TRUE(store.Remove(1));
+  EXPECT_FALSE(store.Remove(1));
+  EXPECT_TRUE(store.Get(1) == NULL);
+  EXPECT_TRUE(store.Get(2) != NULL);
+  EXPECT_EQ(1U, store.size());
+}
+
+TEST(DocumentStoreTest, Add) {
+  DocumentStore store;
+  Document *doc = new Document(3);
+  EXPECT_TRUE(store.Add(doc));
+  EXPECT_EQ(doc, store.Get(3));
+  EXPECT_EQ(1U, store.size());
+
+  // A Document with the same ID is not replaced
+  Document other(3);
+  EXPECT_FALSE(store.Add(&other));
+  EXPECT_EQ(doc, store.Get(3));
+}
+
+TEST(DocumentStoreTest, ApplyDiff) {
+  DocumentStore store;
+  store.GetOrCreate(1);
+
+  Diff diff(0, "papaya");
+  EXPECT_TRUE(store.ApplyDiff(1, &diff));
+  EXPECT_EQ(1, diff.version());
+
+  string data;
+  store.Get(1)->GetData(&data);
+  EXPECT_EQ("papaya", data);
+
+  // Unknown document
+  Diff other_diff(0, "papaya");
+  EXPECT_FALSE(store.ApplyDiff(2, &other_diff));
+  EXPECT_EQ(-1, other_diff.version());
+}
+
+TEST(DocumentStoreTest, GetDocIDs) {
+  DocumentStore store;
+  store.GetOrCreate(3);
+  store.GetOrCreate(1);
+  store.GetOrCreate(2);
+
+  vector<DocID> doc_ids;
+  store.GetDocIDs(&doc_ids);
+  ASSERT_EQ(3U, doc_ids.size());
+  EXPECT_EQ(1, doc_ids[0]);
+  EXPECT_EQ(2, doc_ids[1]);
+  EXPECT_EQ(3, doc_ids[2]);
+}
+
+namespace {
+
+class CountingObserver : public DocumentObserver {
+ public:
+  CountingObserver() : count_(0) {}
+
+  virtual void OnDiffApplied(const Document& /* doc */,
+                             const Diff& /* diff */) {
+    ++count_;
+  }
+
+  int count_;
+};
+
+}  // namespace
+
+TEST(DocumentStoreTest, Observers) {
+  DocumentStore store;
+  store.GetOrCreate(1);
+
+  // Observes existing and new documents
+  CountingObserver observer;
+  store.AddObserver(&observer);
+  store.GetOrCreate(2);
+  Diff diff1(0, "papaya");
+  EXPECT_TRUE(store.ApplyDiff(1, &diff1));
+  Diff diff2(0, "papaya");
+  EXPECT_TRUE(store.ApplyDiff(2, &diff2));
+  EXPECT_EQ(2, observer.count_);
+
+  EXPECT_TRUE(store.RemoveObserver(&observer));
+  EXPECT_FALSE(store.RemoveObserver(&observer));
+  store.GetOrCreate(3);
+  Diff diff3(0, "papaya");
+  EXPECT_TRUE(store.ApplyDiff(1, &diff3));
+  Diff diff4(0, "papaya");
+  EXPECT_TRUE(store.ApplyDiff(3, &diff4));
+  EXPECT_EQ(2, observer.count_);
+}
+
+}  // namespace kamiah
@@ -11,6 +11,23 @@
 
 namespace kamiah {
 
+// Observer that records the versions of the diffs it is notified of.
+class RecordingObserver : public DocumentObserver {
+ public:
+  virtual void OnDiffApplying(const Document& doc, const Diff& diff) {
+    EXPECT_EQ(doc.version() + 1, diff.version());
+    sizes_before_.push_back(doc.size());
+  }
+
+  virtual void OnDiffApplied(const Document& doc, const Diff& diff) {
+    EXPECT_EQ(doc.version(), diff.version());
+    versions_.push_back(diff.version());
+  }
+
+  vector<Version> versions_;
+  vector<Length> sizes_before_;
+};
+
 TEST(DocumentTest, InitialDocument) {
   Document doc(13);
 
@@ -109,6 +126,90 @@ TEST(DocumentTest, ApplyDiffTestIndexValues) {
   Diff diff7(-1, content);
   EXPECT_FALSE(doc.ApplyDiff(&diff6));
   EXPECT_FALSE(doc.ApplyDiff(&diff7));
+
+  // Try to delete a negative length
+  Version version = doc.version();
+  Diff diff8(1, -1);
+  EXPECT_FALSE(doc.ApplyDiff(&diff8));
+  EXPECT_EQ(version, doc.version());
+  EXPECT_EQ(doc_size, doc.size());
+}
+
+TEST(DocumentTest, ApplyDiffUtf8) {
+  Document doc(1);
+
+  // "papaya" with an accented first a and the last a as "\xF0\x9F\x8D\x88"
+  string content = "p\xC3\xA1paya\xF0\x9F\x8D\x88";
+  Diff diff1(0, content);
+  EXPECT_TRUE(doc.ApplyDiff(&diff1));
+
+  // Not valid UTF-8
+  Diff diff2(0, "\xC3");
+  Diff diff3(0, "\xC0\xAF");
+  Diff diff4(0, "\xED\xA0\x80");
+  EXPECT_FALSE(doc.ApplyDiff(&diff2));
+  EXPECT_FALSE(doc.ApplyDiff(&diff3));
+  EXPECT_FALSE(doc.ApplyDiff(&diff4));
+
+  // In the middle of a character
+  Diff diff5(2, "x");
+  Diff diff6(2, 1);
+  Diff diff7(0, 2);
+  Diff diff8(8, 100);
+  EXPECT_FALSE(doc.ApplyDiff(&diff5));
+  EXPECT_FALSE(doc.ApplyDiff(&diff6));
+  EXPECT_FALSE(doc.ApplyDiff(&diff7));
+  EXPECT_FALSE(doc.ApplyDiff(&diff8));
+  EXPECT_EQ(1, doc.version());
+
+  // Whole characters
+  Diff diff9(1, 2);
+  Diff diff10(5, 4);
+  Diff diff11(1, "\xC3\xA1");
+  EXPECT_TRUE(doc.ApplyDiff(&diff9));
+  EXPECT_TRUE(doc.ApplyDiff(&diff10));
+  EXPECT_TRUE(doc.ApplyDiff(&diff11));
+  string data;
+  doc.GetData(&data);
+  EXPECT_EQ("p\xC3\xA1paya", data);
+}
+
+TEST(DocumentTest, Units) {
+  Document doc(1);
+  Diff diff(0, "p\xC3\xA1paya\xF0\x9F\x8D\x88!");
+  ASSERT_TRUE(doc.ApplyDiff(&diff));
+  EXPECT_EQ(12, doc.length(UNIT_BYTES));
+  EXPECT_EQ(8, doc.length(UNIT_CODE_POINTS));
+  EXPECT_EQ(9, doc.length(UNIT_UTF16));
+
+  Index index;
+  EXPECT_TRUE(doc.ToByteIndex(UNIT_UTF16, 8, &index));
+  EXPECT_EQ(11, index);
+  EXPECT_FALSE(doc.ToByteIndex(UNIT_UTF16, 7, &index));
+  EXPECT_TRUE(doc.FromByteIndex(UNIT_UTF16, 11, &index));
+  EXPECT_EQ(8, index);
+  EXPECT_TRUE(doc.FromByteIndex(UNIT_CODE_POINTS, 11, &index));
+  EXPECT_EQ(7, index);
+  EXPECT_FALSE(doc.FromByteIndex(UNIT_UTF16, 2, &index));
+  EXPECT_FALSE(doc.FromByteIndex(UNIT_UTF16, 13, &index));
+
+  // Diffs in UTF-16 code units
+  Diff byte_diff(0, 0);
+  EXPECT_TRUE(doc.ToByteDiff(UNIT_UTF16, Diff(6, 2), &byte_diff));
+  EXPECT_EQ(Diff::DELETE, byte_diff.type());
+  EXPECT_EQ(7, byte_diff.index());
+  EXPECT_EQ(4, byte_diff.length());
+  EXPECT_FALSE(doc.ToByteDiff(UNIT_UTF16, Diff(6, 1), &byte_diff));
+  EXPECT_TRUE(doc.ToByteDiff(UNIT_UTF16, Diff(1, 100), &byte_diff));
+  EXPECT_EQ(11, byte_diff.length());
+  EXPECT_TRUE(doc.ToByteDiff(UNIT_UTF16, Diff(2, "\xC3\xA1"), &byte_diff));
+  EXPECT_EQ(Diff::INSERT, byte_diff.type());
+  EXPECT_EQ(3, byte_diff.index());
+  EXPECT_TRUE(doc.ApplyDiff(&byte_diff));
+
+  string data;
+  doc.GetData(&data);
+  EXPECT_EQ("p\xC3\xA1\xC3\xA1paya\xF0\x9F\x8D\x88!", data);
 }
 
 TEST(DocumentTest, MultipleInserts) {
@@ -295,4 +396,289 @@ TEST(DocumentTest, DiffCacheLargerThanMaxSize) {
   EXPECT_EQ(0U, diffs.size());
 }
 
+TEST(DocumentTest, Observers) {
+  Document doc(1);
+  RecordingObserver first;
+  RecordingObserver second;
+  doc.AddObserver(&first);
+  doc.AddObserver(&second);
+
+  Diff diff1(0, "papaya");
+  EXPECT_TRUE(doc.ApplyDiff(&diff1));
+
+  // Failed diffs are not observed
+  Diff diff2(100, "papaya");
+  EXPECT_FALSE(doc.ApplyDiff(&diff2));
+
+  EXPECT_TRUE(doc.RemoveObserver(&first));
+  EXPECT_FALSE(doc.RemoveObserver(&first));
+  Diff diff3(0, 3);
+  EXPECT_TRUE(doc.ApplyDiff(&diff3));
+
+  ASSERT_EQ(1U, first.versions_.size());
+  EXPECT_EQ(1, first.versions_[0]);
+  ASSERT_EQ(2U, second.versions_.size());
+  EXPECT_EQ(1, second.versions_[0]);
+  EXPECT_EQ(2, second.versions_[1]);
+
+  // Observers see the text before each diff too
+  ASSERT_EQ(2U, second.sizes_before_.size());
+  EXPECT_EQ(0, second.sizes_before_[0]);
+  EXPECT_EQ(6, second.sizes_before_[1]);
+}
+
+TEST(DocumentTest, GetDataIntoBuffer) {
+  Document doc(1);
+  EXPECT_EQ(0, doc.size());
+
+  Diff diff1(0, "papaya");
+  EXPECT_TRUE(doc.ApplyDiff(&diff1));
+  Diff diff2(0, 2);
+  EXPECT_TRUE(doc.ApplyDiff(&diff2));
+  ASSERT_EQ(4, doc.size());
+
+  char data[5] = "xxxx";
+  doc.GetData(data);
+  EXPECT_EQ("paya", string(data, 4));
+}
+
+TEST(DocumentTest, Restore) {
+  Document doc(1);
+  size_t max_cache = Document::kMaxCacheSize;
+  Version num_diffs = max_cache + 2;
+  for (Version i = 0; i < num_diffs; ++i) {
+    Diff diff(0, "papaya");
+    EXPECT_TRUE(doc.ApplyDiff(&diff));
+  }
+  list<Diff> cached;
+  doc.GetCachedDiffs(&cached);
+  ASSERT_EQ(max_cache, cached.size());
+  EXPECT_EQ(num_diffs, cached.back().version());
+
+  string data;
+  doc.GetData(&data);
+  Document restored(1, doc.version(), data.data(), data.size(), cached);
+  EXPECT_EQ(1, restored.doc_id());
+  EXPECT_EQ(num_diffs, restored.version());
+  string restored_data;
+  restored.GetData(&restored_data);
+  EXPECT_EQ(data, restored_data);
+
+  // Same updates available
+  list<Diff> updates;
+  EXPECT_FALSE(restored.GetUpdates(num_diffs - max_cache, &updates));
+  EXPECT_TRUE(restored.GetUpdates(num_diffs - max_cache + 1, &updates));
+  EXPECT_EQ(max_cache, updates.size());
+
+  // Keeps going from the restored version
+  Diff diff(0, 6);
+  EXPECT_TRUE(restored.ApplyDiff(&diff));
+  EXPECT_EQ(num_diffs + 1, diff.version());
+  updates.clear();
+  EXPECT_TRUE(restored.GetUpdates(num_diffs, &updates));
+  EXPECT_EQ(2U, updates.size());
+
+  // Without diffs nothing is cached
+  Document no_diffs(2, 5, "kamiah", 6, list<Diff>());
+  EXPECT_EQ(5, no_diffs.version());
+  EXPECT_EQ(6, no_diffs.size());
+  updates.clear();
+  EXPECT_FALSE(no_diffs.GetUpdates(5, &updates));
+}
+
+TEST(DocumentTest, Positions) {
+  Document doc(1);
+  Position position;
+  EXPECT_EQ(1, doc.num_lines());
+  EXPECT_TRUE(doc.GetPosition(0, &position));
+  EXPECT_EQ(Position(0, 0), position);
+
+  Diff diff(0, "papaya\nkamiah\n\nide");
+  ASSERT_TRUE(doc.ApplyDiff(&diff));
+  EXPECT_EQ(4, doc.num_lines());
+  EXPECT_TRUE(doc.GetPosition(3, &position));
+  EXPECT_EQ(Position(0, 3), position);
+  EXPECT_TRUE(doc.GetPosition(6, &position));
+  EXPECT_EQ(Position(0, 6), position);
+  EXPECT_TRUE(doc.GetPosition(7, &position));
+  EXPECT_EQ(Position(1, 0), position);
+  EXPECT_TRUE(doc.GetPosition(14, &position));
+  EXPECT_EQ(Position(2, 0), position);
+  EXPECT_TRUE(doc.GetPosition(18, &position));
+  EXPECT_EQ(Position(3, 3), position);
+  EXPECT_FALSE(doc.GetPosition(-1, &position));
+  EXPECT_FALSE(doc.GetPosition(19, &position));
+
+  // Every index round-trips
+  for (Index i = 0; i <= doc.size(); ++i) {
+    Index index;
+    ASSERT_TRUE(doc.GetPosition(i, &position));
+    EXPECT_TRUE(doc.GetIndex(position, &index));
+    EXPECT_EQ(i, index);
+  }
+
+  // Past the end of a line or of the Document
+  Index index;
+  EXPECT_FALSE(doc.GetIndex(Position(0, 7), &index));
+  EXPECT_FALSE(doc.GetIndex(Position(2, 1), &index));
+  EXPECT_FALSE(doc.GetIndex(Position(3, 4), &index));
+  EXPECT_FALSE(doc.GetIndex(Position(4, 0), &index));
+  EXPECT_FALSE(doc.GetIndex(Position(-1, 0), &index));
+
+  // Kept up to date by diffs
+  Diff erase(6, 7);
+  ASSERT_TRUE(doc.ApplyDiff(&erase));
+  EXPECT_EQ(3, doc.num_lines());
+  EXPECT_TRUE(doc.GetIndex(Position(2, 2), &index));
+  EXPECT_EQ(10, index);
+}
+
+TEST(DocumentTest, GetLines) {
+  Document doc(1);
+  Diff diff(0, "papaya\nkamiah\n\nide");
+  ASSERT_TRUE(doc.ApplyDiff(&diff));
+
+  string lines;
+  EXPECT_TRUE(doc.GetLines(0, 1, &lines));
+  EXPECT_EQ("papaya\n", lines);
+  EXPECT_TRUE(doc.GetLines(1, 3, &lines));
+  EXPECT_EQ("kamiah\n\n", lines);
+  EXPECT_TRUE(doc.GetLines(2, 10, &lines));
+  EXPECT_EQ("\nide", lines);
+  EXPECT_TRUE(doc.GetLines(1, 1, &lines));
+  EXPECT_EQ("", lines);
+  EXPECT_TRUE(doc.GetLines(4, 10, &lines));
+  EXPECT_EQ("", lines);
+  EXPECT_FALSE(doc.GetLines(2, 1, &lines));
+  EXPECT_FALSE(doc.GetLines(-1, 1, &lines));
+}
+
+TEST(DocumentTest, Markers) {
+  Document doc(1);
+  Diff diff(0, "papaya kamiah");
+  ASSERT_TRUE(doc.ApplyDiff(&diff));
+  EXPECT_EQ(-1, doc.AddMarker(14, BIAS_LEFT));
+  MarkerID start = doc.AddMarker(7, BIAS_LEFT);
+  MarkerID end = doc.AddMarker(13, BIAS_RIGHT);
+  EXPECT_EQ(2U, doc.num_markers());
+
+  // Markers follow the text around them
+  Diff insert(7, "ide ");
+  ASSERT_TRUE(doc.ApplyDiff(&insert));
+  Diff append(17, "!");
+  ASSERT_TRUE(doc.ApplyDiff(&append));
+  Diff erase(0, 3);
+  ASSERT_TRUE(doc.ApplyDiff(&erase));
+  Index index;
+  EXPECT_TRUE(doc.GetMarker(start, &index));
+  EXPECT_EQ(4, index);
+  EXPECT_TRUE(doc.GetMarker(end, &index));
+  EXPECT_EQ(15, index);
+
+  vector<Marker> markers;
+  doc.GetMarkers(5, 20, &markers);
+  ASSERT_EQ(1U, markers.size());
+  EXPECT_EQ(end, markers[0].id);
+  EXPECT_TRUE(doc.RemoveMarker(end));
+  EXPECT_FALSE(doc.GetMarker(end, &index));
+  EXPECT_EQ(1U, doc.num_markers());
+}
+
+TEST(DocumentTest, MapPosition) {
+  Document doc(1);
+  Diff diff(0, "papaya kamiah");
+  ASSERT_TRUE(doc.ApplyDiff(&diff));
+  Diff insert(7, "ide ");
+  ASSERT_TRUE(doc.ApplyDiff(&insert));
+  Diff erase(0, 3);
+  ASSERT_TRUE(doc.ApplyDiff(&erase));
+
+  Index index;
+  EXPECT_TRUE(doc.MapPosition(0, 0, 1, BIAS_RIGHT, &index));
+  EXPECT_EQ(13, index);
+  EXPECT_TRUE(doc.MapPosition(7, 1, 3, BIAS_LEFT, &index));
+  EXPECT_EQ(4, index);
+  EXPECT_TRUE(doc.MapPosition(7, 1, 3, BIAS_RIGHT, &index));
+  EXPECT_EQ(8, index);
+  EXPECT_TRUE(doc.MapPosition(2, 1, 3, BIAS_RIGHT, &index));
+  EXPECT_EQ(0, index);
+  EXPECT_TRUE(doc.MapPosition(5, 3, 3, BIAS_RIGHT, &index));
+  EXPECT_EQ(5, index);
+  EXPECT_FALSE(doc.MapPosition(5, 2, 1, BIAS_RIGHT, &index));
+  EXPECT_FALSE(doc.MapPosition(5, 3, 4, BIAS_RIGHT, &index));
+  EXPECT_FALSE(doc.MapPosition(-1, 1, 3, BIAS_RIGHT, &index));
+
+  vector<Index> indices;
+  indices.push_back(0);
+  indices.push_back(7);
+  indices.push_back(13);
+  EXPECT_TRUE(doc.MapPositions(1, 2, BIAS_RIGHT, &indices));
+  EXPECT_EQ(0, indices[0]);
+  EXPECT_EQ(11, indices[1]);
+  EXPECT_EQ(17, indices[2]);
+
+  // Only the cached diffs can be used
+  for (size_t i = 0; i < Document::kMaxCacheSize; ++i) {
+    Diff append(doc.size(), "!");
+    ASSERT_TRUE(doc.ApplyDiff(&append));
+  }
+  EXPECT_FALSE(doc.MapPosition(7, 1, 3, BIAS_LEFT, &index));
+  EXPECT_TRUE(doc.MapPosition(5, 3, doc.version(), BIAS_LEFT, &index));
+  EXPECT_EQ(5, index);
+}
+
+TEST(DocumentTest, Find) {
+  Document doc(1);
+  Diff diff(0, "int main() {\n  return papaya;\n}\nint papaya() {}\n");
+  ASSERT_TRUE(doc.ApplyDiff(&diff));
+
+  for (int indexed = 0; indexed < 2; ++indexed) {
+    vector<Index> found;
+    doc.Find("papaya", &found);
+    ASSERT_EQ(2U, found.size());
+    EXPECT_EQ(22, found[0]);
+    EXPECT_EQ(36, found[1]);
+
+    vector<TextMatch> matches;
+    EXPECT_TRUE(doc.FindRegex("^int [a-z]+\\(", &matches));
+    ASSERT_EQ(2U, matches.size());
+    EXPECT_EQ(0, matches[0].index);
+    EXPECT_EQ(9, matches[0].length);
+    EXPECT_EQ(32, matches[1].index);
+    matches.clear();
+    EXPECT_TRUE(doc.FindRegex("pa(pa)?ya;$", &matches));
+    ASSERT_EQ(1U, matches.size());
+    EXPECT_EQ(22, matches[0].index);
+    EXPECT_FALSE(doc.FindRegex("papaya(", &matches));
+
+    doc.EnableSearchIndex();
+    EXPECT_TRUE(doc.has_search_index());
+  }
+
+  // The index is kept up to date
+  Diff erase(24, 2);
+  ASSERT_TRUE(doc.ApplyDiff(&erase));
+  vector<Index> found;
+  doc.Find("papaya", &found);
+  ASSERT_EQ(1U, found.size());
+  EXPECT_EQ(34, found[0]);
+}
+
+TEST(DocumentTest, FindRegexEmptyMatches) {
+  Document doc(1);
+  // "\xc3\xb1" is a two byte character
+  Diff diff(0, "a\xc3\xb1" "b\nc");
+  ASSERT_TRUE(doc.ApplyDiff(&diff));
+
+  // Empty matches are only found at character boundaries
+  vector<TextMatch> matches;
+  EXPECT_TRUE(doc.FindRegex("x*", &matches));
+  Index expected[] = { 0, 1, 3, 4, 5, 6 };
+  ASSERT_EQ(6U, matches.size());
+  for (size_t i = 0; i < matches.size(); ++i) {
+    EXPECT_EQ(expected[i], matches[i].index);
+    EXPECT_EQ(0, matches[i].length);
+  }
+}
+
 }  // namespace kamiah
@@ -0,0 +1,119 @@
+/**
+ * @file epoch.cc
+ * @brief Implementation of an EpochManager.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "epoch.h"
+
+namespace kamiah {
+
+EpochManager::EpochManager() : epoch_(0) {
+  for (int i = 0; i < kMaxReaders; ++i) {
+    readers_[i].epoch = kInactive;
+    readers_[i].in_use = false;
+  }
+}
+
+EpochManager::~EpochManager() {
+  for (size_t i = 0; i < retired_.size(); ++i) {
+    retired_[i].deleter(retired_[i].object);
+  }
+}
+
+int EpochManager::RegisterReader() {
+  MutexLock l(&mu_);
+  for (int i = 0; i < kMaxReaders; ++i) {
+    if (!readers_[i].in_use) {
+      readers_[i].in_use = true;
+      readers_[i].epoch = kInactive;
+      return i;
+    }
+  }
+  return -1;
+}
+
+void EpochManager::UnregisterReader(int reader) {
+  MutexLock l(&mu_);
+  readers_[reader].epoch = kInactive;
+  readers_[reader].in_use = false;
+}
+
+void EpochManager::Enter(int reader) {
+  // The barrier orders the publication of our epoch before any load of a
+  // shared object: either a writer scanning the slots sees us, or we see
+  // what the writer unlinked before retiring.
+  readers_[reader].epoch = epoch_;
+  __sync_synchronize();
+}
+
+void EpochManager::Exit(int reader) {
+  // All our loads must be done before we stop protecting them
+  __sync_synchronize();
+  readers_[reader].epoch = kInactive;
+}
+
+void EpochManager::Retire(void (*deleter)(void*), void *object) {
+  Retired retired;
+  retired.deleter = deleter;
+  retired.object = object;
+
+  bool reclaim = false;
+  {
+    MutexLock l(&mu_);
+
+    // Tag with the current epoch and advance it so that readers entering from
+    // now on are known to have entered after the object was unlinked.
+    retired.epoch = __sync_fetch_and_add(&epoch_, 1);
+    retired_.push_back(retired);
+    reclaim = retired_.size() >= kReclaimThreshold;
+  }
+
+  if (reclaim) {
+    Reclaim();
+  }
+}
+
+size_t EpochManager::Reclaim() {
+  vector<Retired> to_delete;
+  {
+    MutexLock l(&mu_);
+    int64_t min_epoch = MinReaderEpoch();
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired_.size(); ++i) {
+      if (retired_[i].epoch < min_epoch) {
+        to_delete.push_back(retired_[i]);
+      } else {
+        retired_[kept++] = retired_[i];
+      }
+    }
+    retired_.resize(kept);
+  }
+
+  // Run the deleters outside the lock, they can be arbitrarily expensive
+  for (size_t i = 0; i < to_delete.size(); ++i) {
+    to_delete[i].deleter(to_delete[i].object);
+  }
+  return to_delete.size();
+}
+
+size_t EpochManager::num_retired() const {
+  MutexLock l(&mu_);
+  return retired_.size();
+}
+
+int64_t EpochManager::MinReaderEpoch() const {
+  __sync_synchronize();
+  int64_t min_epoch = kInactive;
+  for (int i = 0; i < kMaxReaders; ++i) {
+    int64_t epoch = readers_[i].epoch;
+    if (epoch < min_epoch) {
+      min_epoch = epoch;
+    }
+  }
+  return min_epoch;
+}
+
+}  // namespace kamiah
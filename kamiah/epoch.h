@@ -0,0 +1,242 @@
+/**
+ * @file epoch.h
+ * @brief Definition of an EpochManager for epoch-based memory reclamation.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_EPOCH_H_
+#define KAMIAH_EPOCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "mutex.h"
+
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief An EpochManager lets readers access shared objects without taking
+ *     locks while writers replace them, deferring the deletion of replaced
+ *     objects until no reader can still be looking at them.
+ *
+ * Readers register once (usually once per thread) to get a reader slot, and
+ * then bracket every access with Enter() and Exit() (or an EpochGuard). Both
+ * are a store and a memory barrier on the reader's own cache line.
+ *
+ * Writers unlink an object so that new readers can no longer reach it and
+ * then Retire() it. A retired object is tagged with the current epoch and the
+ * epoch is advanced. Reclaim() deletes every retired object whose epoch is
+ * older than the epoch of all the readers currently inside a critical
+ * section, since those readers entered after the object was unlinked.
+ *
+ * Critical sections must not be nested and should be short: a reader that
+ * stays inside one holds back the reclamation of everything retired since.
+ *
+ * This class is thread-safe.
+ */
+class EpochManager {
+ public:
+  // Maximum number of readers that can be registered at once.
+  static const int kMaxReaders = 128;
+
+  // Number of retired objects after which Retire() attempts a Reclaim().
+  static const size_t kReclaimThreshold = 64;
+
+  EpochManager();
+
+  /**
+   * @brief Destroys the EpochManager, deleting all the retired objects. No
+   *     reader may be inside a critical section.
+   */
+  ~EpochManager();
+
+  /**
+   * @brief Registers a reader.
+   *
+   * @return The slot of the reader, or -1 if kMaxReaders are registered.
+   */
+  int RegisterReader();
+
+  /**
+   * @brief Unregisters a reader. The reader must not be inside a critical
+   *     section.
+   *
+   * @param reader The slot of the reader.
+   */
+  void UnregisterReader(int reader);
+
+  /**
+   * @brief Enters a critical section. Objects reachable from here on will not
+   *     be deleted until Exit() is called.
+   *
+   * @param reader The slot of the reader.
+   */
+  void Enter(int reader);
+
+  /**
+   * @brief Exits a critical section.
+   *
+   * @param reader The slot of the reader.
+   */
+  void Exit(int reader);
+
+  /**
+   * @brief Schedules an object that is no longer reachable by new readers for
+   *     deletion.
+   *
+   * @param deleter Function that deletes the object.
+   * @param object The object to delete.
+   */
+  void Retire(void (*deleter)(void*), void *object);
+
+  /**
+   * @brief Schedules an object allocated with new for deletion.
+   *
+   * @param object The object to delete.
+   */
+  template <typename T>
+  void RetireObject(T *object) {
+    Retire(&DeleteObject<T>, object);
+  }
+
+  /**
+   * @brief Deletes the retired objects that no reader can be accessing.
+   *
+   * @return The number of objects deleted.
+   */
+  size_t Reclaim();
+
+  /**
+   * @brief Gets the number of retired objects waiting to be deleted.
+   *
+   * @return The number of retired objects waiting to be deleted.
+   */
+  size_t num_retired() const;
+
+ private:
+  // Epoch of a reader that is not inside a critical section.
+  static const int64_t kInactive = 0x7fffffffffffffffLL;
+
+  // Each slot has a cache line of its own so readers do not contend.
+  struct ReaderSlot {
+    volatile int64_t epoch;
+    bool in_use;
+    char padding[64 - sizeof(int64_t) - sizeof(bool)];
+  };
+
+  struct Retired {
+    int64_t epoch;
+    void (*deleter)(void*);
+    void *object;
+  };
+
+  template <typename T>
+  static void DeleteObject(void *object) {
+    delete static_cast<T*>(object);
+  }
+
+  // Gets the smallest epoch of all the readers inside a critical section.
+  int64_t MinReaderEpoch() const;
+
+  volatile int64_t epoch_;
+  ReaderSlot readers_[kMaxReaders];
+
+  mutable Mutex mu_;
+  vector<Retired> retired_;
+
+  // Not copyable.
+  EpochManager(const EpochManager&);
+  void operator=(const EpochManager&);
+};
+
+/**
+ * @brief An EpochGuard is inside a critical section for as long as it is in
+ *     scope.
+ */
+class EpochGuard {
+ public:
+  EpochGuard(EpochManager *manager, int reader)
+      : manager_(manager), reader_(reader) {
+    manager_->Enter(reader_);
+  }
+
+  ~EpochGuard() {
+    manager_->Exit(reader_);
+  }
+
+ private:
+  EpochManager *manager_;
+  int reader_;
+
+  // Not copyable.
+  EpochGuard(const EpochGuard&);
+  void operator=(const EpochGuard&);
+};
+
+/**
+ * @brief An EpochPointer is a pointer to an object that readers load inside
+ *     a critical section and that writers replace, retiring the old object.
+ *
+ * Writers must be serialized by the caller.
+ */
+template <typename T>
+class EpochPointer {
+ public:
+  /**
+   * @brief Constructs an EpochPointer.
+   *
+   * @param manager The manager used to retire replaced objects. Not owned.
+   * @param initial The initial object, may be NULL. Owned.
+   */
+  EpochPointer(EpochManager *manager, T *initial)
+      : manager_(manager), object_(initial) {
+  }
+
+  ~EpochPointer() {
+    delete object_;
+  }
+
+  /**
+   * @brief Gets the current object. Must be called inside a critical section
+   *     and the object must not be used after exiting it.
+   *
+   * @return The current object.
+   */
+  const T* Load() const {
+    const T *object = object_;
+    __sync_synchronize();
+    return object;
+  }
+
+  /**
+   * @brief Replaces the current object and retires the old one.
+   *
+   * @param object The new object. Owned.
+   */
+  void Store(T *object) {
+    T *old = object_;
+    __sync_synchronize();
+    object_ = object;
+    __sync_synchronize();
+    if (old != NULL) {
+      manager_->RetireObject(old);
+    }
+  }
+
+ private:
+  EpochManager *manager_;
+  T * volatile object_;
+
+  // Not copyable.
+  EpochPointer(const EpochPointer&);
+  void operator=(const EpochPointer&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_EPOCH_H_
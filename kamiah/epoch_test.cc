@@ -0,0 +1,189 @@
+/**
+ * @file epoch_test.cc
+ * @brief Unit tests for an EpochManager.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "epoch.h"
+
+#include <pthread.h>
+
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+// Value of Tracked::magic_ until the object is deleted.
+const int kAlive = 0x5a5a5a5a;
+
+// Object that records its deletion.
+class Tracked {
+ public:
+
+  explicit Tracked(int *deleted) : magic_(kAlive), deleted_(deleted) {}
+
+  ~Tracked() {
+    magic_ = 0;
+    if (deleted_ != NULL) {
+      __sync_fetch_and_add(deleted_, 1);
+    }
+  }
+
+  volatile int magic_;
+  int *deleted_;
+};
+
+TEST(EpochManagerTest, RegisterReaders) {
+  EpochManager manager;
+  vector<int> readers;
+  for (int i = 0; i < EpochManager::kMaxReaders; ++i) {
+    int reader = manager.RegisterReader();
+    ASSERT_GE(reader, 0);
+    readers.push_back(reader);
+  }
+  EXPECT_EQ(-1, manager.RegisterReader());
+
+  // Slots are reused
+  manager.UnregisterReader(readers[3]);
+  EXPECT_EQ(readers[3], manager.RegisterReader());
+}
+
+TEST(EpochManagerTest, ReclaimWithoutReaders) {
+  int deleted = 0;
+  EpochManager manager;
+  manager.RetireObject(new Tracked(&deleted));
+  manager.RetireObject(new Tracked(&deleted));
+  EXPECT_EQ(2U, manager.num_retired());
+  EXPECT_EQ(0, deleted);
+
+  EXPECT_EQ(2U, manager.Reclaim());
+  EXPECT_EQ(2, deleted);
+  EXPECT_EQ(0U, manager.num_retired());
+}
+
+TEST(EpochManagerTest, ActiveReaderDefersReclaim) {
+  int deleted = 0;
+  EpochManager manager;
+  int reader = manager.RegisterReader();
+
+  Tracked *before = new Tracked(&deleted);
+  manager.Enter(reader);
+  manager.RetireObject(before);
+
+  // The reader may be looking at the object
+  EXPECT_EQ(0U, manager.Reclaim());
+  EXPECT_EQ(kAlive, before->magic_);
+
+  manager.Exit(reader);
+  EXPECT_EQ(1U, manager.Reclaim());
+  EXPECT_EQ(1, deleted);
+}
+
+TEST(EpochManagerTest, LaterReaderDoesNotDeferReclaim) {
+  int deleted = 0;
+  EpochManager manager;
+  int reader = manager.RegisterReader();
+
+  manager.RetireObject(new Tracked(&deleted));
+
+  // This reader entered after the object was retired so it cannot see it
+  EpochGuard guard(&manager, reader);
+  EXPECT_EQ(1U, manager.Reclaim());
+  EXPECT_EQ(1, deleted);
+}
+
+TEST(EpochManagerTest, DestructorDeletesRetired) {
+  int deleted = 0;
+  {
+    EpochManager manager;
+    manager.RetireObject(new Tracked(&deleted));
+  }
+  EXPECT_EQ(1, deleted);
+}
+
+TEST(EpochManagerTest, RetireReclaimsPastThreshold) {
+  int deleted = 0;
+  EpochManager manager;
+  for (size_t i = 0; i < EpochManager::kReclaimThreshold; ++i) {
+    manager.RetireObject(new Tracked(&deleted));
+  }
+  EXPECT_EQ((int) EpochManager::kReclaimThreshold, deleted);
+}
+
+TEST(EpochPointerTest, StoreRetiresOld) {
+  int deleted = 0;
+  EpochManager manager;
+  int reader = manager.RegisterReader();
+  {
+    EpochPointer<Tracked> pointer(&manager, new Tracked(&deleted));
+
+    manager.Enter(reader);
+    const Tracked *loaded = pointer.Load();
+    pointer.Store(new Tracked(&deleted));
+    manager.Reclaim();
+    EXPECT_EQ(kAlive, loaded->magic_);
+    EXPECT_EQ(0, deleted);
+    manager.Exit(reader);
+
+    manager.Reclaim();
+    EXPECT_EQ(1, deleted);
+  }
+
+  // The current object is owned by the pointer
+  EXPECT_EQ(2, deleted);
+}
+
+struct StressState {
+  EpochManager manager;
+  EpochPointer<Tracked> *pointer;
+  volatile bool done;
+  volatile int bad_reads;
+};
+
+void* StressReader(void *arg) {
+  StressState *state = static_cast<StressState*>(arg);
+  int reader = state->manager.RegisterReader();
+  while (!state->done) {
+    EpochGuard guard(&state->manager, reader);
+    const Tracked *tracked = state->pointer->Load();
+    for (int i = 0; i < 10; ++i) {
+      if (tracked->magic_ != kAlive) {
+        __sync_fetch_and_add(&state->bad_reads, 1);
+      }
+    }
+  }
+  state->manager.UnregisterReader(reader);
+  return NULL;
+}
+
+TEST(EpochManagerTest, ConcurrentReadersNeverSeeDeletedObjects) {
+  const int kNumReaders = 4;
+  int deleted = 0;
+  StressState state;
+  state.pointer = new EpochPointer<Tracked>(&state.manager,
+                                            new Tracked(&deleted));
+  state.done = false;
+  state.bad_reads = 0;
+
+  pthread_t readers[kNumReaders];
+  for (int i = 0; i < kNumReaders; ++i) {
+    pthread_create(&readers[i], NULL, &StressReader, &state);
+  }
+
+  const int kNumWrites = 20000;
+  for (int i = 0; i < kNumWrites; ++i) {
+    state.pointer->Store(new Tracked(&deleted));
+  }
+
+  state.done = true;
+  for (int i = 0; i < kNumReaders; ++i) {
+    pthread_join(readers[i], NULL);
+  }
+  state.manager.Reclaim();
+
+  EXPECT_EQ(0, state.bad_reads);
+  EXPECT_EQ(kNumWrites, deleted);
+  delete state.pointer;
+}
+
+}  // namespace kamiah
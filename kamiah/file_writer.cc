@@ -0,0 +1,481 @@
+/**
+ * @file file_writer.cc
+ * @brief Implementation of the FileWriter backends.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "file_writer.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef KAMIAH_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#include "mutex.h"
+#include "scheduler.h"
+#include "thread_pool.h"
+
+namespace kamiah {
+
+namespace {
+
+// Signals a waiter when a write completes.
+class WaitCallback : public WriteCallback {
+ public:
+  WaitCallback() : cv_(&mu_), done_(false), ok_(false) {}
+
+  virtual void OnWriteDone(bool ok) {
+    MutexLock l(&mu_);
+    ok_ = ok;
+    done_ = true;
+    cv_.Signal();
+  }
+
+  bool Wait() {
+    MutexLock l(&mu_);
+    while (!done_) {
+      cv_.Wait();
+    }
+    return ok_;
+  }
+
+ private:
+  Mutex mu_;
+  CondVar cv_;
+  bool done_;
+  bool ok_;
+};
+
+// Writes all of data at an offset, retrying partial writes.
+bool PwriteAll(int fd, uint64_t offset, const char *data, size_t size) {
+  size_t written = 0;
+  while (written < size) {
+    ssize_t bytes = pwrite(fd, data + written, size - written,
+                           offset + written);
+    if (bytes < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += bytes;
+  }
+  return true;
+}
+
+class WriteTask : public Task {
+ public:
+  WriteTask(int fd, uint64_t offset, const char *data, size_t size,
+            bool sync, WriteCallback *callback)
+      : fd_(fd), offset_(offset), data_(data), size_(size), sync_(sync),
+        callback_(callback) {}
+
+  virtual void Run() {
+    bool ok = PwriteAll(fd_, offset_, data_, size_) &&
+        (!sync_ || (fdatasync(fd_) == 0));
+    callback_->OnWriteDone(ok);
+  }
+
+ private:
+  int fd_;
+  uint64_t offset_;
+  const char *data_;
+  size_t size_;
+  bool sync_;
+  WriteCallback *callback_;
+};
+
+class ThreadPoolFileWriter : public FileWriter {
+ public:
+  ThreadPoolFileWriter() : pool_(kNumThreads) {}
+
+  virtual ~ThreadPoolFileWriter() {
+    pool_.Wait();
+  }
+
+  virtual void Write(int fd, uint64_t offset, const char *data, size_t size,
+                     bool sync, WriteCallback *callback) {
+    pool_.Schedule(new WriteTask(fd, offset, data, size, sync, callback));
+  }
+
+  virtual Backend backend() const {
+    return THREAD_POOL;
+  }
+
+ private:
+  ThreadPool pool_;
+};
+
+#ifdef KAMIAH_HAVE_IO_URING
+
+// Number of entries of the submission queue. The completion queue is twice
+// as large.
+const unsigned kRingEntries = 256;
+
+// Tags the user data of the sync that follows a write.
+const uint64_t kSyncTag = 1;
+
+int IoUringSetup(unsigned entries, struct io_uring_params *params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int IoUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete,
+                 unsigned flags) {
+  int ret;
+  do {
+    ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                  flags, NULL, 0);
+  } while ((ret < 0) && (errno == EINTR));
+  return ret;
+}
+
+/**
+ * Submits writes through an io_uring from the calling thread and reaps their
+ * completions on a thread of its own. A write with a sync is submitted as a
+ * writev linked to an fsync, so the pair costs a single system call.
+ */
+class IoUringFileWriter : public FileWriter {
+ public:
+  static IoUringFileWriter* New() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = IoUringSetup(kRingEntries, &params);
+    if (ring_fd < 0) {
+      return NULL;
+    }
+
+    IoUringFileWriter *writer = new IoUringFileWriter(ring_fd);
+    if (!writer->Map(params) ||
+        (pthread_create(&writer->reaper_, NULL, &ReaperThread,
+                        writer) != 0)) {
+      delete writer;
+      return NULL;
+    }
+    writer->reaper_started_ = true;
+    return writer;
+  }
+
+  virtual ~IoUringFileWriter() {
+    if (reaper_started_) {
+      // Wait for the writes in flight and then for the stop marker
+      MutexLock l(&mu_);
+      while (in_flight_ > 0) {
+        space_cv_.Wait();
+      }
+      struct io_uring_sqe *sqe = NextSqe();
+      sqe->opcode = IORING_OP_NOP;
+      sqe->user_data = 0;
+      if (Submit(1) == 0) {
+        // The ring is unusable, so the reaper cannot wait on it either
+        ring_failed_ = true;
+      }
+      mu_.Unlock();
+      pthread_join(reaper_, NULL);
+      mu_.Lock();
+    }
+    if (sqes_ != MAP_FAILED) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != MAP_FAILED) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if ((sq_ring_ != MAP_FAILED) && (sq_ring_ != cq_ring_)) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    close(ring_fd_);
+  }
+
+  virtual void Write(int fd, uint64_t offset, const char *data, size_t size,
+                     bool sync, WriteCallback *callback) {
+    Request *request = new Request;
+    request->callback = callback;
+    request->iov.iov_base = const_cast<char*>(data);
+    request->iov.iov_len = size;
+    unsigned count = sync ? 2 : 1;
+    request->pending = count;
+    request->ok = true;
+
+    unsigned unsubmitted;
+    {
+      // Do not hand the kernel more than the completion queue can hold
+      MutexLock l(&mu_);
+      while (in_flight_ + count > kRingEntries) {
+        space_cv_.Wait();
+      }
+      in_flight_ += count;
+
+      struct io_uring_sqe *sqe = NextSqe();
+      sqe->opcode = IORING_OP_WRITEV;
+      sqe->fd = fd;
+      sqe->off = offset;
+      sqe->addr = reinterpret_cast<uintptr_t>(&request->iov);
+      sqe->len = 1;
+      sqe->user_data = reinterpret_cast<uintptr_t>(request);
+      if (sync) {
+        sqe->flags = IOSQE_IO_LINK;
+        sqe = NextSqe();
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = fd;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = reinterpret_cast<uintptr_t>(request) | kSyncTag;
+      }
+      unsubmitted = count - Submit(count);
+      if (unsubmitted > 0) {
+        in_flight_ -= unsubmitted;
+        space_cv_.SignalAll();
+      }
+    }
+
+    // The entries the kernel refused never complete, so fail the write in
+    // their place. A write whose sync was refused may still be in flight
+    if (unsubmitted > 0) {
+      request->ok = false;
+      Complete(request, unsubmitted);
+    }
+  }
+
+  virtual Backend backend() const {
+    return IO_URING;
+  }
+
+ private:
+  // A write in flight and its sync.
+  struct Request {
+    WriteCallback *callback;
+    struct iovec iov;
+
+    // Number of completions still to come. Updated atomically.
+    unsigned pending;
+    bool ok;
+  };
+
+  explicit IoUringFileWriter(int ring_fd)
+      : ring_fd_(ring_fd), sq_ring_(MAP_FAILED), cq_ring_(MAP_FAILED),
+        sqes_(MAP_FAILED), sq_ring_size_(0), cq_ring_size_(0), sqes_size_(0),
+        reaper_started_(false), space_cv_(&mu_), in_flight_(0),
+        ring_failed_(false) {}
+
+  // Maps the rings shared with the kernel.
+  bool Map(const struct io_uring_params& params) {
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(__u32);
+    cq_ring_size_ = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap && (cq_ring_size_ > sq_ring_size_)) {
+      sq_ring_size_ = cq_ring_size_;
+    }
+
+    sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+      return false;
+    }
+    if (single_mmap) {
+      cq_ring_ = sq_ring_;
+      cq_ring_size_ = sq_ring_size_;
+    } else {
+      cq_ring_ = mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_,
+                      IORING_OFF_CQ_RING);
+      if (cq_ring_ == MAP_FAILED) {
+        return false;
+      }
+    }
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+      return false;
+    }
+
+    char *sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<volatile __u32*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<volatile __u32*>(sq + params.sq_off.tail);
+    sq_local_tail_ = *sq_tail_;
+    sq_mask_ = *reinterpret_cast<__u32*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<__u32*>(sq + params.sq_off.array);
+    char *cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<volatile __u32*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<volatile __u32*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<__u32*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  // Gets the next submission queue entry, cleared. Called with mu_ held.
+  // Entries are always submitted right away, so the queue never fills up.
+  struct io_uring_sqe *NextSqe() {
+    __u32 index = sq_local_tail_ & sq_mask_;
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe*>(sqes_) +
+        index;
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++sq_local_tail_;
+    return sqe;
+  }
+
+  // Publishes and submits the last count entries from NextSqe(). Called
+  // with mu_ held. Returns how many of them the kernel took, fewer than
+  // count if submitting failed. The others are taken back off the queue.
+  unsigned Submit(unsigned count) {
+    __sync_synchronize();
+    *sq_tail_ = sq_local_tail_;
+    __sync_synchronize();
+    unsigned submitted = 0;
+    while (submitted < count) {
+      int ret = IoUringEnter(ring_fd_, count - submitted, 0, 0);
+      if (ret > 0) {
+        submitted += ret;
+      } else if ((ret < 0) && ((errno == EAGAIN) || (errno == EBUSY))) {
+        // Out of kernel resources, try again
+        usleep(100);
+      } else {
+        break;
+      }
+    }
+
+    if (submitted < count) {
+      // Without SQPOLL the kernel only reads the queue in io_uring_enter(),
+      // so the entries past its head can be withdrawn
+      __sync_synchronize();
+      sq_local_tail_ = *sq_head_;
+      *sq_tail_ = sq_local_tail_;
+      __sync_synchronize();
+    }
+    return submitted;
+  }
+
+  // Accounts for completed entries of the request, and runs its callback
+  // once none are left.
+  static void Complete(Request *request, unsigned completed) {
+    if (__sync_sub_and_fetch(&request->pending, completed) == 0) {
+      request->callback->OnWriteDone(request->ok);
+      delete request;
+    }
+  }
+
+  static void *ReaperThread(void *writer) {
+    static_cast<IoUringFileWriter*>(writer)->Reap();
+    return NULL;
+  }
+
+  // Runs the callbacks of the completed writes until the stop marker.
+  void Reap() {
+    bool stopping = false;
+    while (!stopping) {
+      if ((IoUringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0) &&
+          (errno != EAGAIN) && (errno != EBUSY)) {
+        // Stop if the destructor gave up on the ring
+        MutexLock l(&mu_);
+        if (ring_failed_) {
+          return;
+        }
+      }
+      __u32 head = *cq_head_;
+      __sync_synchronize();
+      __u32 tail = *cq_tail_;
+      __sync_synchronize();
+
+      unsigned completed = 0;
+      for (; head != tail; ++head) {
+        const struct io_uring_cqe& cqe = cqes_[head & cq_mask_];
+        if (cqe.user_data == 0) {
+          stopping = true;
+          continue;
+        }
+        Request *request =
+            reinterpret_cast<Request*>(cqe.user_data & ~kSyncTag);
+        bool sync = (cqe.user_data & kSyncTag) != 0;
+        if ((cqe.res < 0) ||
+            (!sync && (static_cast<size_t>(cqe.res) !=
+                       request->iov.iov_len))) {
+          request->ok = false;
+        }
+        ++completed;
+        Complete(request, 1);
+      }
+      __sync_synchronize();
+      *cq_head_ = head;
+
+      MutexLock l(&mu_);
+      in_flight_ -= completed;
+      space_cv_.SignalAll();
+    }
+  }
+
+  const int ring_fd_;
+  void *sq_ring_;
+  void *cq_ring_;
+  void *sqes_;
+  size_t sq_ring_size_;
+  size_t cq_ring_size_;
+  size_t sqes_size_;
+
+  volatile __u32 *sq_head_;
+  volatile __u32 *sq_tail_;
+  __u32 sq_mask_;
+  __u32 *sq_array_;
+  __u32 sq_local_tail_;
+  volatile __u32 *cq_head_;
+  volatile __u32 *cq_tail_;
+  __u32 cq_mask_;
+  struct io_uring_cqe *cqes_;
+
+  pthread_t reaper_;
+  bool reaper_started_;
+
+  // Serializes submissions.
+  Mutex mu_;
+
+  // Signalled when writes complete.
+  CondVar space_cv_;
+
+  // Number of submitted entries whose completion has not been reaped.
+  unsigned in_flight_;
+
+  // Whether the stop marker could not be submitted.
+  bool ring_failed_;
+};
+
+#endif  // KAMIAH_HAVE_IO_URING
+
+}  // namespace
+
+FileWriter* FileWriter::New(Backend backend) {
+  switch (backend) {
+    case IO_URING:
+#ifdef KAMIAH_HAVE_IO_URING
+      return IoUringFileWriter::New();
+#else
+      return NULL;
+#endif
+    case THREAD_POOL:
+      return new ThreadPoolFileWriter();
+  }
+  return NULL;
+}
+
+FileWriter* FileWriter::NewDefault() {
+  FileWriter *writer = New(IO_URING);
+  if (writer == NULL) {
+    writer = New(THREAD_POOL);
+  }
+  return writer;
+}
+
+bool FileWriter::WriteAndWait(int fd, uint64_t offset, const char *data,
+                              size_t size, bool sync) {
+  WaitCallback callback;
+  Write(fd, offset, data, size, sync, &callback);
+  return callback.Wait();
+}
+
+}  // namespace kamiah
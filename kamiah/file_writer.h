@@ -0,0 +1,110 @@
+/**
+ * @file file_writer.h
+ * @brief Definition of a FileWriter, which writes to files asynchronously.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_FILE_WRITER_H_
+#define KAMIAH_FILE_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace kamiah {
+
+/**
+ * @brief Callback run when an asynchronous write completes.
+ */
+class WriteCallback {
+ public:
+  virtual ~WriteCallback() {}
+
+  /**
+   * @brief Called once the write, and the sync if requested, completed.
+   *
+   * @param ok True iff all the bytes were written (and synced).
+   */
+  virtual void OnWriteDone(bool ok) = 0;
+};
+
+/**
+ * @brief A FileWriter writes to files without blocking the caller.
+ *
+ * Writes are positional and independent of each other. A write with sync
+ * set is followed by an fdatasync() of the file once its bytes are written,
+ * and only completes after the sync. Callbacks run on a thread of the
+ * writer and should be quick.
+ *
+ * There are two backends:
+ *   IO_URING: Submits each write, and its sync, to the kernel in a single
+ *     system call through an io_uring, and reaps the completions from one
+ *     thread. Only available if Kamiah was built with KAMIAH_HAVE_IO_URING
+ *     and the kernel allows it.
+ *   THREAD_POOL: Runs pwrite() and fdatasync() on a ThreadPool.
+ *
+ * This class is thread-safe.
+ */
+class FileWriter {
+ public:
+  enum Backend { IO_URING, THREAD_POOL };
+
+  // Number of threads of a THREAD_POOL writer.
+  static const int kNumThreads = 4;
+
+  /**
+   * @brief Creates a writer with the specified backend.
+   *
+   * @param backend The backend to use.
+   * @return The writer, or NULL if the backend is not available. Owned by the
+   *     caller.
+   */
+  static FileWriter* New(Backend backend);
+
+  /**
+   * @brief Creates a writer with the best available backend: IO_URING if
+   *     possible, THREAD_POOL otherwise.
+   *
+   * @return The writer. Owned by the caller.
+   */
+  static FileWriter* NewDefault();
+
+  /**
+   * @brief Waits for all pending writes to complete and destroys the writer.
+   */
+  virtual ~FileWriter() {}
+
+  /**
+   * @brief Starts writing to a file.
+   *
+   * @param fd The file to write to.
+   * @param offset The offset in the file to write at.
+   * @param data The bytes to write. Must stay valid until the write
+   *     completes.
+   * @param size The number of bytes to write.
+   * @param sync Whether to sync the file after writing.
+   * @param callback Run when the write completes. Not owned.
+   */
+  virtual void Write(int fd, uint64_t offset, const char *data, size_t size,
+                     bool sync, WriteCallback *callback) = 0;
+
+  /**
+   * @brief Writes to a file and waits for the write to complete. Same
+   *     parameters as Write().
+   *
+   * @return True iff all the bytes were written (and synced).
+   */
+  bool WriteAndWait(int fd, uint64_t offset, const char *data, size_t size,
+                    bool sync);
+
+  /**
+   * @brief Gets the backend of the writer.
+   *
+   * @return The backend of the writer.
+   */
+  virtual Backend backend() const = 0;
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_FILE_WRITER_H_
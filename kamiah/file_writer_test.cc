@@ -0,0 +1,177 @@
+/**
+ * @file file_writer_test.cc
+ * @brief Unit tests for the FileWriter backends.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "file_writer.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "mutex.h"
+#include "gtest/gtest.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+// Counts completed writes.
+class CountingCallback : public WriteCallback {
+ public:
+  CountingCallback() : cv_(&mu_), done_(0), failed_(0) {}
+
+  virtual void OnWriteDone(bool ok) {
+    MutexLock l(&mu_);
+    ++done_;
+    if (!ok) {
+      ++failed_;
+    }
+    cv_.SignalAll();
+  }
+
+  void WaitFor(int count) {
+    MutexLock l(&mu_);
+    while (done_ < count) {
+      cv_.Wait();
+    }
+  }
+
+  int failed() {
+    MutexLock l(&mu_);
+    return failed_;
+  }
+
+ private:
+  Mutex mu_;
+  CondVar cv_;
+  int done_;
+  int failed_;
+};
+
+string ReadFile(int fd) {
+  string contents;
+  char buffer[4096];
+  ssize_t bytes;
+  off_t offset = 0;
+  while ((bytes = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+    contents.append(buffer, bytes);
+    offset += bytes;
+  }
+  return contents;
+}
+
+}  // namespace
+
+class FileWriterTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/kamiah_file_writer_test.%d",
+             static_cast<int>(getpid()));
+    path_ = path;
+    fd_ = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_LE(0, fd_);
+
+    backends_.push_back(FileWriter::THREAD_POOL);
+    FileWriter *io_uring = FileWriter::New(FileWriter::IO_URING);
+    if (io_uring != NULL) {
+      backends_.push_back(FileWriter::IO_URING);
+      delete io_uring;
+    }
+  }
+
+  virtual void TearDown() {
+    close(fd_);
+    unlink(path_.c_str());
+  }
+
+  string path_;
+  int fd_;
+
+  // Backends available on this machine.
+  vector<FileWriter::Backend> backends_;
+};
+
+TEST_F(FileWriterTest, WriteAndWait) {
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    ASSERT_EQ(0, ftruncate(fd_, 0));
+    FileWriter *writer = FileWriter::New(backends_[i]);
+    ASSERT_TRUE(writer != NULL);
+    EXPECT_EQ(backends_[i], writer->backend());
+
+    EXPECT_TRUE(writer->WriteAndWait(fd_, 0, "papaya", 6, false));
+    EXPECT_TRUE(writer->WriteAndWait(fd_, 6, "kamiah", 6, true));
+    EXPECT_TRUE(writer->WriteAndWait(fd_, 0, "P", 1, true));
+    EXPECT_EQ("Papayakamiah", ReadFile(fd_));
+
+    // Only a sync
+    EXPECT_TRUE(writer->WriteAndWait(fd_, 0, NULL, 0, true));
+
+    // Not a file
+    EXPECT_FALSE(writer->WriteAndWait(-1, 0, "x", 1, false));
+    EXPECT_FALSE(writer->WriteAndWait(-1, 0, "x", 1, true));
+    delete writer;
+  }
+}
+
+TEST_F(FileWriterTest, ManyConcurrentWrites) {
+  // More writes than fit in an io_uring at once
+  const int kNumWrites = 2000;
+  string expected;
+  for (int i = 0; i < kNumWrites; ++i) {
+    char record[8];
+    snprintf(record, sizeof(record), "%07d", i);
+    expected.append(record, 7);
+  }
+
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    ASSERT_EQ(0, ftruncate(fd_, 0));
+    FileWriter *writer = FileWriter::New(backends_[i]);
+    ASSERT_TRUE(writer != NULL);
+    CountingCallback callback;
+    for (int j = 0; j < kNumWrites; ++j) {
+      writer->Write(fd_, j * 7, expected.data() + j * 7, 7, (j % 100) == 0,
+                    &callback);
+    }
+    callback.WaitFor(kNumWrites);
+    EXPECT_EQ(0, callback.failed());
+    EXPECT_TRUE(expected == ReadFile(fd_));
+    delete writer;
+  }
+}
+
+TEST_F(FileWriterTest, DestructorWaitsForWrites) {
+  for (size_t i = 0; i < backends_.size(); ++i) {
+    ASSERT_EQ(0, ftruncate(fd_, 0));
+    FileWriter *writer = FileWriter::New(backends_[i]);
+    ASSERT_TRUE(writer != NULL);
+    CountingCallback callback;
+    for (int j = 0; j < 100; ++j) {
+      writer->Write(fd_, j, "x", 1, false, &callback);
+    }
+    delete writer;
+    callback.WaitFor(100);
+    EXPECT_EQ(string(100, 'x'), ReadFile(fd_));
+  }
+}
+
+TEST(FileWriterDefaultTest, PrefersIoUring) {
+  FileWriter *writer = FileWriter::NewDefault();
+  ASSERT_TRUE(writer != NULL);
+  FileWriter *io_uring = FileWriter::New(FileWriter::IO_URING);
+  EXPECT_EQ((io_uring != NULL) ? FileWriter::IO_URING :
+            FileWriter::THREAD_POOL, writer->backend());
+  delete io_uring;
+  delete writer;
+}
+
+}  // namespace kamiah
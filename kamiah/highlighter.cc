@@ -0,0 +1,304 @@
+/**
+ * @file highlighter.cc
+ * @brief Implementation of a Highlighter and of the Lexers.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "highlighter.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "text_kernels.h"
+
+using std::string;
+
+namespace kamiah {
+
+namespace {
+
+// States of the CLexer at the end of a line.
+enum CLexerState {
+  STATE_CODE,
+  STATE_COMMENT,
+  STATE_STRING,
+  STATE_DIRECTIVE
+};
+
+// Sorted for binary search.
+const char *kKeywords[] = {
+  "auto", "bool", "break", "case", "catch", "char", "class", "const",
+  "const_cast", "continue", "default", "delete", "do", "double",
+  "dynamic_cast", "else", "enum", "explicit", "extern", "false", "float",
+  "for", "friend", "goto", "if", "inline", "int", "long", "mutable",
+  "namespace", "new", "operator", "private", "protected", "public",
+  "register", "reinterpret_cast", "return", "short", "signed", "sizeof",
+  "static", "static_cast", "struct", "switch", "template", "this", "throw",
+  "true", "try", "typedef", "typename", "union", "unsigned", "using",
+  "virtual", "void", "volatile", "while",
+};
+
+bool CompareKeywords(const char *a, const char *b) {
+  return strcmp(a, b) < 0;
+}
+
+bool IsKeyword(const string& word) {
+  return std::binary_search(
+      kKeywords, kKeywords + sizeof(kKeywords) / sizeof(kKeywords[0]),
+      word.c_str(), &CompareKeywords);
+}
+
+bool IsIdentifierChar(char c) {
+  return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+      ((c >= '0') && (c <= '9')) || (c == '_') || ((c & 0x80) != 0);
+}
+
+// Finds the end of a string or character literal whose body starts at i.
+// Sets *continued if the line ends in the literal with a '\'.
+Index FindQuote(const char *data, Length size, Index i, char quote,
+                bool *continued) {
+  while ((i < size) && (data[i] != quote)) {
+    i += (data[i] == '\\') ? 2 : 1;
+  }
+  *continued = i > size;
+  return (i < size) ? i + 1 : size;
+}
+
+// Finds the end of a block comment whose body starts at i, -1 if it does
+// not end in the line.
+Index FindCommentEnd(const char *data, Length size, Index i) {
+  for (; i + 1 < size; ++i) {
+    if ((data[i] == '*') && (data[i + 1] == '/')) {
+      return i + 2;
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+Token::Token() : column(0), length(0), type(TOKEN_IDENTIFIER) {
+}
+
+Token::Token(Index token_column, Length token_length, TokenType token_type)
+    : column(token_column), length(token_length), type(token_type) {
+}
+
+bool Token::operator==(const Token& other) const {
+  return (column == other.column) && (length == other.length) &&
+      (type == other.type);
+}
+
+int CLexer::LexLine(const char *data, Length size, int state,
+                    vector<Token> *tokens) const {
+  // Directives go on in the next line after a '\'
+  bool backslash = (size > 0) && (data[size - 1] == '\\');
+  bool continued;
+  Index i = 0;
+  switch (state) {
+    case STATE_COMMENT:
+      i = FindCommentEnd(data, size, 0);
+      if (i < 0) {
+        tokens->push_back(Token(0, size, TOKEN_COMMENT));
+        return STATE_COMMENT;
+      }
+      tokens->push_back(Token(0, i, TOKEN_COMMENT));
+      break;
+    case STATE_STRING:
+      i = FindQuote(data, size, 0, '"', &continued);
+      tokens->push_back(Token(0, i, TOKEN_STRING));
+      if (continued) {
+        return STATE_STRING;
+      }
+      break;
+    case STATE_DIRECTIVE:
+      tokens->push_back(Token(0, size, TOKEN_DIRECTIVE));
+      return backslash ? STATE_DIRECTIVE : STATE_CODE;
+  }
+
+  bool line_start = i == 0;
+  while (i < size) {
+    char c = data[i];
+    Index start = i;
+    if ((c == ' ') || (c == '\t') || (c == '\r')) {
+      ++i;
+      continue;
+    }
+    if ((c == '#') && line_start) {
+      tokens->push_back(Token(start, size - start, TOKEN_DIRECTIVE));
+      return backslash ? STATE_DIRECTIVE : STATE_CODE;
+    }
+    line_start = false;
+    if ((c == '/') && (i + 1 < size) && (data[i + 1] == '/')) {
+      tokens->push_back(Token(start, size - start, TOKEN_COMMENT));
+      return STATE_CODE;
+    }
+    if ((c == '/') && (i + 1 < size) && (data[i + 1] == '*')) {
+      i = FindCommentEnd(data, size, i + 2);
+      if (i < 0) {
+        tokens->push_back(Token(start, size - start, TOKEN_COMMENT));
+        return STATE_COMMENT;
+      }
+      tokens->push_back(Token(start, i - start, TOKEN_COMMENT));
+    } else if ((c == '"') || (c == '\'')) {
+      i = FindQuote(data, size, i + 1, c, &continued);
+      tokens->push_back(Token(start, i - start, TOKEN_STRING));
+      if (continued && (c == '"')) {
+        return STATE_STRING;
+      }
+    } else if ((c >= '0') && (c <= '9')) {
+      while ((i < size) && (IsIdentifierChar(data[i]) || (data[i] == '.'))) {
+        ++i;
+      }
+      tokens->push_back(Token(start, i - start, TOKEN_NUMBER));
+    } else if (IsIdentifierChar(c)) {
+      while ((i < size) && IsIdentifierChar(data[i])) {
+        ++i;
+      }
+      bool keyword = IsKeyword(string(data + start, i - start));
+      tokens->push_back(Token(start, i - start,
+                              keyword ? TOKEN_KEYWORD : TOKEN_IDENTIFIER));
+    } else {
+      ++i;
+      tokens->push_back(Token(start, 1, TOKEN_PUNCTUATION));
+    }
+  }
+  return STATE_CODE;
+}
+
+struct Highlighter::Line {
+  Line() : end_state(-1) {}
+
+  vector<Token> tokens;
+
+  // The state of the Lexer at the end of the line, -1 if it was not lexed.
+  int end_state;
+};
+
+Highlighter::Highlighter(const Document& doc, const Lexer *lexer)
+    : doc_id_(doc.doc_id()), lexer_(lexer), removed_lines_(0),
+      num_lines_lexed_(0) {
+  for (Length i = 0; i < doc.num_lines(); ++i) {
+    lines_.push_back(new Line());
+  }
+  structure_.InsertLines(0, lines_.size());
+  Relex(doc, 0, lines_.size() - 1);
+}
+
+Highlighter::~Highlighter() {
+  for (size_t i = 0; i < lines_.size(); ++i) {
+    delete lines_[i];
+  }
+}
+
+void Highlighter::OnDiffApplying(const Document& doc, const Diff& diff) {
+  // Remember how many lines a delete joins while they are still there
+  removed_lines_ = 0;
+  if ((doc.doc_id() == doc_id_) && (diff.type() == Diff::DELETE)) {
+    const Text& text = doc.text();
+    Index end = std::min(diff.index() + diff.length(), text.size());
+    removed_lines_ = text.LineOf(end) - text.LineOf(diff.index());
+  }
+}
+
+void Highlighter::OnDiffApplied(const Document& doc, const Diff& diff) {
+  if (doc.doc_id() != doc_id_) {
+    return;
+  }
+
+  // Replace the lines of the diff, keeping the first one. The end state of
+  // a line goes with its end, which the following line was lexed from.
+  Index first = doc.text().LineOf(diff.index());
+  if (removed_lines_ > 0) {
+    lines_[first]->end_state = lines_[first + removed_lines_]->end_state;
+  }
+  for (Index i = first + 1; i <= first + removed_lines_; ++i) {
+    delete lines_[i];
+  }
+  lines_.erase(lines_.begin() + first + 1,
+               lines_.begin() + first + 1 + removed_lines_);
+  structure_.EraseLines(first + 1, removed_lines_);
+  Length added_lines = 0;
+  if (diff.type() == Diff::INSERT) {
+    added_lines = CountNewlines(diff.text().data(), diff.text().size());
+    vector<Line*> added;
+    for (Length i = 0; i < added_lines; ++i) {
+      added.push_back(new Line());
+    }
+    lines_.insert(lines_.begin() + first + 1, added.begin(), added.end());
+    std::swap(lines_[first]->end_state,
+              lines_[first + added_lines]->end_state);
+    structure_.InsertLines(first + 1, added_lines);
+  }
+  Relex(doc, first, first + added_lines);
+}
+
+bool Highlighter::GetTokens(Index line, vector<Token> *tokens) const {
+  if ((line < 0) || (line >= static_cast<Index>(lines_.size()))) {
+    return false;
+  }
+  tokens->insert(tokens->end(), lines_[line]->tokens.begin(),
+                 lines_[line]->tokens.end());
+  return true;
+}
+
+bool Highlighter::FindMatchingBracket(Index index, Index *match) const {
+  return structure_.FindMatch(index, match);
+}
+
+void Highlighter::GetFolds(Index first_line, Index end_line, FoldMode mode,
+                           vector<FoldRange> *folds) const {
+  structure_.GetFolds(first_line, end_line, mode, folds);
+}
+
+Length Highlighter::num_lines() const {
+  return lines_.size();
+}
+
+int64_t Highlighter::num_lines_lexed() const {
+  return num_lines_lexed_;
+}
+
+void Highlighter::Relex(const Document& doc, Index first, Index last) {
+  int state = (first == 0) ? 0 : lines_[first - 1]->end_state;
+  string data;
+  vector<Bracket> brackets;
+  for (Index i = first; i < static_cast<Index>(lines_.size()); ++i) {
+    data.clear();
+    doc.GetLines(i, i + 1, &data);
+    Length size = data.size();
+    if (!data.empty() && (data[data.size() - 1] == '\n')) {
+      data.erase(data.size() - 1);
+    }
+    Line *line = lines_[i];
+    line->tokens.clear();
+    int previous_state = line->end_state;
+    state = lexer_->LexLine(data.data(), data.size(), state, &line->tokens);
+    line->end_state = state;
+    ++num_lines_lexed_;
+
+    // Only brackets that are punctuation count
+    brackets.clear();
+    for (size_t j = 0; j < line->tokens.size(); ++j) {
+      const Token& token = line->tokens[j];
+      if ((token.type == TOKEN_PUNCTUATION) &&
+          (memchr("()[]{}", data[token.column], 6) != NULL)) {
+        Bracket bracket;
+        bracket.column = token.column;
+        bracket.c = data[token.column];
+        brackets.push_back(bracket);
+      }
+    }
+    size_t indent = data.find_first_not_of(" \t\r");
+    structure_.SetLine(i, size, (indent == string::npos) ? -1 : indent,
+                       brackets);
+    if ((i >= last) && (state == previous_state)) {
+      break;
+    }
+  }
+}
+
+}  // namespace kamiah
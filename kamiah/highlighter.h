@@ -0,0 +1,190 @@
+/**
+ * @file highlighter.h
+ * @brief Definition of a Highlighter, which keeps the tokens of every line
+ *     of a Document up to date as diffs are applied to it, and of the Lexers
+ *     it uses.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_HIGHLIGHTER_H_
+#define KAMIAH_HIGHLIGHTER_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "diff.h"
+#include "document.h"
+#include "structure_tree.h"
+#include "types.h"
+
+using std::vector;
+
+namespace kamiah {
+
+enum TokenType {
+  TOKEN_IDENTIFIER,
+  TOKEN_KEYWORD,
+  TOKEN_NUMBER,
+  TOKEN_STRING,
+  TOKEN_COMMENT,
+  TOKEN_DIRECTIVE,
+  TOKEN_PUNCTUATION
+};
+
+/**
+ * @brief A token of a line. Whitespace is not part of any token.
+ */
+struct Token {
+  Token();
+  Token(Index token_column, Length token_length, TokenType token_type);
+
+  bool operator==(const Token& other) const;
+
+  // Where the token starts, in bytes from the start of the line.
+  Index column;
+  Length length;
+  TokenType type;
+};
+
+/**
+ * @brief A Lexer splits lines into tokens. It lexes one line at a time and
+ *     carries a state from the end of a line to the start of the next one,
+ *     for tokens that span lines like block comments. The state at the start
+ *     of a Document is 0.
+ */
+class Lexer {
+ public:
+  virtual ~Lexer() {}
+
+  /**
+   * @brief Lexes a line.
+   *
+   * @param data The line, without its '\n'.
+   * @param size The number of characters in data.
+   * @param state The state at the start of the line.
+   * @param tokens Vector to append the tokens of the line to.
+   * @return The state at the end of the line.
+   */
+  virtual int LexLine(const char *data, Length size, int state,
+                      vector<Token> *tokens) const = 0;
+};
+
+/**
+ * @brief A Lexer for C and C++.
+ *
+ * This class is thread-safe.
+ */
+class CLexer : public Lexer {
+ public:
+  virtual int LexLine(const char *data, Length size, int state,
+                      vector<Token> *tokens) const;
+};
+
+/**
+ * @brief A Highlighter keeps the tokens of every line of a Document, for
+ *     example to send the highlighting of the lines in view to thin clients.
+ *
+ * It keeps the tokens of each line and the state of the Lexer at its end.
+ * When a diff is applied, the lines it touches are lexed again, then the
+ * lines after them until one ends in the same state as before the diff:
+ * from there on the tokens cannot have changed. Typing in a line usually
+ * lexes just that line, while opening a block comment lexes up to where it
+ * is closed.
+ *
+ * The brackets outside of comments and strings and the indentation of the
+ * lines are also kept in a StructureTree, to match brackets and find the
+ * regions that can be folded without walking the Document.
+ *
+ * A Highlighter only observes the Document it was created for.
+ *
+ * This class is thread-compatible.
+ */
+class Highlighter : public DocumentObserver {
+ public:
+  /**
+   * @brief Lexes a Document. The Highlighter must then be registered as an
+   *     observer of the Document.
+   *
+   * @param doc The Document.
+   * @param lexer The Lexer to lex the Document with. Not owned.
+   */
+  Highlighter(const Document& doc, const Lexer *lexer);
+  virtual ~Highlighter();
+
+  virtual void OnDiffApplying(const Document& doc, const Diff& diff);
+  virtual void OnDiffApplied(const Document& doc, const Diff& diff);
+
+  /**
+   * @brief Gets the tokens of a line.
+   *
+   * @param line The line, between 0 and num_lines() - 1.
+   * @param tokens Vector to append the tokens of the line to, in order.
+   * @return True iff the line is in the Document.
+   */
+  bool GetTokens(Index line, vector<Token> *tokens) const;
+
+  /**
+   * @brief Finds the bracket matching another, for example the one at the
+   *     cursor. Brackets in comments and strings are not matched.
+   *
+   * @param index The position of the bracket.
+   * @param match Where to write the position of the matching bracket.
+   * @return True iff there is a bracket at index and it has a match.
+   */
+  bool FindMatchingBracket(Index index, Index *match) const;
+
+  /**
+   * @brief Gets the regions that can be folded that overlap a range of
+   *     lines, for example the lines in view.
+   *
+   * @param first_line The first line of the range.
+   * @param end_line The line after the last one of the range.
+   * @param mode How to find the regions.
+   * @param folds Vector to append the regions to, ordered by start line.
+   */
+  void GetFolds(Index first_line, Index end_line, FoldMode mode,
+                vector<FoldRange> *folds) const;
+
+  /**
+   * @brief Gets the number of lines of the Document.
+   *
+   * @return The number of lines.
+   */
+  Length num_lines() const;
+
+  /**
+   * @brief Gets the number of lines lexed since the Highlighter was
+   *     created, for statistics.
+   *
+   * @return The number of lines lexed.
+   */
+  int64_t num_lines_lexed() const;
+
+ private:
+  struct Line;
+
+  // Lexes lines from first until one after last ends in the state it ended
+  // in before.
+  void Relex(const Document& doc, Index first, Index last);
+
+  DocID doc_id_;
+  const Lexer *lexer_;
+  vector<Line*> lines_;
+
+  // The brackets and indentation of the lines.
+  StructureTree structure_;
+
+  // The number of lines removed by the diff being applied.
+  Length removed_lines_;
+  int64_t num_lines_lexed_;
+
+  // Not copyable.
+  Highlighter(const Highlighter&);
+  void operator=(const Highlighter&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_HIGHLIGHTER_H_
@@ -0,0 +1,202 @@
+/**
+ * @file highlighter_test.cc
+ * @brief Unit tests for a Highlighter and the Lexers.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "highlighter.h"
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+vector<Token> Lex(const Lexer& lexer, const string& line, int *state) {
+  vector<Token> tokens;
+  *state = lexer.LexLine(line.data(), line.size(), *state, &tokens);
+  return tokens;
+}
+
+}  // namespace
+
+TEST(CLexerTest, LexLine) {
+  CLexer lexer;
+  int state = 0;
+  vector<Token> tokens = Lex(lexer, "  return x1 + 0x1F; // done", &state);
+  ASSERT_EQ(6U, tokens.size());
+  EXPECT_EQ(Token(2, 6, TOKEN_KEYWORD), tokens[0]);
+  EXPECT_EQ(Token(9, 2, TOKEN_IDENTIFIER), tokens[1]);
+  EXPECT_EQ(Token(12, 1, TOKEN_PUNCTUATION), tokens[2]);
+  EXPECT_EQ(Token(14, 4, TOKEN_NUMBER), tokens[3]);
+  EXPECT_EQ(Token(18, 1, TOKEN_PUNCTUATION), tokens[4]);
+  EXPECT_EQ(Token(20, 7, TOKEN_COMMENT), tokens[5]);
+  EXPECT_EQ(0, state);
+
+  tokens = Lex(lexer, "s = \"a\\\"b\" /* papaya", &state);
+  ASSERT_EQ(4U, tokens.size());
+  EXPECT_EQ(Token(4, 6, TOKEN_STRING), tokens[2]);
+  EXPECT_EQ(Token(11, 9, TOKEN_COMMENT), tokens[3]);
+  EXPECT_NE(0, state);
+  tokens = Lex(lexer, "kamiah */ '\\''", &state);
+  ASSERT_EQ(2U, tokens.size());
+  EXPECT_EQ(Token(0, 9, TOKEN_COMMENT), tokens[0]);
+  EXPECT_EQ(Token(10, 4, TOKEN_STRING), tokens[1]);
+  EXPECT_EQ(0, state);
+
+  // Directives and strings can go on in the next line
+  tokens = Lex(lexer, "  #define PAPAYA \\", &state);
+  ASSERT_EQ(1U, tokens.size());
+  EXPECT_EQ(Token(2, 16, TOKEN_DIRECTIVE), tokens[0]);
+  tokens = Lex(lexer, "  1", &state);
+  EXPECT_EQ(Token(0, 3, TOKEN_DIRECTIVE), tokens[0]);
+  EXPECT_EQ(0, state);
+  tokens = Lex(lexer, "\"papaya\\", &state);
+  tokens = Lex(lexer, "kamiah\" x", &state);
+  ASSERT_EQ(2U, tokens.size());
+  EXPECT_EQ(Token(0, 7, TOKEN_STRING), tokens[0]);
+  EXPECT_EQ(0, state);
+}
+
+class HighlighterTest : public ::testing::Test {
+ protected:
+  HighlighterTest() : doc_(1) {
+    Diff diff(0, "int main() {\n  return 0;\n}\n\nint x = 1;\n");
+    EXPECT_TRUE(doc_.ApplyDiff(&diff));
+    highlighter_ = new Highlighter(doc_, &lexer_);
+    doc_.AddObserver(highlighter_);
+  }
+
+  virtual ~HighlighterTest() {
+    delete highlighter_;
+  }
+
+  void Apply(Diff diff) {
+    ASSERT_TRUE(doc_.ApplyDiff(&diff));
+  }
+
+  // Checks the tokens against those of the Document lexed from scratch.
+  void ExpectRelexed() {
+    Highlighter relexed(doc_, &lexer_);
+    ASSERT_EQ(relexed.num_lines(), highlighter_->num_lines());
+    for (Index line = 0; line < relexed.num_lines(); ++line) {
+      vector<Token> expected;
+      vector<Token> tokens;
+      EXPECT_TRUE(relexed.GetTokens(line, &expected));
+      EXPECT_TRUE(highlighter_->GetTokens(line, &tokens));
+      EXPECT_TRUE(expected == tokens) << line;
+    }
+
+    // And the brackets and folds
+    for (Index index = 0; index < doc_.size(); ++index) {
+      Index expected = -1;
+      Index match = -1;
+      EXPECT_EQ(relexed.FindMatchingBracket(index, &expected),
+                highlighter_->FindMatchingBracket(index, &match));
+      EXPECT_EQ(expected, match) << index;
+    }
+    for (int mode = FOLD_BRACKETS; mode <= FOLD_INDENTATION; ++mode) {
+      vector<FoldRange> expected;
+      vector<FoldRange> folds;
+      relexed.GetFolds(0, relexed.num_lines(), static_cast<FoldMode>(mode),
+                       &expected);
+      highlighter_->GetFolds(0, highlighter_->num_lines(),
+                             static_cast<FoldMode>(mode), &folds);
+      EXPECT_TRUE(expected == folds) << mode;
+    }
+  }
+
+  CLexer lexer_;
+  Document doc_;
+  Highlighter *highlighter_;
+};
+
+TEST_F(HighlighterTest, Edits) {
+  EXPECT_EQ(6, highlighter_->num_lines());
+  EXPECT_EQ(6, highlighter_->num_lines_lexed());
+  vector<Token> tokens;
+  EXPECT_TRUE(highlighter_->GetTokens(1, &tokens));
+  EXPECT_EQ(3U, tokens.size());
+  EXPECT_FALSE(highlighter_->GetTokens(6, &tokens));
+
+  // Typing only lexes its line
+  Apply(Diff(22, "0"));
+  EXPECT_EQ(7, highlighter_->num_lines_lexed());
+  ExpectRelexed();
+
+  // Opening a block comment lexes to the end, closing it too
+  Apply(Diff(13, "/*"));
+  EXPECT_EQ(7 + 5, highlighter_->num_lines_lexed());
+  ExpectRelexed();
+  Apply(Diff(28, "*/"));
+  EXPECT_EQ(7 + 5 + 4, highlighter_->num_lines_lexed());
+  tokens.clear();
+  EXPECT_TRUE(highlighter_->GetTokens(2, &tokens));
+  EXPECT_EQ(TOKEN_COMMENT, tokens[0].type);
+  EXPECT_EQ(TOKEN_PUNCTUATION, tokens[1].type);
+  ExpectRelexed();
+
+  // Lines that are added and removed
+  Apply(Diff(0, "// papaya\n\n"));
+  Apply(Diff(5, 20));
+  ExpectRelexed();
+}
+
+TEST_F(HighlighterTest, Brackets) {
+  Index match;
+  EXPECT_TRUE(highlighter_->FindMatchingBracket(11, &match));
+  EXPECT_EQ(25, match);
+  EXPECT_TRUE(highlighter_->FindMatchingBracket(25, &match));
+  EXPECT_EQ(11, match);
+  vector<FoldRange> folds;
+  highlighter_->GetFolds(0, 6, FOLD_BRACKETS, &folds);
+  ASSERT_EQ(1U, folds.size());
+  EXPECT_EQ(FoldRange(0, 2), folds[0]);
+  folds.clear();
+  highlighter_->GetFolds(0, 6, FOLD_INDENTATION, &folds);
+  ASSERT_EQ(1U, folds.size());
+  EXPECT_EQ(FoldRange(0, 1), folds[0]);
+
+  // Brackets in comments and strings do not count
+  Apply(Diff(25, "// }\n\"}\"\n"));
+  EXPECT_TRUE(highlighter_->FindMatchingBracket(11, &match));
+  EXPECT_EQ(34, match);
+  EXPECT_FALSE(highlighter_->FindMatchingBracket(28, &match));
+  EXPECT_FALSE(highlighter_->FindMatchingBracket(31, &match));
+  folds.clear();
+  highlighter_->GetFolds(3, 4, FOLD_BRACKETS, &folds);
+  ASSERT_EQ(1U, folds.size());
+  EXPECT_EQ(FoldRange(0, 4), folds[0]);
+  ExpectRelexed();
+}
+
+TEST_F(HighlighterTest, RandomEdits) {
+  const char *snippets[] = {
+    "/*", "*/", "\"", "\\", "\n", "#if 1", "x", " ", "//", "'", "int",
+    "{", "}", "(", ")",
+  };
+  srand(49);
+  for (int i = 0; i < 2000; ++i) {
+    Index index = rand() % (doc_.size() + 1);
+    if (rand() % 3 != 0) {
+      Apply(Diff(index, snippets[rand() % 15]));
+    } else {
+      Apply(Diff(index, rand() % 10));
+    }
+    if (i % 20 == 0) {
+      ExpectRelexed();
+    }
+  }
+  ExpectRelexed();
+}
+
+}  // namespace kamiah
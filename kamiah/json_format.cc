@@ -0,0 +1,599 @@
+/**
+ * @file json_format.cc
+ * @brief Implementation of the JSON serialization of Diffs.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "json_format.h"
+
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace kamiah {
+
+namespace {
+
+// Maximum nesting of unknown values that will be skipped.
+const int kMaxDepth = 32;
+
+// Whether a byte needs special handling inside a JSON string: it ends the
+// string, starts an escape, or must be escaped.
+inline bool IsSpecial(char c) {
+  return (c == '"') || (c == '\\') || (static_cast<unsigned char>(c) < 0x20);
+}
+
+// Gets the first special byte in [p, limit), or limit if there is none.
+const char* FindSpecial(const char *p, const char *limit) {
+#ifdef __SSE2__
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1f);
+  while (limit - p >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+
+    // A byte is a control character iff max(byte, 0x1f) == 0x1f
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                     _mm_cmpeq_epi8(chunk, backslash)),
+        _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+    int mask = _mm_movemask_epi8(special);
+    if (mask != 0) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+#endif
+
+  while ((p < limit) && !IsSpecial(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+int HexValue(char c) {
+  if ((c >= '0') && (c <= '9')) {
+    return c - '0';
+  } else if ((c >= 'a') && (c <= 'f')) {
+    return c - 'a' + 10;
+  } else if ((c >= 'A') && (c <= 'F')) {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+void AppendUtf8(uint32_t code_point, string *out) {
+  if (code_point < 0x80) {
+    out->push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    out->push_back(static_cast<char>(0xc0 | (code_point >> 6)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  } else if (code_point < 0x10000) {
+    out->push_back(static_cast<char>(0xe0 | (code_point >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  } else {
+    out->push_back(static_cast<char>(0xf0 | (code_point >> 18)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3f)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  }
+}
+
+// Reads the JSON values used by the diff schema from a buffer.
+class JsonReader {
+ public:
+  JsonReader(const char *data, size_t size)
+      : p_(data), limit_(data + size) {
+  }
+
+  // Consumes the specified character, skipping whitespace before it.
+  bool Consume(char c) {
+    SkipWhitespace();
+    if ((p_ < limit_) && (*p_ == c)) {
+      ++p_;
+      return true;
+    }
+    return false;
+  }
+
+  // Whether all the input was read, ignoring trailing whitespace.
+  bool AtEnd() {
+    SkipWhitespace();
+    return p_ == limit_;
+  }
+
+  bool ReadString(string *out) {
+    out->clear();
+    if (!Consume('"')) {
+      return false;
+    }
+
+    for (;;) {
+      const char *special = FindSpecial(p_, limit_);
+      out->append(p_, special - p_);
+      p_ = special;
+      if (p_ == limit_) {
+        return false;
+      }
+
+      char c = *p_++;
+      if (c == '"') {
+        return true;
+      } else if ((c != '\\') || (p_ == limit_)) {
+        // Unescaped control character or truncated escape
+        return false;
+      }
+
+      c = *p_++;
+      switch (c) {
+        case '"': out->push_back('"'); break;
+        case '\\': out->push_back('\\'); break;
+        case '/': out->push_back('/'); break;
+        case 'b': out->push_back('\b'); break;
+        case 'f': out->push_back('\f'); break;
+        case 'n': out->push_back('\n'); break;
+        case 'r': out->push_back('\r'); break;
+        case 't': out->push_back('\t'); break;
+        case 'u':
+          if (!ReadUnicodeEscape(out)) {
+            return false;
+          }
+          break;
+        default:
+          return false;
+      }
+    }
+  }
+
+  bool ReadInt64(int64_t *value) {
+    SkipWhitespace();
+    bool negative = Consume('-');
+    const char *start = p_;
+    uint64_t magnitude = 0;
+    while ((p_ < limit_) && (*p_ >= '0') && (*p_ <= '9')) {
+      uint64_t digit = *p_ - '0';
+      if (magnitude > (0x7fffffffffffffffULL - digit) / 10) {
+        return false;
+      }
+      magnitude = magnitude * 10 + digit;
+      ++p_;
+    }
+
+    // Only integers are valid here
+    if ((p_ == start) ||
+        ((p_ < limit_) && ((*p_ == '.') || (*p_ == 'e') || (*p_ == 'E')))) {
+      return false;
+    }
+    *value = negative ? -static_cast<int64_t>(magnitude) :
+        static_cast<int64_t>(magnitude);
+    return true;
+  }
+
+  bool ReadBool(bool *value) {
+    SkipWhitespace();
+    if (SkipLiteral("true")) {
+      *value = true;
+      return true;
+    } else if (SkipLiteral("false")) {
+      *value = false;
+      return true;
+    }
+    return false;
+  }
+
+  // Whether the next value starts with the specified character, without
+  // consuming it.
+  bool Peek(char c) {
+    SkipWhitespace();
+    return (p_ < limit_) && (*p_ == c);
+  }
+
+  // Skips over a value of any type.
+  bool SkipValue(int depth) {
+    SkipWhitespace();
+    if ((p_ == limit_) || (depth > kMaxDepth)) {
+      return false;
+    }
+
+    switch (*p_) {
+      case '"':
+        return SkipString();
+      case '{':
+        ++p_;
+        if (Consume('}')) {
+          return true;
+        }
+        do {
+          if (!SkipString() || !Consume(':') || !SkipValue(depth + 1)) {
+            return false;
+          }
+        } while (Consume(','));
+        return Consume('}');
+      case '[':
+        ++p_;
+        if (Consume(']')) {
+          return true;
+        }
+        do {
+          if (!SkipValue(depth + 1)) {
+            return false;
+          }
+        } while (Consume(','));
+        return Consume(']');
+      case 't':
+        return SkipLiteral("true");
+      case 'f':
+        return SkipLiteral("false");
+      case 'n':
+        return SkipLiteral("null");
+      default:
+        return SkipNumber();
+    }
+  }
+
+ private:
+  void SkipWhitespace() {
+    while ((p_ < limit_) &&
+           ((*p_ == ' ') || (*p_ == '\n') || (*p_ == '\r') || (*p_ == '\t'))) {
+      ++p_;
+    }
+  }
+
+  bool ReadHex4(uint32_t *value) {
+    if (limit_ - p_ < 4) {
+      return false;
+    }
+    *value = 0;
+    for (int i = 0; i < 4; ++i) {
+      int digit = HexValue(*p_++);
+      if (digit < 0) {
+        return false;
+      }
+      *value = (*value << 4) | digit;
+    }
+    return true;
+  }
+
+  // Reads the XXXX of a \uXXXX escape, and its low surrogate if needed.
+  bool ReadUnicodeEscape(string *out) {
+    uint32_t code_point;
+    if (!ReadHex4(&code_point)) {
+      return false;
+    }
+
+    if ((code_point >= 0xd800) && (code_point <= 0xdbff)) {
+      uint32_t low;
+      if ((limit_ - p_ < 2) || (p_[0] != '\\') || (p_[1] != 'u')) {
+        return false;
+      }
+      p_ += 2;
+      if (!ReadHex4(&low) || (low < 0xdc00) || (low > 0xdfff)) {
+        return false;
+      }
+      code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+    } else if ((code_point >= 0xdc00) && (code_point <= 0xdfff)) {
+      // Lone low surrogate
+      return false;
+    }
+
+    AppendUtf8(code_point, out);
+    return true;
+  }
+
+  bool SkipString() {
+    if (!Consume('"')) {
+      return false;
+    }
+
+    for (;;) {
+      p_ = FindSpecial(p_, limit_);
+      if (p_ == limit_) {
+        return false;
+      }
+
+      char c = *p_++;
+      if (c == '"') {
+        return true;
+      } else if ((c != '\\') || (p_ == limit_)) {
+        return false;
+      }
+
+      // None of the escaped characters end the string
+      ++p_;
+    }
+  }
+
+  bool SkipLiteral(const char *literal) {
+    for (const char *l = literal; *l != '\0'; ++l) {
+      if ((p_ == limit_) || (*p_ != *l)) {
+        return false;
+      }
+      ++p_;
+    }
+    return true;
+  }
+
+  bool SkipNumber() {
+    const char *start = p_;
+    while ((p_ < limit_) && (((*p_ >= '0') && (*p_ <= '9')) || (*p_ == '-') ||
+                             (*p_ == '+') || (*p_ == '.') || (*p_ == 'e') ||
+                             (*p_ == 'E'))) {
+      ++p_;
+    }
+    return p_ != start;
+  }
+
+  const char *p_;
+  const char *limit_;
+};
+
+// Reads a diff object.
+bool ReadDiff(JsonReader *reader, string *key, Diff *diff) {
+  if (!reader->Consume('{')) {
+    return false;
+  }
+
+  Version version = -1;
+  Index index = 0;
+  Length length = 0;
+  string text;
+  string type;
+  bool has_index = false;
+  bool has_length = false;
+  bool has_text = false;
+  do {
+    if (!reader->ReadString(key) || !reader->Consume(':')) {
+      return false;
+    }
+
+    bool ok;
+    if (*key == "version") {
+      ok = reader->ReadInt64(&version);
+    } else if (*key == "type") {
+      ok = reader->ReadString(&type);
+    } else if (*key == "index") {
+      ok = has_index = reader->ReadInt64(&index);
+    } else if (*key == "length") {
+      ok = has_length = reader->ReadInt64(&length);
+    } else if (*key == "text") {
+      ok = has_text = reader->ReadString(&text);
+    } else {
+      ok = reader->SkipValue(0);
+    }
+    if (!ok) {
+      return false;
+    }
+  } while (reader->Consume(','));
+
+  if (!reader->Consume('}') || !has_index) {
+    return false;
+  }
+
+  if ((type == "insert") && has_text) {
+    *diff = Diff(index, text);
+  } else if ((type == "delete") && has_length) {
+    *diff = Diff(index, length);
+  } else {
+    return false;
+  }
+  diff->set_version(version);
+  return true;
+}
+
+// Reads a request object. Exactly one of "diffs", "subscribe" and
+// "unsubscribe" must be present.
+bool ReadRequest(JsonReader *reader, string *key, JsonRequest *request) {
+  if (!reader->Consume('{')) {
+    return false;
+  }
+
+  bool has_doc_id = false;
+  int num_types = 0;
+  request->diffs.clear();
+  request->from_version = -1;
+  do {
+    if (!reader->ReadString(key) || !reader->Consume(':')) {
+      return false;
+    }
+
+    bool ok;
+    if (*key == "doc_id") {
+      ok = has_doc_id = reader->ReadInt64(&request->doc_id);
+    } else if (*key == "diffs") {
+      request->type = JsonRequest::APPLY;
+      ++num_types;
+      ok = reader->Consume('[');
+      if (ok && !reader->Consume(']')) {
+        do {
+          Diff diff(0, 0);
+          if (!ReadDiff(reader, key, &diff)) {
+            return false;
+          }
+          request->diffs.push_back(diff);
+        } while (reader->Consume(','));
+        ok = reader->Consume(']');
+      }
+    } else if (*key == "subscribe") {
+      request->type = JsonRequest::SUBSCRIBE;
+      ++num_types;
+      ok = reader->ReadInt64(&request->from_version);
+    } else if (*key == "unsubscribe") {
+      bool unsubscribe;
+      ok = reader->ReadBool(&unsubscribe) && unsubscribe;
+      request->type = JsonRequest::UNSUBSCRIBE;
+      ++num_types;
+    } else {
+      ok = reader->SkipValue(0);
+    }
+    if (!ok) {
+      return false;
+    }
+  } while (reader->Consume(','));
+
+  return reader->Consume('}') && has_doc_id && (num_types == 1);
+}
+
+}  // namespace
+
+void AppendJsonInt(int64_t value, string *out) {
+  char buf[24];
+  char *end = buf + sizeof(buf);
+  char *p = end;
+
+  // Work with the magnitude as unsigned so INT64_MIN does not overflow
+  uint64_t magnitude = (value < 0) ? -static_cast<uint64_t>(value) : value;
+  do {
+    *--p = static_cast<char>('0' + (magnitude % 10));
+    magnitude /= 10;
+  } while (magnitude != 0);
+  if (value < 0) {
+    *--p = '-';
+  }
+  out->append(p, end - p);
+}
+
+void AppendJsonString(const string& text, string *out) {
+  static const char kHex[] = "0123456789abcdef";
+
+  out->push_back('"');
+  const char *p = text.data();
+  const char *limit = p + text.size();
+  while (p < limit) {
+    // Copy everything up to the next byte that needs escaping at once
+    const char *special = FindSpecial(p, limit);
+    out->append(p, special - p);
+    if (special == limit) {
+      break;
+    }
+
+    char c = *special;
+    switch (c) {
+      case '"': out->append("\\\""); break;
+      case '\\': out->append("\\\\"); break;
+      case '\b': out->append("\\b"); break;
+      case '\f': out->append("\\f"); break;
+      case '\n': out->append("\\n"); break;
+      case '\r': out->append("\\r"); break;
+      case '\t': out->append("\\t"); break;
+      default:
+        out->append("\\u00");
+        out->push_back(kHex[(c >> 4) & 0xf]);
+        out->push_back(kHex[c & 0xf]);
+        break;
+    }
+    p = special + 1;
+  }
+  out->push_back('"');
+}
+
+void EncodeJsonDiff(const Diff& diff, string *out) {
+  out->append("{\"version\":");
+  AppendJsonInt(diff.version(), out);
+  if (diff.type() == Diff::INSERT) {
+    out->append(",\"type\":\"insert\",\"index\":");
+    AppendJsonInt(diff.index(), out);
+    out->append(",\"text\":");
+    AppendJsonString(diff.text(), out);
+  } else {
+    out->append(",\"type\":\"delete\",\"index\":");
+    AppendJsonInt(diff.index(), out);
+    out->append(",\"length\":");
+    AppendJsonInt(diff.length(), out);
+  }
+  out->push_back('}');
+}
+
+bool DecodeJsonDiff(const char *data, size_t size, Diff *diff) {
+  JsonReader reader(data, size);
+  string key;
+  return ReadDiff(&reader, &key, diff) && reader.AtEnd();
+}
+
+bool DecodeJsonDiffMessage(const char *data, size_t size, DocID *doc_id,
+                           vector<Diff> *diffs) {
+  JsonReader reader(data, size);
+  JsonRequest request;
+  string key;
+  if (!ReadRequest(&reader, &key, &request) || !reader.AtEnd() ||
+      (request.type != JsonRequest::APPLY)) {
+    return false;
+  }
+  *doc_id = request.doc_id;
+  if (diffs->empty()) {
+    diffs->swap(request.diffs);
+  } else {
+    diffs->insert(diffs->end(), request.diffs.begin(), request.diffs.end());
+  }
+  return true;
+}
+
+bool DecodeJsonRequests(const char *data, size_t size,
+                        vector<JsonRequest> *requests) {
+  JsonReader reader(data, size);
+  string key;
+  if (!reader.Peek('[')) {
+    requests->push_back(JsonRequest());
+    return ReadRequest(&reader, &key, &requests->back()) && reader.AtEnd();
+  }
+
+  reader.Consume('[');
+  if (!reader.Consume(']')) {
+    do {
+      requests->push_back(JsonRequest());
+      if (!ReadRequest(&reader, &key, &requests->back())) {
+        return false;
+      }
+    } while (reader.Consume(','));
+    if (!reader.Consume(']')) {
+      return false;
+    }
+  }
+  return reader.AtEnd();
+}
+
+void EncodeJsonUpdates(DocID doc_id, const list<Diff>& updates, string *out) {
+  out->append("{\"doc_id\":");
+  AppendJsonInt(doc_id, out);
+  out->append(",\"updates\":[");
+  for (list<Diff>::const_iterator it = updates.begin(); it != updates.end();
+       ++it) {
+    if (it != updates.begin()) {
+      out->push_back(',');
+    }
+    EncodeJsonDiff(*it, out);
+  }
+  out->append("]}");
+}
+
+void EncodeJsonApplied(DocID doc_id, Version version, string *out) {
+  out->append("{\"doc_id\":");
+  AppendJsonInt(doc_id, out);
+  out->append(",\"applied\":");
+  AppendJsonInt(version, out);
+  out->push_back('}');
+}
+
+void EncodeJsonData(DocID doc_id, Version version, const string& data,
+                    string *out) {
+  out->append("{\"doc_id\":");
+  AppendJsonInt(doc_id, out);
+  out->append(",\"version\":");
+  AppendJsonInt(version, out);
+  out->append(",\"data\":");
+  AppendJsonString(data, out);
+  out->push_back('}');
+}
+
+void JsonEncoder::Encode(DocID doc_id, const Diff& diff, string *out) const {
+  out->append("{\"doc_id\":");
+  AppendJsonInt(doc_id, out);
+  out->append(",\"updates\":[");
+  EncodeJsonDiff(diff, out);
+  out->append("]}");
+}
+
+}  // namespace kamiah
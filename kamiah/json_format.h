@@ -0,0 +1,180 @@
+/**
+ * @file json_format.h
+ * @brief JSON serialization of Diffs for the web tier.
+ *
+ * A diff is a JSON object:
+ *
+ *   {"version":5,"type":"insert","index":12,"text":"papaya"}
+ *   {"version":6,"type":"delete","index":12,"length":6}
+ *
+ * where "version" is optional when decoding (-1 if absent) and unknown keys
+ * are ignored. Requests from clients apply diffs to, subscribe to, or
+ * unsubscribe from one Document:
+ *
+ *   {"doc_id":1,"diffs":[<diff>,...]}
+ *   {"doc_id":1,"subscribe":5}
+ *   {"doc_id":1,"unsubscribe":true}
+ *
+ * where "subscribe" holds the version from which to get updates. Updates sent
+ * to clients have the same shape as diff requests:
+ *
+ *   {"doc_id":1,"updates":[<diff>,...]}
+ *
+ * and the other messages sent to clients are:
+ *
+ *   {"doc_id":1,"applied":6}
+ *   {"doc_id":1,"version":6,"data":"papaya"}
+ *
+ * where "applied" is the version of an applied diff, -1 if it could not be
+ * applied, and "data" holds the full contents of a Document.
+ *
+ * The decoder is specialized for this schema: it builds Diffs directly while
+ * scanning the input, without building a tree of JSON values first, and scans
+ * string contents 16 bytes at a time with SSE2 where available.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_JSON_FORMAT_H_
+#define KAMIAH_JSON_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "diff.h"
+#include "diff_encoder.h"
+#include "types.h"
+
+using std::list;
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief Appends an integer as a JSON number to a string.
+ *
+ * @param value The integer.
+ * @param out String to append the JSON to.
+ */
+void AppendJsonInt(int64_t value, string *out);
+
+/**
+ * @brief Appends a JSON string literal, quoted and escaped, to a string.
+ *
+ * @param text The contents of the string, UTF-8.
+ * @param out String to append the JSON to.
+ */
+void AppendJsonString(const string& text, string *out);
+
+/**
+ * @brief Appends the JSON object of a diff to a string.
+ *
+ * @param diff The diff to encode.
+ * @param out String to append the JSON to.
+ */
+void EncodeJsonDiff(const Diff& diff, string *out);
+
+/**
+ * @brief Decodes the JSON object of a diff.
+ *
+ * @param data The JSON text.
+ * @param size The number of bytes of JSON text.
+ * @param diff Where to write the decoded diff.
+ * @return True iff the text is a single well-formed diff object.
+ */
+bool DecodeJsonDiff(const char *data, size_t size, Diff *diff);
+
+/**
+ * @brief Decodes a diff message sent by a client.
+ *
+ * @param data The JSON text.
+ * @param size The number of bytes of JSON text.
+ * @param doc_id Where to write the ID of the Document.
+ * @param diffs Vector to append the decoded diffs to.
+ * @return True iff the text is a well-formed diff message. The contents of
+ *     diffs are undefined otherwise.
+ */
+bool DecodeJsonDiffMessage(const char *data, size_t size, DocID *doc_id,
+                           vector<Diff> *diffs);
+
+/**
+ * @brief A request from a client.
+ */
+struct JsonRequest {
+  enum Type {
+    APPLY,
+    SUBSCRIBE,
+    UNSUBSCRIBE
+  };
+
+  Type type;
+  DocID doc_id;
+
+  // Only used for SUBSCRIBE requests.
+  Version from_version;
+
+  // Only used for APPLY requests.
+  vector<Diff> diffs;
+};
+
+/**
+ * @brief Decodes the requests in a message sent by a client. A message is
+ *     either a single request object or an array of them.
+ *
+ * @param data The JSON text.
+ * @param size The number of bytes of JSON text.
+ * @param requests Vector to append the decoded requests to.
+ * @return True iff the text is a well-formed message. The contents of
+ *     requests are undefined otherwise.
+ */
+bool DecodeJsonRequests(const char *data, size_t size,
+                        vector<JsonRequest> *requests);
+
+/**
+ * @brief Appends an updates message to a string.
+ *
+ * @param doc_id The ID of the Document.
+ * @param updates The updates, usually from Document::GetUpdates().
+ * @param out String to append the JSON to.
+ */
+void EncodeJsonUpdates(DocID doc_id, const list<Diff>& updates, string *out);
+
+/**
+ * @brief Appends the result of applying a diff to a string.
+ *
+ * @param doc_id The ID of the Document.
+ * @param version The version of the applied diff, -1 if it was not applied.
+ * @param out String to append the JSON to.
+ */
+void EncodeJsonApplied(DocID doc_id, Version version, string *out);
+
+/**
+ * @brief Appends the full contents of a Document to a string.
+ *
+ * @param doc_id The ID of the Document.
+ * @param version The version of the Document.
+ * @param data The contents of the Document.
+ * @param out String to append the JSON to.
+ */
+void EncodeJsonData(DocID doc_id, Version version, const string& data,
+                    string *out);
+
+/**
+ * @brief A JsonEncoder encodes a diff as an updates message holding only
+ *     that diff.
+ *
+ * This class is thread-safe.
+ */
+class JsonEncoder : public DiffEncoder {
+ public:
+  virtual void Encode(DocID doc_id, const Diff& diff, string *out) const;
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_JSON_FORMAT_H_
@@ -0,0 +1,277 @@
+/**
+ * @file json_format_test.cc
+ * @brief Unit tests for the JSON serialization of Diffs.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "json_format.h"
+
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+bool Decode(const string& json, Diff *diff) {
+  return DecodeJsonDiff(json.data(), json.size(), diff);
+}
+
+TEST(JsonFormatTest, EncodeInsert) {
+  Diff diff(12, "papaya");
+  diff.set_version(5);
+  string json;
+  EncodeJsonDiff(diff, &json);
+  EXPECT_EQ("{\"version\":5,\"type\":\"insert\",\"index\":12,"
+            "\"text\":\"papaya\"}", json);
+}
+
+TEST(JsonFormatTest, EncodeDelete) {
+  Diff diff(12, 6);
+  string json;
+  EncodeJsonDiff(diff, &json);
+  EXPECT_EQ("{\"version\":-1,\"type\":\"delete\",\"index\":12,"
+            "\"length\":6}", json);
+}
+
+TEST(JsonFormatTest, EncodeEscapes) {
+  Diff diff(0, "a\"b\\c\nd\te\x01" "f\xc3\xa9");
+  string json;
+  EncodeJsonDiff(diff, &json);
+  EXPECT_NE(string::npos,
+            json.find("\"text\":\"a\\\"b\\\\c\\nd\\te\\u0001f\xc3\xa9\""));
+}
+
+TEST(JsonFormatTest, DecodeInsert) {
+  Diff diff(0, 0);
+  ASSERT_TRUE(Decode(" { \"type\" : \"insert\", \"index\": 12,\n"
+                     "   \"text\": \"papaya\", \"version\": 5 } ", &diff));
+  EXPECT_EQ(Diff::INSERT, diff.type());
+  EXPECT_EQ(12, diff.index());
+  EXPECT_EQ("papaya", diff.text());
+  EXPECT_EQ(5, diff.version());
+}
+
+TEST(JsonFormatTest, DecodeDelete) {
+  Diff diff(0, 0);
+  ASSERT_TRUE(Decode("{\"type\":\"delete\",\"index\":3,\"length\":10}",
+                     &diff));
+  EXPECT_EQ(Diff::DELETE, diff.type());
+  EXPECT_EQ(3, diff.index());
+  EXPECT_EQ(10, diff.length());
+  EXPECT_EQ(-1, diff.version());
+}
+
+TEST(JsonFormatTest, DecodeIgnoresUnknownKeys) {
+  Diff diff(0, 0);
+  ASSERT_TRUE(Decode("{\"cursor\":{\"line\":[1,2.5e3,true,null]},"
+                     "\"type\":\"insert\",\"author\":\"vic\\\"tor\","
+                     "\"index\":0,\"text\":\"a\",\"ok\":false}", &diff));
+  EXPECT_EQ("a", diff.text());
+}
+
+TEST(JsonFormatTest, DecodeEscapes) {
+  Diff diff(0, 0);
+  ASSERT_TRUE(Decode("{\"type\":\"insert\",\"index\":0,\"text\":"
+                     "\"q\\\"b\\\\s\\/n\\nt\\tu\\u00e9\\u20ac\\ud83d\\ude00\"}",
+                     &diff));
+  EXPECT_EQ("q\"b\\s/n\nt\tu\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80",
+            diff.text());
+}
+
+TEST(JsonFormatTest, DecodeLongText) {
+  // Long enough to go through the vectorized scan with escapes in between
+  string text;
+  string escaped;
+  for (int i = 0; i < 100; ++i) {
+    text.append("papaya-papaya-papaya\n");
+    escaped.append("papaya-papaya-papaya\\n");
+  }
+
+  Diff diff(0, 0);
+  ASSERT_TRUE(Decode("{\"type\":\"insert\",\"index\":0,\"text\":\"" +
+                     escaped + "\"}", &diff));
+  EXPECT_EQ(text, diff.text());
+}
+
+TEST(JsonFormatTest, RoundTrip) {
+  string text;
+  for (int c = 1; c < 256; ++c) {
+    text.push_back(static_cast<char>(c));
+  }
+  Diff diff(1234567890123LL, text);
+  diff.set_version(-1);
+
+  string json;
+  EncodeJsonDiff(diff, &json);
+  Diff decoded(0, 0);
+  ASSERT_TRUE(Decode(json, &decoded));
+  EXPECT_EQ(diff.index(), decoded.index());
+  EXPECT_EQ(diff.text(), decoded.text());
+  EXPECT_EQ(diff.version(), decoded.version());
+}
+
+TEST(JsonFormatTest, DecodeMalformed) {
+  const char *malformed[] = {
+    "",
+    "{}",
+    "[]",
+    "{\"type\":\"insert\",\"index\":0}",
+    "{\"type\":\"delete\",\"index\":0}",
+    "{\"type\":\"move\",\"index\":0,\"length\":1}",
+    "{\"type\":\"insert\",\"text\":\"a\"}",
+    "{\"type\":\"insert\",\"index\":1.5,\"text\":\"a\"}",
+    "{\"type\":\"insert\",\"index\":99999999999999999999,\"text\":\"a\"}",
+    "{\"type\":\"insert\",\"index\":0,\"text\":\"a\"",
+    "{\"type\":\"insert\",\"index\":0,\"text\":\"a\"} x",
+    "{\"type\":\"insert\",\"index\":0,\"text\":\"a\nb\"}",
+    "{\"type\":\"insert\",\"index\":0,\"text\":\"\\x\"}",
+    "{\"type\":\"insert\",\"index\":0,\"text\":\"\\u12\"}",
+    "{\"type\":\"insert\",\"index\":0,\"text\":\"\\ud83d\"}",
+    "{\"type\":\"insert\",\"index\":0,\"text\":\"\\ude00\"}",
+    "{\"type\":\"insert\",\"index\":0,\"text\":\"a\",}",
+    "{\"type\":\"insert\" \"index\":0,\"text\":\"a\"}",
+  };
+  for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+    Diff diff(0, 0);
+    EXPECT_FALSE(Decode(malformed[i], &diff)) << malformed[i];
+  }
+}
+
+TEST(JsonFormatTest, DecodeMessage) {
+  string json = "{\"doc_id\":7,\"diffs\":["
+                "{\"type\":\"insert\",\"index\":0,\"text\":\"papaya\"},"
+                "{\"type\":\"delete\",\"index\":0,\"length\":2}]}";
+  DocID doc_id = 0;
+  vector<Diff> diffs;
+  ASSERT_TRUE(DecodeJsonDiffMessage(json.data(), json.size(), &doc_id,
+                                    &diffs));
+  EXPECT_EQ(7, doc_id);
+  ASSERT_EQ(2U, diffs.size());
+  EXPECT_EQ(Diff::INSERT, diffs[0].type());
+  EXPECT_EQ("papaya", diffs[0].text());
+  EXPECT_EQ(Diff::DELETE, diffs[1].type());
+  EXPECT_EQ(2, diffs[1].length());
+
+  // No diffs is fine
+  json = "{\"diffs\":[],\"doc_id\":7}";
+  diffs.clear();
+  EXPECT_TRUE(DecodeJsonDiffMessage(json.data(), json.size(), &doc_id,
+                                    &diffs));
+  EXPECT_TRUE(diffs.empty());
+}
+
+TEST(JsonFormatTest, DecodeMalformedMessage) {
+  const char *malformed[] = {
+    "{\"doc_id\":7}",
+    "{\"diffs\":[]}",
+    "{\"doc_id\":7,\"diffs\":{}}",
+    "{\"doc_id\":7,\"diffs\":[{}]}",
+    "{\"doc_id\":\"7\",\"diffs\":[]}",
+    "{\"doc_id\":7,\"diffs\":[]",
+  };
+  for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+    string json = malformed[i];
+    DocID doc_id;
+    vector<Diff> diffs;
+    EXPECT_FALSE(DecodeJsonDiffMessage(json.data(), json.size(), &doc_id,
+                                       &diffs)) << json;
+  }
+}
+
+TEST(JsonFormatTest, DecodeRequests) {
+  string json = "{\"doc_id\":7,\"subscribe\":3}";
+  vector<JsonRequest> requests;
+  ASSERT_TRUE(DecodeJsonRequests(json.data(), json.size(), &requests));
+  ASSERT_EQ(1U, requests.size());
+  EXPECT_EQ(JsonRequest::SUBSCRIBE, requests[0].type);
+  EXPECT_EQ(7, requests[0].doc_id);
+  EXPECT_EQ(3, requests[0].from_version);
+
+  // Batch of requests
+  json = "[{\"doc_id\":1,\"diffs\":[{\"type\":\"insert\",\"index\":0,"
+         "\"text\":\"a\"}]}, {\"unsubscribe\":true,\"doc_id\":2}]";
+  requests.clear();
+  ASSERT_TRUE(DecodeJsonRequests(json.data(), json.size(), &requests));
+  ASSERT_EQ(2U, requests.size());
+  EXPECT_EQ(JsonRequest::APPLY, requests[0].type);
+  EXPECT_EQ(1, requests[0].doc_id);
+  ASSERT_EQ(1U, requests[0].diffs.size());
+  EXPECT_EQ("a", requests[0].diffs[0].text());
+  EXPECT_EQ(JsonRequest::UNSUBSCRIBE, requests[1].type);
+  EXPECT_EQ(2, requests[1].doc_id);
+
+  json = " [ ] ";
+  requests.clear();
+  EXPECT_TRUE(DecodeJsonRequests(json.data(), json.size(), &requests));
+  EXPECT_TRUE(requests.empty());
+}
+
+TEST(JsonFormatTest, DecodeMalformedRequests) {
+  const char *malformed[] = {
+    "{\"doc_id\":7}",
+    "{\"subscribe\":1}",
+    "{\"doc_id\":7,\"subscribe\":1,\"unsubscribe\":true}",
+    "{\"doc_id\":7,\"unsubscribe\":false}",
+    "{\"doc_id\":7,\"subscribe\":\"1\"}",
+    "[{\"doc_id\":7,\"subscribe\":1},]",
+    "[{\"doc_id\":7,\"subscribe\":1}",
+    "[1]",
+  };
+  for (size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); ++i) {
+    string json = malformed[i];
+    vector<JsonRequest> requests;
+    EXPECT_FALSE(DecodeJsonRequests(json.data(), json.size(), &requests))
+        << json;
+  }
+
+  // Only diff requests are diff messages
+  string json = "{\"doc_id\":7,\"subscribe\":1}";
+  DocID doc_id;
+  vector<Diff> diffs;
+  EXPECT_FALSE(DecodeJsonDiffMessage(json.data(), json.size(), &doc_id,
+                                     &diffs));
+}
+
+TEST(JsonFormatTest, EncodeServerMessages) {
+  string json;
+  EncodeJsonApplied(3, 9, &json);
+  EXPECT_EQ("{\"doc_id\":3,\"applied\":9}", json);
+
+  json.clear();
+  EncodeJsonData(3, 9, "a\"b", &json);
+  EXPECT_EQ("{\"doc_id\":3,\"version\":9,\"data\":\"a\\\"b\"}", json);
+}
+
+TEST(JsonFormatTest, EncodeUpdates) {
+  list<Diff> updates;
+  updates.push_back(Diff(0, "papaya"));
+  updates.back().set_version(1);
+  updates.push_back(Diff(0, 2));
+  updates.back().set_version(2);
+
+  string json;
+  EncodeJsonUpdates(3, updates, &json);
+  EXPECT_EQ("{\"doc_id\":3,\"updates\":["
+            "{\"version\":1,\"type\":\"insert\",\"index\":0,"
+            "\"text\":\"papaya\"},"
+            "{\"version\":2,\"type\":\"delete\",\"index\":0,\"length\":2}]}",
+            json);
+
+  json.clear();
+  EncodeJsonUpdates(3, list<Diff>(), &json);
+  EXPECT_EQ("{\"doc_id\":3,\"updates\":[]}", json);
+}
+
+TEST(JsonFormatTest, JsonEncoder) {
+  Diff diff(0, "papaya");
+  diff.set_version(1);
+  list<Diff> updates(1, diff);
+
+  string expected;
+  EncodeJsonUpdates(3, updates, &expected);
+  string json;
+  JsonEncoder encoder;
+  encoder.Encode(3, diff, &json);
+  EXPECT_EQ(expected, json);
+}
+
+}  // namespace kamiah
@@ -0,0 +1,128 @@
+/**
+ * @file kamiah_c.cc
+ * @brief Implementation of the C API of Kamiah Documents.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "kamiah_c.h"
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "diff.h"
+#include "document.h"
+#include "mutex.h"
+
+using std::list;
+using std::string;
+using std::vector;
+using kamiah::Diff;
+using kamiah::Document;
+using kamiah::Mutex;
+using kamiah::MutexLock;
+
+struct kamiah_document {
+  explicit kamiah_document(int64_t doc_id) : doc(doc_id) {}
+
+  Mutex mu;
+  Document doc;
+};
+
+struct kamiah_updates {
+  vector<Diff> diffs;
+};
+
+extern "C" {
+
+kamiah_document_t* kamiah_document_new(int64_t doc_id) {
+  return new kamiah_document(doc_id);
+}
+
+void kamiah_document_free(kamiah_document_t *doc) {
+  delete doc;
+}
+
+int64_t kamiah_document_id(const kamiah_document_t *doc) {
+  // The ID never changes, no need to lock
+  return doc->doc.doc_id();
+}
+
+int64_t kamiah_document_version(kamiah_document_t *doc) {
+  MutexLock lock(&doc->mu);
+  return doc->doc.version();
+}
+
+int64_t kamiah_document_apply_diff(kamiah_document_t *doc,
+                                   const kamiah_diff_t *diff) {
+  // Build the diff, and copy its text, before taking the lock
+  Diff applied = (diff->type == KAMIAH_INSERT) ?
+      Diff(diff->index, string(diff->text, diff->text_size)) :
+      Diff(diff->index, diff->length);
+
+  MutexLock lock(&doc->mu);
+  if (!doc->doc.ApplyDiff(&applied)) {
+    return -1;
+  }
+  return applied.version();
+}
+
+size_t kamiah_document_size(kamiah_document_t *doc) {
+  MutexLock lock(&doc->mu);
+  return doc->doc.size();
+}
+
+int kamiah_document_get_data(kamiah_document_t *doc, char *data,
+                             size_t capacity, size_t *size) {
+  MutexLock lock(&doc->mu);
+  *size = doc->doc.size();
+  if (*size > capacity) {
+    return 0;
+  }
+  doc->doc.GetData(data);
+  return 1;
+}
+
+kamiah_updates_t* kamiah_document_get_updates(kamiah_document_t *doc,
+                                              int64_t from_version) {
+  list<Diff> diffs;
+  {
+    MutexLock lock(&doc->mu);
+    if (!doc->doc.GetUpdates(from_version, &diffs)) {
+      return NULL;
+    }
+  }
+
+  kamiah_updates_t *updates = new kamiah_updates;
+  updates->diffs.assign(diffs.begin(), diffs.end());
+  return updates;
+}
+
+size_t kamiah_updates_size(const kamiah_updates_t *updates) {
+  return updates->diffs.size();
+}
+
+void kamiah_updates_get(const kamiah_updates_t *updates, size_t i,
+                        kamiah_diff_t *diff) {
+  const Diff& update = updates->diffs[i];
+  diff->version = update.version();
+  diff->index = update.index();
+  if (update.type() == Diff::INSERT) {
+    diff->type = KAMIAH_INSERT;
+    diff->length = 0;
+    diff->text = update.text().data();
+    diff->text_size = update.text().size();
+  } else {
+    diff->type = KAMIAH_DELETE;
+    diff->length = update.length();
+    diff->text = NULL;
+    diff->text_size = 0;
+  }
+}
+
+void kamiah_updates_free(kamiah_updates_t *updates) {
+  delete updates;
+}
+
+}  // extern "C"
@@ -0,0 +1,154 @@
+/**
+ * @file kamiah_c.h
+ * @brief C API of Kamiah Documents, for embedding the engine in other
+ *     languages.
+ *
+ * Handles returned by this API are owned by the caller and must be released
+ * with the matching *_free() function. Unlike a Document, a
+ * kamiah_document_t is thread-safe so that bindings can call into it without
+ * holding their own interpreter lock.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_KAMIAH_C_H_
+#define KAMIAH_KAMIAH_C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct kamiah_document kamiah_document_t;
+typedef struct kamiah_updates kamiah_updates_t;
+
+typedef enum {
+  KAMIAH_INSERT = 0,
+  KAMIAH_DELETE = 1
+} kamiah_diff_type_t;
+
+/**
+ * @brief A diff as seen through the C API. Mirrors a Diff.
+ *
+ * text and text_size are only used by KAMIAH_INSERT diffs, length is only
+ * used by KAMIAH_DELETE diffs.
+ */
+typedef struct {
+  int64_t version;
+  kamiah_diff_type_t type;
+  int64_t index;
+  int64_t length;
+  const char *text;
+  size_t text_size;
+} kamiah_diff_t;
+
+/**
+ * @brief Creates an empty Document.
+ *
+ * @param doc_id The ID of the Document.
+ * @return The new Document.
+ */
+kamiah_document_t* kamiah_document_new(int64_t doc_id);
+
+/**
+ * @brief Destroys a Document.
+ *
+ * @param doc The Document to destroy, may be NULL.
+ */
+void kamiah_document_free(kamiah_document_t *doc);
+
+/**
+ * @brief Gets the ID of a Document.
+ *
+ * @param doc The Document.
+ * @return The ID of the Document.
+ */
+int64_t kamiah_document_id(const kamiah_document_t *doc);
+
+/**
+ * @brief Gets the current version of a Document.
+ *
+ * @param doc The Document.
+ * @return The current version of the Document.
+ */
+int64_t kamiah_document_version(kamiah_document_t *doc);
+
+/**
+ * @brief Applies a diff to a Document. The version of the diff is ignored.
+ *
+ * @param doc The Document.
+ * @param diff The diff to apply. Its text is copied.
+ * @return The version of the applied diff, or -1 if it was not applied.
+ */
+int64_t kamiah_document_apply_diff(kamiah_document_t *doc,
+                                   const kamiah_diff_t *diff);
+
+/**
+ * @brief Gets the size of the data of a Document.
+ *
+ * @param doc The Document.
+ * @return The number of characters in the Document.
+ */
+size_t kamiah_document_size(kamiah_document_t *doc);
+
+/**
+ * @brief Copies the data of a Document into a caller-owned buffer.
+ *
+ * The size is checked and the data copied atomically, so a caller can size
+ * its buffer with kamiah_document_size() and retry if the Document grew in
+ * between.
+ *
+ * @param doc The Document.
+ * @param data Where to write the data.
+ * @param capacity The size of data.
+ * @param size Where to write the size of the data.
+ * @return 1 iff the data fit and was copied, 0 otherwise.
+ */
+int kamiah_document_get_data(kamiah_document_t *doc, char *data,
+                             size_t capacity, size_t *size);
+
+/**
+ * @brief Gets the diffs from a version to the current version of a
+ *     Document. See Document::GetUpdates().
+ *
+ * @param doc The Document.
+ * @param from_version The version from which to start getting updates.
+ * @return The updates, or NULL if they are no longer available and the data
+ *     should be requested instead.
+ */
+kamiah_updates_t* kamiah_document_get_updates(kamiah_document_t *doc,
+                                              int64_t from_version);
+
+/**
+ * @brief Gets the number of diffs in some updates.
+ *
+ * @param updates The updates.
+ * @return The number of diffs.
+ */
+size_t kamiah_updates_size(const kamiah_updates_t *updates);
+
+/**
+ * @brief Gets a diff of some updates.
+ *
+ * @param updates The updates.
+ * @param i The position of the diff, less than kamiah_updates_size().
+ * @param diff Where to write the diff. Its text points into the updates and
+ *     is valid until they are freed.
+ */
+void kamiah_updates_get(const kamiah_updates_t *updates, size_t i,
+                        kamiah_diff_t *diff);
+
+/**
+ * @brief Destroys some updates.
+ *
+ * @param updates The updates to destroy, may be NULL.
+ */
+void kamiah_updates_free(kamiah_updates_t *updates);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // KAMIAH_KAMIAH_C_H_
@@ -0,0 +1,128 @@
+/**
+ * @file kamiah_c_test.cc
+ * @brief Unit tests for the C API of Kamiah Documents.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "kamiah_c.h"
+
+#include <string.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace {
+
+kamiah_diff_t Insert(int64_t index, const char *text) {
+  kamiah_diff_t diff;
+  memset(&diff, 0, sizeof(diff));
+  diff.type = KAMIAH_INSERT;
+  diff.index = index;
+  diff.text = text;
+  diff.text_size = strlen(text);
+  return diff;
+}
+
+kamiah_diff_t Delete(int64_t index, int64_t length) {
+  kamiah_diff_t diff;
+  memset(&diff, 0, sizeof(diff));
+  diff.type = KAMIAH_DELETE;
+  diff.index = index;
+  diff.length = length;
+  return diff;
+}
+
+string GetData(kamiah_document_t *doc) {
+  string data(kamiah_document_size(doc), '\0');
+  size_t size;
+  EXPECT_EQ(1, kamiah_document_get_data(doc, &data[0], data.size(), &size));
+  EXPECT_EQ(data.size(), size);
+  return data;
+}
+
+}  // namespace
+
+TEST(KamiahCTest, ApplyDiff) {
+  kamiah_document_t *doc = kamiah_document_new(7);
+  EXPECT_EQ(7, kamiah_document_id(doc));
+  EXPECT_EQ(0, kamiah_document_version(doc));
+  EXPECT_EQ(0u, kamiah_document_size(doc));
+
+  kamiah_diff_t insert = Insert(0, "papaya");
+  EXPECT_EQ(1, kamiah_document_apply_diff(doc, &insert));
+  kamiah_diff_t remove = Delete(0, 2);
+  EXPECT_EQ(2, kamiah_document_apply_diff(doc, &remove));
+  EXPECT_EQ(2, kamiah_document_version(doc));
+  EXPECT_EQ("paya", GetData(doc));
+
+  // Out of bounds
+  kamiah_diff_t bad = Insert(100, "x");
+  EXPECT_EQ(-1, kamiah_document_apply_diff(doc, &bad));
+  EXPECT_EQ(2, kamiah_document_version(doc));
+
+  // Text with embedded NULs is not truncated
+  kamiah_diff_t binary = Insert(4, "");
+  binary.text = "a\0b";
+  binary.text_size = 3;
+  EXPECT_EQ(3, kamiah_document_apply_diff(doc, &binary));
+  EXPECT_EQ(string("payaa\0b", 7), GetData(doc));
+
+  kamiah_document_free(doc);
+}
+
+TEST(KamiahCTest, GetDataTooSmall) {
+  kamiah_document_t *doc = kamiah_document_new(1);
+  kamiah_diff_t insert = Insert(0, "papaya");
+  kamiah_document_apply_diff(doc, &insert);
+
+  char data[4] = "xxx";
+  size_t size;
+  EXPECT_EQ(0, kamiah_document_get_data(doc, data, sizeof(data), &size));
+  EXPECT_EQ(6u, size);
+  EXPECT_EQ("xxx", string(data));
+
+  kamiah_document_free(doc);
+}
+
+TEST(KamiahCTest, GetUpdates) {
+  kamiah_document_t *doc = kamiah_document_new(1);
+
+  // Nothing cached yet
+  EXPECT_TRUE(kamiah_document_get_updates(doc, 1) == NULL);
+
+  kamiah_diff_t insert = Insert(0, "papaya");
+  kamiah_document_apply_diff(doc, &insert);
+  kamiah_diff_t remove = Delete(1, 3);
+  kamiah_document_apply_diff(doc, &remove);
+
+  kamiah_updates_t *updates = kamiah_document_get_updates(doc, 1);
+  ASSERT_TRUE(updates != NULL);
+  ASSERT_EQ(2u, kamiah_updates_size(updates));
+
+  kamiah_diff_t diff;
+  kamiah_updates_get(updates, 0, &diff);
+  EXPECT_EQ(1, diff.version);
+  EXPECT_EQ(KAMIAH_INSERT, diff.type);
+  EXPECT_EQ(0, diff.index);
+  EXPECT_EQ("papaya", string(diff.text, diff.text_size));
+
+  kamiah_updates_get(updates, 1, &diff);
+  EXPECT_EQ(2, diff.version);
+  EXPECT_EQ(KAMIAH_DELETE, diff.type);
+  EXPECT_EQ(1, diff.index);
+  EXPECT_EQ(3, diff.length);
+  kamiah_updates_free(updates);
+
+  // Up to date
+  updates = kamiah_document_get_updates(doc, 3);
+  ASSERT_TRUE(updates != NULL);
+  EXPECT_EQ(0u, kamiah_updates_size(updates));
+  kamiah_updates_free(updates);
+
+  kamiah_updates_free(NULL);
+  kamiah_document_free(doc);
+}
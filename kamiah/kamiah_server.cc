@@ -0,0 +1,274 @@
+/**
+ * @file kamiah_server.cc
+ * @brief Standalone server of Kamiah Documents.
+ *
+ * Usage: kamiah_server [--address=ADDRESS] [--port=PORT]
+ *     [--websocket_port=PORT] [--shm_path=PATH] [--diff_log=PATH]
+ *     [--durability=sync_each|sync_interval|no_sync] [--snapshot=PATH]
+ *     [--snapshot_interval_secs=SECONDS] [--recovery_threads=THREADS]
+ *     [--primary=ADDRESS:PORT]
+ *
+ * With --diff_log, the Documents are recovered from the log on startup and
+ * every diff applied to them is logged. With --snapshot, the Documents are
+ * served from the snapshot (before replaying the log) and a new snapshot is
+ * written on shutdown, and every --snapshot_interval_secs if set. Each
+ * snapshot drops the part of the log it covers. Recovery loads the snapshot
+ * and replays the log on --recovery_threads threads, one per core by default.
+ *
+ * With --primary, the server is a read-only follower that replicates the
+ * Documents of another kamiah_server. Sending it SIGUSR1 promotes it to a
+ * primary that accepts diffs, usually once the old primary failed. A
+ * follower that loses its primary connects to it again. It exits with an
+ * error if its Documents differ from those of the primary, for example when
+ * the primary lost diffs it had already replicated.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "diff_log.h"
+#include "document_store.h"
+#include "recovery.h"
+#include "server.h"
+#include "snapshotter.h"
+
+using std::string;
+using kamiah::DiffLog;
+using kamiah::DiffLogOptions;
+using kamiah::DocumentStore;
+using kamiah::RecoveryObserver;
+using kamiah::RecoveryOptions;
+using kamiah::RecoveryStats;
+using kamiah::Server;
+using kamiah::ServerOptions;
+using kamiah::Snapshotter;
+
+namespace {
+
+Server *server = NULL;
+
+void HandleSignal(int /* signal */) {
+  if (server != NULL) {
+    server->Stop();
+  }
+}
+
+void HandlePromoteSignal(int /* signal */) {
+  if (server != NULL) {
+    server->Promote();
+  }
+}
+
+bool ParseFlag(const char *arg, const char *name, string *value) {
+  size_t name_size = strlen(name);
+  if ((strncmp(arg, name, name_size) != 0) || (arg[name_size] != '=')) {
+    return false;
+  }
+  *value = arg + name_size + 1;
+  return true;
+}
+
+bool ParseAddress(const string& value, string *address, int *port) {
+  size_t colon = value.rfind(':');
+  if ((colon == string::npos) || (colon == 0) ||
+      (colon + 1 == value.size())) {
+    return false;
+  }
+  *address = value.substr(0, colon);
+  *port = atoi(value.c_str() + colon + 1);
+  return true;
+}
+
+bool ParseDurability(const string& value,
+                     DiffLogOptions::Durability *durability) {
+  if (value == "sync_each") {
+    *durability = DiffLogOptions::SYNC_EACH;
+  } else if (value == "sync_interval") {
+    *durability = DiffLogOptions::SYNC_INTERVAL;
+  } else if (value == "no_sync") {
+    *durability = DiffLogOptions::NO_SYNC;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Prints the progress of the recovery at most once a second.
+class RecoveryPrinter : public RecoveryObserver {
+ public:
+  RecoveryPrinter() : last_print_(time(NULL)) {}
+
+  virtual void OnRecoveryProgress(const RecoveryStats& stats) {
+    time_t now = time(NULL);
+    if (now == last_print_) {
+      return;
+    }
+    last_print_ = now;
+    printf("Recovering: %lld/%lld documents loaded, %lld/%lld records "
+           "replayed\n", static_cast<long long>(stats.documents_loaded),
+           static_cast<long long>(stats.documents_to_load),
+           static_cast<long long>(stats.records_replayed),
+           static_cast<long long>(stats.records_to_replay));
+    fflush(stdout);
+  }
+
+ private:
+  time_t last_print_;
+};
+
+// Megabytes per second of bytes processed in micros.
+double Throughput(int64_t bytes, int64_t micros) {
+  return (micros > 0) ? static_cast<double>(bytes) / micros : 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  ServerOptions options;
+  options.port = 7070;
+  string diff_log_path;
+  string snapshot_path;
+  int snapshot_interval_secs = 0;
+  DiffLogOptions diff_log_options;
+  RecoveryOptions recovery_options;
+  for (int i = 1; i < argc; ++i) {
+    string value;
+    if (ParseFlag(argv[i], "--address", &value)) {
+      options.address = value;
+    } else if (ParseFlag(argv[i], "--port", &value)) {
+      options.port = atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "--websocket_port", &value)) {
+      options.websocket_port = atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "--shm_path", &value)) {
+      options.shm_path = value;
+    } else if (ParseFlag(argv[i], "--diff_log", &value)) {
+      diff_log_path = value;
+    } else if (ParseFlag(argv[i], "--durability", &value) &&
+               ParseDurability(value, &diff_log_options.durability)) {
+    } else if (ParseFlag(argv[i], "--snapshot", &value)) {
+      snapshot_path = value;
+    } else if (ParseFlag(argv[i], "--snapshot_interval_secs", &value)) {
+      snapshot_interval_secs = atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "--recovery_threads", &value)) {
+      recovery_options.num_threads = atoi(value.c_str());
+    } else if (ParseFlag(argv[i], "--primary", &value) &&
+               ParseAddress(value, &options.primary_address,
+                            &options.primary_port)) {
+    } else {
+      fprintf(stderr, "Usage: %s [--address=ADDRESS] [--port=PORT] "
+              "[--websocket_port=PORT] [--shm_path=PATH] [--diff_log=PATH] "
+              "[--durability=sync_each|sync_interval|no_sync] "
+              "[--snapshot=PATH] [--snapshot_interval_secs=SECONDS] "
+              "[--recovery_threads=THREADS] [--primary=ADDRESS:PORT]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  DocumentStore store;
+  RecoveryPrinter printer;
+  recovery_options.observer = &printer;
+  RecoveryStats stats;
+  if (!kamiah::Recover(snapshot_path, diff_log_path, recovery_options, &store,
+                       &stats)) {
+    fprintf(stderr, "Failed to recover from %s and %s\n",
+            snapshot_path.c_str(), diff_log_path.c_str());
+    return 1;
+  }
+  if (!snapshot_path.empty()) {
+    printf("Loaded %lld documents (%lld bytes) from %s in %.3fs (%.1f MB/s)\n",
+           static_cast<long long>(stats.documents_loaded),
+           static_cast<long long>(stats.bytes_loaded), snapshot_path.c_str(),
+           stats.load_micros / 1e6,
+           Throughput(stats.bytes_loaded, stats.load_micros));
+  }
+  DiffLog *diff_log = NULL;
+  if (!diff_log_path.empty()) {
+    printf("Recovered %lld diffs of %d documents from %s in %.3fs "
+           "(%.1f MB/s)\n", static_cast<long long>(stats.diffs_applied),
+           static_cast<int>(store.size()), diff_log_path.c_str(),
+           stats.replay_micros / 1e6,
+           Throughput(stats.log_bytes, stats.replay_micros));
+
+    diff_log = DiffLog::Open(diff_log_path, diff_log_options);
+    if (diff_log == NULL) {
+      fprintf(stderr, "Failed to open %s\n", diff_log_path.c_str());
+      return 1;
+    }
+    store.AddObserver(diff_log);
+  }
+
+  Snapshotter *snapshotter = NULL;
+  if (!snapshot_path.empty()) {
+    snapshotter = new Snapshotter(&store, snapshot_path, diff_log);
+  }
+
+  Server kamiah_server(&store, options);
+  kamiah_server.set_diff_log(diff_log);
+  if ((snapshotter != NULL) && (snapshot_interval_secs > 0)) {
+    kamiah_server.set_snapshotter(snapshotter,
+                                  snapshot_interval_secs * 1000000LL);
+  }
+  if (!kamiah_server.Start()) {
+    if (kamiah_server.read_only()) {
+      fprintf(stderr, "Failed to listen on %s:%d or to replicate %s:%d\n",
+              options.address.c_str(), options.port,
+              options.primary_address.c_str(), options.primary_port);
+    } else {
+      fprintf(stderr, "Failed to listen on %s:%d\n", options.address.c_str(),
+              options.port);
+    }
+    return 1;
+  }
+  server = &kamiah_server;
+  signal(SIGINT, &HandleSignal);
+  signal(SIGTERM, &HandleSignal);
+  signal(SIGUSR1, &HandlePromoteSignal);
+  if (kamiah_server.read_only()) {
+    printf("Replicating %s:%d\n", options.primary_address.c_str(),
+           options.primary_port);
+  }
+
+  printf("Listening on %s:%d\n", options.address.c_str(),
+         kamiah_server.port());
+  if (kamiah_server.websocket_port() >= 0) {
+    printf("Listening for WebSockets on %s:%d\n", options.address.c_str(),
+           kamiah_server.websocket_port());
+  }
+  if (!options.shm_path.empty()) {
+    printf("Listening for shared memory clients on %s\n",
+           options.shm_path.c_str());
+  }
+  fflush(stdout);
+  kamiah_server.Run();
+  server = NULL;
+
+  if (snapshotter != NULL) {
+    snapshotter->Wait();
+    if (!snapshotter->Start() || !snapshotter->Wait()) {
+      fprintf(stderr, "Failed to write %s\n", snapshot_path.c_str());
+    }
+    delete snapshotter;
+  }
+
+  if (diff_log != NULL) {
+    store.RemoveObserver(diff_log);
+    delete diff_log;
+  }
+
+  if (kamiah_server.replication_failed()) {
+    fprintf(stderr, "Stopped replicating %s:%d, the documents differ from "
+            "those of the primary\n", options.primary_address.c_str(),
+            options.primary_port);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file lsp_adapter.cc
+ * @brief Implementation of an LspAdapter.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "lsp_adapter.h"
+
+#include <algorithm>
+
+#include "json_format.h"
+#include "util.h"
+
+using std::min;
+
+namespace kamiah {
+
+namespace {
+
+void AppendLspPosition(const Position& position, string *out) {
+  out->append("{\"line\":");
+  AppendJsonInt(position.line, out);
+  out->append(",\"character\":");
+  AppendJsonInt(position.column, out);
+  out->push_back('}');
+}
+
+}  // namespace
+
+LspAdapter::PendingChanges::PendingChanges()
+    : version(0), first_micros(0), insert_end(-1) {
+}
+
+LspAdapter::LspAdapter(LspListener *listener, int64_t flush_interval_micros)
+    : listener_(listener), flush_interval_micros_(flush_interval_micros) {
+}
+
+LspAdapter::~LspAdapter() {
+}
+
+void LspAdapter::OnDiffApplying(const Document& doc, const Diff& diff) {
+  PendingChanges& pending = pending_[doc.doc_id()];
+  if (pending.changes.empty()) {
+    pending.first_micros = NowMicros();
+  }
+  pending.version = diff.version();
+
+  // Typing extends the last insert
+  if ((diff.type() == Diff::INSERT) && (diff.index() == pending.insert_end)) {
+    pending.changes.back().text.append(diff.text());
+    pending.insert_end += diff.text().size();
+    return;
+  }
+
+  // The Document still has the text the diff replaces
+  LspChange change;
+  doc.GetPosition(diff.index(), UNIT_UTF16, &change.start);
+  if (diff.type() == Diff::INSERT) {
+    change.end = change.start;
+    change.text = diff.text();
+    pending.insert_end = diff.index() + diff.text().size();
+  } else {
+    Index end = min(diff.index() + diff.length(), doc.size());
+    doc.GetPosition(end, UNIT_UTF16, &change.end);
+    pending.insert_end = -1;
+  }
+  pending.changes.push_back(change);
+}
+
+void LspAdapter::OnDiffApplied(const Document& /* doc */,
+                               const Diff& /* diff */) {
+}
+
+void LspAdapter::Poll() {
+  int64_t now = NowMicros();
+  map<DocID, PendingChanges>::iterator it = pending_.begin();
+  while (it != pending_.end()) {
+    map<DocID, PendingChanges>::iterator next = it;
+    ++next;
+    if (now - it->second.first_micros >= flush_interval_micros_) {
+      Send(it);
+    }
+    it = next;
+  }
+}
+
+void LspAdapter::Flush() {
+  while (!pending_.empty()) {
+    Send(pending_.begin());
+  }
+}
+
+size_t LspAdapter::num_pending() const {
+  return pending_.size();
+}
+
+void LspAdapter::Send(map<DocID, PendingChanges>::iterator it) {
+  // Forget the changes first in case the listener applies more diffs
+  DocID doc_id = it->first;
+  PendingChanges pending;
+  pending.changes.swap(it->second.changes);
+  pending.version = it->second.version;
+  pending_.erase(it);
+  listener_->OnDidChange(doc_id, pending.version, pending.changes);
+}
+
+void EncodeLspDidChange(const string& uri, Version version,
+                        const vector<LspChange>& changes, string *out) {
+  out->append("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didChange\","
+              "\"params\":{\"textDocument\":{\"uri\":");
+  AppendJsonString(uri, out);
+  out->append(",\"version\":");
+  AppendJsonInt(version, out);
+  out->append("},\"contentChanges\":[");
+  for (size_t i = 0; i < changes.size(); ++i) {
+    if (i > 0) {
+      out->push_back(',');
+    }
+    out->append("{\"range\":{\"start\":");
+    AppendLspPosition(changes[i].start, out);
+    out->append(",\"end\":");
+    AppendLspPosition(changes[i].end, out);
+    out->append("},\"text\":");
+    AppendJsonString(changes[i].text, out);
+    out->push_back('}');
+  }
+  out->append("]}}");
+}
+
+}  // namespace kamiah
@@ -0,0 +1,149 @@
+/**
+ * @file lsp_adapter.h
+ * @brief Definition of an LspAdapter, which turns the diffs applied to
+ *     Documents into the incremental change events of the Language Server
+ *     Protocol.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_LSP_ADAPTER_H_
+#define KAMIAH_LSP_ADAPTER_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "diff.h"
+#include "document.h"
+#include "types.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief A TextDocumentContentChangeEvent: the range of a Document that a
+ *     change replaces, in lines and UTF-16 columns, and the text it is
+ *     replaced with.
+ */
+struct LspChange {
+  Position start;
+  Position end;
+  string text;
+};
+
+/**
+ * @brief An LspListener receives the changes to the Documents an LspAdapter
+ *     observes.
+ */
+class LspListener {
+ public:
+  virtual ~LspListener() {}
+
+  /**
+   * @brief Called with the changes made to a Document since they were last
+   *     flushed, as in a textDocument/didChange notification.
+   *
+   * @param doc_id The ID of the Document.
+   * @param version The version of the Document after the changes.
+   * @param changes The changes, in order. The range of each one is in the
+   *     Document as left by the ones before it.
+   */
+  virtual void OnDidChange(DocID doc_id, Version version,
+                           const vector<LspChange>& changes) = 0;
+};
+
+/**
+ * @brief An LspAdapter converts the diffs applied to the Documents it
+ *     observes into LspChanges as they are applied, so language servers get
+ *     incremental changes instead of the full text of the Document.
+ *
+ * The changes of each Document are batched and sent to the listener once
+ * the oldest one is flush_interval_micros old (see Poll()). Inserts that
+ * continue the previous one, as when typing, are merged into one change.
+ * Ranges are computed from the line index of the Document, so converting a
+ * diff takes O(log n).
+ *
+ * An LspAdapter can observe any number of Documents.
+ *
+ * This class is thread-compatible.
+ */
+class LspAdapter : public DocumentObserver {
+ public:
+  /**
+   * @brief Constructs an LspAdapter.
+   *
+   * @param listener Where to send the changes. Not owned.
+   * @param flush_interval_micros How long changes are batched for.
+   */
+  LspAdapter(LspListener *listener, int64_t flush_interval_micros);
+  virtual ~LspAdapter();
+
+  virtual void OnDiffApplying(const Document& doc, const Diff& diff);
+  virtual void OnDiffApplied(const Document& doc, const Diff& diff);
+
+  /**
+   * @brief Sends the changes of the Documents whose oldest pending change
+   *     is at least flush_interval_micros old. Should be called
+   *     periodically.
+   */
+  void Poll();
+
+  /**
+   * @brief Sends all the pending changes.
+   */
+  void Flush();
+
+  /**
+   * @brief Gets the number of Documents with pending changes.
+   *
+   * @return The number of Documents with pending changes.
+   */
+  size_t num_pending() const;
+
+ private:
+  // Changes to a Document that were not sent yet.
+  struct PendingChanges {
+    PendingChanges();
+
+    Version version;
+    int64_t first_micros;
+    vector<LspChange> changes;
+
+    // Byte index right after the text of the last change if it is an insert
+    // that the next one can extend, -1 otherwise.
+    Index insert_end;
+  };
+
+  // Sends and forgets the pending changes of a Document.
+  void Send(map<DocID, PendingChanges>::iterator it);
+
+  LspListener *listener_;
+  int64_t flush_interval_micros_;
+  map<DocID, PendingChanges> pending_;
+
+  // Not copyable.
+  LspAdapter(const LspAdapter&);
+  void operator=(const LspAdapter&);
+};
+
+/**
+ * @brief Appends a textDocument/didChange notification to a string.
+ *
+ * @param uri The URI of the Document.
+ * @param version The version of the Document after the changes.
+ * @param changes The changes.
+ * @param out String to append the JSON-RPC message to, without the
+ *     Content-Length header.
+ */
+void EncodeLspDidChange(const string& uri, Version version,
+                        const vector<LspChange>& changes, string *out);
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_LSP_ADAPTER_H_
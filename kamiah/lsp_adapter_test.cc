@@ -0,0 +1,211 @@
+/**
+ * @file lsp_adapter_test.cc
+ * @brief Unit tests for an LspAdapter.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "lsp_adapter.h"
+
+#include <stdlib.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+// Finds the byte index of a line and UTF-16 column in UTF-8 text, as a
+// language server would.
+size_t FindPosition(const string& text, const Position& position) {
+  size_t i = 0;
+  for (Index line = 0; line < position.line; ++line) {
+    i = text.find('\n', i) + 1;
+  }
+  for (Index column = 0; column < position.column; ) {
+    unsigned char c = text[i];
+    column += (c >= 0xF0) ? 2 : 1;
+    do {
+      ++i;
+    } while ((i < text.size()) && ((text[i] & 0xC0) == 0x80));
+  }
+  return i;
+}
+
+// Applies the changes it receives to its copies of the Documents.
+class LspClient : public LspListener {
+ public:
+  LspClient() : num_notifications(0), num_changes(0) {}
+
+  virtual void OnDidChange(DocID doc_id, Version version,
+                           const vector<LspChange>& changes) {
+    last_changes = changes;
+    versions[doc_id] = version;
+    string *text = &texts[doc_id];
+    for (size_t i = 0; i < changes.size(); ++i) {
+      size_t start = FindPosition(*text, changes[i].start);
+      size_t end = FindPosition(*text, changes[i].end);
+      text->replace(start, end - start, changes[i].text);
+    }
+    ++num_notifications;
+    num_changes += changes.size();
+  }
+
+  map<DocID, string> texts;
+  map<DocID, Version> versions;
+  vector<LspChange> last_changes;
+  int num_notifications;
+  int num_changes;
+};
+
+}  // namespace
+
+class LspAdapterTest : public ::testing::Test {
+ protected:
+  LspAdapterTest() : doc_(1), adapter_(&client_, 1000000000) {
+    doc_.AddObserver(&adapter_);
+  }
+
+  void Insert(Index index, const string& text) {
+    Diff diff(index, text);
+    ASSERT_TRUE(doc_.ApplyDiff(&diff));
+  }
+
+  void Erase(Index index, Length length) {
+    Diff diff(index, length);
+    ASSERT_TRUE(doc_.ApplyDiff(&diff));
+  }
+
+  string GetData() const {
+    string data;
+    doc_.GetData(&data);
+    return data;
+  }
+
+  Document doc_;
+  LspClient client_;
+  LspAdapter adapter_;
+};
+
+TEST_F(LspAdapterTest, Ranges) {
+  Insert(0, "papaya\nkamiah");
+  Erase(9, 2);
+  Insert(7, "\xF0\x9F\x8D\x88");
+  adapter_.Flush();
+  ASSERT_EQ(1, client_.num_notifications);
+  ASSERT_EQ(3U, client_.last_changes.size());
+  EXPECT_EQ(Position(0, 0), client_.last_changes[0].end);
+  EXPECT_EQ(Position(1, 2), client_.last_changes[1].start);
+  EXPECT_EQ(Position(1, 4), client_.last_changes[1].end);
+  EXPECT_EQ("", client_.last_changes[1].text);
+  EXPECT_EQ(Position(1, 0), client_.last_changes[2].start);
+  EXPECT_EQ(3, client_.versions[1]);
+  EXPECT_EQ(GetData(), client_.texts[1]);
+
+  // After the surrogate pair the columns are in UTF-16 code units
+  Insert(13, "x");
+  Erase(7, 4);
+  adapter_.Flush();
+  ASSERT_EQ(2U, client_.last_changes.size());
+  EXPECT_EQ(Position(1, 4), client_.last_changes[0].start);
+  EXPECT_EQ(Position(1, 0), client_.last_changes[1].start);
+  EXPECT_EQ(Position(1, 2), client_.last_changes[1].end);
+  EXPECT_EQ(GetData(), client_.texts[1]);
+
+  vector<LspChange> changes;
+  LspChange change;
+  string json;
+  change.start = Position(1, 2);
+  change.end = Position(1, 4);
+  change.text = "a\"b";
+  changes.push_back(change);
+  EncodeLspDidChange("file:///papaya.cc", 7, changes, &json);
+  EXPECT_EQ("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didChange\","
+            "\"params\":{\"textDocument\":{\"uri\":\"file:///papaya.cc\","
+            "\"version\":7},\"contentChanges\":[{\"range\":{\"start\":"
+            "{\"line\":1,\"character\":2},\"end\":{\"line\":1,"
+            "\"character\":4}},\"text\":\"a\\\"b\"}]}}",
+            json);
+}
+
+TEST_F(LspAdapterTest, TypingIsMerged) {
+  Insert(0, "int main() {\n}\n");
+  const char *typed = "  return 0;\n";
+  for (Index i = 0; typed[i] != '\0'; ++i) {
+    Insert(13 + i, string(1, typed[i]));
+  }
+  Erase(13, 2);
+  adapter_.Flush();
+  EXPECT_EQ(1, client_.num_notifications);
+  ASSERT_EQ(3U, client_.last_changes.size());
+  EXPECT_EQ(Position(1, 0), client_.last_changes[1].start);
+  EXPECT_EQ("  return 0;\n", client_.last_changes[1].text);
+  EXPECT_EQ(GetData(), client_.texts[1]);
+  EXPECT_EQ(doc_.version(), client_.versions[1]);
+}
+
+TEST_F(LspAdapterTest, Poll) {
+  LspAdapter adapter(&client_, 0);
+  Document doc(2);
+  doc.AddObserver(&adapter);
+  Diff diff(0, "kapoho");
+  ASSERT_TRUE(doc.ApplyDiff(&diff));
+  Insert(0, "papaya");
+  EXPECT_EQ(1U, adapter.num_pending());
+  EXPECT_EQ(1U, adapter_.num_pending());
+
+  // Only the changes older than the interval are sent
+  adapter.Poll();
+  adapter_.Poll();
+  EXPECT_EQ(0U, adapter.num_pending());
+  EXPECT_EQ(1U, adapter_.num_pending());
+  EXPECT_EQ("kapoho", client_.texts[2]);
+  EXPECT_EQ(0U, client_.texts.count(1));
+  adapter_.Flush();
+  EXPECT_EQ(0U, adapter_.num_pending());
+  EXPECT_EQ("papaya", client_.texts[1]);
+}
+
+TEST_F(LspAdapterTest, RandomEdits) {
+  const char *characters[] = {
+    "a", "b", "\n", "\xC3\xA1", "\xE2\x82\xAC", "\xF0\x9F\x8D\x88",
+  };
+  srand(44);
+  for (int i = 0; i < 2000; ++i) {
+    // Edit at a character boundary
+    Index code_point = rand() % (doc_.length(UNIT_CODE_POINTS) + 1);
+    Index index;
+    ASSERT_TRUE(doc_.ToByteIndex(UNIT_CODE_POINTS, code_point, &index));
+    if ((rand() % 3 != 0) || (doc_.size() == 0)) {
+      string text;
+      for (int j = rand() % 10; j >= 0; --j) {
+        text += characters[rand() % 6];
+      }
+      Insert(index, text);
+    } else {
+      Index end;
+      Length length = rand() % 10;
+      if (!doc_.ToByteIndex(UNIT_CODE_POINTS, code_point + length, &end)) {
+        end = doc_.size();
+      }
+      Erase(index, end - index);
+    }
+    if (rand() % 50 == 0) {
+      adapter_.Flush();
+      ASSERT_EQ(GetData(), client_.texts[1]);
+    }
+  }
+  adapter_.Flush();
+  EXPECT_EQ(GetData(), client_.texts[1]);
+  EXPECT_EQ(doc_.version(), client_.versions[1]);
+}
+
+}  // namespace kamiah
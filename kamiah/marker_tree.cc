@@ -0,0 +1,268 @@
+/**
+ * @file marker_tree.cc
+ * @brief Implementation of a MarkerTree.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "marker_tree.h"
+
+namespace kamiah {
+
+struct MarkerTree::Node {
+  Node(MarkerID node_id, Index node_index, Bias node_bias, uint32_t priority)
+      : id(node_id), index(node_index), bias(node_bias), pending(0),
+        priority(priority), left(NULL), right(NULL), parent(NULL) {
+  }
+
+  MarkerID id;
+
+  // The position of the marker, without the pending shifts of its
+  // ancestors.
+  Index index;
+  Bias bias;
+
+  // Shift not yet applied to the descendants of the node.
+  Length pending;
+
+  // Every node has a higher priority than its children.
+  uint32_t priority;
+  Node *left;
+  Node *right;
+  Node *parent;
+};
+
+namespace {
+
+template <typename T>
+void SetParent(T *child, T *parent) {
+  if (child != NULL) {
+    child->parent = parent;
+  }
+}
+
+}  // namespace
+
+MarkerTree::MarkerTree() : root_(NULL), next_id_(1), random_(2463534242U) {
+}
+
+MarkerTree::~MarkerTree() {
+  DeleteTree(root_);
+}
+
+MarkerID MarkerTree::Add(Index index, Bias bias) {
+  Node *node = new Node(next_id_++, index, bias, NextPriority());
+  nodes_[node->id] = node;
+
+  Node *before;
+  Node *after;
+  Split(root_, index, &before, &after);
+  root_ = Merge(Merge(before, node), after);
+  return node->id;
+}
+
+bool MarkerTree::Remove(MarkerID id) {
+  map<MarkerID, Node*>::iterator it = nodes_.find(id);
+  if (it == nodes_.end()) {
+    return false;
+  }
+  Node *node = it->second;
+  nodes_.erase(it);
+
+  // Replace the node with its children
+  Push(node);
+  Node *child = Merge(node->left, node->right);
+  Node *parent = node->parent;
+  SetParent(child, parent);
+  if (parent == NULL) {
+    root_ = child;
+  } else if (parent->left == node) {
+    parent->left = child;
+  } else {
+    parent->right = child;
+  }
+  delete node;
+  return true;
+}
+
+bool MarkerTree::Get(MarkerID id, Index *index) const {
+  map<MarkerID, Node*>::const_iterator it = nodes_.find(id);
+  if (it == nodes_.end()) {
+    return false;
+  }
+  *index = it->second->index;
+  for (const Node *node = it->second->parent; node != NULL;
+       node = node->parent) {
+    *index += node->pending;
+  }
+  return true;
+}
+
+void MarkerTree::GetRange(Index start, Index end,
+                          vector<Marker> *markers) const {
+  Collect(root_, 0, start, end, markers);
+}
+
+void MarkerTree::Insert(Index index, Length length) {
+  if (length <= 0) {
+    return;
+  }
+  Node *before;
+  Node *rest;
+  Node *at;
+  Node *after;
+  Split(root_, index, &before, &rest);
+  Split(rest, index + 1, &at, &after);
+
+  // Markers at the insert stay or move depending on their bias
+  vector<Node*> at_nodes;
+  Detach(at, &at_nodes);
+  Node *left = NULL;
+  Node *right = NULL;
+  for (size_t i = 0; i < at_nodes.size(); ++i) {
+    if (at_nodes[i]->bias == BIAS_LEFT) {
+      left = Merge(left, at_nodes[i]);
+    } else {
+      right = Merge(right, at_nodes[i]);
+    }
+  }
+  right = Merge(right, after);
+  Shift(right, length);
+  root_ = Merge(Merge(before, left), right);
+}
+
+void MarkerTree::Erase(Index index, Length length) {
+  if (length <= 0) {
+    return;
+  }
+  Node *before;
+  Node *rest;
+  Node *erased;
+  Node *after;
+  Split(root_, index, &before, &rest);
+  Split(rest, index + length + 1, &erased, &after);
+  Collapse(erased, index);
+  Shift(after, -length);
+  root_ = Merge(Merge(before, erased), after);
+}
+
+size_t MarkerTree::size() const {
+  return nodes_.size();
+}
+
+void MarkerTree::Split(Node *node, Index index, Node **left, Node **right) {
+  if (node == NULL) {
+    *left = NULL;
+    *right = NULL;
+    return;
+  }
+  Push(node);
+  node->parent = NULL;
+  if (node->index < index) {
+    Split(node->right, index, &node->right, right);
+    SetParent(node->right, node);
+    *left = node;
+  } else {
+    Split(node->left, index, left, &node->left);
+    SetParent(node->left, node);
+    *right = node;
+  }
+}
+
+MarkerTree::Node* MarkerTree::Merge(Node *left, Node *right) {
+  if (left == NULL) {
+    return right;
+  }
+  if (right == NULL) {
+    return left;
+  }
+  if (left->priority > right->priority) {
+    Push(left);
+    left->right = Merge(left->right, right);
+    SetParent(left->right, left);
+    left->parent = NULL;
+    return left;
+  }
+  Push(right);
+  right->left = Merge(left, right->left);
+  SetParent(right->left, right);
+  right->parent = NULL;
+  return right;
+}
+
+void MarkerTree::Shift(Node *node, Length delta) {
+  if (node != NULL) {
+    node->index += delta;
+    node->pending += delta;
+  }
+}
+
+void MarkerTree::Push(Node *node) {
+  if (node->pending != 0) {
+    Shift(node->left, node->pending);
+    Shift(node->right, node->pending);
+    node->pending = 0;
+  }
+}
+
+void MarkerTree::Collapse(Node *node, Index index) {
+  if (node == NULL) {
+    return;
+  }
+  node->index = index;
+  node->pending = 0;
+  Collapse(node->left, index);
+  Collapse(node->right, index);
+}
+
+void MarkerTree::Detach(Node *node, vector<Node*> *nodes) {
+  if (node == NULL) {
+    return;
+  }
+  Push(node);
+  Detach(node->left, nodes);
+  nodes->push_back(node);
+  Detach(node->right, nodes);
+  node->left = NULL;
+  node->right = NULL;
+  node->parent = NULL;
+}
+
+void MarkerTree::Collect(const Node *node, Length shift, Index start,
+                         Index end, vector<Marker> *markers) {
+  if (node == NULL) {
+    return;
+  }
+  Index index = node->index + shift;
+  if (index >= start) {
+    Collect(node->left, shift + node->pending, start, end, markers);
+  }
+  if ((index >= start) && (index < end)) {
+    Marker marker;
+    marker.id = node->id;
+    marker.index = index;
+    marker.bias = node->bias;
+    markers->push_back(marker);
+  }
+  if (index < end) {
+    Collect(node->right, shift + node->pending, start, end, markers);
+  }
+}
+
+void MarkerTree::DeleteTree(Node *node) {
+  if (node != NULL) {
+    DeleteTree(node->left);
+    DeleteTree(node->right);
+    delete node;
+  }
+}
+
+uint32_t MarkerTree::NextPriority() {
+  // xorshift32
+  random_ ^= random_ << 13;
+  random_ ^= random_ >> 17;
+  random_ ^= random_ << 5;
+  return random_;
+}
+
+}  // namespace kamiah
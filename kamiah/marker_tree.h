@@ -0,0 +1,158 @@
+/**
+ * @file marker_tree.h
+ * @brief Definition of a MarkerTree, positions in a text that shift as the
+ *     text is edited.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_MARKER_TREE_H_
+#define KAMIAH_MARKER_TREE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <vector>
+
+#include "types.h"
+
+using std::map;
+using std::vector;
+
+namespace kamiah {
+
+typedef int64_t MarkerID;
+
+/**
+ * @brief A marker and its current position.
+ */
+struct Marker {
+  MarkerID id;
+  Index index;
+  Bias bias;
+};
+
+/**
+ * @brief A MarkerTree keeps markers (cursors, selection ends, breakpoints,
+ *     diagnostics) at positions of a text and shifts them as text is
+ *     inserted and deleted.
+ *
+ * The markers are kept in a treap ordered by position. Edits split the
+ * treap around the edited position and shift everything after it lazily, so
+ * an edit takes O(log n) plus the number of markers at the position of an
+ * insert or inside a deleted range. Markers at the position of an insert
+ * stay before the inserted text if they have BIAS_LEFT and move after it if
+ * they have BIAS_RIGHT. Markers inside a deleted range move to its start.
+ *
+ * A range, like a selection or a diagnostic, is a pair of markers.
+ *
+ * This class is thread-compatible.
+ */
+class MarkerTree {
+ public:
+  MarkerTree();
+  ~MarkerTree();
+
+  /**
+   * @brief Adds a marker.
+   *
+   * @param index The position of the marker.
+   * @param bias Which way the marker goes when text is inserted at it.
+   * @return The ID of the marker.
+   */
+  MarkerID Add(Index index, Bias bias);
+
+  /**
+   * @brief Removes a marker.
+   *
+   * @param id The ID of the marker.
+   * @return True iff the marker existed.
+   */
+  bool Remove(MarkerID id);
+
+  /**
+   * @brief Gets the position of a marker.
+   *
+   * @param id The ID of the marker.
+   * @param index Where to write the position of the marker.
+   * @return True iff the marker exists.
+   */
+  bool Get(MarkerID id, Index *index) const;
+
+  /**
+   * @brief Gets the markers in a range, for example those in view.
+   *
+   * @param start The first position to get markers at.
+   * @param end The position after the last one to get markers at.
+   * @param markers Vector to append the markers to, ordered by position.
+   */
+  void GetRange(Index start, Index end, vector<Marker> *markers) const;
+
+  /**
+   * @brief Shifts the markers after text was inserted.
+   *
+   * @param index Where the text was inserted.
+   * @param length The number of characters inserted.
+   */
+  void Insert(Index index, Length length);
+
+  /**
+   * @brief Shifts the markers after text was deleted.
+   *
+   * @param index The first character deleted.
+   * @param length The number of characters deleted.
+   */
+  void Erase(Index index, Length length);
+
+  /**
+   * @brief Gets the number of markers.
+   *
+   * @return The number of markers.
+   */
+  size_t size() const;
+
+ private:
+  struct Node;
+
+  // Splits a treap into the nodes before index and the rest.
+  static void Split(Node *node, Index index, Node **left, Node **right);
+
+  // Joins two treaps, all of the nodes of left being before those of right.
+  static Node* Merge(Node *left, Node *right);
+
+  // Shifts all the nodes of a treap.
+  static void Shift(Node *node, Length delta);
+
+  // Applies the pending shift of a node to its children.
+  static void Push(Node *node);
+
+  // Moves all the nodes of a treap to index.
+  static void Collapse(Node *node, Index index);
+
+  // Appends the nodes of a treap in order to a vector, detaching them.
+  static void Detach(Node *node, vector<Node*> *nodes);
+
+  // Appends the nodes of a treap in [start, end) to markers. shift is the
+  // pending shift of the ancestors of the node.
+  static void Collect(const Node *node, Length shift, Index start, Index end,
+                      vector<Marker> *markers);
+
+  static void DeleteTree(Node *node);
+
+  // Gets a random priority.
+  uint32_t NextPriority();
+
+  Node *root_;
+  map<MarkerID, Node*> nodes_;
+  MarkerID next_id_;
+  uint32_t random_;
+
+  // Not copyable.
+  MarkerTree(const MarkerTree&);
+  void operator=(const MarkerTree&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_MARKER_TREE_H_
@@ -0,0 +1,165 @@
+/**
+ * @file marker_tree_test.cc
+ * @brief Unit tests for a MarkerTree.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "marker_tree.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::map;
+using std::max;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+// The expected position and bias of a marker.
+struct Expected {
+  Index index;
+  Bias bias;
+};
+
+void ExpectMarkers(const map<MarkerID, Expected>& expected,
+                   const MarkerTree& tree) {
+  ASSERT_EQ(expected.size(), tree.size());
+  for (map<MarkerID, Expected>::const_iterator it = expected.begin();
+       it != expected.end(); ++it) {
+    Index index;
+    ASSERT_TRUE(tree.Get(it->first, &index));
+    EXPECT_EQ(it->second.index, index) << it->first;
+  }
+}
+
+}  // namespace
+
+TEST(MarkerTreeTest, Empty) {
+  MarkerTree tree;
+  Index index;
+  EXPECT_EQ(0U, tree.size());
+  EXPECT_FALSE(tree.Get(1, &index));
+  EXPECT_FALSE(tree.Remove(1));
+  tree.Insert(0, 10);
+  tree.Erase(0, 5);
+  vector<Marker> markers;
+  tree.GetRange(0, 100, &markers);
+  EXPECT_TRUE(markers.empty());
+}
+
+TEST(MarkerTreeTest, Bias) {
+  MarkerTree tree;
+  MarkerID left = tree.Add(5, BIAS_LEFT);
+  MarkerID right = tree.Add(5, BIAS_RIGHT);
+  MarkerID before = tree.Add(4, BIAS_RIGHT);
+  MarkerID after = tree.Add(6, BIAS_LEFT);
+
+  tree.Insert(5, 3);
+  Index index;
+  EXPECT_TRUE(tree.Get(left, &index));
+  EXPECT_EQ(5, index);
+  EXPECT_TRUE(tree.Get(right, &index));
+  EXPECT_EQ(8, index);
+  EXPECT_TRUE(tree.Get(before, &index));
+  EXPECT_EQ(4, index);
+  EXPECT_TRUE(tree.Get(after, &index));
+  EXPECT_EQ(9, index);
+
+  // Markers in a deleted range move to its start
+  tree.Erase(4, 5);
+  EXPECT_TRUE(tree.Get(left, &index));
+  EXPECT_EQ(4, index);
+  EXPECT_TRUE(tree.Get(right, &index));
+  EXPECT_EQ(4, index);
+  EXPECT_TRUE(tree.Get(after, &index));
+  EXPECT_EQ(4, index);
+
+  vector<Marker> markers;
+  tree.GetRange(4, 5, &markers);
+  EXPECT_EQ(4U, markers.size());
+  EXPECT_TRUE(tree.Remove(before));
+  EXPECT_FALSE(tree.Remove(before));
+  EXPECT_FALSE(tree.Get(before, &index));
+  EXPECT_EQ(3U, tree.size());
+}
+
+TEST(MarkerTreeTest, RandomEdits) {
+  srand(45);
+  MarkerTree tree;
+  map<MarkerID, Expected> expected;
+  Length size = 1000;
+  for (int i = 0; i < 20000; ++i) {
+    int action = rand() % 10;
+    if ((action < 4) || expected.empty()) {
+      Expected marker;
+      marker.index = rand() % (size + 1);
+      marker.bias = (rand() % 2 == 0) ? BIAS_LEFT : BIAS_RIGHT;
+      expected[tree.Add(marker.index, marker.bias)] = marker;
+    } else if (action < 5) {
+      map<MarkerID, Expected>::iterator it =
+          expected.lower_bound(rand() % (i + 1));
+      if (it != expected.end()) {
+        EXPECT_TRUE(tree.Remove(it->first));
+        expected.erase(it);
+      }
+    } else if (action < 8) {
+      Index index = rand() % (size + 1);
+      Length length = 1 + rand() % 20;
+      tree.Insert(index, length);
+      size += length;
+      for (map<MarkerID, Expected>::iterator it = expected.begin();
+           it != expected.end(); ++it) {
+        Expected& marker = it->second;
+        if ((marker.index > index) ||
+            ((marker.index == index) && (marker.bias == BIAS_RIGHT))) {
+          marker.index += length;
+        }
+      }
+    } else {
+      Index index = rand() % (size + 1);
+      Length length = std::min<Length>(1 + rand() % 20, size - index);
+      tree.Erase(index, length);
+      size -= length;
+      for (map<MarkerID, Expected>::iterator it = expected.begin();
+           it != expected.end(); ++it) {
+        Expected& marker = it->second;
+        marker.index = (marker.index <= index) ? marker.index
+            : max(index, marker.index - length);
+      }
+    }
+
+    if (i % 1000 == 0) {
+      ExpectMarkers(expected, tree);
+
+      // A range holds the markers in it, in order
+      Index start = rand() % (size + 1);
+      Index end = start + rand() % 100;
+      vector<Marker> markers;
+      tree.GetRange(start, end, &markers);
+      size_t in_range = 0;
+      for (map<MarkerID, Expected>::iterator it = expected.begin();
+           it != expected.end(); ++it) {
+        in_range += (it->second.index >= start) && (it->second.index < end);
+      }
+      EXPECT_EQ(in_range, markers.size());
+      for (size_t j = 0; j < markers.size(); ++j) {
+        EXPECT_EQ(expected[markers[j].id].index, markers[j].index);
+        EXPECT_EQ(expected[markers[j].id].bias, markers[j].bias);
+        if (j > 0) {
+          EXPECT_LE(markers[j - 1].index, markers[j].index);
+        }
+      }
+    }
+  }
+  ExpectMarkers(expected, tree);
+}
+
+}  // namespace kamiah
@@ -0,0 +1,65 @@
+/**
+ * @file mutex.cc
+ * @brief Implementation of a Mutex and a CondVar.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "mutex.h"
+
+#include <errno.h>
+#include <sys/time.h>
+
+namespace kamiah {
+
+static const int64_t kMicrosecondsPerSecond = 1000000;
+
+Mutex::Mutex() {
+  pthread_mutex_init(&mu_, NULL);
+}
+
+Mutex::~Mutex() {
+  pthread_mutex_destroy(&mu_);
+}
+
+void Mutex::Lock() {
+  pthread_mutex_lock(&mu_);
+}
+
+void Mutex::Unlock() {
+  pthread_mutex_unlock(&mu_);
+}
+
+CondVar::CondVar(Mutex *mu) : mu_(mu) {
+  pthread_cond_init(&cv_, NULL);
+}
+
+CondVar::~CondVar() {
+  pthread_cond_destroy(&cv_);
+}
+
+void CondVar::Wait() {
+  pthread_cond_wait(&cv_, &mu_->mu_);
+}
+
+bool CondVar::TimedWait(int64_t timeout_micros) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  int64_t deadline = now.tv_sec * kMicrosecondsPerSecond + now.tv_usec +
+      timeout_micros;
+
+  struct timespec abstime;
+  abstime.tv_sec = deadline / kMicrosecondsPerSecond;
+  abstime.tv_nsec = (deadline % kMicrosecondsPerSecond) * 1000;
+  return pthread_cond_timedwait(&cv_, &mu_->mu_, &abstime) != ETIMEDOUT;
+}
+
+void CondVar::Signal() {
+  pthread_cond_signal(&cv_);
+}
+
+void CondVar::SignalAll() {
+  pthread_cond_broadcast(&cv_);
+}
+
+}  // namespace kamiah
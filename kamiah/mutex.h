@@ -0,0 +1,117 @@
+/**
+ * @file mutex.h
+ * @brief Definition of a Mutex and a CondVar.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_MUTEX_H_
+#define KAMIAH_MUTEX_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+namespace kamiah {
+
+/**
+ * @brief A Mutex is a non-recursive mutual exclusion lock.
+ *
+ * This class is thread-safe.
+ */
+class Mutex {
+ public:
+  Mutex();
+  ~Mutex();
+
+  /**
+   * @brief Acquires the lock, blocking until it is available.
+   */
+  void Lock();
+
+  /**
+   * @brief Releases the lock. Must be held by the caller.
+   */
+  void Unlock();
+
+ private:
+  friend class CondVar;
+
+  pthread_mutex_t mu_;
+
+  // Not copyable.
+  Mutex(const Mutex&);
+  void operator=(const Mutex&);
+};
+
+/**
+ * @brief A MutexLock holds a Mutex for as long as it is in scope.
+ */
+class MutexLock {
+ public:
+  explicit MutexLock(Mutex *mu) : mu_(mu) {
+    mu_->Lock();
+  }
+
+  ~MutexLock() {
+    mu_->Unlock();
+  }
+
+ private:
+  Mutex *mu_;
+
+  // Not copyable.
+  MutexLock(const MutexLock&);
+  void operator=(const MutexLock&);
+};
+
+/**
+ * @brief A CondVar is a condition variable associated with a Mutex.
+ *
+ * This class is thread-safe.
+ */
+class CondVar {
+ public:
+  /**
+   * @brief Constructs a CondVar.
+   *
+   * @param mu The mutex that must be held when waiting on the CondVar.
+   */
+  explicit CondVar(Mutex *mu);
+  ~CondVar();
+
+  /**
+   * @brief Atomically releases the mutex and waits to be signalled. The mutex
+   *     is held again when this returns. May wake up spuriously.
+   */
+  void Wait();
+
+  /**
+   * @brief Like Wait() but gives up after the specified time.
+   *
+   * @param timeout_micros Maximum number of microseconds to wait.
+   * @return False iff the wait timed out.
+   */
+  bool TimedWait(int64_t timeout_micros);
+
+  /**
+   * @brief Wakes up one waiter.
+   */
+  void Signal();
+
+  /**
+   * @brief Wakes up all waiters.
+   */
+  void SignalAll();
+
+ private:
+  pthread_cond_t cv_;
+  Mutex *mu_;
+
+  // Not copyable.
+  CondVar(const CondVar&);
+  void operator=(const CondVar&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_MUTEX_H_
@@ -0,0 +1,78 @@
+/**
+ * @file mutex_test.cc
+ * @brief Unit tests for a Mutex and a CondVar.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "mutex.h"
+
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+struct Counter {
+  Counter() : cv(&mu), count(0), waiting(0) {}
+
+  Mutex mu;
+  CondVar cv;
+  int count;
+  int waiting;
+};
+
+void* Increment(void *arg) {
+  Counter *counter = static_cast<Counter*>(arg);
+  for (int i = 0; i < 10000; ++i) {
+    MutexLock l(&counter->mu);
+    ++counter->count;
+  }
+  return NULL;
+}
+
+void* WaitForCount(void *arg) {
+  Counter *counter = static_cast<Counter*>(arg);
+  MutexLock l(&counter->mu);
+  ++counter->waiting;
+  counter->cv.SignalAll();
+  while (counter->count == 0) {
+    counter->cv.Wait();
+  }
+  return NULL;
+}
+
+TEST(MutexTest, MutualExclusion) {
+  Counter counter;
+  pthread_t threads[4];
+  for (int i = 0; i < 4; ++i) {
+    pthread_create(&threads[i], NULL, &Increment, &counter);
+  }
+  for (int i = 0; i < 4; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  EXPECT_EQ(40000, counter.count);
+}
+
+TEST(CondVarTest, Signal) {
+  Counter counter;
+  pthread_t thread;
+  pthread_create(&thread, NULL, &WaitForCount, &counter);
+
+  {
+    MutexLock l(&counter.mu);
+    while (counter.waiting == 0) {
+      counter.cv.Wait();
+    }
+    counter.count = 1;
+    counter.cv.SignalAll();
+  }
+  pthread_join(thread, NULL);
+}
+
+TEST(CondVarTest, TimedWaitTimesOut) {
+  Counter counter;
+  MutexLock l(&counter.mu);
+  EXPECT_FALSE(counter.cv.TimedWait(1000));
+}
+
+}  // namespace kamiah
@@ -0,0 +1,52 @@
+/**
+ * @file protocol.cc
+ * @brief Implementation of the framing of Kamiah messages.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "protocol.h"
+
+#include <stdint.h>
+
+#include "wire_format.h"
+
+namespace kamiah {
+
+void AppendFrame(MessageType type, const string& payload, string *out) {
+  PutVarint64(payload.size() + 1, out);
+  out->push_back(static_cast<char>(type));
+  out->append(payload);
+}
+
+FrameStatus ParseFrame(const char *data, size_t size, Frame *frame) {
+  const char *p = data;
+  const char *limit = data + size;
+  uint64_t frame_size;
+  if (!GetVarint64(&p, limit, &frame_size)) {
+    // A varint never takes more than 10 bytes
+    return (size < 10) ? FRAME_INCOMPLETE : FRAME_INVALID;
+  }
+  if ((frame_size == 0) || (frame_size > kMaxFrameSize)) {
+    return FRAME_INVALID;
+  }
+  if (frame_size > static_cast<uint64_t>(limit - p)) {
+    return FRAME_INCOMPLETE;
+  }
+
+  frame->type = static_cast<MessageType>(static_cast<unsigned char>(*p));
+  frame->payload = p + 1;
+  frame->payload_size = frame_size - 1;
+  frame->frame_size = (p - data) + frame_size;
+  return FRAME_OK;
+}
+
+void UpdateFrameEncoder::Encode(DocID doc_id, const Diff& diff,
+                                string *out) const {
+  string payload;
+  PutVarint64(doc_id, &payload);
+  EncodeDiff(diff, &payload);
+  AppendFrame(MSG_UPDATE, payload, out);
+}
+
+}  // namespace kamiah
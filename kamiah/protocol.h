@@ -0,0 +1,137 @@
+/**
+ * @file protocol.h
+ * @brief Framing of the messages exchanged by Kamiah servers and clients.
+ *
+ * Every message is a frame:
+ *
+ *   size        varint, number of bytes of type and payload
+ *   type        one byte, a MessageType
+ *   payload     depends on the type, see MessageType
+ *
+ * Payloads use the encodings of wire_format.h.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_PROTOCOL_H_
+#define KAMIAH_PROTOCOL_H_
+
+#include <stddef.h>
+
+#include <string>
+
+#include "diff.h"
+#include "diff_encoder.h"
+#include "types.h"
+
+using std::string;
+
+namespace kamiah {
+
+// Largest frame that will be accepted.
+const size_t kMaxFrameSize = 16 * 1024 * 1024;
+
+enum MessageType {
+  // Client to server.
+
+  // Applies a diff. Payload: varint DocID, diff.
+  MSG_APPLY = 1,
+
+  // Starts streaming the updates of a Document, beginning with those from the
+  // specified version. Payload: varint DocID, signed varint version.
+  MSG_SUBSCRIBE = 2,
+
+  // Stops streaming the updates of a Document. Payload: varint DocID.
+  MSG_UNSUBSCRIBE = 3,
+
+  // Sent by a follower to replicate all the Documents of the server. The
+  // server answers with an MSG_DOCUMENT for each of them and an MSG_SYNCED,
+  // and then streams every diff it applies as an MSG_UPDATE. Payload: empty.
+  MSG_REPLICATE = 4,
+
+  // Server to client.
+
+  // Result of an MSG_APPLY. Payload: varint DocID, signed varint version of
+  // the applied diff, -1 if it could not be applied.
+  MSG_APPLIED = 16,
+
+  // A diff applied to a subscribed Document. Payload: varint DocID, diff.
+  MSG_UPDATE = 17,
+
+  // The cached updates of a subscribed Document. Payload: varint DocID,
+  // batch of updates.
+  MSG_UPDATES = 18,
+
+  // The full contents of a subscribed Document, sent when the requested
+  // updates are no longer cached. Payload: varint DocID, signed varint
+  // version, varint data size, data.
+  MSG_DATA = 19,
+
+  // The state of a replicated Document. Documents larger than a frame are
+  // split: the data that does not fit follows in MSG_DOCUMENT_DATA frames.
+  // Payload: varint DocID, signed varint version, varint data size, batch of
+  // the cached updates, the first bytes of the data.
+  MSG_DOCUMENT = 20,
+
+  // Every Document was sent to the follower, the updates that follow are
+  // those applied from now on. Payload: empty.
+  MSG_SYNCED = 21,
+
+  // The next bytes of the data of the Document of the last MSG_DOCUMENT.
+  // Payload: the bytes.
+  MSG_DOCUMENT_DATA = 22
+};
+
+enum FrameStatus {
+  FRAME_OK,
+  FRAME_INCOMPLETE,
+  FRAME_INVALID
+};
+
+/**
+ * @brief A parsed frame. The payload references the buffer it was parsed
+ *     from.
+ */
+struct Frame {
+  MessageType type;
+  const char *payload;
+  size_t payload_size;
+
+  // Total number of bytes of the frame, including its header.
+  size_t frame_size;
+};
+
+/**
+ * @brief Appends a frame to a string.
+ *
+ * @param type The type of the message.
+ * @param payload The payload of the message.
+ * @param out String to append the frame to.
+ */
+void AppendFrame(MessageType type, const string& payload, string *out);
+
+/**
+ * @brief Parses the frame at the start of a buffer.
+ *
+ * @param data The start of the buffer.
+ * @param size The number of bytes in the buffer.
+ * @param frame Where to write the frame.
+ * @return FRAME_OK if a frame was parsed, FRAME_INCOMPLETE if more bytes are
+ *     needed, or FRAME_INVALID if the buffer does not start with a frame.
+ */
+FrameStatus ParseFrame(const char *data, size_t size, Frame *frame);
+
+/**
+ * @brief An UpdateFrameEncoder encodes a diff as a complete MSG_UPDATE frame
+ *     so that it can be written to sockets as is.
+ *
+ * This class is thread-safe.
+ */
+class UpdateFrameEncoder : public DiffEncoder {
+ public:
+  virtual void Encode(DocID doc_id, const Diff& diff, string *out) const;
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_PROTOCOL_H_
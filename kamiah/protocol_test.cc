@@ -0,0 +1,87 @@
+/**
+ * @file protocol_test.cc
+ * @brief Unit tests for the framing of Kamiah messages.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "protocol.h"
+
+#include "wire_format.h"
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+TEST(ProtocolTest, RoundTrip) {
+  string data;
+  AppendFrame(MSG_APPLY, "hello", &data);
+  AppendFrame(MSG_UNSUBSCRIBE, "", &data);
+
+  Frame frame;
+  ASSERT_EQ(FRAME_OK, ParseFrame(data.data(), data.size(), &frame));
+  EXPECT_EQ(MSG_APPLY, frame.type);
+  EXPECT_EQ("hello", string(frame.payload, frame.payload_size));
+  EXPECT_EQ(7u, frame.frame_size);
+
+  ASSERT_EQ(FRAME_OK, ParseFrame(data.data() + frame.frame_size,
+                                 data.size() - frame.frame_size, &frame));
+  EXPECT_EQ(MSG_UNSUBSCRIBE, frame.type);
+  EXPECT_EQ(0u, frame.payload_size);
+  EXPECT_EQ(2u, frame.frame_size);
+}
+
+TEST(ProtocolTest, Incomplete) {
+  string data;
+  AppendFrame(MSG_APPLY, string(300, 'a'), &data);
+
+  Frame frame;
+  for (size_t size = 0; size < data.size(); ++size) {
+    EXPECT_EQ(FRAME_INCOMPLETE, ParseFrame(data.data(), size, &frame));
+  }
+  EXPECT_EQ(FRAME_OK, ParseFrame(data.data(), data.size(), &frame));
+  EXPECT_EQ(300u, frame.payload_size);
+}
+
+TEST(ProtocolTest, Invalid) {
+  Frame frame;
+
+  // Empty frame, no type
+  string data(1, '\0');
+  EXPECT_EQ(FRAME_INVALID, ParseFrame(data.data(), data.size(), &frame));
+
+  // Too large
+  data.clear();
+  PutVarint64(kMaxFrameSize + 1, &data);
+  EXPECT_EQ(FRAME_INVALID, ParseFrame(data.data(), data.size(), &frame));
+
+  // Size that never ends
+  data.assign(11, '\xff');
+  EXPECT_EQ(FRAME_INVALID, ParseFrame(data.data(), data.size(), &frame));
+}
+
+TEST(ProtocolTest, UpdateFrameEncoder) {
+  UpdateFrameEncoder encoder;
+  Diff diff(3, "abc");
+  diff.set_version(7);
+  string data;
+  encoder.Encode(42, diff, &data);
+
+  Frame frame;
+  ASSERT_EQ(FRAME_OK, ParseFrame(data.data(), data.size(), &frame));
+  EXPECT_EQ(data.size(), frame.frame_size);
+  EXPECT_EQ(MSG_UPDATE, frame.type);
+
+  const char *p = frame.payload;
+  const char *limit = p + frame.payload_size;
+  uint64_t doc_id;
+  DiffView view;
+  ASSERT_TRUE(GetVarint64(&p, limit, &doc_id));
+  ASSERT_TRUE(DecodeDiff(&p, limit, &view));
+  EXPECT_EQ(limit, p);
+  EXPECT_EQ(42u, doc_id);
+  EXPECT_EQ(7, view.version);
+  EXPECT_EQ(3, view.index);
+  EXPECT_EQ("abc", string(view.text, view.text_size));
+}
+
+}  // namespace kamiah
@@ -0,0 +1,330 @@
+/**
+ * @file recovery.cc
+ * @brief Implementation of the recovery of a DocumentStore.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "recovery.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "diff_log.h"
+#include "mutex.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "thread_pool.h"
+#include "util.h"
+#include "wire_format.h"
+
+using std::max;
+using std::min;
+using std::stable_sort;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+// Tasks scheduled per thread, so that threads that finish early take on the
+// work of the others.
+const int kTasksPerThread = 4;
+
+// Number of Documents loaded or records replayed between progress reports.
+const int64_t kProgressInterval = 4096;
+
+struct Record {
+  DocID doc_id;
+  DiffView diff;
+};
+
+bool CompareDocIDs(const Record& a, const Record& b) {
+  return a.doc_id < b.doc_id;
+}
+
+// Progress shared by the tasks of a recovery.
+class Progress {
+ public:
+  Progress(RecoveryObserver *observer, RecoveryStats *stats)
+      : observer_(observer), stats_(stats), ok_(true) {}
+
+  void AddLoaded(int64_t documents, int64_t bytes, bool ok) {
+    MutexLock l(&mu_);
+    stats_->documents_loaded += documents;
+    stats_->bytes_loaded += bytes;
+    ok_ = ok_ && ok;
+    Report();
+  }
+
+  void AddReplayed(int64_t records, int64_t diffs, bool ok) {
+    MutexLock l(&mu_);
+    stats_->records_replayed += records;
+    stats_->diffs_applied += diffs;
+    ok_ = ok_ && ok;
+    Report();
+  }
+
+  bool ok() {
+    MutexLock l(&mu_);
+    return ok_;
+  }
+
+ private:
+  void Report() {
+    if (observer_ != NULL) {
+      observer_->OnRecoveryProgress(*stats_);
+    }
+  }
+
+  Mutex mu_;
+  RecoveryObserver *observer_;
+  RecoveryStats *stats_;
+  bool ok_;
+};
+
+// Loads some of the Documents of a snapshot.
+class LoadTask : public Task {
+ public:
+  LoadTask(const Snapshot *snapshot, const DocID *doc_ids, size_t size,
+           vector<Document*> *docs, Progress *progress)
+      : snapshot_(snapshot), doc_ids_(doc_ids), size_(size), docs_(docs),
+        progress_(progress) {}
+
+  virtual void Run() {
+    docs_->reserve(size_);
+    int64_t loaded = 0;
+    int64_t bytes = 0;
+    for (size_t i = 0; i < size_; ++i) {
+      // The Documents are in the snapshot, so they only fail to load if
+      // their entries are corrupted
+      Document *doc = snapshot_->Load(doc_ids_[i]);
+      if (doc == NULL) {
+        progress_->AddLoaded(loaded, bytes, false);
+        return;
+      }
+      docs_->push_back(doc);
+      bytes += doc->size();
+      if (++loaded == kProgressInterval) {
+        progress_->AddLoaded(loaded, bytes, true);
+        loaded = 0;
+        bytes = 0;
+      }
+    }
+    progress_->AddLoaded(loaded, bytes, true);
+  }
+
+ private:
+  const Snapshot *snapshot_;
+  const DocID *doc_ids_;
+  size_t size_;
+  vector<Document*> *docs_;
+  Progress *progress_;
+};
+
+// Sorts the records of a partition by DocID, keeping the order of those of
+// each Document.
+class SortTask : public Task {
+ public:
+  explicit SortTask(vector<Record> *records) : records_(records) {}
+
+  virtual void Run() {
+    stable_sort(records_->begin(), records_->end(), &CompareDocIDs);
+  }
+
+ private:
+  vector<Record> *records_;
+};
+
+// Replays the sorted records of a partition. docs has the Document of each
+// run of records with the same DocID.
+class ReplayTask : public Task {
+ public:
+  ReplayTask(const vector<Record>& records, const vector<Document*>& docs,
+             Progress *progress)
+      : records_(records), docs_(docs), progress_(progress) {}
+
+  virtual void Run() {
+    int64_t replayed = 0;
+    int64_t applied = 0;
+    size_t run = 0;
+    for (size_t i = 0; i < records_.size(); ++i) {
+      if ((i > 0) && (records_[i].doc_id != records_[i - 1].doc_id)) {
+        ++run;
+      }
+      Document *doc = docs_[run];
+      const DiffView& view = records_[i].diff;
+      if (view.version > doc->version()) {
+        Diff diff = view.ToDiff();
+        if ((view.version != doc->version() + 1) || !doc->ApplyDiff(&diff)) {
+          progress_->AddReplayed(replayed, applied, false);
+          return;
+        }
+        ++applied;
+      }
+      if (++replayed == kProgressInterval) {
+        progress_->AddReplayed(replayed, applied, true);
+        replayed = 0;
+        applied = 0;
+      }
+    }
+    progress_->AddReplayed(replayed, applied, true);
+  }
+
+ private:
+  const vector<Record>& records_;
+  const vector<Document*>& docs_;
+  Progress *progress_;
+};
+
+// Reads all the records of a log into partitions by DocID. The readers must
+// outlive the records. Returns false if the log is corrupted.
+bool ReadLog(const string& path, vector<DiffLogReader*> *readers,
+             vector<vector<Record> > *partitions, RecoveryStats *stats) {
+  DiffLogReader *reader = DiffLogReader::Open(path);
+  if (reader == NULL) {
+    return false;
+  }
+  readers->push_back(reader);
+
+  Record record;
+  while (reader->Next(&record.doc_id, &record.diff)) {
+    uint64_t partition =
+        static_cast<uint64_t>(record.doc_id) % partitions->size();
+    (*partitions)[partition].push_back(record);
+    ++stats->records_to_replay;
+  }
+  stats->log_bytes += reader->offset();
+  return !reader->corrupted();
+}
+
+// Schedules tasks to load Documents of a snapshot, in as many slices as
+// there are slots in docs.
+void ScheduleLoads(const Snapshot *snapshot, const vector<DocID>& doc_ids,
+                   vector<vector<Document*> > *docs, Progress *progress,
+                   ThreadPool *pool) {
+  size_t slice = (doc_ids.size() + docs->size() - 1) / docs->size();
+  for (size_t i = 0; i * slice < doc_ids.size(); ++i) {
+    size_t size = min(slice, doc_ids.size() - i * slice);
+    pool->Schedule(new LoadTask(snapshot, &doc_ids[i * slice], size,
+                                &(*docs)[i], progress));
+  }
+}
+
+}  // namespace
+
+RecoveryStats::RecoveryStats()
+    : documents_to_load(0), documents_loaded(0), bytes_loaded(0),
+      records_to_replay(0), records_replayed(0), diffs_applied(0),
+      log_bytes(0), load_micros(0), replay_micros(0) {
+}
+
+RecoveryOptions::RecoveryOptions()
+    : num_threads(static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN))),
+      load_all_documents(true), observer(NULL) {
+}
+
+bool Recover(const string& snapshot_path, const string& diff_log_path,
+             const RecoveryOptions& options, DocumentStore *store,
+             RecoveryStats *stats) {
+  *stats = RecoveryStats();
+  if (store->size() != 0) {
+    return false;
+  }
+
+  const Snapshot *snapshot = NULL;
+  if (!snapshot_path.empty() && (access(snapshot_path.c_str(), F_OK) == 0)) {
+    Snapshot *opened = Snapshot::Open(snapshot_path);
+    if (opened == NULL) {
+      return false;
+    }
+    store->LoadSnapshot(opened);
+    snapshot = opened;
+  }
+
+  ThreadPool pool(max(options.num_threads, 1));
+  size_t num_tasks = pool.num_threads() * kTasksPerThread;
+  Progress progress(options.observer, stats);
+
+  // Read the log, including the part a snapshot that was interrupted did not
+  // drop
+  int64_t start = NowMicros();
+  vector<DiffLogReader*> readers;
+  vector<vector<Record> > partitions(num_tasks);
+  bool ok = true;
+  if (!diff_log_path.empty()) {
+    ok = ReadLog(DiffLog::RotatedPath(diff_log_path), &readers, &partitions,
+                 stats) &&
+        ReadLog(diff_log_path, &readers, &partitions, stats);
+  }
+  int64_t read_micros = NowMicros() - start;
+
+  // Load the snapshot while the partitions are sorted. When only the
+  // Documents in the log are loaded, they are only known once sorted.
+  start = NowMicros();
+  vector<DocID> doc_ids;
+  vector<vector<Document*> > loaded(num_tasks);
+  if (ok) {
+    for (size_t i = 0; i < partitions.size(); ++i) {
+      pool.Schedule(new SortTask(&partitions[i]));
+    }
+    if ((snapshot != NULL) && options.load_all_documents) {
+      snapshot->GetDocIDs(&doc_ids);
+      stats->documents_to_load = doc_ids.size();
+      ScheduleLoads(snapshot, doc_ids, &loaded, &progress, &pool);
+    }
+    pool.Wait();
+    if ((snapshot != NULL) && !options.load_all_documents) {
+      for (size_t i = 0; i < partitions.size(); ++i) {
+        for (size_t j = 0; j < partitions[i].size(); ++j) {
+          DocID doc_id = partitions[i][j].doc_id;
+          if (((j == 0) || (doc_id != partitions[i][j - 1].doc_id)) &&
+              snapshot->Contains(doc_id)) {
+            doc_ids.push_back(doc_id);
+          }
+        }
+      }
+      stats->documents_to_load = doc_ids.size();
+      if (!doc_ids.empty()) {
+        ScheduleLoads(snapshot, doc_ids, &loaded, &progress, &pool);
+        pool.Wait();
+      }
+    }
+    for (size_t i = 0; i < loaded.size(); ++i) {
+      for (size_t j = 0; j < loaded[i].size(); ++j) {
+        store->Add(loaded[i][j]);
+      }
+    }
+    ok = progress.ok();
+  }
+  stats->load_micros = NowMicros() - start;
+
+  // Replay each partition on its own thread
+  start = NowMicros();
+  vector<vector<Document*> > docs(num_tasks);
+  if (ok) {
+    for (size_t i = 0; i < partitions.size(); ++i) {
+      for (size_t j = 0; j < partitions[i].size(); ++j) {
+        DocID doc_id = partitions[i][j].doc_id;
+        if ((j == 0) || (doc_id != partitions[i][j - 1].doc_id)) {
+          docs[i].push_back(store->GetOrCreate(doc_id));
+        }
+      }
+      if (!partitions[i].empty()) {
+        pool.Schedule(new ReplayTask(partitions[i], docs[i], &progress));
+      }
+    }
+    pool.Wait();
+    ok = progress.ok();
+  }
+  stats->replay_micros = read_micros + NowMicros() - start;
+
+  for (size_t i = 0; i < readers.size(); ++i) {
+    delete readers[i];
+  }
+  return ok;
+}
+
+}  // namespace kamiah
@@ -0,0 +1,114 @@
+/**
+ * @file recovery.h
+ * @brief Recovery of a DocumentStore from a Snapshot and a DiffLog using all
+ *     the cores of a node.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_RECOVERY_H_
+#define KAMIAH_RECOVERY_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "document_store.h"
+
+using std::string;
+
+namespace kamiah {
+
+/**
+ * @brief Progress of a recovery. All the counts are totals so far.
+ */
+struct RecoveryStats {
+  RecoveryStats();
+
+  // Documents of the snapshot to load, and those loaded so far along with
+  // the size of their text.
+  int64_t documents_to_load;
+  int64_t documents_loaded;
+  int64_t bytes_loaded;
+
+  // Records read from the log, those replayed so far and the diffs they
+  // applied. Records the snapshot already covers are replayed but do not
+  // apply a diff.
+  int64_t records_to_replay;
+  int64_t records_replayed;
+  int64_t diffs_applied;
+
+  // Size of the records read from the log.
+  int64_t log_bytes;
+
+  // Time spent loading the snapshot, and reading and replaying the log.
+  int64_t load_micros;
+  int64_t replay_micros;
+};
+
+/**
+ * @brief A RecoveryObserver is notified as a recovery progresses.
+ */
+class RecoveryObserver {
+ public:
+  virtual ~RecoveryObserver() {}
+
+  /**
+   * @brief Called periodically while Documents are loaded and diffs are
+   *     replayed. Calls are made from the recovery threads, but never
+   *     concurrently.
+   *
+   * @param stats The progress of the recovery.
+   */
+  virtual void OnRecoveryProgress(const RecoveryStats& stats) = 0;
+};
+
+/**
+ * @brief Options of a recovery.
+ */
+struct RecoveryOptions {
+  RecoveryOptions();
+
+  // Number of threads to load and replay with. Defaults to the number of
+  // cores of the node.
+  int num_threads;
+
+  // Whether to load every Document of the snapshot. Otherwise only those
+  // with diffs in the log are loaded, and the rest are loaded by the store
+  // when they are first accessed.
+  bool load_all_documents;
+
+  // Observer notified of the progress of the recovery, or NULL. Not owned.
+  RecoveryObserver *observer;
+};
+
+/**
+ * @brief Recovers the Documents of a node from its latest snapshot and the
+ *     tail of its log, the equivalent of DocumentStore::LoadSnapshot()
+ *     followed by ReplayDiffLog().
+ *
+ * The Documents of the snapshot are loaded in parallel. The records of the
+ * log are then partitioned by DocID and each partition is replayed by one
+ * thread, applying the diffs of each Document in a single batch. The order
+ * of the diffs of every Document is preserved.
+ *
+ * The store must be empty and have no observers, since the Documents are
+ * edited from several threads.
+ *
+ * @param snapshot_path The path of the snapshot, or empty if there is none.
+ *     A snapshot that does not exist is empty.
+ * @param diff_log_path The path of the log, or empty if there is none.
+ * @param options The options of the recovery.
+ * @param store The store to recover the Documents into.
+ * @param stats Where to write the final progress of the recovery.
+ * @return True iff the store was recovered. False if it was not empty, the
+ *     snapshot or the log could not be read or are corrupted, or a diff
+ *     could not be applied.
+ */
+bool Recover(const string& snapshot_path, const string& diff_log_path,
+             const RecoveryOptions& options, DocumentStore *store,
+             RecoveryStats *stats);
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_RECOVERY_H_
@@ -0,0 +1,269 @@
+/**
+ * @file recovery_test.cc
+ * @brief Unit tests for the recovery of a DocumentStore.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "recovery.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "diff_log.h"
+#include "snapshot.h"
+#include "store_test_util.h"
+#include "gtest/gtest.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+class RecoveryTest : public StoreFilesTest {
+ protected:
+  RecoveryTest() : StoreFilesTest("recovery_test") {}
+
+  // Starts logging the diffs applied to a store.
+  DiffLog* StartLog(DocumentStore *store) {
+    DiffLog *log = DiffLog::Open(log_path_, DiffLogOptions());
+    EXPECT_TRUE(log != NULL);
+    store->AddObserver(log);
+    return log;
+  }
+
+  static void StopLog(DocumentStore *store, DiffLog *log) {
+    store->RemoveObserver(log);
+    delete log;
+  }
+
+  // Makes random edits to the Documents of a store.
+  static void RandomEdits(DocumentStore *store, int num_docs, int num_edits) {
+    for (int i = 0; i < num_edits; ++i) {
+      Document *doc = store->GetOrCreate(rand() % num_docs);
+      Index index = rand() % (doc->size() + 1);
+      if ((doc->size() == 0) || (rand() % 3 != 0)) {
+        Diff diff(index, string(1 + rand() % 10, 'a' + i % 26));
+        EXPECT_TRUE(doc->ApplyDiff(&diff));
+      } else {
+        Diff diff(index, 1 + rand() % 10);
+        EXPECT_TRUE(doc->ApplyDiff(&diff));
+      }
+    }
+  }
+
+  // Checks that two stores have the same Documents.
+  static void ExpectSameDocuments(const DocumentStore& expected,
+                                  const DocumentStore& actual) {
+    vector<DocID> expected_ids;
+    expected.GetDocIDs(&expected_ids);
+    vector<DocID> actual_ids;
+    actual.GetDocIDs(&actual_ids);
+    ASSERT_EQ(expected_ids, actual_ids);
+    for (size_t i = 0; i < expected_ids.size(); ++i) {
+      const Document *expected_doc = expected.Get(expected_ids[i]);
+      const Document *actual_doc = actual.Get(actual_ids[i]);
+      ASSERT_TRUE(actual_doc != NULL);
+      EXPECT_EQ(expected_doc->version(), actual_doc->version());
+      EXPECT_EQ(GetData(expected_doc), GetData(actual_doc));
+    }
+  }
+};
+
+// Records the progress reported by a recovery.
+class ProgressRecorder : public RecoveryObserver {
+ public:
+  virtual void OnRecoveryProgress(const RecoveryStats& stats) {
+    progress.push_back(stats);
+  }
+
+  vector<RecoveryStats> progress;
+};
+
+TEST_F(RecoveryTest, Empty) {
+  DocumentStore store;
+  RecoveryStats stats;
+  EXPECT_TRUE(Recover(snapshot_path_, log_path_, RecoveryOptions(), &store,
+                      &stats));
+  EXPECT_EQ(0U, store.size());
+  EXPECT_EQ(0, stats.documents_loaded);
+  EXPECT_EQ(0, stats.records_replayed);
+
+  // Neither a snapshot nor a log
+  EXPECT_TRUE(Recover("", "", RecoveryOptions(), &store, &stats));
+  EXPECT_EQ(0U, store.size());
+}
+
+TEST_F(RecoveryTest, SnapshotAndLog) {
+  srand(39);
+  DocumentStore store;
+  DiffLog *log = StartLog(&store);
+  RandomEdits(&store, 50, 2000);
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+
+  // The log has both the diffs in the snapshot and those after it
+  RandomEdits(&store, 60, 2000);
+  StopLog(&store, log);
+
+  RecoveryOptions options;
+  options.num_threads = 4;
+  DocumentStore recovered;
+  RecoveryStats stats;
+  ASSERT_TRUE(Recover(snapshot_path_, log_path_, options, &recovered, &stats));
+  ExpectSameDocuments(store, recovered);
+  EXPECT_EQ(recovered.size(), recovered.num_loaded());
+
+  EXPECT_EQ(50, stats.documents_to_load);
+  EXPECT_EQ(50, stats.documents_loaded);
+  EXPECT_LT(0, stats.bytes_loaded);
+  EXPECT_EQ(4000, stats.records_to_replay);
+  EXPECT_EQ(4000, stats.records_replayed);
+  EXPECT_EQ(2000, stats.diffs_applied);
+  EXPECT_LT(0, stats.log_bytes);
+}
+
+TEST_F(RecoveryTest, SameAsSequentialReplay) {
+  srand(3939);
+  DocumentStore store;
+  DiffLog *log = StartLog(&store);
+  RandomEdits(&store, 100, 5000);
+  StopLog(&store, log);
+
+  DocumentStore replayed;
+  EXPECT_EQ(5000, ReplayDiffLog(log_path_, &replayed));
+
+  for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+    RecoveryOptions options;
+    options.num_threads = num_threads;
+    DocumentStore recovered;
+    RecoveryStats stats;
+    ASSERT_TRUE(Recover("", log_path_, options, &recovered, &stats));
+    ExpectSameDocuments(replayed, recovered);
+    EXPECT_EQ(5000, stats.diffs_applied);
+  }
+}
+
+TEST_F(RecoveryTest, LoadOnlyDocumentsInLog) {
+  DocumentStore store;
+  Insert(&store, 1, "papaya");
+  Insert(&store, 2, "kamiah");
+  Insert(&store, 3, "kapoho");
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+  DiffLog *log = StartLog(&store);
+  Insert(&store, 2, "ide ");
+  Insert(&store, 4, "new");
+  StopLog(&store, log);
+
+  RecoveryOptions options;
+  options.load_all_documents = false;
+  DocumentStore recovered;
+  RecoveryStats stats;
+  ASSERT_TRUE(Recover(snapshot_path_, log_path_, options, &recovered, &stats));
+  EXPECT_EQ(1, stats.documents_loaded);
+  EXPECT_EQ(2U, recovered.num_loaded());
+  ExpectSameDocuments(store, recovered);
+}
+
+TEST_F(RecoveryTest, ReportsProgress) {
+  srand(3);
+  DocumentStore store;
+  RandomEdits(&store, 10000, 10000);
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+
+  ProgressRecorder recorder;
+  RecoveryOptions options;
+  options.num_threads = 2;
+  options.observer = &recorder;
+  DocumentStore recovered;
+  RecoveryStats stats;
+  ASSERT_TRUE(Recover(snapshot_path_, "", options, &recovered, &stats));
+  EXPECT_EQ(static_cast<int64_t>(store.size()), stats.documents_loaded);
+
+  // Progress only goes forward and ends at the final stats
+  ASSERT_LT(1U, recorder.progress.size());
+  for (size_t i = 1; i < recorder.progress.size(); ++i) {
+    EXPECT_LE(recorder.progress[i - 1].documents_loaded,
+              recorder.progress[i].documents_loaded);
+  }
+  EXPECT_EQ(stats.documents_loaded,
+            recorder.progress.back().documents_loaded);
+  EXPECT_EQ(stats.bytes_loaded, recorder.progress.back().bytes_loaded);
+}
+
+TEST_F(RecoveryTest, Failures) {
+  DocumentStore store;
+  DiffLog *log = StartLog(&store);
+  Insert(&store, 1, "papaya");
+  Insert(&store, 1, "kamiah");
+  StopLog(&store, log);
+
+  // The store must be empty
+  RecoveryStats stats;
+  EXPECT_FALSE(Recover("", log_path_, RecoveryOptions(), &store, &stats));
+
+  // A snapshot that is not valid
+  FILE *file = fopen(snapshot_path_.c_str(), "w");
+  ASSERT_TRUE(file != NULL);
+  fputs("papaya", file);
+  fclose(file);
+  DocumentStore recovered;
+  EXPECT_FALSE(Recover(snapshot_path_, log_path_, RecoveryOptions(),
+                       &recovered, &stats));
+  unlink(snapshot_path_.c_str());
+
+  // A Document of the snapshot that is corrupted
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+  CorruptSnapshot("kamiah");
+  for (int load_all = 0; load_all < 2; ++load_all) {
+    RecoveryOptions options;
+    options.load_all_documents = (load_all == 1);
+    DocumentStore not_loaded;
+    EXPECT_FALSE(Recover(snapshot_path_, log_path_, options, &not_loaded,
+                         &stats));
+  }
+  unlink(snapshot_path_.c_str());
+
+  // A Document of the snapshot that is ahead of the log
+  DocumentStore other;
+  Insert(&other, 1, "x");
+  Insert(&other, 1, "y");
+  Insert(&other, 1, "z");
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, other));
+  DocumentStore ahead;
+  EXPECT_TRUE(Recover(snapshot_path_, log_path_, RecoveryOptions(), &ahead,
+                      &stats));
+  EXPECT_EQ(0, stats.diffs_applied);
+
+  // A log with a gap in the versions of a Document
+  RemoveFiles();
+  DocumentStore gap;
+  Insert(&gap, 2, "x");
+  DiffLog *gap_log = StartLog(&gap);
+  Insert(&gap, 2, "y");
+  StopLog(&gap, gap_log);
+  DocumentStore failed;
+  EXPECT_FALSE(Recover(snapshot_path_, log_path_, RecoveryOptions(), &failed,
+                       &stats));
+
+  // A log with a corrupted record before others
+  RemoveFiles();
+  DocumentStore corrupted;
+  DiffLog *corrupted_log = StartLog(&corrupted);
+  Insert(&corrupted, 3, "papaya");
+  Insert(&corrupted, 3, "kamiah");
+  StopLog(&corrupted, corrupted_log);
+  file = fopen(log_path_.c_str(), "r+");
+  ASSERT_TRUE(file != NULL);
+  fseek(file, 5, SEEK_SET);
+  fputc('x', file);
+  fclose(file);
+  DocumentStore not_recovered;
+  EXPECT_FALSE(Recover("", log_path_, RecoveryOptions(), &not_recovered,
+                       &stats));
+}
+
+}  // namespace kamiah
@@ -0,0 +1,51 @@
+/**
+ * @file scheduler.cc
+ * @brief Implementation of a Scheduler.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "scheduler.h"
+
+namespace kamiah {
+
+Scheduler::Scheduler() {
+}
+
+Scheduler::~Scheduler() {
+  for (deque<Task*>::iterator it = tasks_.begin(); it != tasks_.end(); ++it) {
+    delete *it;
+  }
+}
+
+void Scheduler::Schedule(Task *task) {
+  tasks_.push_back(task);
+}
+
+bool Scheduler::RunOne() {
+  if (tasks_.empty()) {
+    return false;
+  }
+
+  // Pop before running since the task may schedule more tasks
+  Task *task = tasks_.front();
+  tasks_.pop_front();
+  task->Run();
+  delete task;
+
+  return true;
+}
+
+size_t Scheduler::RunUntilIdle() {
+  size_t num_run = 0;
+  while (RunOne()) {
+    ++num_run;
+  }
+  return num_run;
+}
+
+size_t Scheduler::pending() const {
+  return tasks_.size();
+}
+
+}  // namespace kamiah
@@ -0,0 +1,90 @@
+/**
+ * @file scheduler.h
+ * @brief Definition of a Task and a Scheduler to run them.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_SCHEDULER_H_
+#define KAMIAH_SCHEDULER_H_
+
+#include <stddef.h>
+
+#include <deque>
+
+using std::deque;
+
+namespace kamiah {
+
+/**
+ * @brief A Task is a unit of work that can be run by a Scheduler.
+ */
+class Task {
+ public:
+  virtual ~Task() {}
+
+  /**
+   * @brief Runs the task.
+   */
+  virtual void Run() = 0;
+};
+
+/**
+ * @brief A Scheduler runs Tasks in FIFO order on the thread that drives it.
+ *
+ * The Scheduler never blocks: a caller (usually the event loop of the server
+ * hosting Kamiah) calls RunOne() or RunUntilIdle() whenever it has time to do
+ * work. Tasks scheduled while another task is running are run after it.
+ *
+ * This class is thread-compatible.
+ */
+class Scheduler {
+ public:
+  Scheduler();
+
+  /**
+   * @brief Destroys the Scheduler and all tasks that have not been run.
+   */
+  ~Scheduler();
+
+  /**
+   * @brief Schedules the specified task to run.
+   *
+   * @param task The task to run. The Scheduler takes ownership of it and
+   *     deletes it after it has been run.
+   */
+  void Schedule(Task *task);
+
+  /**
+   * @brief Runs the oldest pending task, if any.
+   *
+   * @return True iff a task was run.
+   */
+  bool RunOne();
+
+  /**
+   * @brief Runs tasks until there are no more pending tasks. This includes
+   *     tasks scheduled by the tasks being run.
+   *
+   * @return The number of tasks that were run.
+   */
+  size_t RunUntilIdle();
+
+  /**
+   * @brief Gets the number of tasks waiting to be run.
+   *
+   * @return The number of tasks waiting to be run.
+   */
+  size_t pending() const;
+
+ private:
+  deque<Task*> tasks_;
+
+  // Not copyable.
+  Scheduler(const Scheduler&);
+  void operator=(const Scheduler&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_SCHEDULER_H_
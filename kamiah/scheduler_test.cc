@@ -0,0 +1,112 @@
+/**
+ * @file scheduler_test.cc
+ * @brief Unit tests for a Scheduler.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "scheduler.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::vector;
+
+namespace kamiah {
+
+// Task that records its ID when run and optionally schedules another task.
+class RecordingTask : public Task {
+ public:
+  RecordingTask(int id, vector<int> *ran, Scheduler *scheduler, Task *next)
+      : id_(id), ran_(ran), scheduler_(scheduler), next_(next) {
+  }
+
+  virtual void Run() {
+    ran_->push_back(id_);
+    if (next_ != NULL) {
+      scheduler_->Schedule(next_);
+    }
+  }
+
+ private:
+  int id_;
+  vector<int> *ran_;
+  Scheduler *scheduler_;
+  Task *next_;
+};
+
+// Task that counts how many of its kind are alive.
+class CountedTask : public Task {
+ public:
+  explicit CountedTask(int *alive) : alive_(alive) {
+    ++*alive_;
+  }
+
+  virtual ~CountedTask() {
+    --*alive_;
+  }
+
+  virtual void Run() {}
+
+ private:
+  int *alive_;
+};
+
+TEST(SchedulerTest, InitiallyIdle) {
+  Scheduler scheduler;
+
+  EXPECT_EQ(0U, scheduler.pending());
+  EXPECT_FALSE(scheduler.RunOne());
+  EXPECT_EQ(0U, scheduler.RunUntilIdle());
+}
+
+TEST(SchedulerTest, RunsInOrder) {
+  Scheduler scheduler;
+  vector<int> ran;
+  scheduler.Schedule(new RecordingTask(1, &ran, &scheduler, NULL));
+  scheduler.Schedule(new RecordingTask(2, &ran, &scheduler, NULL));
+  EXPECT_EQ(2U, scheduler.pending());
+
+  EXPECT_TRUE(scheduler.RunOne());
+  ASSERT_EQ(1U, ran.size());
+  EXPECT_EQ(1, ran[0]);
+  EXPECT_EQ(1U, scheduler.pending());
+
+  EXPECT_EQ(1U, scheduler.RunUntilIdle());
+  ASSERT_EQ(2U, ran.size());
+  EXPECT_EQ(2, ran[1]);
+}
+
+TEST(SchedulerTest, TasksScheduledByTasksRunAfter) {
+  Scheduler scheduler;
+  vector<int> ran;
+  Task *third = new RecordingTask(3, &ran, &scheduler, NULL);
+  scheduler.Schedule(new RecordingTask(1, &ran, &scheduler, third));
+  scheduler.Schedule(new RecordingTask(2, &ran, &scheduler, NULL));
+
+  EXPECT_EQ(3U, scheduler.RunUntilIdle());
+  ASSERT_EQ(3U, ran.size());
+  EXPECT_EQ(1, ran[0]);
+  EXPECT_EQ(2, ran[1]);
+  EXPECT_EQ(3, ran[2]);
+}
+
+TEST(SchedulerTest, DeletesTasks) {
+  int alive = 0;
+  {
+    Scheduler scheduler;
+    scheduler.Schedule(new CountedTask(&alive));
+    scheduler.Schedule(new CountedTask(&alive));
+    EXPECT_EQ(2, alive);
+
+    // Ran tasks are deleted
+    EXPECT_TRUE(scheduler.RunOne());
+    EXPECT_EQ(1, alive);
+  }
+
+  // Pending tasks are deleted with the scheduler
+  EXPECT_EQ(0, alive);
+}
+
+}  // namespace kamiah
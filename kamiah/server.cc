@@ -0,0 +1,1468 @@
+/**
+ * @file server.cc
+ * @brief Implementation of a Server.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+#include <set>
+
+#include "shared_buffer.h"
+#include "shm_channel.h"
+#include "util.h"
+#include "wire_format.h"
+
+using std::deque;
+using std::min;
+using std::numeric_limits;
+using std::set;
+
+namespace kamiah {
+
+namespace {
+
+// Number of bytes read from a connection at a time.
+const size_t kReadSize = 64 * 1024;
+
+// Maximum number of events handled per iteration of the event loop.
+const int kMaxEvents = 256;
+
+// Maximum number of buffers written to a connection per system call.
+const int kMaxIovecs = 64;
+
+// Identify the listening sockets and the wake-up eventfd in epoll events.
+// Connections are identified by their pointer.
+char listen_marker;
+char websocket_listen_marker;
+char shm_listen_marker;
+char wake_marker;
+
+// Status code of the close frames sent on protocol errors.
+const uint16_t kWebSocketProtocolError = 1002;
+
+// Largest number of bytes of data of a Document sent to a follower per frame.
+// The cached updates are only sent along if they are not larger than this
+// either.
+const size_t kDocumentChunkSize = 1024 * 1024;
+
+}  // namespace
+
+class Server::Connection : public UpdateSubscriber {
+ public:
+  Connection(Server *server, int fd, bool websocket, ShmChannel *shm)
+      : server_(server), fd_(fd), websocket_(websocket),
+        handshake_done_(false), shm_(shm), in_message_(false),
+        readable_(false), paused_(false), dirty_(false), closing_(false),
+        follower_(false), connecting_(false), sync_bytes_(0),
+        output_offset_(0), output_bytes_(0),
+        messages_bytes_(0) {
+  }
+
+  virtual ~Connection() {
+    delete shm_;
+    close(fd_);
+  }
+
+  virtual void OnUpdate(DocID /* doc_id */, Version /* version */,
+                        const BufferSlice& update) {
+    QueueMessage(update);
+  }
+
+  // Queues bytes to be written to the connection.
+  void Queue(const BufferSlice& slice) {
+    if (closing_) {
+      return;
+    }
+
+    output_.push_back(slice);
+    output_bytes_ += slice.size();
+    server_->MarkDirty(this);
+    CheckQueuedBytes();
+  }
+
+  // Queues a copy of some bytes to be written to the connection.
+  void QueueBytes(const string& bytes) {
+    SharedBuffer *buffer = SharedBuffer::New(bytes.size());
+    memcpy(buffer->mutable_data(), bytes.data(), bytes.size());
+    Queue(BufferSlice(buffer, 0, bytes.size()));
+    buffer->Unref();
+  }
+
+  // Queues a frame to be written to the connection.
+  void QueueFrame(MessageType type, const string& payload) {
+    string frame;
+    AppendFrame(type, payload, &frame);
+    QueueBytes(frame);
+  }
+
+  // Queues a message for the client. Messages to WebSocket connections are
+  // held until they are batched into a frame by Server::FrameMessages().
+  void QueueMessage(const BufferSlice& message) {
+    if (!websocket_) {
+      Queue(message);
+      return;
+    }
+    if (closing_) {
+      return;
+    }
+
+    messages_.push_back(message);
+    messages_bytes_ += message.size();
+    server_->MarkDirty(this);
+    CheckQueuedBytes();
+  }
+
+  // Queues a JSON message to a WebSocket connection.
+  void QueueJson(const string& json) {
+    SharedBuffer *buffer = SharedBuffer::New(json.size());
+    memcpy(buffer->mutable_data(), json.data(), json.size());
+    QueueMessage(BufferSlice(buffer, 0, json.size()));
+    buffer->Unref();
+  }
+
+  // Number of bytes waiting to be written to the connection.
+  size_t queued_bytes() const {
+    return output_bytes_ + messages_bytes_;
+  }
+
+  // Closes connections that do not keep up with what they are sent.
+  // Followers have a limit of their own, which their initial sync does not
+  // count towards. A closed follower connects again and resyncs.
+  void CheckQueuedBytes() {
+    size_t queued = queued_bytes();
+    size_t limit = server_->options_.max_output_bytes;
+    if (follower_) {
+      queued -= min(queued, sync_bytes_);
+      limit = server_->options_.max_follower_output_bytes;
+    }
+    if (queued > limit) {
+      server_->MarkClosing(this);
+    }
+  }
+
+  // Accounts for bytes written to the connection.
+  void DropWritten(size_t written) {
+    output_bytes_ -= written;
+    sync_bytes_ -= min(sync_bytes_, written);
+  }
+
+  // Reads available bytes like read(2) does on a non-blocking socket.
+  ssize_t Read(char *data, size_t size) {
+    if (shm_ == NULL) {
+      return read(fd_, data, size);
+    }
+
+    for (;;) {
+      size_t bytes_read = shm_->Read(data, size);
+      if (bytes_read > 0) {
+        return bytes_read;
+      } else if (shm_->broken()) {
+        // Closed like a socket that failed
+        errno = EPROTO;
+        return -1;
+      } else if (shm_->PrepareWaitForData()) {
+        errno = EAGAIN;
+        return -1;
+      }
+    }
+  }
+
+  // Writes queued bytes until they are all written or the socket is full.
+  // Returns false if the connection failed.
+  bool Write() {
+    if (shm_ != NULL) {
+      return WriteShm();
+    }
+
+    while (!output_.empty()) {
+      struct iovec iov[kMaxIovecs];
+      int num_iov = 0;
+      for (deque<BufferSlice>::const_iterator it = output_.begin();
+           (it != output_.end()) && (num_iov < kMaxIovecs); ++it) {
+        size_t skip = (num_iov == 0) ? output_offset_ : 0;
+        iov[num_iov].iov_base = const_cast<char*>(it->data() + skip);
+        iov[num_iov].iov_len = it->size() - skip;
+        ++num_iov;
+      }
+
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = num_iov;
+      ssize_t written = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+      }
+
+      // Drop what was written
+      DropWritten(written);
+      size_t left = written;
+      while (left > 0) {
+        size_t front_left = output_.front().size() - output_offset_;
+        if (left < front_left) {
+          output_offset_ += left;
+          break;
+        }
+        left -= front_left;
+        output_.pop_front();
+        output_offset_ = 0;
+      }
+    }
+    return true;
+  }
+
+  // Same as Write() for shared memory clients.
+  bool WriteShm() {
+    while (!output_.empty()) {
+      const BufferSlice& front = output_.front();
+      size_t written = shm_->Write(front.data() + output_offset_,
+                                   front.size() - output_offset_);
+      if (written == 0) {
+        if (shm_->broken()) {
+          return false;
+        } else if (shm_->PrepareWaitForSpace()) {
+          return true;
+        }
+        continue;
+      }
+
+      DropWritten(written);
+      output_offset_ += written;
+      if (output_offset_ == front.size()) {
+        output_.pop_front();
+        output_offset_ = 0;
+      }
+    }
+    return true;
+  }
+
+  Server *server_;
+  int fd_;
+
+  // Whether the connection speaks WebSocket, and whether its opening
+  // handshake is done.
+  bool websocket_;
+  bool handshake_done_;
+
+  // The channel of shared memory clients, NULL for sockets. For these, fd_ is
+  // only watched to tell when the client goes away.
+  ShmChannel *shm_;
+
+  // A fragmented WebSocket message being received.
+  bool in_message_;
+  string message_;
+
+  // Whether the socket may have bytes to read. Edge-triggered events only
+  // tell us when this becomes true.
+  bool readable_;
+
+  // Whether reading is paused because too much output is queued.
+  bool paused_;
+
+  bool dirty_;
+  bool closing_;
+
+  // Whether the connection is a follower replicating the server.
+  bool follower_;
+
+  // Whether the connection to the primary is still being established.
+  bool connecting_;
+
+  // Bytes of the initial sync of a follower that are still queued. They are
+  // at the front of output_, so they go first.
+  size_t sync_bytes_;
+
+  string input_;
+  deque<BufferSlice> output_;
+  size_t output_offset_;
+  size_t output_bytes_;
+
+  // Messages waiting to be batched into a WebSocket frame.
+  vector<BufferSlice> messages_;
+  size_t messages_bytes_;
+
+  set<DocID> subscriptions_;
+};
+
+// Queues every diff applied to the store on the connections of the
+// followers. Each diff is serialized once, as a complete MSG_UPDATE frame.
+class Server::ReplicationStream : public DocumentObserver {
+ public:
+  explicit ReplicationStream(const DiffEncoder *encoder)
+      : encoder_(encoder) {}
+
+  virtual void OnDiffApplied(const Document& doc, const Diff& diff) {
+    if (followers_.empty()) {
+      return;
+    }
+
+    scratch_.clear();
+    encoder_->Encode(doc.doc_id(), diff, &scratch_);
+    SharedBuffer *buffer = SharedBuffer::New(scratch_.size());
+    memcpy(buffer->mutable_data(), scratch_.data(), scratch_.size());
+    BufferSlice update(buffer, 0, scratch_.size());
+    for (set<Connection*>::iterator it = followers_.begin();
+         it != followers_.end(); ++it) {
+      (*it)->Queue(update);
+    }
+    buffer->Unref();
+  }
+
+  void AddFollower(Connection *conn) {
+    followers_.insert(conn);
+  }
+
+  void RemoveFollower(Connection *conn) {
+    followers_.erase(conn);
+  }
+
+ private:
+  const DiffEncoder *encoder_;
+  set<Connection*> followers_;
+
+  // Reused to serialize each diff.
+  string scratch_;
+};
+
+ServerOptions::ServerOptions()
+    : address("0.0.0.0"), port(0), websocket_port(-1),
+      shm_capacity(ShmChannel::kDefaultCapacity), high_watermark(1024 * 1024),
+      max_output_bytes(64 * 1024 * 1024),
+      max_follower_output_bytes(256 * 1024 * 1024), primary_port(-1),
+      reconnect_interval_ms(1000) {
+}
+
+Server::Server(DocumentStore *store, const ServerOptions& options)
+    : store_(store), options_(options), diff_log_(NULL), snapshotter_(NULL),
+      snapshot_interval_micros_(0), next_snapshot_micros_(0),
+      separators_(SharedBuffer::New(2)),
+      epoll_fd_(-1), listen_fd_(-1), websocket_listen_fd_(-1),
+      shm_listen_fd_(-1), wake_fd_(-1),
+      port_(-1), websocket_port_(-1), stopped_(false), listening_(false),
+      replication_(NULL), primary_(NULL),
+      read_only_(!options.primary_address.empty()),
+      promote_requested_(false), replication_failed_(false),
+      next_connect_micros_(-1), syncing_(false), receiving_document_(false),
+      pending_doc_id_(0), pending_version_(0), pending_size_(0) {
+  memcpy(separators_->mutable_data(), ",]", 2);
+}
+
+Server::~Server() {
+  for (map<int, Connection*>::iterator it = connections_.begin();
+       it != connections_.end(); ++it) {
+    delete it->second;
+  }
+  map<DocID, UpdateBroadcaster*> *broadcaster_maps[] = {
+    &broadcasters_, &json_broadcasters_
+  };
+  for (int i = 0; i < 2; ++i) {
+    for (map<DocID, UpdateBroadcaster*>::iterator it =
+             broadcaster_maps[i]->begin();
+         it != broadcaster_maps[i]->end(); ++it) {
+      Document *doc = store_->Get(it->first);
+      if (doc != NULL) {
+        doc->RemoveObserver(it->second);
+      }
+      delete it->second;
+    }
+  }
+  if (replication_ != NULL) {
+    store_->RemoveObserver(replication_);
+    delete replication_;
+  }
+  separators_->Unref();
+
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+  }
+  if (websocket_listen_fd_ >= 0) {
+    close(websocket_listen_fd_);
+  }
+  if (shm_listen_fd_ >= 0) {
+    close(shm_listen_fd_);
+    unlink(options_.shm_path.c_str());
+  }
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+  }
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+bool Server::Start() {
+  listen_fd_ = Listen(options_.port, &port_);
+  if (listen_fd_ < 0) {
+    return false;
+  }
+  if (options_.websocket_port >= 0) {
+    websocket_listen_fd_ = Listen(options_.websocket_port, &websocket_port_);
+    if (websocket_listen_fd_ < 0) {
+      return false;
+    }
+  }
+  if (!options_.shm_path.empty()) {
+    shm_listen_fd_ = ListenUnix(options_.shm_path);
+    if (shm_listen_fd_ < 0) {
+      return false;
+    }
+  }
+
+  epoll_fd_ = epoll_create1(0);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK);
+  if ((epoll_fd_ < 0) || (wake_fd_ < 0)) {
+    return false;
+  }
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &wake_marker;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event) < 0) {
+    return false;
+  }
+
+  // Followers only accept clients once they are in sync with their primary
+  return read_only_ ? ConnectToPrimary() : WatchListeners();
+}
+
+void Server::set_diff_log(DiffLog *diff_log) {
+  diff_log_ = diff_log;
+}
+
+void Server::set_snapshotter(Snapshotter *snapshotter,
+                             int64_t interval_micros) {
+  snapshotter_ = snapshotter;
+  snapshot_interval_micros_ = interval_micros;
+  next_snapshot_micros_ = NowMicros() + interval_micros;
+}
+
+void Server::Run() {
+  while (!stopped_) {
+    int64_t wake_micros = -1;
+    if (snapshotter_ != NULL) {
+      wake_micros = next_snapshot_micros_;
+    }
+    if ((next_connect_micros_ >= 0) &&
+        ((wake_micros < 0) || (next_connect_micros_ < wake_micros))) {
+      wake_micros = next_connect_micros_;
+    }
+    int timeout_ms = -1;
+    if (wake_micros >= 0) {
+      int64_t wait_micros = wake_micros - NowMicros();
+      timeout_ms = (wait_micros > 0) ? (wait_micros + 999) / 1000 : 0;
+    }
+    RunOnce(timeout_ms);
+  }
+}
+
+void Server::RunOnce(int timeout_ms) {
+  struct epoll_event events[kMaxEvents];
+  int num_events = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+  for (int i = 0; i < num_events; ++i) {
+    void *ptr = events[i].data.ptr;
+    if (ptr == &listen_marker) {
+      Accept(listen_fd_, false);
+    } else if (ptr == &websocket_listen_marker) {
+      Accept(websocket_listen_fd_, true);
+    } else if (ptr == &shm_listen_marker) {
+      AcceptShm();
+    } else if (ptr == &wake_marker) {
+      uint64_t value;
+      while (read(wake_fd_, &value, sizeof(value)) > 0) {
+      }
+    } else {
+      HandleEvents(static_cast<Connection*>(ptr), events[i].events);
+    }
+  }
+
+  if (promote_requested_ && read_only_) {
+    DoPromote();
+  }
+
+  // Diffs applied in this iteration are committed together before they are
+  // acknowledged.
+  if ((diff_log_ != NULL) &&
+      (diff_log_->durability() == DiffLogOptions::SYNC_EACH)) {
+    diff_log_->WaitForSync(diff_log_->last_sequence());
+  }
+
+  // Write everything that was queued in this iteration. Flushing can resume
+  // reading from paused connections, which can queue more output.
+  while (!dirty_.empty()) {
+    vector<Connection*> dirty;
+    dirty.swap(dirty_);
+    for (size_t i = 0; i < dirty.size(); ++i) {
+      dirty[i]->dirty_ = false;
+      if (!dirty[i]->closing_) {
+        FlushOutput(dirty[i]);
+      }
+    }
+  }
+
+  vector<Connection*> closing;
+  closing.swap(closing_);
+  for (size_t i = 0; i < closing.size(); ++i) {
+    CloseConnection(closing[i]);
+  }
+  Reconnect();
+
+  // No diff is being applied between iterations, so the snapshot is
+  // consistent with the log
+  if ((snapshotter_ != NULL) && (NowMicros() >= next_snapshot_micros_)) {
+    snapshotter_->Start();
+    next_snapshot_micros_ = NowMicros() + snapshot_interval_micros_;
+  }
+}
+
+void Server::Stop() {
+  stopped_ = true;
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) < 0) {
+    // The eventfd is only full if a wake up is already pending
+  }
+}
+
+void Server::Promote() {
+  promote_requested_ = true;
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) < 0) {
+    // The eventfd is only full if a wake up is already pending
+  }
+}
+
+bool Server::read_only() const {
+  return read_only_;
+}
+
+bool Server::replication_failed() const {
+  return replication_failed_;
+}
+
+int Server::port() const {
+  return port_;
+}
+
+int Server::websocket_port() const {
+  return websocket_port_;
+}
+
+size_t Server::num_connections() const {
+  return connections_.size();
+}
+
+int Server::Listen(int port, int *bound_port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  socklen_t addr_size = sizeof(addr);
+  if ((inet_pton(AF_INET, options_.address.c_str(), &addr.sin_addr) != 1) ||
+      (bind(fd, reinterpret_cast<struct sockaddr*>(&addr),
+            sizeof(addr)) < 0) ||
+      (listen(fd, SOMAXCONN) < 0) ||
+      (getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                   &addr_size) < 0)) {
+    close(fd);
+    return -1;
+  }
+  *bound_port = ntohs(addr.sin_port);
+  return fd;
+}
+
+bool Server::WatchListeners() {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &listen_marker;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event) < 0) {
+    return false;
+  }
+  if (websocket_listen_fd_ >= 0) {
+    event.data.ptr = &websocket_listen_marker;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, websocket_listen_fd_,
+                  &event) < 0) {
+      return false;
+    }
+  }
+  if (shm_listen_fd_ >= 0) {
+    event.data.ptr = &shm_listen_marker;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, shm_listen_fd_, &event) < 0) {
+      return false;
+    }
+  }
+
+  // Clients that connected in the meantime are reported right away
+  listening_ = true;
+  return true;
+}
+
+bool Server::ConnectToPrimary() {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options_.primary_port);
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    return false;
+  }
+
+  // The event loop does not wait for the connection, it is finished when the
+  // socket becomes writable (see FinishConnect())
+  bool connecting = false;
+  if (inet_pton(AF_INET, options_.primary_address.c_str(),
+                &addr.sin_addr) != 1) {
+    close(fd);
+    return false;
+  } else if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                     sizeof(addr)) < 0) {
+    if (errno != EINPROGRESS) {
+      close(fd);
+      return false;
+    }
+    connecting = true;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  primary_ = new Connection(this, fd, false, NULL);
+  primary_->connecting_ = connecting;
+  if (!AddConnection(primary_)) {
+    delete primary_;
+    primary_ = NULL;
+    return false;
+  }
+  if (!connecting) {
+    primary_->QueueFrame(MSG_REPLICATE, "");
+  }
+
+  // The primary sends every Document again
+  syncing_ = true;
+  synced_doc_ids_.clear();
+  receiving_document_ = false;
+  pending_data_.clear();
+  pending_diffs_.clear();
+  return true;
+}
+
+bool Server::FinishConnect(Connection *conn) {
+  int error = 0;
+  socklen_t error_size = sizeof(error);
+  if ((getsockopt(conn->fd_, SOL_SOCKET, SO_ERROR, &error,
+                  &error_size) < 0) ||
+      (error != 0)) {
+    return false;
+  }
+  conn->connecting_ = false;
+  conn->QueueFrame(MSG_REPLICATE, "");
+  return true;
+}
+
+void Server::Reconnect() {
+  if ((next_connect_micros_ < 0) || (NowMicros() < next_connect_micros_)) {
+    return;
+  }
+
+  next_connect_micros_ = -1;
+  if (!ConnectToPrimary()) {
+    next_connect_micros_ =
+        NowMicros() + options_.reconnect_interval_ms * 1000LL;
+  }
+}
+
+int Server::ListenUnix(const string& path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0) {
+    return -1;
+  }
+
+  // Remove the socket of a previous server
+  unlink(path.c_str());
+  if ((bind(fd, reinterpret_cast<struct sockaddr*>(&addr),
+            sizeof(addr)) < 0) ||
+      (listen(fd, SOMAXCONN) < 0)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void Server::Accept(int listen_fd, bool websocket) {
+  for (;;) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+
+    // Diffs are small, send them right away
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    Connection *conn = new Connection(this, fd, websocket, NULL);
+    if (!AddConnection(conn)) {
+      delete conn;
+    }
+  }
+}
+
+void Server::AcceptShm() {
+  for (;;) {
+    int fd = accept4(shm_listen_fd_, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+
+    ShmChannel *channel = ShmChannel::Create(options_.shm_capacity);
+    if ((channel == NULL) || !channel->SendDescriptors(fd)) {
+      delete channel;
+      close(fd);
+      continue;
+    }
+    Connection *conn = new Connection(this, fd, false, channel);
+    if (!AddConnection(conn)) {
+      delete conn;
+    }
+  }
+}
+
+bool Server::AddConnection(Connection *conn) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = conn;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn->fd_, &event) < 0) {
+    return false;
+  }
+  if (conn->shm_ != NULL) {
+    event.events = EPOLLIN | EPOLLET;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, conn->shm_->event_fd(),
+                  &event) < 0) {
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd_, NULL);
+      return false;
+    }
+  }
+  connections_[conn->fd_] = conn;
+
+  if (conn->shm_ != NULL) {
+    // The client may have written before the eventfd was watched
+    conn->readable_ = true;
+    ReadInput(conn);
+  }
+  return true;
+}
+
+void Server::HandleEvents(Connection *conn, uint32_t events) {
+  if (conn->closing_) {
+    return;
+  }
+  if (events & EPOLLERR) {
+    MarkClosing(conn);
+    return;
+  }
+  if (conn->connecting_) {
+    if ((events & EPOLLOUT) == 0) {
+      return;
+    } else if (!FinishConnect(conn)) {
+      MarkClosing(conn);
+      return;
+    }
+  }
+
+  if (conn->shm_ != NULL) {
+    // Either the socket or the eventfd fired, check both. Clients never
+    // write to the socket, so it is only readable once they are gone.
+    char byte;
+    ssize_t bytes_read = recv(conn->fd_, &byte, 1, MSG_DONTWAIT);
+    if ((bytes_read == 0) ||
+        ((bytes_read < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+      MarkClosing(conn);
+      return;
+    }
+    conn->shm_->ClearEvent();
+    conn->readable_ = true;
+    ReadInput(conn);
+    MarkDirty(conn);
+    return;
+  }
+
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+    conn->readable_ = true;
+    ReadInput(conn);
+  }
+  if (events & EPOLLOUT) {
+    MarkDirty(conn);
+  }
+}
+
+void Server::ReadInput(Connection *conn) {
+  char buf[kReadSize];
+  for (;;) {
+    // Deal with what we already have before reading more
+    ProcessInput(conn);
+    if (conn->paused_ || conn->closing_ || !conn->readable_) {
+      return;
+    }
+
+    ssize_t bytes_read = conn->Read(buf, sizeof(buf));
+    if (bytes_read > 0) {
+      conn->input_.append(buf, bytes_read);
+    } else if (bytes_read == 0) {
+      MarkClosing(conn);
+      return;
+    } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+      conn->readable_ = false;
+      return;
+    } else if (errno != EINTR) {
+      MarkClosing(conn);
+      return;
+    }
+  }
+}
+
+void Server::ProcessInput(Connection *conn) {
+  if (conn->websocket_) {
+    ProcessWebSocketInput(conn);
+    return;
+  }
+
+  size_t offset = 0;
+  while (!conn->paused_ && !conn->closing_) {
+    Frame frame;
+    FrameStatus status = ParseFrame(conn->input_.data() + offset,
+                                    conn->input_.size() - offset, &frame);
+    if (status == FRAME_INCOMPLETE) {
+      break;
+    } else if ((status == FRAME_INVALID) || !ProcessFrame(conn, frame)) {
+      MarkClosing(conn);
+      break;
+    }
+    offset += frame.frame_size;
+
+    // Stop processing requests from clients that are not reading responses
+    if (conn->queued_bytes() > options_.high_watermark) {
+      conn->paused_ = true;
+    }
+  }
+  conn->input_.erase(0, offset);
+}
+
+bool Server::ProcessFrame(Connection *conn, const Frame& frame) {
+  if (conn == primary_) {
+    return ProcessPrimaryFrame(frame);
+  }
+
+  switch (frame.type) {
+    case MSG_APPLY:
+      return HandleApply(conn, frame);
+    case MSG_SUBSCRIBE:
+      return HandleSubscribe(conn, frame);
+    case MSG_UNSUBSCRIBE:
+      return HandleUnsubscribe(conn, frame);
+    case MSG_REPLICATE:
+      return HandleReplicate(conn, frame);
+    default:
+      return false;
+  }
+}
+
+bool Server::HandleApply(Connection *conn, const Frame& frame) {
+  const char *p = frame.payload;
+  const char *limit = p + frame.payload_size;
+  uint64_t doc_id;
+  DiffView view;
+  if (!GetVarint64(&p, limit, &doc_id) || !DecodeDiff(&p, limit, &view) ||
+      (p != limit)) {
+    return false;
+  }
+
+  Diff diff = view.ToDiff();
+  Apply(conn, doc_id, &diff);
+  return true;
+}
+
+bool Server::HandleSubscribe(Connection *conn, const Frame& frame) {
+  const char *p = frame.payload;
+  const char *limit = p + frame.payload_size;
+  uint64_t doc_id;
+  int64_t from_version;
+  if (!GetVarint64(&p, limit, &doc_id) ||
+      !GetSignedVarint64(&p, limit, &from_version) || (p != limit)) {
+    return false;
+  }
+
+  return Subscribe(conn, doc_id, from_version);
+}
+
+bool Server::HandleUnsubscribe(Connection *conn, const Frame& frame) {
+  const char *p = frame.payload;
+  const char *limit = p + frame.payload_size;
+  uint64_t doc_id;
+  if (!GetVarint64(&p, limit, &doc_id) || (p != limit)) {
+    return false;
+  }
+
+  Unsubscribe(conn, doc_id);
+  return true;
+}
+
+bool Server::HandleReplicate(Connection *conn, const Frame& frame) {
+  if ((frame.payload_size != 0) || conn->follower_) {
+    return false;
+  }
+
+  // Nothing is applied until every Document is queued, so the follower gets
+  // each diff applied from now on exactly once. The whole store is queued
+  // at once, which must not get the follower closed.
+  conn->follower_ = true;
+  conn->sync_bytes_ = numeric_limits<size_t>::max();
+  vector<DocID> doc_ids;
+  store_->GetDocIDs(&doc_ids);
+  for (size_t i = 0; i < doc_ids.size(); ++i) {
+    Document *doc = store_->Get(doc_ids[i]);
+    if (doc == NULL) {
+      // The follower would drop its copy of a corrupted Document
+      conn->follower_ = false;
+      return false;
+    }
+
+    string data;
+    doc->GetData(&data);
+    list<Diff> diffs;
+    doc->GetCachedDiffs(&diffs);
+    string updates;
+    EncodeUpdates(diffs, &updates);
+    if (updates.size() > kDocumentChunkSize) {
+      // The follower can do without them unless it has to catch up
+      updates.clear();
+      EncodeUpdates(list<Diff>(), &updates);
+    }
+
+    // Frames are limited in size, send the data in chunks
+    string payload;
+    PutVarint64(doc_ids[i], &payload);
+    PutSignedVarint64(doc->version(), &payload);
+    PutVarint64(data.size(), &payload);
+    payload.append(updates);
+    size_t chunk_size = min(data.size(), kDocumentChunkSize);
+    payload.append(data, 0, chunk_size);
+    conn->QueueFrame(MSG_DOCUMENT, payload);
+    for (size_t offset = chunk_size; offset < data.size();
+         offset += chunk_size) {
+      chunk_size = min(data.size() - offset, kDocumentChunkSize);
+      conn->QueueFrame(MSG_DOCUMENT_DATA, data.substr(offset, chunk_size));
+    }
+  }
+  conn->QueueFrame(MSG_SYNCED, "");
+  conn->sync_bytes_ = conn->queued_bytes();
+
+  if (replication_ == NULL) {
+    replication_ = new ReplicationStream(&encoder_);
+    store_->AddObserver(replication_);
+  }
+  replication_->AddFollower(conn);
+  return true;
+}
+
+bool Server::ProcessPrimaryFrame(const Frame& frame) {
+  switch (frame.type) {
+    case MSG_DOCUMENT:
+      return HandleDocument(frame);
+    case MSG_DOCUMENT_DATA:
+      return HandleDocumentData(frame);
+    case MSG_SYNCED:
+      return (frame.payload_size == 0) && HandleSynced();
+    case MSG_UPDATE:
+      return HandleReplicatedUpdate(frame);
+    default:
+      return false;
+  }
+}
+
+bool Server::HandleDocument(const Frame& frame) {
+  const char *p = frame.payload;
+  const char *limit = p + frame.payload_size;
+  uint64_t doc_id;
+  int64_t version;
+  uint64_t size;
+  vector<DiffView> views;
+  if (!syncing_ || receiving_document_ || !GetVarint64(&p, limit, &doc_id) ||
+      !GetSignedVarint64(&p, limit, &version) ||
+      !GetVarint64(&p, limit, &size) || !DecodeUpdates(&p, limit, &views) ||
+      (static_cast<uint64_t>(limit - p) > size)) {
+    return false;
+  }
+
+  pending_doc_id_ = doc_id;
+  pending_version_ = version;
+  pending_size_ = size;
+  pending_data_.assign(p, limit - p);
+  pending_diffs_.clear();
+  for (size_t i = 0; i < views.size(); ++i) {
+    pending_diffs_.push_back(views[i].ToDiff());
+  }
+  receiving_document_ = true;
+  return (pending_data_.size() < pending_size_) || InstallDocument();
+}
+
+bool Server::HandleDocumentData(const Frame& frame) {
+  if (!receiving_document_ ||
+      (frame.payload_size > pending_size_ - pending_data_.size())) {
+    return false;
+  }
+  pending_data_.append(frame.payload, frame.payload_size);
+  return (pending_data_.size() < pending_size_) || InstallDocument();
+}
+
+bool Server::InstallDocument() {
+  receiving_document_ = false;
+  DocID doc_id = pending_doc_id_;
+  Version version = pending_version_;
+  string data;
+  data.swap(pending_data_);
+  list<Diff> diffs;
+  diffs.swap(pending_diffs_);
+
+  synced_doc_ids_.insert(doc_id);
+  Document *doc = store_->Get(doc_id);
+  if (!listening_ || (doc == NULL)) {
+    // No client can be watching it yet, replace the local copy
+    store_->Remove(doc_id);
+    store_->Add(new Document(doc_id, version, data.data(), data.size(),
+                             diffs));
+    return true;
+  }
+
+  // Clients may be watching it, so it is kept and only gets the diffs it
+  // missed while the primary was gone
+  for (list<Diff>::const_iterator it = diffs.begin(); it != diffs.end();
+       ++it) {
+    if (it->version() == doc->version() + 1) {
+      Diff diff = *it;
+      if (!doc->ApplyDiff(&diff)) {
+        break;
+      }
+    }
+  }
+  if (doc->version() != version) {
+    replication_failed_ = true;
+    stopped_ = true;
+    return false;
+  }
+  return true;
+}
+
+bool Server::HandleSynced() {
+  if (!syncing_ || receiving_document_) {
+    return false;
+  }
+  syncing_ = false;
+
+  vector<DocID> doc_ids;
+  store_->GetDocIDs(&doc_ids);
+  for (size_t i = 0; i < doc_ids.size(); ++i) {
+    if (synced_doc_ids_.count(doc_ids[i]) != 0) {
+      continue;
+    }
+    if (!listening_) {
+      // Drop the local Documents the primary does not have
+      store_->Remove(doc_ids[i]);
+    } else if ((store_->Get(doc_ids[i]) == NULL) ||
+               (store_->Get(doc_ids[i])->version() > 0)) {
+      // Clients may be watching it, only Documents they created are kept
+      replication_failed_ = true;
+      stopped_ = true;
+      return false;
+    }
+  }
+  synced_doc_ids_.clear();
+
+  // The log does not have the Documents sent by the primary, take a
+  // snapshot of them at the end of this iteration
+  if (snapshotter_ != NULL) {
+    next_snapshot_micros_ = 0;
+  }
+  return listening_ || WatchListeners();
+}
+
+bool Server::HandleReplicatedUpdate(const Frame& frame) {
+  const char *p = frame.payload;
+  const char *limit = p + frame.payload_size;
+  uint64_t doc_id;
+  DiffView view;
+  if (syncing_ || !GetVarint64(&p, limit, &doc_id) ||
+      !DecodeDiff(&p, limit, &view) || (p != limit)) {
+    return false;
+  }
+
+  // Missing a diff closes the connection, the follower then connects again
+  // and catches up
+  Document *doc = store_->GetOrCreate(doc_id);
+  if (doc == NULL) {
+    return false;
+  } else if (view.version <= doc->version()) {
+    return true;
+  }
+  Diff diff = view.ToDiff();
+  return (view.version == doc->version() + 1) && doc->ApplyDiff(&diff);
+}
+
+void Server::DoPromote() {
+  read_only_ = false;
+  if (primary_ != NULL) {
+    MarkClosing(primary_);
+  }
+  next_connect_micros_ = -1;
+  syncing_ = false;
+  synced_doc_ids_.clear();
+  receiving_document_ = false;
+  pending_data_.clear();
+  pending_diffs_.clear();
+  if (!listening_) {
+    WatchListeners();
+  }
+}
+
+void Server::ProcessWebSocketInput(Connection *conn) {
+  size_t offset = 0;
+  if (!conn->handshake_done_) {
+    string key;
+    FrameStatus status = ParseWebSocketHandshake(
+        conn->input_.data(), conn->input_.size(), &key, &offset);
+    if (status == FRAME_INCOMPLETE) {
+      return;
+    } else if (status == FRAME_INVALID) {
+      conn->QueueBytes("HTTP/1.1 400 Bad Request\r\n"
+                       "Connection: close\r\n\r\n");
+      MarkClosing(conn);
+      return;
+    }
+
+    string response;
+    AppendWebSocketHandshakeResponse(key, &response);
+    conn->QueueBytes(response);
+    conn->handshake_done_ = true;
+  }
+
+  while (!conn->paused_ && !conn->closing_ &&
+         (offset < conn->input_.size())) {
+    WebSocketFrame frame;
+    FrameStatus status = ParseWebSocketFrame(&conn->input_[offset],
+                                             conn->input_.size() - offset,
+                                             &frame);
+    if (status == FRAME_INCOMPLETE) {
+      break;
+    } else if ((status == FRAME_INVALID) || !frame.masked ||
+               !ProcessWebSocketFrame(conn, frame)) {
+      // Clients must mask their frames
+      CloseWebSocket(conn, kWebSocketProtocolError);
+      break;
+    }
+    offset += frame.frame_size;
+
+    if (conn->queued_bytes() > options_.high_watermark) {
+      conn->paused_ = true;
+    }
+  }
+  conn->input_.erase(0, offset);
+}
+
+bool Server::ProcessWebSocketFrame(Connection *conn,
+                                   const WebSocketFrame& frame) {
+  switch (frame.opcode) {
+    case WS_TEXT:
+      if (conn->in_message_) {
+        return false;
+      } else if (frame.fin) {
+        return HandleJsonMessage(conn, frame.payload, frame.payload_size);
+      }
+      conn->in_message_ = true;
+      conn->message_.assign(frame.payload, frame.payload_size);
+      return true;
+    case WS_CONTINUATION:
+      if (!conn->in_message_ ||
+          (conn->message_.size() + frame.payload_size > kMaxFrameSize)) {
+        return false;
+      }
+      conn->message_.append(frame.payload, frame.payload_size);
+      if (frame.fin) {
+        conn->in_message_ = false;
+        string message;
+        message.swap(conn->message_);
+        return HandleJsonMessage(conn, message.data(), message.size());
+      }
+      return true;
+    case WS_PING: {
+      string pong;
+      AppendWebSocketFrame(WS_PONG, string(frame.payload, frame.payload_size),
+                           &pong);
+      conn->QueueBytes(pong);
+      return true;
+    }
+    case WS_PONG:
+      return true;
+    case WS_CLOSE: {
+      // Echo the status code after everything that was already queued
+      FrameMessages(conn);
+      string close;
+      size_t status_size = (frame.payload_size < 2) ? frame.payload_size : 2;
+      AppendWebSocketFrame(WS_CLOSE, string(frame.payload, status_size),
+                           &close);
+      conn->QueueBytes(close);
+      MarkClosing(conn);
+      return true;
+    }
+    default:
+      // Only JSON text messages are supported
+      return false;
+  }
+}
+
+bool Server::HandleJsonMessage(Connection *conn, const char *data,
+                               size_t size) {
+  vector<JsonRequest> requests;
+  if (!DecodeJsonRequests(data, size, &requests)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < requests.size(); ++i) {
+    JsonRequest& request = requests[i];
+    switch (request.type) {
+      case JsonRequest::APPLY:
+        for (size_t j = 0; j < request.diffs.size(); ++j) {
+          Apply(conn, request.doc_id, &request.diffs[j]);
+        }
+        break;
+      case JsonRequest::SUBSCRIBE:
+        if (!Subscribe(conn, request.doc_id, request.from_version)) {
+          return false;
+        }
+        break;
+      case JsonRequest::UNSUBSCRIBE:
+        Unsubscribe(conn, request.doc_id);
+        break;
+    }
+  }
+  return true;
+}
+
+void Server::CloseWebSocket(Connection *conn, uint16_t status) {
+  string payload;
+  payload.push_back(static_cast<char>(status >> 8));
+  payload.push_back(static_cast<char>(status));
+  string close;
+  AppendWebSocketFrame(WS_CLOSE, payload, &close);
+  conn->QueueBytes(close);
+  MarkClosing(conn);
+}
+
+void Server::FrameMessages(Connection *conn) {
+  size_t num_messages = conn->messages_.size();
+  if (num_messages == 0) {
+    return;
+  }
+
+  // The messages are sent as they are, only the frame header and the
+  // separators of the array are added around them
+  string header;
+  AppendWebSocketFrameHeader(WS_TEXT, conn->messages_bytes_ + num_messages + 1,
+                             &header);
+  header.push_back('[');
+
+  vector<BufferSlice> messages;
+  messages.swap(conn->messages_);
+  conn->messages_bytes_ = 0;
+  conn->QueueBytes(header);
+  for (size_t i = 0; i < num_messages; ++i) {
+    conn->Queue(messages[i]);
+    conn->Queue(BufferSlice(separators_, (i + 1 < num_messages) ? 0 : 1, 1));
+  }
+}
+
+void Server::Apply(Connection *conn, DocID doc_id, Diff *diff) {
+  // Followers only apply the diffs of their primary
+  Version version = -1;
+  if (!read_only_) {
+    Document *doc = store_->GetOrCreate(doc_id);
+    if ((doc != NULL) && doc->ApplyDiff(diff)) {
+      version = diff->version();
+    }
+  }
+
+  string payload;
+  if (conn->websocket_) {
+    EncodeJsonApplied(doc_id, version, &payload);
+    conn->QueueJson(payload);
+  } else {
+    PutVarint64(doc_id, &payload);
+    PutSignedVarint64(version, &payload);
+    conn->QueueFrame(MSG_APPLIED, payload);
+  }
+}
+
+bool Server::Subscribe(Connection *conn, DocID doc_id, Version from_version) {
+  Document *doc = store_->GetOrCreate(doc_id);
+  if (doc == NULL) {
+    return false;
+  }
+  if (conn->subscriptions_.insert(doc_id).second) {
+    map<DocID, UpdateBroadcaster*>& broadcasters =
+        conn->websocket_ ? json_broadcasters_ : broadcasters_;
+    UpdateBroadcaster *&broadcaster = broadcasters[doc_id];
+    if (broadcaster == NULL) {
+      broadcaster = new UpdateBroadcaster(
+          conn->websocket_ ? static_cast<const DiffEncoder*>(&json_encoder_) :
+          &encoder_);
+      doc->AddObserver(broadcaster);
+    }
+    broadcaster->Subscribe(conn);
+  }
+
+  // Catch up, after that updates are streamed as they are applied
+  if (from_version > doc->version()) {
+    return true;
+  }
+
+  list<Diff> updates;
+  string payload;
+  if (doc->GetUpdates(from_version, &updates)) {
+    if (conn->websocket_) {
+      EncodeJsonUpdates(doc_id, updates, &payload);
+      conn->QueueJson(payload);
+    } else {
+      PutVarint64(doc_id, &payload);
+      EncodeUpdates(updates, &payload);
+      conn->QueueFrame(MSG_UPDATES, payload);
+    }
+  } else {
+    string data;
+    doc->GetData(&data);
+    if (conn->websocket_) {
+      EncodeJsonData(doc_id, doc->version(), data, &payload);
+      conn->QueueJson(payload);
+    } else {
+      PutVarint64(doc_id, &payload);
+      PutSignedVarint64(doc->version(), &payload);
+      PutVarint64(data.size(), &payload);
+      payload.append(data);
+      conn->QueueFrame(MSG_DATA, payload);
+    }
+  }
+  return true;
+}
+
+void Server::FlushOutput(Connection *conn) {
+  FrameMessages(conn);
+  if (!conn->Write()) {
+    MarkClosing(conn);
+    return;
+  }
+
+  if (conn->paused_ && (conn->queued_bytes() <= options_.high_watermark / 2)) {
+    conn->paused_ = false;
+    ReadInput(conn);
+  }
+}
+
+void Server::MarkDirty(Connection *conn) {
+  if (!conn->dirty_) {
+    conn->dirty_ = true;
+    dirty_.push_back(conn);
+  }
+}
+
+void Server::MarkClosing(Connection *conn) {
+  if (!conn->closing_) {
+    conn->closing_ = true;
+    closing_.push_back(conn);
+  }
+}
+
+void Server::Unsubscribe(Connection *conn, DocID doc_id) {
+  if (conn->subscriptions_.erase(doc_id) == 0) {
+    return;
+  }
+
+  map<DocID, UpdateBroadcaster*>& broadcasters =
+      conn->websocket_ ? json_broadcasters_ : broadcasters_;
+  map<DocID, UpdateBroadcaster*>::iterator it = broadcasters.find(doc_id);
+  UpdateBroadcaster *broadcaster = it->second;
+  broadcaster->Unsubscribe(conn);
+  if (broadcaster->num_subscribers() == 0) {
+    Document *doc = store_->Get(doc_id);
+    if (doc != NULL) {
+      doc->RemoveObserver(broadcaster);
+    }
+    delete broadcaster;
+    broadcasters.erase(it);
+  }
+}
+
+void Server::CloseConnection(Connection *conn) {
+  // Best effort to send what the peer asked for before it went away
+  conn->Write();
+
+  while (!conn->subscriptions_.empty()) {
+    Unsubscribe(conn, *conn->subscriptions_.begin());
+  }
+  if (conn->follower_) {
+    replication_->RemoveFollower(conn);
+  }
+  if (conn == primary_) {
+    // Keep replicating unless the follower was promoted or diverged
+    primary_ = NULL;
+    if (read_only_ && !replication_failed_ && !stopped_) {
+      next_connect_micros_ =
+          NowMicros() + options_.reconnect_interval_ms * 1000LL;
+    }
+  }
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd_, NULL);
+  if (conn->shm_ != NULL) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->shm_->event_fd(), NULL);
+  }
+  connections_.erase(conn->fd_);
+  delete conn;
+}
+
+}  // namespace kamiah
@@ -0,0 +1,383 @@
+/**
+ * @file server.h
+ * @brief Definition of a Server.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_SERVER_H_
+#define KAMIAH_SERVER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "diff_log.h"
+#include "document_store.h"
+#include "json_format.h"
+#include "protocol.h"
+#include "shared_buffer.h"
+#include "snapshotter.h"
+#include "types.h"
+#include "update_broadcaster.h"
+#include "websocket.h"
+
+using std::list;
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief Options of a Server.
+ */
+struct ServerOptions {
+  ServerOptions();
+
+  // Address to listen on.
+  string address;
+
+  // Port to listen on, 0 to pick any free port.
+  int port;
+
+  // Port to listen on for WebSocket connections, 0 to pick any free port or
+  // -1 to not accept WebSocket connections.
+  int websocket_port;
+
+  // Path of a Unix socket on which co-located clients get a ShmChannel to
+  // the server, empty to not accept such clients.
+  string shm_path;
+
+  // Capacity of each direction of a ShmChannel.
+  size_t shm_capacity;
+
+  // A connection is not read from while it has more than this many bytes
+  // waiting to be written to it, and is read from again once it has less
+  // than half.
+  size_t high_watermark;
+
+  // A connection is closed if it has more than this many bytes waiting to be
+  // written to it. This only happens to subscribers that do not keep up with
+  // the updates of the Documents they watch.
+  size_t max_output_bytes;
+
+  // Same as max_output_bytes for followers, which are sent every diff. The
+  // state of the store queued for a follower when it connects does not
+  // count. A closed follower connects again and resyncs.
+  size_t max_follower_output_bytes;
+
+  // Address and port of a primary to replicate the Documents of. If set, the
+  // server is a read-only follower of the primary until Promote() is called.
+  string primary_address;
+  int primary_port;
+
+  // Time a follower waits before connecting again to a primary it lost or
+  // could not reach.
+  int reconnect_interval_ms;
+};
+
+/**
+ * @brief A Server serves the Documents of a DocumentStore over TCP using the
+ *     messages defined in protocol.h.
+ *
+ * The Server runs an edge-triggered epoll event loop on a single thread. All
+ * I/O is non-blocking. The updates of a Document are serialized once, as
+ * complete frames, and the same bytes are queued on every subscribed
+ * connection (see UpdateBroadcaster).
+ *
+ * Browsers connect to the WebSocket port and exchange the JSON messages of
+ * json_format.h in text frames. Each frame the server sends holds a JSON
+ * array with all the messages queued for the connection since the last
+ * write, so a burst of updates costs one frame and one system call.
+ *
+ * Clients on the same host can instead connect to the Unix socket at
+ * ServerOptions::shm_path. The server answers with a ShmChannel and exchanges
+ * the usual frames with the client through it, bypassing the network stack.
+ * The Unix socket stays open only to tell when the client goes away.
+ *
+ * If the Documents are logged to a SYNC_EACH DiffLog, diffs are only
+ * acknowledged (and broadcast) once they are durable. The output of each
+ * iteration of the event loop waits for a single sync covering every diff
+ * applied during it.
+ *
+ * A follower connects to its primary (see ServerOptions::primary_address)
+ * and sends MSG_REPLICATE. The primary answers with the state of every
+ * Document and then streams the diffs it applies, in order, once they are
+ * durable. The follower applies them to its own store, so its clients can
+ * subscribe to Documents as usual but cannot apply diffs, and only starts
+ * accepting clients once it is in sync. Followers can have followers of
+ * their own. Promote() turns a follower into a primary, usually once the
+ * old one failed. A follower with a Snapshotter starts a snapshot as soon as
+ * it is in sync, since its log does not have the Documents it was sent.
+ *
+ * A follower that loses its primary, or falls behind it, keeps serving its
+ * clients and connects again every ServerOptions::reconnect_interval_ms.
+ * The primary sends every Document again and the follower catches up on the
+ * diffs it missed from their cached updates. If it cannot, it stops (see
+ * replication_failed()).
+ *
+ * This class is thread-compatible, except for Stop() and Promote() which are
+ * thread-safe.
+ * The DocumentStore must only be used from the thread running the Server.
+ */
+class Server {
+ public:
+  /**
+   * @brief Constructs a Server.
+   *
+   * @param store The Documents to serve. Not owned.
+   * @param options The options of the server.
+   */
+  Server(DocumentStore *store, const ServerOptions& options);
+  ~Server();
+
+  /**
+   * @brief Sets the log the Documents of the store are logged to. Must be
+   *     called before Run().
+   *
+   * @param diff_log The log, already observing the store. Not owned.
+   */
+  void set_diff_log(DiffLog *diff_log);
+
+  /**
+   * @brief Sets a Snapshotter to start a snapshot of the store periodically,
+   *     between iterations of the event loop. Must be called before Run().
+   *
+   * @param snapshotter The snapshotter of the store. Not owned.
+   * @param interval_micros Time between the start of two snapshots.
+   */
+  void set_snapshotter(Snapshotter *snapshotter, int64_t interval_micros);
+
+  /**
+   * @brief Starts listening for connections.
+   *
+   * @return True iff the server is listening.
+   */
+  bool Start();
+
+  /**
+   * @brief Runs the event loop until Stop() is called. Start() must have
+   *     succeeded.
+   */
+  void Run();
+
+  /**
+   * @brief Runs a single iteration of the event loop.
+   *
+   * @param timeout_ms Maximum time to wait for events, -1 to wait forever.
+   */
+  void RunOnce(int timeout_ms);
+
+  /**
+   * @brief Makes Run() return. Can be called from any thread.
+   */
+  void Stop();
+
+  /**
+   * @brief Stops replicating from the primary and starts accepting diffs.
+   *     Can be called from any thread, takes effect on the next iteration of
+   *     the event loop.
+   */
+  void Promote();
+
+  /**
+   * @brief Whether the server is a follower that does not accept diffs.
+   *
+   * @return True iff the server is a follower that was not promoted.
+   */
+  bool read_only() const;
+
+  /**
+   * @brief Whether the server stopped because its Documents differ from
+   *     those of its primary and it could not catch up with them, for
+   *     example because the primary lost diffs it had already replicated.
+   *
+   * @return True iff replication failed.
+   */
+  bool replication_failed() const;
+
+  /**
+   * @brief Gets the port the server is listening on.
+   *
+   * @return The port the server is listening on.
+   */
+  int port() const;
+
+  /**
+   * @brief Gets the port the server is listening on for WebSocket
+   *     connections.
+   *
+   * @return The WebSocket port, -1 if WebSocket connections are disabled.
+   */
+  int websocket_port() const;
+
+  /**
+   * @brief Gets the number of open connections.
+   *
+   * @return The number of open connections.
+   */
+  size_t num_connections() const;
+
+ private:
+  class Connection;
+  class ReplicationStream;
+
+  // Listens on a port, returning the socket or -1 on failure.
+  int Listen(int port, int *bound_port);
+
+  // Starts watching the listening sockets. Returns false on failure.
+  bool WatchListeners();
+
+  // Starts connecting to the primary, which is asked to replicate once the
+  // connection is established. Returns false on failure.
+  bool ConnectToPrimary();
+
+  // Completes a connection to the primary once its socket is writable and
+  // asks it to replicate. Returns false if the connection failed.
+  bool FinishConnect(Connection *conn);
+
+  // Connects to the primary again if it is time to.
+  void Reconnect();
+
+  // Listens on a Unix socket, returning the socket or -1 on failure.
+  int ListenUnix(const string& path);
+
+  // Accepts all pending connections on a listening socket.
+  void Accept(int listen_fd, bool websocket);
+
+  // Accepts all pending shared memory clients.
+  void AcceptShm();
+
+  // Starts watching a new connection. Returns false on failure.
+  bool AddConnection(Connection *conn);
+
+  // Handles epoll events on a connection.
+  void HandleEvents(Connection *conn, uint32_t events);
+
+  // Reads and processes input for as long as the connection is not paused.
+  void ReadInput(Connection *conn);
+
+  // Processes all the complete frames in the connection's input.
+  void ProcessInput(Connection *conn);
+
+  // Processes a single frame. Returns false if the frame is malformed.
+  bool ProcessFrame(Connection *conn, const Frame& frame);
+  bool HandleApply(Connection *conn, const Frame& frame);
+  bool HandleSubscribe(Connection *conn, const Frame& frame);
+  bool HandleUnsubscribe(Connection *conn, const Frame& frame);
+  bool HandleReplicate(Connection *conn, const Frame& frame);
+
+  // Processes a frame sent by the primary.
+  bool ProcessPrimaryFrame(const Frame& frame);
+  bool HandleDocument(const Frame& frame);
+  bool HandleDocumentData(const Frame& frame);
+  bool HandleSynced();
+  bool HandleReplicatedUpdate(const Frame& frame);
+
+  // Replaces a Document with the one received from the primary or, if
+  // clients may be watching it, applies the cached updates it missed.
+  // Returns false if it cannot catch up.
+  bool InstallDocument();
+
+  // Turns the follower into a primary.
+  void DoPromote();
+
+  // Same as the above for WebSocket connections.
+  void ProcessWebSocketInput(Connection *conn);
+  bool ProcessWebSocketFrame(Connection *conn, const WebSocketFrame& frame);
+  bool HandleJsonMessage(Connection *conn, const char *data, size_t size);
+
+  // Sends a close frame with a status code and closes the connection.
+  void CloseWebSocket(Connection *conn, uint16_t status);
+
+  // Queues the pending messages of a WebSocket connection as one frame.
+  void FrameMessages(Connection *conn);
+
+  // Requests shared by both protocols. A diff to a corrupted Document (see
+  // DocumentStore::IsCorrupted()) is rejected, and subscribing to one
+  // returns false so that the connection is closed.
+  void Apply(Connection *conn, DocID doc_id, Diff *diff);
+  bool Subscribe(Connection *conn, DocID doc_id, Version from_version);
+
+  // Writes as much pending output as possible, resuming reading if the
+  // connection drains enough.
+  void FlushOutput(Connection *conn);
+
+  // Remembers that a connection has output to flush at the end of this
+  // iteration of the event loop.
+  void MarkDirty(Connection *conn);
+
+  // Schedules a connection to be closed at the end of this iteration.
+  void MarkClosing(Connection *conn);
+
+  void Unsubscribe(Connection *conn, DocID doc_id);
+  void CloseConnection(Connection *conn);
+
+  DocumentStore *store_;
+  ServerOptions options_;
+  DiffLog *diff_log_;
+  Snapshotter *snapshotter_;
+  int64_t snapshot_interval_micros_;
+  int64_t next_snapshot_micros_;
+  UpdateFrameEncoder encoder_;
+  JsonEncoder json_encoder_;
+
+  // Holds ",]" to separate the messages batched in a WebSocket frame.
+  SharedBuffer *separators_;
+
+  int epoll_fd_;
+  int listen_fd_;
+  int websocket_listen_fd_;
+  int shm_listen_fd_;
+  int wake_fd_;
+  int port_;
+  int websocket_port_;
+  volatile bool stopped_;
+  bool listening_;
+
+  // Replication: the stream sent to followers, created with the first one,
+  // and on a follower the connection to the primary (NULL once it is gone),
+  // when to connect again (-1 if not scheduled), whether it is sending the
+  // Documents and which ones it sent before MSG_SYNCED.
+  ReplicationStream *replication_;
+  Connection *primary_;
+  bool read_only_;
+  volatile bool promote_requested_;
+  bool replication_failed_;
+  int64_t next_connect_micros_;
+  bool syncing_;
+  set<DocID> synced_doc_ids_;
+
+  // The Document being received from the primary, while its data is split
+  // across frames.
+  bool receiving_document_;
+  DocID pending_doc_id_;
+  Version pending_version_;
+  size_t pending_size_;
+  string pending_data_;
+  list<Diff> pending_diffs_;
+
+  map<int, Connection*> connections_;
+
+  // Broadcasters of the updates of each Document, in the binary protocol and
+  // in JSON.
+  map<DocID, UpdateBroadcaster*> broadcasters_;
+  map<DocID, UpdateBroadcaster*> json_broadcasters_;
+  vector<Connection*> dirty_;
+  vector<Connection*> closing_;
+
+  // Not copyable.
+  Server(const Server&);
+  void operator=(const Server&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_SERVER_H_
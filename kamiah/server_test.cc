@@ -0,0 +1,1061 @@
+/**
+ * @file server_test.cc
+ * @brief Unit tests for a Server and a Client.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "client.h"
+#include "protocol.h"
+#include "websocket.h"
+#include "gtest/gtest.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+// Timeout of reads that are expected to succeed.
+const int kTimeoutMs = 5000;
+
+void *RunServer(void *arg) {
+  static_cast<Server*>(arg)->Run();
+  return NULL;
+}
+
+// A kamiah_server process. Its standard output is read through a pipe.
+struct ServerProcess {
+  pid_t pid;
+  int output_fd;
+  int port;
+};
+
+// Stops a kamiah_server process with a signal. Returns its status.
+int StopServerProcess(ServerProcess *process, int signal) {
+  kill(process->pid, signal);
+  int status = 0;
+  waitpid(process->pid, &status, 0);
+  close(process->output_fd);
+  return status;
+}
+
+// Runs kamiah_server with some flags and waits until it listens. Returns
+// false on failure.
+bool StartServerProcess(const vector<string>& flags, ServerProcess *process) {
+  vector<string> args(1, "./kamiah_server");
+  args.insert(args.end(), flags.begin(), flags.end());
+  vector<char*> argv;
+  for (size_t i = 0; i < args.size(); ++i) {
+    argv.push_back(const_cast<char*>(args[i].c_str()));
+  }
+  argv.push_back(NULL);
+
+  int fds[2];
+  if (pipe(fds) < 0) {
+    return false;
+  }
+  process->pid = fork();
+  if (process->pid == 0) {
+    // Do not outlive the test
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execv(argv[0], &argv[0]);
+    _exit(127);
+  }
+  close(fds[1]);
+  process->output_fd = fds[0];
+  if (process->pid < 0) {
+    close(fds[0]);
+    return false;
+  }
+
+  // The port is only known once the server prints it
+  string line;
+  char c;
+  while (read(process->output_fd, &c, 1) == 1) {
+    if (c != '\n') {
+      line.push_back(c);
+    } else if (sscanf(line.c_str(), "Listening on %*[^:]:%d",
+                      &process->port) == 1) {
+      return true;
+    } else {
+      line.clear();
+    }
+  }
+  StopServerProcess(process, SIGKILL);
+  return false;
+}
+
+}  // namespace
+
+class ServerTest : public ::testing::Test {
+ protected:
+  ServerTest() : server_(NULL), diff_log_(NULL), next_sync_doc_id_(1000) {}
+
+  virtual void SetUp() {
+    ServerOptions options;
+    options.address = "127.0.0.1";
+    options.websocket_port = 0;
+    char shm_path[64];
+    snprintf(shm_path, sizeof(shm_path), "/tmp/kamiah_server_test.%d",
+             static_cast<int>(getpid()));
+    options.shm_path = shm_path;
+    options.shm_capacity = 4096;
+    shm_path_ = shm_path;
+
+    char log_path[64];
+    snprintf(log_path, sizeof(log_path), "/tmp/kamiah_server_test_log.%d",
+             static_cast<int>(getpid()));
+    log_path_ = log_path;
+    unlink(log_path);
+    DiffLogOptions log_options;
+    log_options.durability = DiffLogOptions::SYNC_EACH;
+    diff_log_ = DiffLog::Open(log_path_, log_options);
+    ASSERT_TRUE(diff_log_ != NULL);
+    store_.AddObserver(diff_log_);
+
+    server_ = new Server(&store_, options);
+    server_->set_diff_log(diff_log_);
+    ASSERT_TRUE(server_->Start());
+    ASSERT_LT(0, server_->port());
+    ASSERT_EQ(0, pthread_create(&thread_, NULL, &RunServer, server_));
+  }
+
+  virtual void TearDown() {
+    server_->Stop();
+    pthread_join(thread_, NULL);
+    delete server_;
+    store_.RemoveObserver(diff_log_);
+    delete diff_log_;
+    unlink(log_path_.c_str());
+  }
+
+  // Connects a plain socket to the server, -1 on failure.
+  int ConnectRaw(int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if ((fd >= 0) && (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                              sizeof(addr)) < 0)) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  void Connect(Client *client) {
+    ASSERT_TRUE(client->Connect("127.0.0.1", server_->port()));
+  }
+
+  // Applies a diff and waits for its acknowledgement.
+  void Apply(Client *client, DocID doc_id, const Diff& diff,
+             Version expected_version) {
+    ASSERT_TRUE(client->Apply(doc_id, diff));
+    ServerMessage message;
+    ASSERT_TRUE(client->ReadMessage(kTimeoutMs, &message));
+    EXPECT_EQ(MSG_APPLIED, message.type);
+    EXPECT_EQ(doc_id, message.doc_id);
+    EXPECT_EQ(expected_version, message.version);
+  }
+
+  // Connects to the WebSocket port and completes the opening handshake.
+  int ConnectWebSocket() {
+    int fd = ConnectRaw(server_->websocket_port());
+    string request = "GET / HTTP/1.1\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                     "Sec-WebSocket-Version: 13\r\n\r\n";
+    if ((fd < 0) || !WriteAll(fd, request)) {
+      return -1;
+    }
+
+    string response;
+    char c;
+    while ((response.find("\r\n\r\n") == string::npos) &&
+           (read(fd, &c, 1) == 1)) {
+      response.push_back(c);
+    }
+    EXPECT_EQ(0u, response.find("HTTP/1.1 101 Switching Protocols\r\n"));
+    EXPECT_NE(string::npos,
+              response.find("Sec-WebSocket-Accept: "
+                            "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"));
+    return fd;
+  }
+
+  bool WriteAll(int fd, const string& data) {
+    return write(fd, data.data(), data.size()) ==
+        static_cast<ssize_t>(data.size());
+  }
+
+  // Sends a masked text frame.
+  bool SendText(int fd, const string& text) {
+    string frame;
+    AppendMaskedWebSocketFrame(WS_TEXT, true, text, 0x12345678, &frame);
+    return WriteAll(fd, frame);
+  }
+
+  // Reads the next frame sent by the server. Returns false if the
+  // connection was closed.
+  bool ReadWebSocketFrame(int fd, WebSocketOpcode *opcode, string *payload) {
+    string data;
+    WebSocketFrame frame;
+    while (ParseWebSocketFrame(data.empty() ? NULL : &data[0], data.size(),
+                               &frame) != FRAME_OK) {
+      char c;
+      if (read(fd, &c, 1) != 1) {
+        return false;
+      }
+      data.push_back(c);
+    }
+    EXPECT_FALSE(frame.masked);
+    *opcode = frame.opcode;
+    payload->assign(frame.payload, frame.payload_size);
+    return true;
+  }
+
+  // Reads the next text frame, expecting it to be the specified one.
+  void ExpectText(int fd, const string& expected) {
+    WebSocketOpcode opcode;
+    string payload;
+    ASSERT_TRUE(ReadWebSocketFrame(fd, &opcode, &payload));
+    EXPECT_EQ(WS_TEXT, opcode);
+    EXPECT_EQ(expected, payload);
+  }
+
+  // Waits until the server has processed all the requests sent by a client
+  // so far. Requests of a connection are processed in order.
+  void Sync(Client *client) {
+    Apply(client, next_sync_doc_id_++, Diff(0, "sync"), 1);
+  }
+
+  // Starts a server running on its own thread.
+  static Server* StartServer(DocumentStore *store,
+                             const ServerOptions& options,
+                             pthread_t *thread) {
+    Server *server = new Server(store, options);
+    EXPECT_TRUE(server->Start());
+    EXPECT_EQ(0, pthread_create(thread, NULL, &RunServer, server));
+    return server;
+  }
+
+  // Starts a follower of a server, running on its own thread.
+  Server* StartFollower(DocumentStore *store, int primary_port,
+                        pthread_t *thread) {
+    ServerOptions options;
+    options.address = "127.0.0.1";
+    options.primary_address = "127.0.0.1";
+    options.primary_port = primary_port;
+    Server *follower = StartServer(store, options, thread);
+    EXPECT_TRUE(follower->read_only());
+    return follower;
+  }
+
+  static void StopServer(Server *server, pthread_t thread) {
+    server->Stop();
+    pthread_join(thread, NULL);
+    delete server;
+  }
+
+  // Subscribes to a Document from a version it already has and reads the
+  // catch up, so that only the updates applied from now on are left to read.
+  // Unlike Sync(), this works on followers.
+  void SubscribeAt(Client *client, DocID doc_id, Version version) {
+    ASSERT_TRUE(client->Subscribe(doc_id, version));
+    ServerMessage message;
+    ASSERT_TRUE(client->ReadMessage(kTimeoutMs, &message));
+    EXPECT_NE(MSG_UPDATE, message.type);
+  }
+
+  DocumentStore store_;
+  Server *server_;
+  DiffLog *diff_log_;
+  string log_path_;
+  pthread_t thread_;
+  string shm_path_;
+  DocID next_sync_doc_id_;
+};
+
+TEST_F(ServerTest, Apply) {
+  Client client;
+  Connect(&client);
+
+  Apply(&client, 1, Diff(0, "hello"), 1);
+  Apply(&client, 1, Diff(5, " world"), 2);
+  Apply(&client, 2, Diff(0, "other"), 1);
+
+  // Out of bounds
+  Apply(&client, 1, Diff(100, "x"), -1);
+}
+
+TEST_F(ServerTest, AcknowledgedDiffsAreLogged) {
+  Client client;
+  Connect(&client);
+  Apply(&client, 1, Diff(0, "hello"), 1);
+  Apply(&client, 2, Diff(0, "other"), 1);
+
+  // Both diffs are in the log by the time they are acknowledged
+  DiffLogReader *reader = DiffLogReader::Open(log_path_);
+  ASSERT_TRUE(reader != NULL);
+  DocID doc_id;
+  DiffView diff;
+  ASSERT_TRUE(reader->Next(&doc_id, &diff));
+  EXPECT_EQ(1, doc_id);
+  EXPECT_EQ("hello", string(diff.text, diff.text_size));
+  ASSERT_TRUE(reader->Next(&doc_id, &diff));
+  EXPECT_EQ(2, doc_id);
+  EXPECT_EQ(1, diff.version);
+  EXPECT_FALSE(reader->Next(&doc_id, &diff));
+  EXPECT_FALSE(reader->corrupted());
+  delete reader;
+}
+
+TEST_F(ServerTest, SubscribeCatchesUp) {
+  Client client;
+  Connect(&client);
+  Apply(&client, 1, Diff(0, "hello"), 1);
+  Apply(&client, 1, Diff(5, " world"), 2);
+
+  ASSERT_TRUE(client.Subscribe(1, 1));
+  ServerMessage message;
+  ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_UPDATES, message.type);
+  EXPECT_EQ(1, message.doc_id);
+  ASSERT_EQ(2u, message.diffs.size());
+  EXPECT_EQ(1, message.diffs[0].version());
+  EXPECT_EQ("hello", message.diffs[0].text());
+  EXPECT_EQ(2, message.diffs[1].version());
+  EXPECT_EQ(" world", message.diffs[1].text());
+}
+
+TEST_F(ServerTest, SubscribeSendsDataWhenNotCached) {
+  Client client;
+  Connect(&client);
+  const int kNumDiffs = 20;
+  for (int i = 0; i < kNumDiffs; ++i) {
+    Apply(&client, 1, Diff(i, "a"), i + 1);
+  }
+
+  ASSERT_TRUE(client.Subscribe(1, 1));
+  ServerMessage message;
+  ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_DATA, message.type);
+  EXPECT_EQ(kNumDiffs, message.version);
+  EXPECT_EQ(string(kNumDiffs, 'a'), message.data);
+}
+
+TEST_F(ServerTest, StreamsUpdatesToSubscribers) {
+  Client writer, reader1, reader2;
+  Connect(&writer);
+  Connect(&reader1);
+  Connect(&reader2);
+
+  // Up to date, no catch up is sent
+  ASSERT_TRUE(reader1.Subscribe(1, 1));
+  ASSERT_TRUE(reader2.Subscribe(1, 1));
+  Sync(&reader1);
+  Sync(&reader2);
+
+  Apply(&writer, 1, Diff(0, "a"), 1);
+  Apply(&writer, 1, Diff(1, "b"), 2);
+  Apply(&writer, 1, Diff(2, "c"), 3);
+
+  Client *readers[] = {&reader1, &reader2};
+  for (int i = 0; i < 2; ++i) {
+    ServerMessage message;
+    for (Version version = 1; version <= 3; ++version) {
+      ASSERT_TRUE(readers[i]->ReadMessage(kTimeoutMs, &message));
+      EXPECT_EQ(MSG_UPDATE, message.type);
+      EXPECT_EQ(1, message.doc_id);
+      ASSERT_EQ(1u, message.diffs.size());
+      EXPECT_EQ(version, message.diffs[0].version());
+    }
+    EXPECT_FALSE(readers[i]->ReadMessage(100, &message));
+  }
+
+  // The writer did not subscribe
+  ServerMessage message;
+  EXPECT_FALSE(writer.ReadMessage(100, &message));
+}
+
+TEST_F(ServerTest, SubscriberSeesItsOwnUpdates) {
+  Client client;
+  Connect(&client);
+  ASSERT_TRUE(client.Subscribe(1, 1));
+
+  // The update is sent before the acknowledgement
+  ASSERT_TRUE(client.Apply(1, Diff(0, "a")));
+  ServerMessage message;
+  ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_UPDATE, message.type);
+  ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_APPLIED, message.type);
+  EXPECT_EQ(1, message.version);
+}
+
+TEST_F(ServerTest, Unsubscribe) {
+  Client writer, reader;
+  Connect(&writer);
+  Connect(&reader);
+
+  ASSERT_TRUE(reader.Subscribe(1, 1));
+  Sync(&reader);
+  Apply(&writer, 1, Diff(0, "a"), 1);
+  ServerMessage message;
+  ASSERT_TRUE(reader.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_UPDATE, message.type);
+
+  ASSERT_TRUE(reader.Unsubscribe(1));
+  Sync(&reader);
+  Apply(&writer, 1, Diff(1, "b"), 2);
+  EXPECT_FALSE(reader.ReadMessage(100, &message));
+}
+
+TEST_F(ServerTest, ClosesOnMalformedFrame) {
+  const string kFrames[] = {
+    string("\x01\x63", 2),          // Unknown message type
+    string("\x03\x01\x01\x00", 4),  // APPLY with a truncated diff
+    string("\x00", 1),              // No message type
+  };
+  for (size_t i = 0; i < sizeof(kFrames) / sizeof(kFrames[0]); ++i) {
+    int fd = ConnectRaw(server_->port());
+    ASSERT_LE(0, fd);
+    ASSERT_EQ(static_cast<ssize_t>(kFrames[i].size()),
+              write(fd, kFrames[i].data(), kFrames[i].size()));
+
+    // The server closes the connection without responding
+    char buf[16];
+    EXPECT_EQ(0, read(fd, buf, sizeof(buf))) << i;
+    close(fd);
+  }
+
+  // Other connections are unaffected
+  Client client;
+  Connect(&client);
+  Apply(&client, 1, Diff(0, "a"), 1);
+}
+
+TEST_F(ServerTest, ServesManyClients) {
+  const int kNumClients = 50;
+  Client clients[kNumClients];
+  for (int i = 0; i < kNumClients; ++i) {
+    Connect(&clients[i]);
+    ASSERT_TRUE(clients[i].Subscribe(1, 1));
+    Sync(&clients[i]);
+  }
+
+  Client writer;
+  Connect(&writer);
+  Apply(&writer, 1, Diff(0, "shared"), 1);
+  for (int i = 0; i < kNumClients; ++i) {
+    ServerMessage message;
+    ASSERT_TRUE(clients[i].ReadMessage(kTimeoutMs, &message));
+    EXPECT_EQ(MSG_UPDATE, message.type);
+    ASSERT_EQ(1u, message.diffs.size());
+    EXPECT_EQ("shared", message.diffs[0].text());
+  }
+}
+
+TEST_F(ServerTest, PipelinedRequests) {
+  const int kNumDiffs = 10000;
+  Client client;
+  Connect(&client);
+  for (int i = 0; i < kNumDiffs; ++i) {
+    ASSERT_TRUE(client.Apply(1, Diff(i, "x")));
+  }
+  for (int i = 0; i < kNumDiffs; ++i) {
+    ServerMessage message;
+    ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+    EXPECT_EQ(MSG_APPLIED, message.type);
+    EXPECT_EQ(i + 1, message.version);
+  }
+}
+
+TEST_F(ServerTest, WebSocketApplyAndSubscribe) {
+  int fd = ConnectWebSocket();
+  ASSERT_LE(0, fd);
+
+  ASSERT_TRUE(SendText(fd, "{\"doc_id\":1,\"diffs\":[{\"type\":\"insert\","
+                           "\"index\":0,\"text\":\"papaya\"}]}"));
+  ExpectText(fd, "[{\"doc_id\":1,\"applied\":1}]");
+
+  ASSERT_TRUE(SendText(fd, "{\"doc_id\":1,\"subscribe\":1}"));
+  ExpectText(fd, "[{\"doc_id\":1,\"updates\":[{\"version\":1,"
+                 "\"type\":\"insert\",\"index\":0,\"text\":\"papaya\"}]}]");
+
+  // Updates from binary clients are streamed as JSON
+  Client client;
+  Connect(&client);
+  Apply(&client, 1, Diff(6, "!"), 2);
+  ExpectText(fd, "[{\"doc_id\":1,\"updates\":[{\"version\":2,"
+                 "\"type\":\"insert\",\"index\":6,\"text\":\"!\"}]}]");
+
+  // And the other way around
+  ASSERT_TRUE(client.Subscribe(1, 3));
+  Sync(&client);
+  ASSERT_TRUE(SendText(fd, "{\"doc_id\":1,\"diffs\":[{\"type\":\"delete\","
+                           "\"index\":0,\"length\":1}]}"));
+  ServerMessage message;
+  ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_UPDATE, message.type);
+  ASSERT_EQ(1u, message.diffs.size());
+  EXPECT_EQ(Diff::DELETE, message.diffs[0].type());
+  close(fd);
+}
+
+TEST_F(ServerTest, WebSocketBatchesMessages) {
+  int fd = ConnectWebSocket();
+  ASSERT_LE(0, fd);
+
+  // All the responses to a request are sent in one frame
+  ASSERT_TRUE(SendText(fd, "[{\"doc_id\":1,\"subscribe\":1},"
+                           "{\"doc_id\":1,\"diffs\":["
+                           "{\"type\":\"insert\",\"index\":0,\"text\":\"a\"},"
+                           "{\"type\":\"insert\",\"index\":1,\"text\":\"b\"}"
+                           "]}]"));
+  ExpectText(fd, "[{\"doc_id\":1,\"updates\":[{\"version\":1,"
+                 "\"type\":\"insert\",\"index\":0,\"text\":\"a\"}]},"
+                 "{\"doc_id\":1,\"applied\":1},"
+                 "{\"doc_id\":1,\"updates\":[{\"version\":2,"
+                 "\"type\":\"insert\",\"index\":1,\"text\":\"b\"}]},"
+                 "{\"doc_id\":1,\"applied\":2}]");
+  close(fd);
+}
+
+TEST_F(ServerTest, WebSocketControlFrames) {
+  int fd = ConnectWebSocket();
+  ASSERT_LE(0, fd);
+
+  // Fragmented message with a ping in the middle
+  string data;
+  AppendMaskedWebSocketFrame(WS_TEXT, false, "{\"doc_id\":1,", 1, &data);
+  AppendMaskedWebSocketFrame(WS_PING, true, "hi", 2, &data);
+  AppendMaskedWebSocketFrame(WS_CONTINUATION, true, "\"subscribe\":0}", 3,
+                             &data);
+  ASSERT_TRUE(WriteAll(fd, data));
+
+  WebSocketOpcode opcode;
+  string payload;
+  ASSERT_TRUE(ReadWebSocketFrame(fd, &opcode, &payload));
+  EXPECT_EQ(WS_PONG, opcode);
+  EXPECT_EQ("hi", payload);
+  ExpectText(fd, "[{\"doc_id\":1,\"version\":0,\"data\":\"\"}]");
+
+  // Close is echoed
+  data.clear();
+  AppendMaskedWebSocketFrame(WS_CLOSE, true, string("\x03\xe8", 2), 4, &data);
+  ASSERT_TRUE(WriteAll(fd, data));
+  ASSERT_TRUE(ReadWebSocketFrame(fd, &opcode, &payload));
+  EXPECT_EQ(WS_CLOSE, opcode);
+  EXPECT_EQ(string("\x03\xe8", 2), payload);
+  EXPECT_FALSE(ReadWebSocketFrame(fd, &opcode, &payload));
+  close(fd);
+}
+
+TEST_F(ServerTest, WebSocketProtocolErrors) {
+  // Unmasked frame, binary frame and malformed JSON
+  string unmasked;
+  AppendWebSocketFrame(WS_TEXT, "{\"doc_id\":1,\"subscribe\":0}", &unmasked);
+  string binary;
+  AppendMaskedWebSocketFrame(WS_BINARY, true, "abc", 1, &binary);
+  string malformed;
+  AppendMaskedWebSocketFrame(WS_TEXT, true, "{\"doc_id\":", 1, &malformed);
+  const string kFrames[] = {unmasked, binary, malformed};
+
+  for (size_t i = 0; i < sizeof(kFrames) / sizeof(kFrames[0]); ++i) {
+    int fd = ConnectWebSocket();
+    ASSERT_LE(0, fd);
+    ASSERT_TRUE(WriteAll(fd, kFrames[i]));
+
+    WebSocketOpcode opcode;
+    string payload;
+    ASSERT_TRUE(ReadWebSocketFrame(fd, &opcode, &payload)) << i;
+    EXPECT_EQ(WS_CLOSE, opcode);
+    EXPECT_EQ(string("\x03\xea", 2), payload);
+    EXPECT_FALSE(ReadWebSocketFrame(fd, &opcode, &payload));
+    close(fd);
+  }
+
+  // Not a WebSocket handshake
+  int fd = ConnectRaw(server_->websocket_port());
+  ASSERT_LE(0, fd);
+  ASSERT_TRUE(WriteAll(fd, "GET / HTTP/1.1\r\n\r\n"));
+  char buf[64];
+  ssize_t bytes_read = read(fd, buf, sizeof(buf));
+  ASSERT_LT(0, bytes_read);
+  EXPECT_EQ(0u, string(buf, bytes_read).find("HTTP/1.1 400"));
+  close(fd);
+}
+
+TEST_F(ServerTest, SharedMemory) {
+  Client client;
+  ASSERT_TRUE(client.ConnectShm(shm_path_));
+  Apply(&client, 1, Diff(0, "hello"), 1);
+
+  // Updates from TCP clients reach shared memory subscribers
+  ASSERT_TRUE(client.Subscribe(1, 2));
+  Sync(&client);
+  Client tcp_client;
+  Connect(&tcp_client);
+  Apply(&tcp_client, 1, Diff(5, " world"), 2);
+  ServerMessage message;
+  ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_UPDATE, message.type);
+  ASSERT_EQ(1u, message.diffs.size());
+  EXPECT_EQ(" world", message.diffs[0].text());
+}
+
+TEST_F(ServerTest, SharedMemoryLargeMessages) {
+  // Much larger than the capacity of the channel
+  string text(100 * 1000, 'p');
+  Client client;
+  ASSERT_TRUE(client.ConnectShm(shm_path_));
+  Apply(&client, 1, Diff(0, text), 1);
+
+  ASSERT_TRUE(client.Subscribe(1, 1));
+  ServerMessage message;
+  ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_UPDATES, message.type);
+  ASSERT_EQ(1u, message.diffs.size());
+  EXPECT_TRUE(text == message.diffs[0].text());
+}
+
+TEST_F(ServerTest, SharedMemoryPipelinedRequests) {
+  const int kNumDiffs = 10000;
+  Client client;
+  ASSERT_TRUE(client.ConnectShm(shm_path_));
+
+  // The channel fills up in both directions, so read while writing
+  int num_acked = 0;
+  for (int i = 0; i < kNumDiffs; ++i) {
+    ASSERT_TRUE(client.Apply(1, Diff(i, "x")));
+    if (i % 100 == 99) {
+      while (num_acked <= i - 50) {
+        ServerMessage message;
+        ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+        EXPECT_EQ(++num_acked, message.version);
+      }
+    }
+  }
+  while (num_acked < kNumDiffs) {
+    ServerMessage message;
+    ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+    EXPECT_EQ(++num_acked, message.version);
+  }
+}
+
+TEST_F(ServerTest, SharedMemoryClientGoesAway) {
+  Client client;
+  ASSERT_TRUE(client.ConnectShm(shm_path_));
+  ASSERT_TRUE(client.Subscribe(1, 1));
+  Sync(&client);
+  client.Close();
+
+  // The server keeps working after dropping the subscriber
+  Client other;
+  ASSERT_TRUE(other.ConnectShm(shm_path_));
+  Apply(&other, 1, Diff(0, "a"), 1);
+  Apply(&other, 1, Diff(1, "b"), 2);
+}
+
+TEST_F(ServerTest, Replication) {
+  Client writer;
+  Connect(&writer);
+  Apply(&writer, 1, Diff(0, "papaya"), 1);
+
+  DocumentStore follower_store;
+  pthread_t follower_thread;
+  Server *follower = StartFollower(&follower_store, server_->port(),
+                                   &follower_thread);
+
+  // The follower was sent the Document along with its cached diffs
+  Client reader;
+  ASSERT_TRUE(reader.Connect("127.0.0.1", follower->port()));
+  ASSERT_TRUE(reader.Subscribe(1, 1));
+  ServerMessage message;
+  ASSERT_TRUE(reader.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_UPDATES, message.type);
+  ASSERT_EQ(1u, message.diffs.size());
+  EXPECT_EQ("papaya", message.diffs[0].text());
+
+  // Diffs applied on the primary reach the subscribers of the follower
+  Apply(&writer, 1, Diff(0, "kamiah "), 2);
+  Apply(&writer, 2, Diff(0, "ide"), 1);
+  ASSERT_TRUE(reader.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_UPDATE, message.type);
+  EXPECT_EQ(1, message.doc_id);
+  ASSERT_EQ(1u, message.diffs.size());
+  EXPECT_EQ(2, message.diffs[0].version());
+  EXPECT_EQ("kamiah ", message.diffs[0].text());
+
+  // The follower does not accept diffs
+  ASSERT_TRUE(reader.Apply(1, Diff(0, "x")));
+  ASSERT_TRUE(reader.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_APPLIED, message.type);
+  EXPECT_EQ(-1, message.version);
+
+  StopServer(follower, follower_thread);
+  string data;
+  ASSERT_TRUE(follower_store.Get(1) != NULL);
+  follower_store.Get(1)->GetData(&data);
+  EXPECT_EQ("kamiah papaya", data);
+  ASSERT_TRUE(follower_store.Get(2) != NULL);
+  EXPECT_EQ(1, follower_store.Get(2)->version());
+}
+
+TEST_F(ServerTest, ReplicationReplacesLocalDocuments) {
+  Client writer;
+  Connect(&writer);
+  Apply(&writer, 1, Diff(0, "papaya"), 1);
+
+  // Stale copies are replaced and Documents the primary does not have are
+  // dropped
+  DocumentStore follower_store;
+  Diff stale(0, "stale");
+  follower_store.GetOrCreate(1)->ApplyDiff(&stale);
+  follower_store.GetOrCreate(1)->ApplyDiff(&stale);
+  follower_store.GetOrCreate(99);
+  pthread_t follower_thread;
+  Server *follower = StartFollower(&follower_store, server_->port(),
+                                   &follower_thread);
+  Client reader;
+  ASSERT_TRUE(reader.Connect("127.0.0.1", follower->port()));
+  SubscribeAt(&reader, 1, 1);
+  StopServer(follower, follower_thread);
+
+  ASSERT_EQ(1u, follower_store.size());
+  string data;
+  follower_store.Get(1)->GetData(&data);
+  EXPECT_EQ("papaya", data);
+  EXPECT_EQ(1, follower_store.Get(1)->version());
+}
+
+TEST_F(ServerTest, FollowerOfFollower) {
+  DocumentStore middle_store;
+  pthread_t middle_thread;
+  Server *middle = StartFollower(&middle_store, server_->port(),
+                                 &middle_thread);
+  DocumentStore last_store;
+  pthread_t last_thread;
+  Server *last = StartFollower(&last_store, middle->port(), &last_thread);
+
+  Client reader;
+  ASSERT_TRUE(reader.Connect("127.0.0.1", last->port()));
+  SubscribeAt(&reader, 1, 0);
+  Client writer;
+  Connect(&writer);
+  Apply(&writer, 1, Diff(0, "papaya"), 1);
+
+  ServerMessage message;
+  ASSERT_TRUE(reader.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_UPDATE, message.type);
+  ASSERT_EQ(1u, message.diffs.size());
+  EXPECT_EQ("papaya", message.diffs[0].text());
+
+  StopServer(last, last_thread);
+  StopServer(middle, middle_thread);
+}
+
+TEST_F(ServerTest, Promote) {
+  Client writer;
+  Connect(&writer);
+  Apply(&writer, 1, Diff(0, "papaya"), 1);
+
+  DocumentStore follower_store;
+  pthread_t follower_thread;
+  Server *follower = StartFollower(&follower_store, server_->port(),
+                                   &follower_thread);
+  Client client;
+  ASSERT_TRUE(client.Connect("127.0.0.1", follower->port()));
+  SubscribeAt(&client, 1, 1);
+
+  // Diffs are accepted once the promotion takes effect
+  follower->Promote();
+  Version version = -1;
+  for (int i = 0; (i < 100) && (version < 0); ++i) {
+    ASSERT_TRUE(client.Apply(1, Diff(0, "kamiah ")));
+    ServerMessage message;
+    do {
+      ASSERT_TRUE(client.ReadMessage(kTimeoutMs, &message));
+    } while (message.type != MSG_APPLIED);
+    version = message.version;
+  }
+  EXPECT_EQ(2, version);
+
+  // The old primary no longer replicates to it
+  Apply(&writer, 1, Diff(0, "x"), 2);
+  StopServer(follower, follower_thread);
+  EXPECT_EQ(2, follower_store.Get(1)->version());
+  string data;
+  follower_store.Get(1)->GetData(&data);
+  EXPECT_EQ("kamiah papaya", data);
+}
+
+TEST_F(ServerTest, ReplicationOfLargeDocuments) {
+  // The whole store is queued at once, more than subscribers may have queued,
+  // and one Document does not fit in a frame
+  DocumentStore primary_store;
+  Diff large(0, string(kMaxFrameSize + 1024 * 1024, 'k'));
+  ASSERT_TRUE(primary_store.GetOrCreate(1)->ApplyDiff(&large));
+  for (DocID doc_id = 2; doc_id < 10; ++doc_id) {
+    Diff diff(0, string(512 * 1024, 'a' + doc_id));
+    ASSERT_TRUE(primary_store.GetOrCreate(doc_id)->ApplyDiff(&diff));
+  }
+  ServerOptions options;
+  options.address = "127.0.0.1";
+  options.max_output_bytes = 1024 * 1024;
+  pthread_t primary_thread;
+  Server *primary = StartServer(&primary_store, options, &primary_thread);
+
+  DocumentStore follower_store;
+  pthread_t follower_thread;
+  Server *follower = StartFollower(&follower_store, primary->port(),
+                                   &follower_thread);
+  Client reader;
+  ASSERT_TRUE(reader.Connect("127.0.0.1", follower->port()));
+  SubscribeAt(&reader, 2, 1);
+  StopServer(follower, follower_thread);
+  StopServer(primary, primary_thread);
+
+  ASSERT_EQ(primary_store.size(), follower_store.size());
+  for (DocID doc_id = 1; doc_id < 10; ++doc_id) {
+    ASSERT_TRUE(follower_store.Get(doc_id) != NULL);
+    EXPECT_EQ(1, follower_store.Get(doc_id)->version());
+    string expected;
+    string data;
+    primary_store.Get(doc_id)->GetData(&expected);
+    follower_store.Get(doc_id)->GetData(&data);
+    EXPECT_TRUE(expected == data) << doc_id;
+  }
+}
+
+TEST_F(ServerTest, SlowFollowerIsClosed) {
+  // The state of the store is more than a follower may have queued
+  DocumentStore primary_store;
+  Diff large(0, string(2 * 1024 * 1024, 'k'));
+  ASSERT_TRUE(primary_store.GetOrCreate(1)->ApplyDiff(&large));
+  ServerOptions options;
+  options.address = "127.0.0.1";
+  options.max_follower_output_bytes = 1024 * 1024;
+  pthread_t primary_thread;
+  Server *primary = StartServer(&primary_store, options, &primary_thread);
+
+  // A follower that stops reading after its initial sync
+  int fd = ConnectRaw(primary->port());
+  ASSERT_LE(0, fd);
+  string request;
+  AppendFrame(MSG_REPLICATE, "", &request);
+  ASSERT_TRUE(WriteAll(fd, request));
+  string input;
+  bool synced = false;
+  while (!synced) {
+    char buf[64 * 1024];
+    ssize_t bytes_read = read(fd, buf, sizeof(buf));
+    ASSERT_LT(0, bytes_read);
+    input.append(buf, bytes_read);
+    Frame frame;
+    while (ParseFrame(input.data(), input.size(), &frame) == FRAME_OK) {
+      synced = (frame.type == MSG_SYNCED);
+      input.erase(0, frame.frame_size);
+    }
+  }
+
+  // The diffs pile up until the primary closes the follower
+  Client writer;
+  ASSERT_TRUE(writer.Connect("127.0.0.1", primary->port()));
+  for (int i = 0; i < 256; ++i) {
+    Apply(&writer, 1, Diff(0, string(128 * 1024, 'a')), i + 2);
+  }
+  for (;;) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    ASSERT_EQ(1, poll(&pfd, 1, kTimeoutMs));
+    char buf[64 * 1024];
+    ssize_t bytes_read = read(fd, buf, sizeof(buf));
+    if (bytes_read == 0) {
+      break;
+    }
+    ASSERT_LT(0, bytes_read);
+  }
+  close(fd);
+
+  // Clients are unaffected
+  Apply(&writer, 1, Diff(0, "a"), 258);
+  StopServer(primary, primary_thread);
+}
+
+TEST_F(ServerTest, FollowerStopsWhenItCannotCatchUp) {
+  DocumentStore primary_store;
+  Diff diff(0, "papaya");
+  primary_store.GetOrCreate(1)->ApplyDiff(&diff);
+  primary_store.GetOrCreate(1)->ApplyDiff(&diff);
+  ServerOptions options;
+  options.address = "127.0.0.1";
+  pthread_t primary_thread;
+  Server *primary = StartServer(&primary_store, options, &primary_thread);
+  DocumentStore follower_store;
+  pthread_t follower_thread;
+  Server *follower = StartFollower(&follower_store, primary->port(),
+                                   &follower_thread);
+  Client reader;
+  ASSERT_TRUE(reader.Connect("127.0.0.1", follower->port()));
+  SubscribeAt(&reader, 1, 2);
+
+  // The primary comes back without the last diff it replicated
+  options.port = primary->port();
+  StopServer(primary, primary_thread);
+  DocumentStore stale_store;
+  stale_store.GetOrCreate(1)->ApplyDiff(&diff);
+  primary = StartServer(&stale_store, options, &primary_thread);
+
+  // The follower connects again and stops by itself
+  pthread_join(follower_thread, NULL);
+  EXPECT_TRUE(follower->replication_failed());
+  EXPECT_EQ(2, follower_store.Get(1)->version());
+  delete follower;
+  StopServer(primary, primary_thread);
+}
+
+TEST_F(ServerTest, FollowerServesClientsWhileConnecting) {
+  DocumentStore primary_store;
+  ServerOptions options;
+  options.address = "127.0.0.1";
+  pthread_t primary_thread;
+  Server *primary = StartServer(&primary_store, options, &primary_thread);
+  DocumentStore follower_store;
+  ServerOptions follower_options;
+  follower_options.address = "127.0.0.1";
+  follower_options.primary_address = "127.0.0.1";
+  follower_options.primary_port = primary->port();
+  follower_options.reconnect_interval_ms = 100;
+  pthread_t follower_thread;
+  Server *follower = StartServer(&follower_store, follower_options,
+                                 &follower_thread);
+  Client reader;
+  ASSERT_TRUE(reader.Connect("127.0.0.1", follower->port()));
+  SubscribeAt(&reader, 1, 0);
+
+  // The primary is replaced by a listener that never accepts. Once its
+  // backlog is full, connections to it are never established.
+  int port = primary->port();
+  StopServer(primary, primary_thread);
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_LE(0, listen_fd);
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0, bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+                    sizeof(addr)));
+  ASSERT_EQ(0, listen(listen_fd, 0));
+  vector<int> backlog;
+  for (int i = 0; i < 4; ++i) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    ASSERT_LE(0, fd);
+    connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    backlog.push_back(fd);
+  }
+
+  // The follower keeps answering while it tries to connect
+  usleep(500 * 1000);
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(reader.Apply(1, Diff(0, "x")));
+    ServerMessage message;
+    ASSERT_TRUE(reader.ReadMessage(kTimeoutMs, &message));
+    EXPECT_EQ(MSG_APPLIED, message.type);
+    EXPECT_EQ(-1, message.version);
+    usleep(100 * 1000);
+  }
+  Client other;
+  ASSERT_TRUE(other.Connect("127.0.0.1", follower->port()));
+  SubscribeAt(&other, 1, 0);
+
+  StopServer(follower, follower_thread);
+  for (size_t i = 0; i < backlog.size(); ++i) {
+    close(backlog[i]);
+  }
+  close(listen_fd);
+}
+
+TEST_F(ServerTest, FollowerProcessReconnects) {
+  char log_path[64];
+  snprintf(log_path, sizeof(log_path),
+           "/tmp/kamiah_server_test_primary_log.%d",
+           static_cast<int>(getpid()));
+  unlink(log_path);
+  vector<string> primary_flags;
+  primary_flags.push_back("--address=127.0.0.1");
+  primary_flags.push_back(string("--diff_log=") + log_path);
+  primary_flags.push_back("--durability=sync_each");
+  primary_flags.push_back("--port=0");
+  ServerProcess primary;
+  ASSERT_TRUE(StartServerProcess(primary_flags, &primary));
+  Client writer;
+  ASSERT_TRUE(writer.Connect("127.0.0.1", primary.port));
+  Apply(&writer, 1, Diff(0, "papaya"), 1);
+
+  char flag[64];
+  snprintf(flag, sizeof(flag), "--primary=127.0.0.1:%d", primary.port);
+  vector<string> follower_flags;
+  follower_flags.push_back("--address=127.0.0.1");
+  follower_flags.push_back("--port=0");
+  follower_flags.push_back(flag);
+  ServerProcess follower;
+  ASSERT_TRUE(StartServerProcess(follower_flags, &follower));
+  Client reader;
+  ASSERT_TRUE(reader.Connect("127.0.0.1", follower.port));
+  SubscribeAt(&reader, 1, 1);
+
+  // The primary fails and comes back on the same port, recovering its log
+  StopServerProcess(&primary, SIGKILL);
+  snprintf(flag, sizeof(flag), "--port=%d", primary.port);
+  primary_flags.back() = flag;
+  ASSERT_TRUE(StartServerProcess(primary_flags, &primary));
+  Client new_writer;
+  ASSERT_TRUE(new_writer.Connect("127.0.0.1", primary.port));
+  Apply(&new_writer, 1, Diff(0, "kamiah "), 2);
+
+  // The follower connected again and streams the new diff
+  ServerMessage message;
+  ASSERT_TRUE(reader.ReadMessage(kTimeoutMs, &message));
+  EXPECT_EQ(MSG_UPDATE, message.type);
+  ASSERT_EQ(1u, message.diffs.size());
+  EXPECT_EQ(2, message.diffs[0].version());
+  EXPECT_EQ("kamiah ", message.diffs[0].text());
+
+  int status = StopServerProcess(&follower, SIGTERM);
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+  StopServerProcess(&primary, SIGTERM);
+  unlink(log_path);
+}
+
+}  // namespace kamiah
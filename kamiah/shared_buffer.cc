@@ -0,0 +1,108 @@
+/**
+ * @file shared_buffer.cc
+ * @brief Implementation of a SharedBuffer and slices of it.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "shared_buffer.h"
+
+namespace kamiah {
+
+SharedBuffer* SharedBuffer::New(size_t capacity) {
+  return new SharedBuffer(capacity);
+}
+
+SharedBuffer::SharedBuffer(size_t capacity)
+    : refs_(1), capacity_(capacity), data_(new char[capacity]) {
+}
+
+SharedBuffer::~SharedBuffer() {
+  delete[] data_;
+}
+
+void SharedBuffer::Ref() {
+  __sync_fetch_and_add(&refs_, 1);
+}
+
+void SharedBuffer::Unref() {
+  if (__sync_sub_and_fetch(&refs_, 1) == 0) {
+    delete this;
+  }
+}
+
+char* SharedBuffer::mutable_data() {
+  return data_;
+}
+
+const char* SharedBuffer::data() const {
+  return data_;
+}
+
+size_t SharedBuffer::capacity() const {
+  return capacity_;
+}
+
+BufferSlice::BufferSlice() : buffer_(NULL), offset_(0), size_(0) {
+}
+
+BufferSlice::BufferSlice(SharedBuffer *buffer, size_t offset, size_t size)
+    : buffer_(buffer), offset_(offset), size_(size) {
+  buffer_->Ref();
+}
+
+BufferSlice::BufferSlice(const BufferSlice& other)
+    : buffer_(other.buffer_), offset_(other.offset_), size_(other.size_) {
+  if (buffer_ != NULL) {
+    buffer_->Ref();
+  }
+}
+
+BufferSlice& BufferSlice::operator=(const BufferSlice& other) {
+  // Ref before Unref in case of self-assignment
+  if (other.buffer_ != NULL) {
+    other.buffer_->Ref();
+  }
+  if (buffer_ != NULL) {
+    buffer_->Unref();
+  }
+
+  buffer_ = other.buffer_;
+  offset_ = other.offset_;
+  size_ = other.size_;
+  return *this;
+}
+
+BufferSlice::~BufferSlice() {
+  if (buffer_ != NULL) {
+    buffer_->Unref();
+  }
+}
+
+const char* BufferSlice::data() const {
+  if (buffer_ == NULL) {
+    return NULL;
+  }
+  return buffer_->data() + offset_;
+}
+
+size_t BufferSlice::size() const {
+  return size_;
+}
+
+bool BufferSlice::empty() const {
+  return size_ == 0;
+}
+
+const SharedBuffer* BufferSlice::buffer() const {
+  return buffer_;
+}
+
+string BufferSlice::ToString() const {
+  if (buffer_ == NULL) {
+    return string();
+  }
+  return string(data(), size_);
+}
+
+}  // namespace kamiah
@@ -0,0 +1,154 @@
+/**
+ * @file shared_buffer.h
+ * @brief Definition of a SharedBuffer and slices of it.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_SHARED_BUFFER_H_
+#define KAMIAH_SHARED_BUFFER_H_
+
+#include <stddef.h>
+
+#include <string>
+
+using std::string;
+
+namespace kamiah {
+
+/**
+ * @brief A SharedBuffer is a reference counted, fixed capacity byte buffer.
+ *
+ * A SharedBuffer is filled by its creator and then handed out as BufferSlices.
+ * Bytes that have been handed out must not be modified again, which makes
+ * them safe to read from any thread.
+ *
+ * The reference count is thread-safe, the contents are thread-compatible.
+ */
+class SharedBuffer {
+ public:
+  /**
+   * @brief Creates a SharedBuffer.
+   *
+   * @param capacity The number of bytes in the buffer.
+   * @return The new buffer, with a reference count of one.
+   */
+  static SharedBuffer* New(size_t capacity);
+
+  /**
+   * @brief Adds a reference to the buffer.
+   */
+  void Ref();
+
+  /**
+   * @brief Removes a reference to the buffer, deleting it if it was the last
+   *     one.
+   */
+  void Unref();
+
+  /**
+   * @brief Gets the contents of the buffer for writing.
+   *
+   * @return The contents of the buffer.
+   */
+  char* mutable_data();
+
+  /**
+   * @brief Gets the contents of the buffer.
+   *
+   * @return The contents of the buffer.
+   */
+  const char* data() const;
+
+  /**
+   * @brief Gets the number of bytes in the buffer.
+   *
+   * @return The number of bytes in the buffer.
+   */
+  size_t capacity() const;
+
+ private:
+  explicit SharedBuffer(size_t capacity);
+  ~SharedBuffer();
+
+  int refs_;
+  size_t capacity_;
+  char *data_;
+
+  // Not copyable.
+  SharedBuffer(const SharedBuffer&);
+  void operator=(const SharedBuffer&);
+};
+
+/**
+ * @brief A BufferSlice is a view of a range of bytes of a SharedBuffer. The
+ *     slice holds a reference to the buffer for as long as it lives.
+ *
+ * Copying a slice copies the reference, not the bytes.
+ *
+ * This class is thread-compatible.
+ */
+class BufferSlice {
+ public:
+  /**
+   * @brief Constructs an empty slice.
+   */
+  BufferSlice();
+
+  /**
+   * @brief Constructs a slice of a buffer.
+   *
+   * @param buffer The buffer to take a slice of. A reference is added to it.
+   * @param offset The offset of the first byte of the slice in the buffer.
+   * @param size The number of bytes in the slice.
+   */
+  BufferSlice(SharedBuffer *buffer, size_t offset, size_t size);
+
+  BufferSlice(const BufferSlice& other);
+  BufferSlice& operator=(const BufferSlice& other);
+  ~BufferSlice();
+
+  /**
+   * @brief Gets the bytes in the slice.
+   *
+   * @return The bytes in the slice, NULL for an empty slice.
+   */
+  const char* data() const;
+
+  /**
+   * @brief Gets the number of bytes in the slice.
+   *
+   * @return The number of bytes in the slice.
+   */
+  size_t size() const;
+
+  /**
+   * @brief Gets whether the slice is empty.
+   *
+   * @return True iff the slice has no bytes.
+   */
+  bool empty() const;
+
+  /**
+   * @brief Gets the buffer this slice references.
+   *
+   * @return The buffer this slice references, NULL for an empty slice.
+   */
+  const SharedBuffer* buffer() const;
+
+  /**
+   * @brief Copies the bytes in the slice to a string.
+   *
+   * @return The bytes in the slice.
+   */
+  string ToString() const;
+
+ private:
+  SharedBuffer *buffer_;
+  size_t offset_;
+  size_t size_;
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_SHARED_BUFFER_H_
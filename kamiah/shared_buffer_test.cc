@@ -0,0 +1,69 @@
+/**
+ * @file shared_buffer_test.cc
+ * @brief Unit tests for a SharedBuffer and slices of it.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "shared_buffer.h"
+
+#include <string.h>
+
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+// Creates a buffer holding "papaya-papaya".
+SharedBuffer* NewPapayaBuffer() {
+  SharedBuffer *buffer = SharedBuffer::New(strlen("papaya-papaya"));
+  memcpy(buffer->mutable_data(), "papaya-papaya", buffer->capacity());
+  return buffer;
+}
+
+TEST(SharedBufferTest, EmptySlice) {
+  BufferSlice slice;
+
+  EXPECT_TRUE(slice.empty());
+  EXPECT_EQ(0U, slice.size());
+  EXPECT_TRUE(slice.data() == NULL);
+  EXPECT_TRUE(slice.buffer() == NULL);
+  EXPECT_EQ("", slice.ToString());
+}
+
+TEST(SharedBufferTest, Slices) {
+  SharedBuffer *buffer = NewPapayaBuffer();
+  BufferSlice first(buffer, 0, strlen("papaya"));
+  BufferSlice second(buffer, strlen("papaya-"), strlen("papaya"));
+  buffer->Unref();
+
+  EXPECT_FALSE(first.empty());
+  EXPECT_EQ(6U, first.size());
+  EXPECT_EQ("papaya", first.ToString());
+  EXPECT_EQ("papaya", second.ToString());
+
+  // Both reference the same bytes
+  EXPECT_EQ(first.buffer(), second.buffer());
+  EXPECT_EQ(first.data() + strlen("papaya-"), second.data());
+}
+
+TEST(SharedBufferTest, CopiesShareBuffer) {
+  SharedBuffer *buffer = NewPapayaBuffer();
+  BufferSlice slice(buffer, 0, buffer->capacity());
+  buffer->Unref();
+
+  BufferSlice copy(slice);
+  BufferSlice assigned;
+  assigned = slice;
+  assigned = assigned;
+
+  EXPECT_EQ(slice.data(), copy.data());
+  EXPECT_EQ(slice.data(), assigned.data());
+  EXPECT_EQ("papaya-papaya", assigned.ToString());
+
+  // The buffer outlives the original slice
+  slice = BufferSlice();
+  EXPECT_TRUE(slice.empty());
+  EXPECT_EQ("papaya-papaya", copy.ToString());
+}
+
+}  // namespace kamiah
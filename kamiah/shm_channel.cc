@@ -0,0 +1,340 @@
+/**
+ * @file shm_channel.cc
+ * @brief Implementation of a ShmChannel.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "shm_channel.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace kamiah {
+
+// The positions of a ring only ever grow. The writer owns head and the reader
+// owns tail, each on its own cache line. The waiting flags are set by an end
+// that is about to sleep and cleared by whoever wakes it.
+struct ShmRing {
+  volatile uint64_t head;
+  char head_padding[56];
+  volatile uint64_t tail;
+  char tail_padding[56];
+  volatile uint32_t reader_waiting;
+  volatile uint32_t writer_waiting;
+  char waiting_padding[56];
+};
+
+namespace {
+
+const uint64_t kShmMagic = 0x6b616d6961687368ULL;
+
+// Smallest capacity of a direction of a channel.
+const size_t kMinCapacity = 4096;
+
+// Start of the shared memory, followed by the data of the client to server
+// ring and then that of the server to client ring.
+struct ShmHeader {
+  uint64_t magic;
+  uint64_t capacity;
+  char padding[48];
+  ShmRing rings[2];
+};
+
+// Creates an anonymous shared memory object. The name is only used until it
+// is unlinked, right after creation.
+int CreateShm() {
+  static int counter = 0;
+  for (int attempt = 0; attempt < 16; ++attempt) {
+    char name[64];
+    snprintf(name, sizeof(name), "/kamiah-%d-%d",
+             static_cast<int>(getpid()), __sync_fetch_and_add(&counter, 1));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+      shm_unlink(name);
+      return fd;
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+ShmChannel::ShmChannel(int shm_fd, void *memory, size_t memory_size,
+                       size_t capacity, int server_event_fd,
+                       int client_event_fd, bool server)
+    : shm_fd_(shm_fd), memory_(memory), memory_size_(memory_size),
+      capacity_(capacity), server_event_fd_(server_event_fd),
+      client_event_fd_(client_event_fd), server_(server), broken_(false) {
+  ShmHeader *header = static_cast<ShmHeader*>(memory);
+  char *data = static_cast<char*>(memory) + sizeof(ShmHeader);
+  if (server) {
+    in_ = &header->rings[0];
+    in_data_ = data;
+    out_ = &header->rings[1];
+    out_data_ = data + capacity;
+  } else {
+    out_ = &header->rings[0];
+    out_data_ = data;
+    in_ = &header->rings[1];
+    in_data_ = data + capacity;
+  }
+}
+
+ShmChannel::~ShmChannel() {
+  munmap(memory_, memory_size_);
+  close(shm_fd_);
+  close(server_event_fd_);
+  close(client_event_fd_);
+}
+
+ShmChannel* ShmChannel::Create(size_t capacity) {
+  size_t rounded = kMinCapacity;
+  while (rounded < capacity) {
+    rounded *= 2;
+  }
+  capacity = rounded;
+
+  int shm_fd = CreateShm();
+  if (shm_fd < 0) {
+    return NULL;
+  }
+  size_t memory_size = sizeof(ShmHeader) + 2 * capacity;
+  void *memory = MAP_FAILED;
+  if (ftruncate(shm_fd, memory_size) == 0) {
+    memory = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  shm_fd, 0);
+  }
+  if (memory == MAP_FAILED) {
+    close(shm_fd);
+    return NULL;
+  }
+
+  // The memory of a new object is zeroed, so are the rings
+  ShmHeader *header = static_cast<ShmHeader*>(memory);
+  header->magic = kShmMagic;
+  header->capacity = capacity;
+
+  int server_event_fd = eventfd(0, EFD_NONBLOCK);
+  int client_event_fd = eventfd(0, EFD_NONBLOCK);
+  if ((server_event_fd < 0) || (client_event_fd < 0)) {
+    munmap(memory, memory_size);
+    close(shm_fd);
+    if (server_event_fd >= 0) {
+      close(server_event_fd);
+    }
+    if (client_event_fd >= 0) {
+      close(client_event_fd);
+    }
+    return NULL;
+  }
+  return new ShmChannel(shm_fd, memory, memory_size, capacity,
+                        server_event_fd, client_event_fd, true);
+}
+
+ShmChannel* ShmChannel::Attach(int socket) {
+  char byte;
+  struct iovec iov;
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  if (recvmsg(socket, &msg, 0) != 1) {
+    return NULL;
+  }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if ((cmsg == NULL) || (cmsg->cmsg_level != SOL_SOCKET) ||
+      (cmsg->cmsg_type != SCM_RIGHTS) ||
+      (cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))) {
+    return NULL;
+  }
+  int fds[3];
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  // Check that the memory is a channel before trusting its capacity
+  struct stat stats;
+  void *memory = MAP_FAILED;
+  if ((fstat(fds[0], &stats) == 0) &&
+      (static_cast<size_t>(stats.st_size) > sizeof(ShmHeader))) {
+    memory = mmap(NULL, stats.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fds[0], 0);
+  }
+  if (memory != MAP_FAILED) {
+    ShmHeader *header = static_cast<ShmHeader*>(memory);
+    if ((header->magic == kShmMagic) &&
+        (sizeof(ShmHeader) + 2 * header->capacity ==
+         static_cast<uint64_t>(stats.st_size))) {
+      return new ShmChannel(fds[0], memory, stats.st_size, header->capacity,
+                            fds[1], fds[2], false);
+    }
+    munmap(memory, stats.st_size);
+  }
+  for (int i = 0; i < 3; ++i) {
+    close(fds[i]);
+  }
+  return NULL;
+}
+
+bool ShmChannel::SendDescriptors(int socket) const {
+  char byte = 0;
+  struct iovec iov;
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+  int fds[3] = {shm_fd_, server_event_fd_, client_event_fd_};
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  return sendmsg(socket, &msg, MSG_NOSIGNAL) == 1;
+}
+
+size_t ShmChannel::Write(const char *data, size_t size) {
+  uint64_t head = out_->head;
+  uint64_t tail = out_->tail;
+  if (!CheckPositions(head, tail)) {
+    return 0;
+  }
+
+  // Do not overwrite bytes before the reader is done with them
+  __sync_synchronize();
+  size_t available = capacity_ - (head - tail);
+  size_t written = (size < available) ? size : available;
+  if (written == 0) {
+    return 0;
+  }
+
+  size_t offset = head & (capacity_ - 1);
+  size_t first = capacity_ - offset;
+  if (first > written) {
+    first = written;
+  }
+  memcpy(out_data_ + offset, data, first);
+  memcpy(out_data_, data + first, written - first);
+
+  // Publish the bytes, then check whether the reader needs waking up. The
+  // barrier pairs with the one in PrepareWaitForData().
+  __sync_synchronize();
+  out_->head = head + written;
+  __sync_synchronize();
+  if (out_->reader_waiting &&
+      __sync_bool_compare_and_swap(&out_->reader_waiting, 1, 0)) {
+    Signal();
+  }
+  return written;
+}
+
+size_t ShmChannel::Read(char *data, size_t size) {
+  uint64_t tail = in_->tail;
+  uint64_t head = in_->head;
+  if (!CheckPositions(head, tail)) {
+    return 0;
+  }
+
+  // Do not read bytes before the writer is done with them
+  __sync_synchronize();
+  size_t available = head - tail;
+  size_t bytes_read = (size < available) ? size : available;
+  if (bytes_read == 0) {
+    return 0;
+  }
+
+  size_t offset = tail & (capacity_ - 1);
+  size_t first = capacity_ - offset;
+  if (first > bytes_read) {
+    first = bytes_read;
+  }
+  memcpy(data, in_data_ + offset, first);
+  memcpy(data + first, in_data_, bytes_read - first);
+
+  __sync_synchronize();
+  in_->tail = tail + bytes_read;
+  __sync_synchronize();
+  if (in_->writer_waiting &&
+      __sync_bool_compare_and_swap(&in_->writer_waiting, 1, 0)) {
+    Signal();
+  }
+  return bytes_read;
+}
+
+bool ShmChannel::PrepareWaitForData() {
+  in_->reader_waiting = 1;
+  __sync_synchronize();
+  uint64_t head = in_->head;
+  uint64_t tail = in_->tail;
+  if (!CheckPositions(head, tail) || (head != tail)) {
+    __sync_bool_compare_and_swap(&in_->reader_waiting, 1, 0);
+    return false;
+  }
+  return true;
+}
+
+bool ShmChannel::PrepareWaitForSpace() {
+  out_->writer_waiting = 1;
+  __sync_synchronize();
+  uint64_t head = out_->head;
+  uint64_t tail = out_->tail;
+  if (!CheckPositions(head, tail) || (head - tail < capacity_)) {
+    __sync_bool_compare_and_swap(&out_->writer_waiting, 1, 0);
+    return false;
+  }
+  return true;
+}
+
+int ShmChannel::event_fd() const {
+  return server_ ? server_event_fd_ : client_event_fd_;
+}
+
+void ShmChannel::ClearEvent() {
+  uint64_t value;
+  if (read(event_fd(), &value, sizeof(value)) < 0) {
+    // Nothing to clear
+  }
+}
+
+size_t ShmChannel::capacity() const {
+  return capacity_;
+}
+
+bool ShmChannel::broken() const {
+  return broken_;
+}
+
+void ShmChannel::Signal() {
+  uint64_t one = 1;
+  if (write(server_ ? client_event_fd_ : server_event_fd_, &one,
+            sizeof(one)) < 0) {
+    // The eventfd is only full if a notification is already pending
+  }
+}
+
+bool ShmChannel::CheckPositions(uint64_t head, uint64_t tail) {
+  // A tail past the head also wraps around to more than the capacity
+  if (head - tail > capacity_) {
+    broken_ = true;
+  }
+  return !broken_;
+}
+
+}  // namespace kamiah
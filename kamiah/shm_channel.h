@@ -0,0 +1,178 @@
+/**
+ * @file shm_channel.h
+ * @brief Definition of a ShmChannel.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_SHM_CHANNEL_H_
+#define KAMIAH_SHM_CHANNEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace kamiah {
+
+struct ShmRing;
+
+/**
+ * @brief A ShmChannel is a bidirectional byte stream between two processes
+ *     on the same host, backed by a pair of single-producer single-consumer
+ *     rings in shared memory.
+ *
+ * The server end creates the channel and hands its file descriptors (the
+ * shared memory and two eventfds) to the client end over a Unix socket.
+ * Reads and writes are plain memory copies into and out of the rings. The
+ * eventfds are only written to when the other end is about to sleep waiting
+ * for data or space, so a busy channel makes no system calls at all.
+ *
+ * To wait, an end calls PrepareWaitForData() or PrepareWaitForSpace() and,
+ * if they return true, waits for event_fd() to become readable (with epoll or
+ * poll) and calls ClearEvent().
+ *
+ * The channel does not detect that the other end went away, the Unix socket
+ * used to set it up should be kept open and watched for that.
+ *
+ * Either end can write anything to the shared memory. The positions of the
+ * rings are checked before they are used and, if they are not consistent,
+ * the channel is broken (see broken()).
+ *
+ * This class is thread-compatible. Each end must be used by one thread at a
+ * time, but the two ends can be used concurrently.
+ */
+class ShmChannel {
+ public:
+  // Capacity of each direction of a channel, unless otherwise specified.
+  static const size_t kDefaultCapacity = 1024 * 1024;
+
+  /**
+   * @brief Creates the server end of a new channel.
+   *
+   * @param capacity The number of bytes each direction can hold. Rounded up
+   *     to a power of two.
+   * @return The new channel, or NULL on failure. Owned by the caller.
+   */
+  static ShmChannel* Create(size_t capacity);
+
+  /**
+   * @brief Opens the client end of a channel from the file descriptors sent
+   *     by SendDescriptors().
+   *
+   * @param socket A connected Unix socket.
+   * @return The channel, or NULL on failure. Owned by the caller.
+   */
+  static ShmChannel* Attach(int socket);
+
+  ~ShmChannel();
+
+  /**
+   * @brief Sends the file descriptors of the channel so that the other end
+   *     can Attach() to it.
+   *
+   * @param socket A connected Unix socket.
+   * @return True iff the descriptors were sent.
+   */
+  bool SendDescriptors(int socket) const;
+
+  /**
+   * @brief Writes as many bytes as fit to the channel without blocking.
+   *
+   * @param data The bytes to write.
+   * @param size The number of bytes to write.
+   * @return The number of bytes written, 0 if the channel is full or
+   *     broken.
+   */
+  size_t Write(const char *data, size_t size);
+
+  /**
+   * @brief Reads as many bytes as are available, up to a maximum, without
+   *     blocking.
+   *
+   * @param data Where to write the bytes.
+   * @param size The maximum number of bytes to read.
+   * @return The number of bytes read, 0 if the channel is empty or broken.
+   */
+  size_t Read(char *data, size_t size);
+
+  /**
+   * @brief Asks to be notified through event_fd() when there are bytes to
+   *     read.
+   *
+   * @return True iff the channel is still empty and the caller should wait.
+   *     If false, there are bytes to read or the channel is broken, and no
+   *     notification will come.
+   */
+  bool PrepareWaitForData();
+
+  /**
+   * @brief Asks to be notified through event_fd() when bytes can be written.
+   *
+   * @return True iff the channel is still full and the caller should wait.
+   *     If false, bytes can be written or the channel is broken, and no
+   *     notification will come.
+   */
+  bool PrepareWaitForSpace();
+
+  /**
+   * @brief Whether the positions of a ring were found to be inconsistent,
+   *     for example because the other end overwrote them. Nothing is read
+   *     from or written to a broken channel, it should be closed.
+   *
+   * @return True iff the channel is broken.
+   */
+  bool broken() const;
+
+  /**
+   * @brief Gets the eventfd that becomes readable when this end is notified.
+   *
+   * @return The eventfd of this end.
+   */
+  int event_fd() const;
+
+  /**
+   * @brief Resets event_fd() after a notification.
+   */
+  void ClearEvent();
+
+  /**
+   * @brief Gets the capacity of each direction of the channel.
+   *
+   * @return The number of bytes each direction can hold.
+   */
+  size_t capacity() const;
+
+ private:
+  ShmChannel(int shm_fd, void *memory, size_t memory_size, size_t capacity,
+             int server_event_fd, int client_event_fd, bool server);
+
+  // Notifies the other end.
+  void Signal();
+
+  // Checks the positions of a ring, read once from the shared memory. Breaks
+  // the channel and returns false if the ring would hold more than its
+  // capacity.
+  bool CheckPositions(uint64_t head, uint64_t tail);
+
+  int shm_fd_;
+  void *memory_;
+  size_t memory_size_;
+  size_t capacity_;
+  int server_event_fd_;
+  int client_event_fd_;
+  bool server_;
+  bool broken_;
+
+  // Rings written and read by this end, and their data.
+  ShmRing *out_;
+  ShmRing *in_;
+  char *out_data_;
+  char *in_data_;
+
+  // Not copyable.
+  ShmChannel(const ShmChannel&);
+  void operator=(const ShmChannel&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_SHM_CHANNEL_H_
@@ -0,0 +1,309 @@
+/**
+ * @file shm_channel_test.cc
+ * @brief Unit tests for a ShmChannel.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "shm_channel.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace kamiah {
+
+namespace {
+
+// Whether the eventfd of a channel end was notified.
+bool Notified(ShmChannel *channel) {
+  struct pollfd pfd;
+  pfd.fd = channel->event_fd();
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, 0) == 1;
+}
+
+// Waits until a channel end is notified or the condition already holds.
+void WaitForData(ShmChannel *channel) {
+  if (channel->PrepareWaitForData()) {
+    struct pollfd pfd;
+    pfd.fd = channel->event_fd();
+    pfd.events = POLLIN;
+    poll(&pfd, 1, -1);
+    channel->ClearEvent();
+  }
+}
+
+void WaitForSpace(ShmChannel *channel) {
+  if (channel->PrepareWaitForSpace()) {
+    struct pollfd pfd;
+    pfd.fd = channel->event_fd();
+    pfd.events = POLLIN;
+    poll(&pfd, 1, -1);
+    channel->ClearEvent();
+  }
+}
+
+// Writes all of data, waiting for space as needed.
+void WriteAll(ShmChannel *channel, const string& data) {
+  size_t written = 0;
+  while (written < data.size()) {
+    size_t bytes = channel->Write(data.data() + written,
+                                  data.size() - written);
+    written += bytes;
+    if (bytes == 0) {
+      WaitForSpace(channel);
+    }
+  }
+}
+
+// Reads size bytes, waiting for them as needed.
+string ReadAll(ShmChannel *channel, size_t size) {
+  string data(size, '\0');
+  size_t read = 0;
+  while (read < size) {
+    size_t bytes = channel->Read(&data[read], size - read);
+    read += bytes;
+    if (bytes == 0) {
+      WaitForData(channel);
+    }
+  }
+  return data;
+}
+
+string Pattern(size_t size) {
+  string data(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<char>(i * 7 + i / 251);
+  }
+  return data;
+}
+
+// Receives the shared memory of a channel sent by SendDescriptors() and maps
+// it, as a client could. Returns NULL on failure.
+uint64_t* MapShm(int socket, size_t *size) {
+  char byte;
+  struct iovec iov;
+  iov.iov_base = &byte;
+  iov.iov_len = 1;
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = NULL;
+  if (recvmsg(socket, &msg, 0) == 1) {
+    cmsg = CMSG_FIRSTHDR(&msg);
+  }
+  if (cmsg == NULL) {
+    return NULL;
+  }
+  int fds[3];
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  struct stat stats;
+  void *memory = MAP_FAILED;
+  if (fstat(fds[0], &stats) == 0) {
+    *size = stats.st_size;
+    memory = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  }
+  for (int i = 0; i < 3; ++i) {
+    close(fds[i]);
+  }
+  return (memory == MAP_FAILED) ? NULL : static_cast<uint64_t*>(memory);
+}
+
+const size_t kStreamSize = 4 * 1024 * 1024;
+
+void *StreamToServer(void *arg) {
+  WriteAll(static_cast<ShmChannel*>(arg), Pattern(kStreamSize));
+  return NULL;
+}
+
+}  // namespace
+
+class ShmChannelTest : public ::testing::Test {
+ protected:
+  ShmChannelTest() : server_(NULL), client_(NULL) {}
+
+  virtual void SetUp() {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets_));
+    server_ = ShmChannel::Create(4096);
+    ASSERT_TRUE(server_ != NULL);
+    ASSERT_TRUE(server_->SendDescriptors(sockets_[0]));
+    client_ = ShmChannel::Attach(sockets_[1]);
+    ASSERT_TRUE(client_ != NULL);
+  }
+
+  virtual void TearDown() {
+    delete client_;
+    delete server_;
+    close(sockets_[0]);
+    close(sockets_[1]);
+  }
+
+  int sockets_[2];
+  ShmChannel *server_;
+  ShmChannel *client_;
+};
+
+TEST_F(ShmChannelTest, ReadWrite) {
+  EXPECT_EQ(4096u, server_->capacity());
+  EXPECT_EQ(4096u, client_->capacity());
+
+  char buf[16];
+  EXPECT_EQ(0u, server_->Read(buf, sizeof(buf)));
+  EXPECT_EQ(0u, client_->Read(buf, sizeof(buf)));
+
+  // Each direction is separate
+  EXPECT_EQ(5u, client_->Write("hello", 5));
+  EXPECT_EQ(0u, client_->Read(buf, sizeof(buf)));
+  EXPECT_EQ(3u, server_->Read(buf, 3));
+  EXPECT_EQ("hel", string(buf, 3));
+  EXPECT_EQ(2u, server_->Read(buf, sizeof(buf)));
+  EXPECT_EQ("lo", string(buf, 2));
+
+  EXPECT_EQ(3u, server_->Write("bye", 3));
+  EXPECT_EQ(3u, client_->Read(buf, sizeof(buf)));
+  EXPECT_EQ("bye", string(buf, 3));
+}
+
+TEST_F(ShmChannelTest, FullAndWrapAround) {
+  string data = Pattern(3000);
+  EXPECT_EQ(3000u, client_->Write(data.data(), data.size()));
+
+  // Only part fits
+  EXPECT_EQ(1096u, client_->Write(data.data(), data.size()));
+  EXPECT_EQ(0u, client_->Write(data.data(), data.size()));
+
+  EXPECT_EQ(data, ReadAll(server_, 3000));
+  EXPECT_EQ(data.substr(0, 1096), ReadAll(server_, 1096));
+
+  // Written across the end of the ring
+  EXPECT_EQ(3000u, client_->Write(data.data(), data.size()));
+  EXPECT_EQ(data, ReadAll(server_, 3000));
+}
+
+TEST_F(ShmChannelTest, Notifications) {
+  // Nobody is waiting, no notification
+  EXPECT_EQ(1u, client_->Write("a", 1));
+  EXPECT_FALSE(Notified(server_));
+
+  // Data is available, no need to wait
+  EXPECT_FALSE(server_->PrepareWaitForData());
+  char buf[4096];
+  EXPECT_EQ(1u, server_->Read(buf, sizeof(buf)));
+
+  EXPECT_TRUE(server_->PrepareWaitForData());
+  EXPECT_EQ(1u, client_->Write("b", 1));
+  EXPECT_TRUE(Notified(server_));
+  server_->ClearEvent();
+  EXPECT_FALSE(Notified(server_));
+
+  // Only one notification per wait
+  EXPECT_EQ(1u, client_->Write("c", 1));
+  EXPECT_FALSE(Notified(server_));
+  EXPECT_EQ(2u, server_->Read(buf, sizeof(buf)));
+
+  // Waiting for space
+  string data = Pattern(4096);
+  EXPECT_EQ(4096u, client_->Write(data.data(), data.size()));
+  EXPECT_TRUE(client_->PrepareWaitForSpace());
+  EXPECT_FALSE(Notified(client_));
+  EXPECT_EQ(10u, server_->Read(buf, 10));
+  EXPECT_TRUE(Notified(client_));
+}
+
+TEST_F(ShmChannelTest, Threads) {
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, NULL, &StreamToServer, client_));
+  EXPECT_TRUE(Pattern(kStreamSize) == ReadAll(server_, kStreamSize));
+  pthread_join(thread, NULL);
+}
+
+TEST_F(ShmChannelTest, Processes) {
+  pid_t pid = fork();
+  ASSERT_LE(0, pid);
+  if (pid == 0) {
+    // Echo everything back from another process
+    ShmChannel *channel = ShmChannel::Attach(sockets_[1]);
+    string data = ReadAll(channel, kStreamSize);
+    WriteAll(channel, data);
+    _exit(0);
+  }
+
+  ShmChannel *server = ShmChannel::Create(64 * 1024);
+  ASSERT_TRUE(server != NULL);
+  ASSERT_TRUE(server->SendDescriptors(sockets_[0]));
+  WriteAll(server, Pattern(kStreamSize));
+  EXPECT_TRUE(Pattern(kStreamSize) == ReadAll(server, kStreamSize));
+  delete server;
+
+  int status;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST_F(ShmChannelTest, CorruptedPositions) {
+  int sockets[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+  ASSERT_TRUE(server_->SendDescriptors(sockets[0]));
+  size_t size = 0;
+  uint64_t *memory = MapShm(sockets[1], &size);
+  close(sockets[0]);
+  close(sockets[1]);
+  ASSERT_TRUE(memory != NULL);
+
+  // The head of the client to server ring is the only position that is 5
+  EXPECT_EQ(5u, client_->Write("hello", 5));
+  uint64_t *head = memory;
+  while (*head != 5) {
+    ++head;
+  }
+
+  // A ring holding more than its capacity breaks both ends for good
+  *head = 5 + 4096 + 1;
+  char buf[16];
+  EXPECT_EQ(0u, server_->Read(buf, sizeof(buf)));
+  EXPECT_TRUE(server_->broken());
+  EXPECT_FALSE(server_->PrepareWaitForData());
+  EXPECT_EQ(0u, client_->Write("x", 1));
+  EXPECT_TRUE(client_->broken());
+  EXPECT_FALSE(client_->PrepareWaitForSpace());
+  *head = 5;
+  EXPECT_EQ(0u, server_->Read(buf, sizeof(buf)));
+  EXPECT_EQ(0u, server_->Write("x", 1));
+  EXPECT_FALSE(Notified(server_));
+  munmap(memory, size);
+}
+
+TEST(ShmChannelAttachTest, RejectsOtherDescriptors) {
+  int sockets[2];
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+
+  // No descriptors at all
+  ASSERT_EQ(1, write(sockets[0], "x", 1));
+  EXPECT_TRUE(ShmChannel::Attach(sockets[1]) == NULL);
+
+  // Closed
+  close(sockets[0]);
+  EXPECT_TRUE(ShmChannel::Attach(sockets[1]) == NULL);
+  close(sockets[1]);
+}
+
+}  // namespace kamiah
@@ -0,0 +1,282 @@
+/**
+ * @file snapshot.cc
+ * @brief Implementation of a Snapshot.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <list>
+
+#include "document_store.h"
+#include "util.h"
+#include "wire_format.h"
+
+using std::list;
+
+namespace kamiah {
+
+namespace {
+
+const char kMagic[8] = { 'K', 'M', 'S', 'N', 'A', 'P', '\0', '\0' };
+const uint32_t kFormatVersion = 2;
+
+// Everything in the file starts at a multiple of this.
+const size_t kAlignment = 8;
+
+// Size at which written data is flushed to the file.
+const size_t kWriteBufferSize = 1 << 20;
+
+}  // namespace
+
+struct Snapshot::Header {
+  char magic[8];
+  uint32_t format_version;
+  uint32_t entry_size;
+  uint64_t num_documents;
+  uint64_t index_offset;
+  uint64_t file_size;
+};
+
+struct Snapshot::Entry {
+  int64_t doc_id;
+  int64_t version;
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t diffs_offset;
+  uint64_t diffs_size;
+
+  // CRC-32 of the text, the diffs and the version.
+  uint32_t crc;
+  uint32_t padding;
+};
+
+Snapshot::Snapshot(const char *data, size_t size)
+    : data_(data), size_(size), entries_(NULL), num_entries_(0) {
+}
+
+Snapshot::~Snapshot() {
+  munmap(const_cast<char*>(data_), size_);
+}
+
+bool Snapshot::Write(const string& path, const DocumentStore& store) {
+  vector<DocID> doc_ids;
+  store.GetDocIDs(&doc_ids);
+  vector<DocumentImage> images(doc_ids.size());
+  for (size_t i = 0; i < doc_ids.size(); ++i) {
+    const Document *doc = store.Get(doc_ids[i]);
+    if (doc == NULL) {
+      // Its entry of the previous snapshot is corrupted
+      return false;
+    }
+    doc->GetImage(&images[i]);
+  }
+  return Write(path, images);
+}
+
+bool Snapshot::Write(const string& path, const vector<DocumentImage>& images) {
+  string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+
+  // The header is filled in once the index is written
+  vector<Entry> entries(images.size());
+  Header header;
+  memset(&header, 0, sizeof(header));
+  string buffer(sizeof(header), '\0');
+  uint64_t offset = 0;
+  bool ok = true;
+  for (size_t i = 0; ok && (i < images.size()); ++i) {
+    const DocumentImage& image = images[i];
+    Entry *entry = &entries[i];
+    entry->doc_id = image.doc_id;
+    entry->version = image.version;
+
+    size_t start = buffer.size();
+    entry->data_offset = offset + buffer.size();
+    entry->data_size = image.text.size();
+    for (size_t chunk = 0; chunk < image.text.num_chunks(); ++chunk) {
+      buffer.append(image.text.chunk_data(chunk),
+                    image.text.chunk_size(chunk));
+    }
+
+    entry->diffs_offset = offset + buffer.size();
+    EncodeUpdates(image.diffs, &buffer);
+    entry->diffs_size = offset + buffer.size() - entry->diffs_offset;
+    entry->crc = ExtendCrc32(ExtendCrc32(0, &buffer[start],
+                                         buffer.size() - start),
+                             reinterpret_cast<const char*>(&entry->version),
+                             sizeof(entry->version));
+    buffer.append((kAlignment - buffer.size() % kAlignment) % kAlignment,
+                  '\0');
+
+    if (buffer.size() >= kWriteBufferSize) {
+      ok = WriteAll(fd, buffer.data(), buffer.size());
+      offset += buffer.size();
+      buffer.clear();
+    }
+  }
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.format_version = kFormatVersion;
+  header.entry_size = sizeof(Entry);
+  header.num_documents = entries.size();
+  header.index_offset = offset + buffer.size();
+  header.file_size = header.index_offset + entries.size() * sizeof(Entry);
+  if (!entries.empty()) {
+    buffer.append(reinterpret_cast<const char*>(&entries[0]),
+                  entries.size() * sizeof(Entry));
+  }
+  ok = ok && WriteAll(fd, buffer.data(), buffer.size()) &&
+       (pwrite(fd, &header, sizeof(header), 0) ==
+        static_cast<ssize_t>(sizeof(header))) &&
+       (fdatasync(fd) == 0);
+  close(fd);
+
+  if (!ok || (rename(tmp_path.c_str(), path.c_str()) != 0)) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return SyncDirectory(path);
+}
+
+Snapshot* Snapshot::Open(const string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if ((fstat(fd, &st) != 0) ||
+      (static_cast<size_t>(st.st_size) < sizeof(Header))) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = st.st_size;
+  void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return NULL;
+  }
+
+  // Documents are loaded one at a time, do not read ahead of them
+  madvise(data, size, MADV_RANDOM);
+  Snapshot *snapshot = new Snapshot(static_cast<const char*>(data), size);
+
+  const Header *header = static_cast<const Header*>(data);
+  if ((memcmp(header->magic, kMagic, sizeof(kMagic)) != 0) ||
+      (header->format_version != kFormatVersion) ||
+      (header->entry_size != sizeof(Entry)) ||
+      (header->file_size != size) ||
+      (header->index_offset < sizeof(Header)) ||
+      (header->index_offset % kAlignment != 0) ||
+      (header->index_offset > size) ||
+      (header->num_documents !=
+       (size - header->index_offset) / sizeof(Entry)) ||
+      ((size - header->index_offset) % sizeof(Entry) != 0)) {
+    delete snapshot;
+    return NULL;
+  }
+  snapshot->entries_ = reinterpret_cast<const Entry*>(
+      snapshot->data_ + header->index_offset);
+  snapshot->num_entries_ = header->num_documents;
+  return snapshot;
+}
+
+Document* Snapshot::Load(DocID doc_id) const {
+  const Entry *entry = Find(doc_id);
+  const char *data;
+  list<Diff> diffs;
+  if ((entry == NULL) || !Read(*entry, &data, &diffs)) {
+    return NULL;
+  }
+  return new Document(doc_id, entry->version, data, entry->data_size, diffs);
+}
+
+bool Snapshot::LoadImage(DocID doc_id, DocumentImage *image) const {
+  const Entry *entry = Find(doc_id);
+  const char *data;
+  list<Diff> diffs;
+  if ((entry == NULL) || !Read(*entry, &data, &diffs)) {
+    return false;
+  }
+  image->doc_id = doc_id;
+  image->version = entry->version;
+  image->text = Text(data, entry->data_size);
+  image->diffs.swap(diffs);
+  return true;
+}
+
+bool Snapshot::Contains(DocID doc_id) const {
+  return Find(doc_id) != NULL;
+}
+
+void Snapshot::GetDocIDs(vector<DocID> *doc_ids) const {
+  doc_ids->reserve(doc_ids->size() + num_entries_);
+  for (size_t i = 0; i < num_entries_; ++i) {
+    doc_ids->push_back(entries_[i].doc_id);
+  }
+}
+
+size_t Snapshot::size() const {
+  return num_entries_;
+}
+
+const Snapshot::Entry* Snapshot::Find(DocID doc_id) const {
+  size_t low = 0;
+  size_t high = num_entries_;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (entries_[middle].doc_id < doc_id) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if ((low == num_entries_) || (entries_[low].doc_id != doc_id)) {
+    return NULL;
+  }
+  return &entries_[low];
+}
+
+bool Snapshot::Read(const Entry& entry, const char **data,
+                    list<Diff> *diffs) const {
+  // Everything a Document points to is between the header and the index
+  uint64_t limit = reinterpret_cast<const char*>(entries_) - data_;
+  if ((entry.data_offset > limit) ||
+      (entry.data_size > limit - entry.data_offset) ||
+      (entry.diffs_offset > limit) ||
+      (entry.diffs_size > limit - entry.diffs_offset)) {
+    return false;
+  }
+  uint32_t crc = ExtendCrc32(0, data_ + entry.data_offset, entry.data_size);
+  crc = ExtendCrc32(crc, data_ + entry.diffs_offset, entry.diffs_size);
+  crc = ExtendCrc32(crc, reinterpret_cast<const char*>(&entry.version),
+                    sizeof(entry.version));
+  if (crc != entry.crc) {
+    return false;
+  }
+
+  const char *p = data_ + entry.diffs_offset;
+  const char *diffs_limit = p + entry.diffs_size;
+  vector<DiffView> views;
+  if (!DecodeUpdates(&p, diffs_limit, &views) || (p != diffs_limit)) {
+    return false;
+  }
+  for (size_t i = 0; i < views.size(); ++i) {
+    diffs->push_back(views[i].ToDiff());
+  }
+  *data = data_ + entry.data_offset;
+  return true;
+}
+
+}  // namespace kamiah
@@ -0,0 +1,155 @@
+/**
+ * @file snapshot.h
+ * @brief Definition of a Snapshot, an on-disk image of a DocumentStore.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_SNAPSHOT_H_
+#define KAMIAH_SNAPSHOT_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "document.h"
+#include "types.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+class DocumentStore;
+
+/**
+ * @brief A Snapshot is a read-only image of the Documents of a DocumentStore
+ *     that is mapped into memory instead of read.
+ *
+ * The file is laid out so that it can be used in place:
+ *
+ *   Header: "KMSNAP\0\0", format version, number of documents, offset of the
+ *       index and size of the file.
+ *   Data: For every Document, its text followed by its diff cache encoded
+ *       with EncodeUpdates(), padded to 8 bytes.
+ *   Index: One fixed-size entry per Document (ID, version, the location of
+ *       its text and diffs, and a CRC-32 of them and the version), sorted by
+ *       DocID.
+ *
+ * Fixed-width fields are in the byte order of the machine that wrote the
+ * snapshot. Opening a snapshot only checks the header; a Document is found
+ * with a binary search of the index and only its pages are read when it is
+ * loaded, so the cost of a restart is proportional to the Documents that are
+ * actually used. Loading a Document checks the CRC of its entry, a
+ * corrupted entry is never loaded.
+ *
+ * This class is thread-safe.
+ */
+class Snapshot {
+ public:
+  /**
+   * @brief Writes a snapshot of all the Documents in a store. The snapshot is
+   *     written to a temporary file that replaces path once it is synced.
+   *
+   * @param path The path of the snapshot.
+   * @param store The store to write.
+   * @return True iff the snapshot was written and synced. False if a
+   *     Document of the store is corrupted (see DocumentStore::IsCorrupted()).
+   */
+  static bool Write(const string& path, const DocumentStore& store);
+
+  /**
+   * @brief Writes a snapshot of Document images, like Write() above. Images
+   *     can be written from any thread.
+   *
+   * @param path The path of the snapshot.
+   * @param images The images to write, sorted by DocID.
+   * @return True iff the snapshot was written and synced.
+   */
+  static bool Write(const string& path, const vector<DocumentImage>& images);
+
+  /**
+   * @brief Maps a snapshot into memory.
+   *
+   * @param path The path of the snapshot.
+   * @return The snapshot, or NULL if it does not exist or is not a valid
+   *     snapshot. Owned by the caller.
+   */
+  static Snapshot* Open(const string& path);
+
+  /**
+   * @brief Unmaps the snapshot. Documents loaded from it are not affected.
+   */
+  ~Snapshot();
+
+  /**
+   * @brief Loads a Document from the snapshot.
+   *
+   * @param doc_id The ID of the Document.
+   * @return The Document, or NULL if it is not in the snapshot or its entry
+   *     is corrupted. Owned by the caller.
+   */
+  Document* Load(DocID doc_id) const;
+
+  /**
+   * @brief Loads the image of a Document from the snapshot.
+   *
+   * @param doc_id The ID of the Document.
+   * @param image Where to write the image.
+   * @return True iff the Document is in the snapshot and its entry is valid.
+   */
+  bool LoadImage(DocID doc_id, DocumentImage *image) const;
+
+  /**
+   * @brief Checks whether a Document is in the snapshot.
+   *
+   * @param doc_id The ID of the Document.
+   * @return True iff the Document is in the snapshot.
+   */
+  bool Contains(DocID doc_id) const;
+
+  /**
+   * @brief Gets the IDs of all the Documents in the snapshot in increasing
+   *     order.
+   *
+   * @param doc_ids Vector in which to write the IDs.
+   */
+  void GetDocIDs(vector<DocID> *doc_ids) const;
+
+  /**
+   * @brief Gets the number of Documents in the snapshot.
+   *
+   * @return The number of Documents in the snapshot.
+   */
+  size_t size() const;
+
+ private:
+  struct Header;
+  struct Entry;
+
+  Snapshot(const char *data, size_t size);
+
+  // Finds the entry of a Document, NULL if there is none.
+  const Entry* Find(DocID doc_id) const;
+
+  // Gets the text and diff cache of a Document. Returns false if its entry
+  // is corrupted.
+  bool Read(const Entry& entry, const char **data, list<Diff> *diffs) const;
+
+  // The mapped file.
+  const char *data_;
+  size_t size_;
+
+  // The index, sorted by DocID.
+  const Entry *entries_;
+  size_t num_entries_;
+
+  // Not copyable.
+  Snapshot(const Snapshot&);
+  void operator=(const Snapshot&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_SNAPSHOT_H_
@@ -0,0 +1,275 @@
+/**
+ * @file snapshot_test.cc
+ * @brief Unit tests for a Snapshot.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "document_store.h"
+#include "store_test_util.h"
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace kamiah {
+
+namespace {
+
+// Observer that counts the diffs it is notified of.
+class CountingObserver : public DocumentObserver {
+ public:
+  CountingObserver() : num_diffs_(0) {}
+
+  virtual void OnDiffApplied(const Document& /* doc */,
+                             const Diff& /* diff */) {
+    ++num_diffs_;
+  }
+
+  int num_diffs_;
+};
+
+}  // namespace
+
+class SnapshotTest : public StoreFilesTest {
+ protected:
+  SnapshotTest() : StoreFilesTest("snapshot_test") {}
+
+  // Overwrites bytes of the snapshot file.
+  void Overwrite(off_t offset, const string& bytes) {
+    int fd = open(snapshot_path_.c_str(), O_WRONLY);
+    ASSERT_LE(0, fd);
+    ASSERT_EQ(static_cast<ssize_t>(bytes.size()),
+              pwrite(fd, bytes.data(), bytes.size(), offset));
+    close(fd);
+  }
+};
+
+TEST_F(SnapshotTest, WriteAndLoad) {
+  DocumentStore store;
+  Insert(&store, 1, "papaya");
+  Insert(&store, 1, "ide ");
+  Insert(&store, 7, "kamiah");
+  for (size_t i = 0; i < Document::kMaxCacheSize + 5; ++i) {
+    Insert(&store, 3, "x");
+  }
+  store.GetOrCreate(5);
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+
+  Snapshot *snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_EQ(4U, snapshot->size());
+  vector<DocID> doc_ids;
+  snapshot->GetDocIDs(&doc_ids);
+  ASSERT_EQ(4U, doc_ids.size());
+  EXPECT_EQ(1, doc_ids[0]);
+  EXPECT_EQ(3, doc_ids[1]);
+  EXPECT_EQ(5, doc_ids[2]);
+  EXPECT_EQ(7, doc_ids[3]);
+  EXPECT_TRUE(snapshot->Contains(5));
+  EXPECT_FALSE(snapshot->Contains(2));
+  EXPECT_TRUE(snapshot->Load(2) == NULL);
+  EXPECT_TRUE(snapshot->Load(8) == NULL);
+
+  Document *doc = snapshot->Load(1);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ(1, doc->doc_id());
+  EXPECT_EQ(2, doc->version());
+  EXPECT_EQ("ide papaya", GetData(doc));
+  list<Diff> updates;
+  EXPECT_TRUE(doc->GetUpdates(1, &updates));
+  ASSERT_EQ(2U, updates.size());
+  EXPECT_EQ("papaya", updates.front().text());
+  EXPECT_EQ("ide ", updates.back().text());
+  delete doc;
+
+  // Only the diff cache is kept
+  doc = snapshot->Load(3);
+  ASSERT_TRUE(doc != NULL);
+  Version version = Document::kMaxCacheSize + 5;
+  EXPECT_EQ(version, doc->version());
+  EXPECT_EQ(string(version, 'x'), GetData(doc));
+  updates.clear();
+  EXPECT_FALSE(doc->GetUpdates(5, &updates));
+  EXPECT_TRUE(doc->GetUpdates(6, &updates));
+  size_t max_cache = Document::kMaxCacheSize;
+  EXPECT_EQ(max_cache, updates.size());
+  delete doc;
+
+  doc = snapshot->Load(5);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ(0, doc->version());
+  EXPECT_EQ(0, doc->size());
+  delete doc;
+
+  // Documents outlive the snapshot
+  doc = snapshot->Load(7);
+  delete snapshot;
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ("kamiah", GetData(doc));
+  delete doc;
+}
+
+TEST_F(SnapshotTest, EmptyStore) {
+  DocumentStore store;
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+  Snapshot *snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_EQ(0U, snapshot->size());
+  EXPECT_FALSE(snapshot->Contains(0));
+  delete snapshot;
+}
+
+TEST_F(SnapshotTest, InvalidSnapshots) {
+  // Missing
+  EXPECT_TRUE(Snapshot::Open(snapshot_path_) == NULL);
+
+  // Not a snapshot
+  DocumentStore store;
+  Insert(&store, 1, "papaya");
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+  Overwrite(0, "PAPAYA");
+  EXPECT_TRUE(Snapshot::Open(snapshot_path_) == NULL);
+
+  // Truncated
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+  int fd = open(snapshot_path_.c_str(), O_RDONLY);
+  off_t size = lseek(fd, 0, SEEK_END);
+  close(fd);
+  ASSERT_EQ(0, truncate(snapshot_path_.c_str(), size - 1));
+  EXPECT_TRUE(Snapshot::Open(snapshot_path_) == NULL);
+  ASSERT_EQ(0, truncate(snapshot_path_.c_str(), 4));
+  EXPECT_TRUE(Snapshot::Open(snapshot_path_) == NULL);
+}
+
+TEST_F(SnapshotTest, CorruptedEntry) {
+  DocumentStore store;
+  Insert(&store, 1, "papaya");
+  Insert(&store, 2, "kamiah");
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+
+  // Point the text of the last Document past the end of the file
+  int fd = open(snapshot_path_.c_str(), O_RDONLY);
+  off_t size = lseek(fd, 0, SEEK_END);
+  close(fd);
+  Overwrite(size - 4 * sizeof(uint64_t), string(sizeof(uint64_t), '\xff'));
+
+  Snapshot *snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_TRUE(snapshot->Contains(2));
+  EXPECT_TRUE(snapshot->Load(2) == NULL);
+  Document *doc = snapshot->Load(1);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ("papaya", GetData(doc));
+  delete doc;
+  delete snapshot;
+}
+
+TEST_F(SnapshotTest, CorruptedText) {
+  DocumentStore store;
+  Insert(&store, 1, "papaya");
+  Insert(&store, 2, "kamiah");
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+
+  CorruptSnapshot("kamiah");
+  Snapshot *snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_TRUE(snapshot->Load(2) == NULL);
+  DocumentImage image;
+  EXPECT_FALSE(snapshot->LoadImage(2, &image));
+
+  // The store neither drops it nor creates it again
+  DocumentStore loaded;
+  ASSERT_TRUE(loaded.LoadSnapshot(snapshot));
+  EXPECT_TRUE(loaded.Get(2) == NULL);
+  EXPECT_TRUE(loaded.IsCorrupted(2));
+  EXPECT_FALSE(loaded.IsCorrupted(1));
+  EXPECT_TRUE(loaded.GetOrCreate(2) == NULL);
+  Diff diff(0, "x");
+  EXPECT_FALSE(loaded.ApplyDiff(2, &diff));
+  Document *doc = new Document(2);
+  EXPECT_FALSE(loaded.Add(doc));
+  delete doc;
+  EXPECT_EQ(2U, loaded.size());
+  EXPECT_FALSE(Snapshot::Write(snapshot_path_, loaded));
+
+  // Until it is removed
+  EXPECT_TRUE(loaded.Remove(2));
+  EXPECT_FALSE(loaded.IsCorrupted(2));
+  EXPECT_TRUE(loaded.GetOrCreate(2) != NULL);
+}
+
+TEST_F(SnapshotTest, DocumentStoreLoadsLazily) {
+  {
+    DocumentStore store;
+    Insert(&store, 1, "papaya");
+    Insert(&store, 2, "kamiah");
+    Insert(&store, 3, "kapoho");
+    ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+  }
+
+  DocumentStore store;
+  CountingObserver observer;
+  store.AddObserver(&observer);
+  Snapshot *snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  ASSERT_TRUE(store.LoadSnapshot(snapshot));
+  EXPECT_EQ(3U, store.size());
+  EXPECT_EQ(0U, store.num_loaded());
+  vector<DocID> doc_ids;
+  store.GetDocIDs(&doc_ids);
+  EXPECT_EQ(3U, doc_ids.size());
+
+  // Only loaded on access, with the observers of the store
+  Document *doc = store.Get(2);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ(1U, store.num_loaded());
+  EXPECT_EQ("kamiah", GetData(doc));
+  EXPECT_EQ(doc, store.GetOrCreate(2));
+  Diff diff(0, 3);
+  EXPECT_TRUE(store.ApplyDiff(2, &diff));
+  EXPECT_EQ(2, diff.version());
+  EXPECT_EQ(1, observer.num_diffs_);
+
+  // Removed without being loaded
+  EXPECT_TRUE(store.Remove(3));
+  EXPECT_TRUE(store.Get(3) == NULL);
+  EXPECT_EQ(2U, store.size());
+
+  // New Documents are unaffected
+  Insert(&store, 4, "ide");
+  EXPECT_EQ(2U, store.num_loaded());
+  EXPECT_EQ(2, observer.num_diffs_);
+  store.RemoveObserver(&observer);
+
+  // Only an empty store can load a snapshot
+  snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_FALSE(store.LoadSnapshot(snapshot));
+  delete snapshot;
+
+  // The snapshot can be replaced while it is mapped
+  ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+  EXPECT_EQ(3U, store.num_loaded());
+  snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_EQ(3U, snapshot->size());
+  EXPECT_FALSE(snapshot->Contains(3));
+  doc = snapshot->Load(2);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ("iah", GetData(doc));
+  delete doc;
+  doc = snapshot->Load(1);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ("papaya", GetData(doc));
+  delete doc;
+  delete snapshot;
+}
+
+}  // namespace kamiah
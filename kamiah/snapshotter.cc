@@ -0,0 +1,118 @@
+/**
+ * @file snapshotter.cc
+ * @brief Implementation of a Snapshotter.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "snapshotter.h"
+
+#include <unistd.h>
+
+#include "snapshot.h"
+
+namespace kamiah {
+
+Snapshotter::Snapshotter(DocumentStore *store, const string& path,
+                         DiffLog *diff_log)
+    : store_(store), path_(path), diff_log_(diff_log), started_(false),
+      done_(true), ok_(true), num_snapshots_(0) {
+}
+
+Snapshotter::~Snapshotter() {
+  Wait();
+}
+
+bool Snapshotter::Start() {
+  if (in_progress()) {
+    return false;
+  }
+  Wait();
+
+  // Nothing can be applied between taking the images and rotating the log,
+  // so the rotated log only has records that the snapshot covers.
+  images_.clear();
+  not_loaded_.clear();
+  store_->GetImages(&images_, &not_loaded_);
+  if (diff_log_ != NULL) {
+    diff_log_->Rotate();
+  }
+
+  {
+    MutexLock l(&mu_);
+    done_ = false;
+  }
+  if (pthread_create(&thread_, NULL, &WriteThread, this) != 0) {
+    MutexLock l(&mu_);
+    done_ = true;
+    ok_ = false;
+    return false;
+  }
+  started_ = true;
+  return true;
+}
+
+bool Snapshotter::Wait() {
+  if (started_) {
+    pthread_join(thread_, NULL);
+    started_ = false;
+  }
+  MutexLock l(&mu_);
+  return ok_;
+}
+
+bool Snapshotter::in_progress() const {
+  MutexLock l(&mu_);
+  return !done_;
+}
+
+int64_t Snapshotter::num_snapshots() const {
+  MutexLock l(&mu_);
+  return num_snapshots_;
+}
+
+void *Snapshotter::WriteThread(void *snapshotter) {
+  static_cast<Snapshotter*>(snapshotter)->WriteSnapshot();
+  return NULL;
+}
+
+void Snapshotter::WriteSnapshot() {
+  // Documents that were never loaded are copied from the previous snapshot,
+  // which the store keeps mapped. A corrupted one fails the snapshot rather
+  // than being left out of it.
+  const Snapshot *previous = store_->snapshot();
+  vector<DocumentImage> images;
+  images.reserve(images_.size() + not_loaded_.size());
+  size_t i = 0;
+  size_t j = 0;
+  bool ok = true;
+  while (ok && ((i < images_.size()) || (j < not_loaded_.size()))) {
+    if ((j == not_loaded_.size()) ||
+        ((i < images_.size()) && (images_[i].doc_id < not_loaded_[j]))) {
+      images.push_back(images_[i]);
+      ++i;
+    } else {
+      images.push_back(DocumentImage());
+      ok = previous->LoadImage(not_loaded_[j], &images.back());
+      ++j;
+    }
+  }
+  images_.clear();
+  not_loaded_.clear();
+
+  // Every record in the rotated log, and in one left over by a snapshot that
+  // failed, is older than this snapshot.
+  ok = ok && Snapshot::Write(path_, images);
+  if (ok && (diff_log_ != NULL)) {
+    unlink(DiffLog::RotatedPath(diff_log_->path()).c_str());
+  }
+
+  MutexLock l(&mu_);
+  ok_ = ok;
+  done_ = true;
+  if (ok) {
+    ++num_snapshots_;
+  }
+}
+
+}  // namespace kamiah
@@ -0,0 +1,124 @@
+/**
+ * @file snapshotter.h
+ * @brief Definition of a Snapshotter, which writes Snapshots of live
+ *     Documents in the background.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_SNAPSHOTTER_H_
+#define KAMIAH_SNAPSHOTTER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "diff_log.h"
+#include "document.h"
+#include "document_store.h"
+#include "mutex.h"
+#include "types.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief A Snapshotter writes Snapshots of a DocumentStore while diffs keep
+ *     being applied to it, and drops the records of the store's DiffLog that
+ *     each snapshot covers.
+ *
+ * Start() takes an image of every Document in memory, which only copies
+ * references to the chunks of their text, and rotates the log. A background
+ * thread then writes the images, along with the Documents that are still
+ * only in the store's previous snapshot, and deletes the rotated log once
+ * the new snapshot is durable. Edits made meanwhile only copy the chunks of
+ * text they touch. A Document that is corrupted in the previous snapshot
+ * fails every new one, so that it is never dropped from them.
+ *
+ * Start() must be called from the thread that applies diffs to the store.
+ * The store and the log must outlive the Snapshotter.
+ *
+ * This class is thread-compatible.
+ */
+class Snapshotter {
+ public:
+  /**
+   * @brief Constructor of a Snapshotter.
+   *
+   * @param store The store to snapshot. Not owned.
+   * @param path The path to write the snapshots to.
+   * @param diff_log The log of the store, or NULL if it has none. Not owned.
+   */
+  Snapshotter(DocumentStore *store, const string& path, DiffLog *diff_log);
+
+  /**
+   * @brief Waits for the snapshot being written, if any.
+   */
+  ~Snapshotter();
+
+  /**
+   * @brief Takes a snapshot of the store and starts writing it. Does not
+   *     wait for the snapshot to be written.
+   *
+   * @return True iff a snapshot was started, false if one is still being
+   *     written.
+   */
+  bool Start();
+
+  /**
+   * @brief Waits for the snapshot being written, if any.
+   *
+   * @return True iff the last snapshot started was written successfully.
+   */
+  bool Wait();
+
+  /**
+   * @brief Whether a snapshot is being written.
+   *
+   * @return True iff a snapshot is being written.
+   */
+  bool in_progress() const;
+
+  /**
+   * @brief Gets the number of snapshots written successfully.
+   *
+   * @return The number of snapshots written successfully.
+   */
+  int64_t num_snapshots() const;
+
+ private:
+  static void *WriteThread(void *snapshotter);
+
+  // Writes the captured images and drops the rotated log.
+  void WriteSnapshot();
+
+  DocumentStore *store_;
+  const string path_;
+  DiffLog *diff_log_;
+
+  // The thread writing the last snapshot, if it was not joined yet.
+  pthread_t thread_;
+  bool started_;
+
+  // The snapshot being written: images of the Documents in memory and the
+  // IDs of those still in the previous snapshot.
+  vector<DocumentImage> images_;
+  vector<DocID> not_loaded_;
+
+  mutable Mutex mu_;
+  bool done_;
+  bool ok_;
+  int64_t num_snapshots_;
+
+  // Not copyable.
+  Snapshotter(const Snapshotter&);
+  void operator=(const Snapshotter&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_SNAPSHOTTER_H_
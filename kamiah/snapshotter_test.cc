@@ -0,0 +1,176 @@
+/**
+ * @file snapshotter_test.cc
+ * @brief Unit tests for a Snapshotter.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "snapshotter.h"
+
+#include <unistd.h>
+
+#include <string>
+
+#include "snapshot.h"
+#include "store_test_util.h"
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace kamiah {
+
+class SnapshotterTest : public StoreFilesTest {
+ protected:
+  SnapshotterTest() : StoreFilesTest("snapshotter_test") {}
+};
+
+TEST_F(SnapshotterTest, SnapshotWhileEditing) {
+  DocumentStore store;
+  DiffLogOptions options;
+  options.durability = DiffLogOptions::SYNC_EACH;
+  DiffLog *log = DiffLog::Open(log_path_, options);
+  ASSERT_TRUE(log != NULL);
+  store.AddObserver(log);
+
+  // A large Document, and a small one
+  string large(64 * Text::kMaxChunkSize, 'x');
+  Insert(&store, 1, large);
+  Insert(&store, 2, "papaya");
+
+  Snapshotter snapshotter(&store, snapshot_path_, log);
+  EXPECT_EQ(0, snapshotter.num_snapshots());
+  ASSERT_TRUE(snapshotter.Start());
+
+  // Edits made while the snapshot is written are not in it
+  Insert(&store, 1, "kamiah");
+  Insert(&store, 2, "ide ");
+  Insert(&store, 3, "kapoho");
+  EXPECT_TRUE(snapshotter.Wait());
+  EXPECT_FALSE(snapshotter.in_progress());
+  EXPECT_EQ(1, snapshotter.num_snapshots());
+
+  Snapshot *snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_EQ(2U, snapshot->size());
+  Document *doc = snapshot->Load(1);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ(1, doc->version());
+  EXPECT_EQ(large, GetData(doc));
+  delete doc;
+  doc = snapshot->Load(2);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ("papaya", GetData(doc));
+  delete doc;
+  delete snapshot;
+
+  // The records the snapshot covers were dropped
+  EXPECT_NE(0, access(DiffLog::RotatedPath(log_path_).c_str(), F_OK));
+  store.RemoveObserver(log);
+  delete log;
+
+  // The snapshot and the rest of the log recover everything
+  DocumentStore recovered;
+  snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  ASSERT_TRUE(recovered.LoadSnapshot(snapshot));
+  EXPECT_EQ(3, ReplayDiffLog(log_path_, &recovered));
+  ASSERT_EQ(3U, recovered.size());
+  EXPECT_EQ("kamiah" + large, GetData(recovered.Get(1)));
+  EXPECT_EQ("ide papaya", GetData(recovered.Get(2)));
+  EXPECT_EQ("kapoho", GetData(recovered.Get(3)));
+}
+
+TEST_F(SnapshotterTest, DocumentsNotLoaded) {
+  {
+    DocumentStore store;
+    Insert(&store, 1, "papaya");
+    Insert(&store, 2, "kamiah");
+    Insert(&store, 3, "kapoho");
+    ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+  }
+
+  // Only one of the Documents of the previous snapshot is loaded
+  DocumentStore store;
+  Snapshot *snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  ASSERT_TRUE(store.LoadSnapshot(snapshot));
+  Insert(&store, 2, "ide ");
+  EXPECT_TRUE(store.Remove(3));
+  EXPECT_EQ(1U, store.num_loaded());
+
+  Snapshotter snapshotter(&store, snapshot_path_, NULL);
+  ASSERT_TRUE(snapshotter.Start());
+  EXPECT_TRUE(snapshotter.Wait());
+  EXPECT_EQ(1U, store.num_loaded());
+
+  snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  EXPECT_EQ(2U, snapshot->size());
+  Document *doc = snapshot->Load(1);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ("papaya", GetData(doc));
+  delete doc;
+  doc = snapshot->Load(2);
+  ASSERT_TRUE(doc != NULL);
+  EXPECT_EQ("ide kamiah", GetData(doc));
+  EXPECT_EQ(2, doc->version());
+  delete doc;
+  EXPECT_FALSE(snapshot->Contains(3));
+  delete snapshot;
+}
+
+TEST_F(SnapshotterTest, CorruptedDocumentNotLoaded) {
+  {
+    DocumentStore store;
+    Insert(&store, 1, "papaya");
+    Insert(&store, 2, "kamiah");
+    ASSERT_TRUE(Snapshot::Write(snapshot_path_, store));
+  }
+  CorruptSnapshot("kamiah");
+
+  // The Document is not dropped from the next snapshot, which fails instead
+  DocumentStore store;
+  Snapshot *snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  ASSERT_TRUE(store.LoadSnapshot(snapshot));
+  Insert(&store, 1, "ide ");
+  Snapshotter snapshotter(&store, snapshot_path_, NULL);
+  ASSERT_TRUE(snapshotter.Start());
+  EXPECT_FALSE(snapshotter.Wait());
+  EXPECT_EQ(0, snapshotter.num_snapshots());
+  EXPECT_TRUE(store.IsCorrupted(2));
+}
+
+TEST_F(SnapshotterTest, RepeatedSnapshots) {
+  DocumentStore store;
+  DiffLogOptions options;
+  options.durability = DiffLogOptions::SYNC_EACH;
+  DiffLog *log = DiffLog::Open(log_path_, options);
+  ASSERT_TRUE(log != NULL);
+  store.AddObserver(log);
+
+  Snapshotter snapshotter(&store, snapshot_path_, log);
+  for (int i = 0; i < 5; ++i) {
+    Insert(&store, i % 2, "x");
+    if (!snapshotter.Start()) {
+      EXPECT_TRUE(snapshotter.Wait());
+      EXPECT_TRUE(snapshotter.Start());
+    }
+    Insert(&store, i % 2, "y");
+  }
+  EXPECT_TRUE(snapshotter.Wait());
+  EXPECT_EQ(5, snapshotter.num_snapshots());
+  store.RemoveObserver(log);
+  delete log;
+
+  DocumentStore recovered;
+  Snapshot *snapshot = Snapshot::Open(snapshot_path_);
+  ASSERT_TRUE(snapshot != NULL);
+  ASSERT_TRUE(recovered.LoadSnapshot(snapshot));
+  ASSERT_LE(0, ReplayDiffLog(log_path_, &recovered));
+  EXPECT_EQ(GetData(store.Get(0)), GetData(recovered.Get(0)));
+  EXPECT_EQ(GetData(store.Get(1)), GetData(recovered.Get(1)));
+  EXPECT_EQ(store.Get(0)->version(), recovered.Get(0)->version());
+}
+
+}  // namespace kamiah
@@ -0,0 +1,67 @@
+/**
+ * @file store_test_util.cc
+ * @brief Implementation of the fixture shared by the store tests.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "store_test_util.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "diff_log.h"
+
+namespace kamiah {
+
+StoreFilesTest::StoreFilesTest(const string& name) : name_(name) {
+}
+
+void StoreFilesTest::SetUp() {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/kamiah_%s.%d", name_.c_str(),
+           static_cast<int>(getpid()));
+  snapshot_path_ = string(path) + ".snapshot";
+  log_path_ = string(path) + ".log";
+  RemoveFiles();
+}
+
+void StoreFilesTest::TearDown() {
+  RemoveFiles();
+}
+
+void StoreFilesTest::RemoveFiles() {
+  unlink(snapshot_path_.c_str());
+  unlink(log_path_.c_str());
+  unlink(DiffLog::RotatedPath(log_path_).c_str());
+}
+
+void StoreFilesTest::CorruptSnapshot(const string& text) {
+  FILE *file = fopen(snapshot_path_.c_str(), "r+");
+  ASSERT_TRUE(file != NULL);
+  string contents;
+  char buffer[4096];
+  size_t bytes;
+  while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents.append(buffer, bytes);
+  }
+  size_t offset = contents.find(text);
+  ASSERT_NE(string::npos, offset);
+  fseek(file, offset, SEEK_SET);
+  fputc(contents[offset] ^ 0x20, file);
+  fclose(file);
+}
+
+void StoreFilesTest::Insert(DocumentStore *store, DocID doc_id,
+                            const string& text) {
+  Diff diff(0, text);
+  EXPECT_TRUE(store->GetOrCreate(doc_id)->ApplyDiff(&diff));
+}
+
+string StoreFilesTest::GetData(const Document *doc) {
+  string data;
+  doc->GetData(&data);
+  return data;
+}
+
+}  // namespace kamiah
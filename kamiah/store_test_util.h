@@ -0,0 +1,56 @@
+/**
+ * @file store_test_util.h
+ * @brief Fixture shared by the tests that write the Documents of a store to
+ *     snapshots and logs.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_STORE_TEST_UTIL_H_
+#define KAMIAH_STORE_TEST_UTIL_H_
+
+#include <string>
+
+#include "document_store.h"
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace kamiah {
+
+/**
+ * @brief Base of the fixtures of tests that write a snapshot and a log. The
+ *     files are under /tmp and are removed before and after each test.
+ */
+class StoreFilesTest : public ::testing::Test {
+ protected:
+  /**
+   * @brief Constructs the fixture.
+   *
+   * @param name Name in the paths of the files, unique to the test binary.
+   */
+  explicit StoreFilesTest(const string& name);
+
+  virtual void SetUp();
+  virtual void TearDown();
+
+  // Removes the snapshot, the log and the log rotated by a snapshot.
+  void RemoveFiles();
+
+  // Flips a bit of the first occurrence of some text in the snapshot, like
+  // the text of a Document.
+  void CorruptSnapshot(const string& text);
+
+  // Inserts text at the start of a Document of the store.
+  static void Insert(DocumentStore *store, DocID doc_id, const string& text);
+
+  static string GetData(const Document *doc);
+
+  string name_;
+  string snapshot_path_;
+  string log_path_;
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_STORE_TEST_UTIL_H_
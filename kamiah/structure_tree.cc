@@ -0,0 +1,626 @@
+/**
+ * @file structure_tree.cc
+ * @brief Implementation of a StructureTree.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "structure_tree.h"
+
+#include <limits.h>
+
+#include <algorithm>
+#include <map>
+
+using std::map;
+using std::max;
+using std::min;
+
+namespace kamiah {
+
+namespace {
+
+// Kinds of brackets: (), [] and {}.
+const int kNumKinds = 3;
+
+// The indentation of blank lines, more than that of any other line.
+const int kBlankIndent = INT_MAX;
+
+// How the count of open brackets of a kind goes over a range of brackets.
+struct Balance {
+  Balance() : sum(0), min_prefix(0), max_suffix(0) {}
+
+  // Opening brackets minus closing brackets.
+  int sum;
+
+  // The smallest sum of the brackets from the start of the range, and the
+  // largest to its end. Both count the empty range.
+  int min_prefix;
+  int max_suffix;
+};
+
+Balance Combine(const Balance& first, const Balance& second) {
+  Balance combined;
+  combined.sum = first.sum + second.sum;
+  combined.min_prefix = min(first.min_prefix, first.sum + second.min_prefix);
+  combined.max_suffix = max(second.max_suffix, second.sum + first.max_suffix);
+  return combined;
+}
+
+// Gets the kind of a bracket, -1 if it is not one.
+int KindOf(char c, bool *open) {
+  *open = (c == '(') || (c == '[') || (c == '{');
+  switch (c) {
+    case '(':
+    case ')':
+      return 0;
+    case '[':
+    case ']':
+      return 1;
+    case '{':
+    case '}':
+      return 2;
+  }
+  return -1;
+}
+
+// Gets how a bracket changes the count of open brackets of a kind.
+int Step(const Bracket& bracket, int kind) {
+  bool open;
+  if (KindOf(bracket.c, &open) != kind) {
+    return 0;
+  }
+  return open ? 1 : -1;
+}
+
+template <typename T>
+Length CountOf(const T *node) {
+  return (node != NULL) ? node->count : 0;
+}
+
+template <typename T>
+Length SizeOf(const T *node) {
+  return (node != NULL) ? node->total_size : 0;
+}
+
+template <typename T>
+int MinIndentOf(const T *node) {
+  return (node != NULL) ? node->min_indent : kBlankIndent;
+}
+
+template <typename T>
+Balance TotalOf(const T *node, int kind) {
+  return (node != NULL) ? node->total[kind] : Balance();
+}
+
+void AddFold(Index start_line, Index end_line, map<Index, Index> *ends) {
+  if (end_line > start_line) {
+    Index& end = (*ends)[start_line];
+    end = max(end, end_line);
+  }
+}
+
+}  // namespace
+
+FoldRange::FoldRange() : start_line(0), end_line(0) {
+}
+
+FoldRange::FoldRange(Index range_start_line, Index range_end_line)
+    : start_line(range_start_line), end_line(range_end_line) {
+}
+
+bool FoldRange::operator==(const FoldRange& other) const {
+  return (start_line == other.start_line) && (end_line == other.end_line);
+}
+
+struct StructureTree::Node {
+  explicit Node(uint32_t node_priority)
+      : size(0), indent(kBlankIndent), priority(node_priority), left(NULL),
+        right(NULL), count(1), total_size(0), min_indent(kBlankIndent) {
+  }
+
+  // The line.
+  Length size;
+  int indent;
+  vector<Bracket> brackets;
+  Balance balance[kNumKinds];
+
+  // Every node has a higher priority than its children.
+  uint32_t priority;
+  Node *left;
+  Node *right;
+
+  // Totals of the subtree.
+  Length count;
+  Length total_size;
+  int min_indent;
+  Balance total[kNumKinds];
+};
+
+StructureTree::StructureTree() : root_(NULL), random_(2463534242U) {
+}
+
+StructureTree::~StructureTree() {
+  DeleteTree(root_);
+}
+
+void StructureTree::InsertLines(Index line, Length count) {
+  Node *added = NULL;
+  for (Length i = 0; i < count; ++i) {
+    added = Merge(added, new Node(NextPriority()));
+  }
+  Node *before;
+  Node *after;
+  Split(root_, line, &before, &after);
+  root_ = Merge(Merge(before, added), after);
+}
+
+void StructureTree::EraseLines(Index line, Length count) {
+  if (count <= 0) {
+    return;
+  }
+  Node *before;
+  Node *rest;
+  Node *erased;
+  Node *after;
+  Split(root_, line, &before, &rest);
+  Split(rest, count, &erased, &after);
+  DeleteTree(erased);
+  root_ = Merge(before, after);
+}
+
+void StructureTree::SetLine(Index line, Length size, int indent,
+                            const vector<Bracket>& brackets) {
+  if ((line >= 0) && (line < num_lines())) {
+    Set(root_, line, size, indent, brackets);
+  }
+}
+
+bool StructureTree::FindMatch(Index index, Index *match) const {
+  if ((index < 0) || (index >= size())) {
+    return false;
+  }
+
+  // Find the line and column of the index
+  const Node *node = root_;
+  Index line = 0;
+  Index column = index;
+  while (true) {
+    Length left_size = SizeOf(node->left);
+    if (column < left_size) {
+      node = node->left;
+      continue;
+    }
+    column -= left_size;
+    line += CountOf(node->left);
+    if (column < node->size) {
+      break;
+    }
+    column -= node->size;
+    ++line;
+    node = node->right;
+  }
+
+  const vector<Bracket>& brackets = node->brackets;
+  size_t position = 0;
+  while ((position < brackets.size()) &&
+         (brackets[position].column < column)) {
+    ++position;
+  }
+  if ((position == brackets.size()) ||
+      (brackets[position].column != column)) {
+    return false;
+  }
+  bool open;
+  KindOf(brackets[position].c, &open);
+  Index match_line;
+  Index match_column;
+  if (open) {
+    if (!FindClosing(line, position, &match_line, &match_column)) {
+      return false;
+    }
+  } else if (!FindOpening(line, position, &match_line, &match_column)) {
+    return false;
+  }
+  *match = LineStart(match_line) + match_column;
+  return true;
+}
+
+void StructureTree::GetFolds(Index first_line, Index end_line, FoldMode mode,
+                             vector<FoldRange> *folds) const {
+  first_line = max(first_line, static_cast<Index>(0));
+  end_line = min(end_line, static_cast<Index>(num_lines()));
+  if (first_line >= end_line) {
+    return;
+  }
+  if (mode == FOLD_BRACKETS) {
+    GetBracketFolds(first_line, end_line, folds);
+  } else {
+    GetIndentationFolds(first_line, end_line, folds);
+  }
+}
+
+Length StructureTree::num_lines() const {
+  return CountOf(root_);
+}
+
+Length StructureTree::size() const {
+  return SizeOf(root_);
+}
+
+void StructureTree::Split(Node *node, Length count, Node **left,
+                          Node **right) {
+  if (node == NULL) {
+    *left = NULL;
+    *right = NULL;
+    return;
+  }
+  Length left_count = CountOf(node->left);
+  if (left_count < count) {
+    Split(node->right, count - left_count - 1, &node->right, right);
+    *left = node;
+  } else {
+    Split(node->left, count, left, &node->left);
+    *right = node;
+  }
+  Update(node);
+}
+
+StructureTree::Node* StructureTree::Merge(Node *left, Node *right) {
+  if (left == NULL) {
+    return right;
+  }
+  if (right == NULL) {
+    return left;
+  }
+  if (left->priority > right->priority) {
+    left->right = Merge(left->right, right);
+    Update(left);
+    return left;
+  }
+  right->left = Merge(left, right->left);
+  Update(right);
+  return right;
+}
+
+void StructureTree::Update(Node *node) {
+  node->count = CountOf(node->left) + 1 + CountOf(node->right);
+  node->total_size = SizeOf(node->left) + node->size + SizeOf(node->right);
+  node->min_indent = min(node->indent,
+                         min(MinIndentOf(node->left),
+                             MinIndentOf(node->right)));
+  for (int kind = 0; kind < kNumKinds; ++kind) {
+    node->total[kind] = Combine(Combine(TotalOf(node->left, kind),
+                                        node->balance[kind]),
+                                TotalOf(node->right, kind));
+  }
+}
+
+void StructureTree::Set(Node *node, Index line, Length size, int indent,
+                        const vector<Bracket>& brackets) {
+  Length left_count = CountOf(node->left);
+  if (line < left_count) {
+    Set(node->left, line, size, indent, brackets);
+  } else if (line > left_count) {
+    Set(node->right, line - left_count - 1, size, indent, brackets);
+  } else {
+    node->size = size;
+    node->indent = (indent < 0) ? kBlankIndent : indent;
+    node->brackets = brackets;
+    for (int kind = 0; kind < kNumKinds; ++kind) {
+      Balance balance;
+      for (size_t i = 0; i < brackets.size(); ++i) {
+        Balance bracket;
+        bracket.sum = Step(brackets[i], kind);
+        bracket.min_prefix = min(bracket.sum, 0);
+        bracket.max_suffix = max(bracket.sum, 0);
+        balance = Combine(balance, bracket);
+      }
+      node->balance[kind] = balance;
+    }
+  }
+  Update(node);
+}
+
+const StructureTree::Node* StructureTree::FindLine(Index line) const {
+  const Node *node = root_;
+  while (node != NULL) {
+    Length left_count = CountOf(node->left);
+    if (line == left_count) {
+      return node;
+    }
+    if (line < left_count) {
+      node = node->left;
+    } else {
+      line -= left_count + 1;
+      node = node->right;
+    }
+  }
+  return NULL;
+}
+
+Index StructureTree::LineStart(Index line) const {
+  Index start = 0;
+  const Node *node = root_;
+  while (node != NULL) {
+    Length left_count = CountOf(node->left);
+    if (line < left_count) {
+      node = node->left;
+      continue;
+    }
+    start += SizeOf(node->left);
+    if (line == left_count) {
+      break;
+    }
+    start += node->size;
+    line -= left_count + 1;
+    node = node->right;
+  }
+  return start;
+}
+
+bool StructureTree::FindClosing(Index line, size_t position,
+                                Index *match_line,
+                                Index *match_column) const {
+  const Node *node = FindLine(line);
+  bool open;
+  int kind = KindOf(node->brackets[position].c, &open);
+
+  // Look in the rest of the line, then for the line where the count of open
+  // brackets gets below the one of the bracket
+  int sum = 0;
+  for (size_t i = position + 1; i < node->brackets.size(); ++i) {
+    sum += Step(node->brackets[i], kind);
+    if (sum < 0) {
+      *match_line = line;
+      *match_column = node->brackets[i].column;
+      return true;
+    }
+  }
+  line = SearchForward(root_, 0, line + 1, kind, -1, &sum);
+  if (line < 0) {
+    return false;
+  }
+  node = FindLine(line);
+  for (size_t i = 0; i < node->brackets.size(); ++i) {
+    sum += Step(node->brackets[i], kind);
+    if (sum < 0) {
+      *match_line = line;
+      *match_column = node->brackets[i].column;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool StructureTree::FindOpening(Index line, size_t position,
+                                Index *match_line,
+                                Index *match_column) const {
+  const Node *node = FindLine(line);
+  bool open;
+  int kind = KindOf(node->brackets[position].c, &open);
+
+  int sum = 0;
+  for (size_t i = position; i > 0; --i) {
+    sum += Step(node->brackets[i - 1], kind);
+    if (sum > 0) {
+      *match_line = line;
+      *match_column = node->brackets[i - 1].column;
+      return true;
+    }
+  }
+  line = SearchBackward(root_, 0, line, kind, 1, &sum);
+  if (line < 0) {
+    return false;
+  }
+  node = FindLine(line);
+  for (size_t i = node->brackets.size(); i > 0; --i) {
+    sum += Step(node->brackets[i - 1], kind);
+    if (sum > 0) {
+      *match_line = line;
+      *match_column = node->brackets[i - 1].column;
+      return true;
+    }
+  }
+  return false;
+}
+
+Index StructureTree::FindIndentationEnd(Index line, int indent) const {
+  // The region ends before the next line that is not more indented, without
+  // the blank lines before that one
+  Index next = FirstIndentAtMost(root_, 0, line + 1, indent);
+  Index end = (next < 0) ? num_lines() : next;
+  Index last = LastIndentAtMost(root_, 0, end, kBlankIndent - 1);
+  return (last > line) ? last : -1;
+}
+
+void StructureTree::GetBracketFolds(Index first_line, Index end_line,
+                                    vector<FoldRange> *folds) const {
+  map<Index, Index> ends;
+  Index match_line;
+  Index match_column;
+
+  // The brackets opened before the range and still open at its start, from
+  // the innermost out
+  for (int kind = 0; kind < kNumKinds; ++kind) {
+    int sum = 0;
+    int target = 1;
+    Index line = first_line;
+    while ((line = SearchBackward(root_, 0, line, kind, target, &sum)) >= 0) {
+      const vector<Bracket>& brackets = FindLine(line)->brackets;
+      for (size_t i = brackets.size(); i > 0; --i) {
+        sum += Step(brackets[i - 1], kind);
+        if (sum == target) {
+          if (FindClosing(line, i - 1, &match_line, &match_column)) {
+            AddFold(line, match_line, &ends);
+          }
+          ++target;
+        }
+      }
+    }
+  }
+
+  // The brackets opened in the range
+  vector<const Node*> nodes;
+  CollectLines(root_, 0, first_line, end_line, &nodes);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    Index line = first_line + i;
+    const vector<Bracket>& brackets = nodes[i]->brackets;
+    for (size_t j = 0; j < brackets.size(); ++j) {
+      bool open;
+      KindOf(brackets[j].c, &open);
+      if (open && FindClosing(line, j, &match_line, &match_column)) {
+        AddFold(line, match_line, &ends);
+      }
+    }
+  }
+
+  for (map<Index, Index>::const_iterator it = ends.begin(); it != ends.end();
+       ++it) {
+    folds->push_back(FoldRange(it->first, it->second));
+  }
+}
+
+void StructureTree::GetIndentationFolds(Index first_line, Index end_line,
+                                        vector<FoldRange> *folds) const {
+  // The lines before the range that the start of the range is indented
+  // under, from the innermost out
+  vector<FoldRange> enclosing;
+  Index next = FirstIndentAtMost(root_, 0, first_line, kBlankIndent - 1);
+  if (next >= 0) {
+    int indent = FindLine(next)->indent;
+    Index line;
+    while ((line = LastIndentAtMost(root_, 0, first_line, indent - 1)) >= 0) {
+      indent = FindLine(line)->indent;
+      enclosing.push_back(FoldRange(line, FindIndentationEnd(line, indent)));
+    }
+  }
+  folds->insert(folds->end(), enclosing.rbegin(), enclosing.rend());
+
+  vector<const Node*> nodes;
+  CollectLines(root_, 0, first_line, end_line, &nodes);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    if (nodes[i]->indent == kBlankIndent) {
+      continue;
+    }
+    Index line = first_line + i;
+    Index end = FindIndentationEnd(line, nodes[i]->indent);
+    if (end >= 0) {
+      folds->push_back(FoldRange(line, end));
+    }
+  }
+}
+
+Index StructureTree::SearchForward(const Node *node, Index offset,
+                                   Index from, int kind, int target,
+                                   int *sum) {
+  if ((node == NULL) || (offset + node->count <= from)) {
+    return -1;
+  }
+
+  // Skip the subtree if the count does not get to target in it
+  if ((offset >= from) && (*sum + node->total[kind].min_prefix > target)) {
+    *sum += node->total[kind].sum;
+    return -1;
+  }
+  Index found = SearchForward(node->left, offset, from, kind, target, sum);
+  if (found >= 0) {
+    return found;
+  }
+  Index line = offset + CountOf(node->left);
+  if (line >= from) {
+    if (*sum + node->balance[kind].min_prefix <= target) {
+      return line;
+    }
+    *sum += node->balance[kind].sum;
+  }
+  return SearchForward(node->right, line + 1, from, kind, target, sum);
+}
+
+Index StructureTree::SearchBackward(const Node *node, Index offset, Index to,
+                                    int kind, int target, int *sum) {
+  if ((node == NULL) || (offset >= to)) {
+    return -1;
+  }
+  if ((offset + node->count <= to) &&
+      (*sum + node->total[kind].max_suffix < target)) {
+    *sum += node->total[kind].sum;
+    return -1;
+  }
+  Index line = offset + CountOf(node->left);
+  Index found = SearchBackward(node->right, line + 1, to, kind, target, sum);
+  if (found >= 0) {
+    return found;
+  }
+  if (line < to) {
+    if (*sum + node->balance[kind].max_suffix >= target) {
+      return line;
+    }
+    *sum += node->balance[kind].sum;
+  }
+  return SearchBackward(node->left, offset, to, kind, target, sum);
+}
+
+Index StructureTree::FirstIndentAtMost(const Node *node, Index offset,
+                                       Index from, int indent) {
+  if ((node == NULL) || (offset + node->count <= from) ||
+      (node->min_indent > indent)) {
+    return -1;
+  }
+  Index found = FirstIndentAtMost(node->left, offset, from, indent);
+  if (found >= 0) {
+    return found;
+  }
+  Index line = offset + CountOf(node->left);
+  if ((line >= from) && (node->indent <= indent)) {
+    return line;
+  }
+  return FirstIndentAtMost(node->right, line + 1, from, indent);
+}
+
+Index StructureTree::LastIndentAtMost(const Node *node, Index offset,
+                                      Index to, int indent) {
+  if ((node == NULL) || (offset >= to) || (node->min_indent > indent)) {
+    return -1;
+  }
+  Index line = offset + CountOf(node->left);
+  Index found = LastIndentAtMost(node->right, line + 1, to, indent);
+  if (found >= 0) {
+    return found;
+  }
+  if ((line < to) && (node->indent <= indent)) {
+    return line;
+  }
+  return LastIndentAtMost(node->left, offset, to, indent);
+}
+
+void StructureTree::CollectLines(const Node *node, Index offset, Index first,
+                                 Index end, vector<const Node*> *nodes) {
+  if ((node == NULL) || (offset >= end) || (offset + node->count <= first)) {
+    return;
+  }
+  Index line = offset + CountOf(node->left);
+  CollectLines(node->left, offset, first, end, nodes);
+  if ((line >= first) && (line < end)) {
+    nodes->push_back(node);
+  }
+  CollectLines(node->right, line + 1, first, end, nodes);
+}
+
+void StructureTree::DeleteTree(Node *node) {
+  if (node != NULL) {
+    DeleteTree(node->left);
+    DeleteTree(node->right);
+    delete node;
+  }
+}
+
+uint32_t StructureTree::NextPriority() {
+  // xorshift32
+  random_ ^= random_ << 13;
+  random_ ^= random_ >> 17;
+  random_ ^= random_ << 5;
+  return random_;
+}
+
+}  // namespace kamiah
@@ -0,0 +1,223 @@
+/**
+ * @file structure_tree.h
+ * @brief Definition of a StructureTree, an index of the brackets and the
+ *     indentation of the lines of a text used to match brackets and to find
+ *     the regions that can be folded.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_STRUCTURE_TREE_H_
+#define KAMIAH_STRUCTURE_TREE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "types.h"
+
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief A bracket of a line: one of ()[]{}.
+ */
+struct Bracket {
+  // Where the bracket is, in bytes from the start of the line.
+  Index column;
+  char c;
+};
+
+/**
+ * @brief A region of lines that can be folded, from the line it starts in
+ *     to the last line it spans.
+ */
+struct FoldRange {
+  FoldRange();
+  FoldRange(Index range_start_line, Index range_end_line);
+
+  bool operator==(const FoldRange& other) const;
+
+  Index start_line;
+  Index end_line;
+};
+
+// How the regions that can be folded are found.
+enum FoldMode {
+  // From a line with an opening bracket to the line of its closing bracket.
+  FOLD_BRACKETS,
+
+  // From a line to the last of the lines after it that are more indented.
+  FOLD_INDENTATION
+};
+
+/**
+ * @brief A StructureTree keeps, for every line of a text, its size, its
+ *     indentation and its brackets. It finds the bracket matching another
+ *     and the regions that can be folded in a range of lines without walking
+ *     the rest of the text.
+ *
+ * The lines are kept in a treap ordered by line number. Every node also
+ * keeps, for its subtree, the number of lines and characters, the smallest
+ * indentation and, for each kind of bracket, how the count of open brackets
+ * goes up and down. Matching a bracket skips whole subtrees where the count
+ * cannot get back to it, so it takes O(log n) plus the brackets of the lines
+ * at both ends. Folds are found in O(log n) each. Changing, adding or
+ * removing a line takes O(log n).
+ *
+ * Only brackets of the same kind match: in "( ] )" the parentheses match
+ * and the square bracket does not.
+ *
+ * The StructureTree does not look at the text, its user reports the lines
+ * that change (see Highlighter).
+ *
+ * This class is thread-compatible.
+ */
+class StructureTree {
+ public:
+  StructureTree();
+  ~StructureTree();
+
+  /**
+   * @brief Adds empty lines.
+   *
+   * @param line Where to add the lines, between 0 and num_lines().
+   * @param count The number of lines to add.
+   */
+  void InsertLines(Index line, Length count);
+
+  /**
+   * @brief Removes lines.
+   *
+   * @param line The first line to remove.
+   * @param count The number of lines to remove.
+   */
+  void EraseLines(Index line, Length count);
+
+  /**
+   * @brief Sets the contents of a line.
+   *
+   * @param line The line, between 0 and num_lines() - 1.
+   * @param size The number of characters in the line, its '\n' included.
+   * @param indent The number of whitespace characters the line starts with,
+   *     -1 if the line is blank.
+   * @param brackets The brackets of the line, ordered by column.
+   */
+  void SetLine(Index line, Length size, int indent,
+               const vector<Bracket>& brackets);
+
+  /**
+   * @brief Finds the bracket matching another.
+   *
+   * @param index The position of the bracket.
+   * @param match Where to write the position of the matching bracket.
+   * @return True iff there is a bracket at index and it has a match.
+   */
+  bool FindMatch(Index index, Index *match) const;
+
+  /**
+   * @brief Gets the regions that can be folded that overlap a range of
+   *     lines, for example the lines in view. At most one region starts in
+   *     each line: the largest.
+   *
+   * @param first_line The first line of the range.
+   * @param end_line The line after the last one of the range.
+   * @param mode How to find the regions.
+   * @param folds Vector to append the regions to, ordered by start line.
+   */
+  void GetFolds(Index first_line, Index end_line, FoldMode mode,
+                vector<FoldRange> *folds) const;
+
+  /**
+   * @brief Gets the number of lines.
+   *
+   * @return The number of lines.
+   */
+  Length num_lines() const;
+
+  /**
+   * @brief Gets the number of characters of all the lines.
+   *
+   * @return The number of characters.
+   */
+  Length size() const;
+
+ private:
+  struct Node;
+
+  // Splits a treap into its first count lines and the rest.
+  static void Split(Node *node, Length count, Node **left, Node **right);
+
+  // Joins two treaps, all of the lines of left being before those of right.
+  static Node* Merge(Node *left, Node *right);
+
+  // Recomputes the totals of a node from its line and its children.
+  static void Update(Node *node);
+
+  // Sets the contents of the line at a position of a treap.
+  static void Set(Node *node, Index line, Length size, int indent,
+                  const vector<Bracket>& brackets);
+
+  // Gets the node of a line, NULL if there is no such line.
+  const Node* FindLine(Index line) const;
+
+  // Gets the index the line starts at.
+  Index LineStart(Index line) const;
+
+  // Finds the bracket that closes or opens the one at a position of the
+  // brackets of a line.
+  bool FindClosing(Index line, size_t position, Index *match_line,
+                   Index *match_column) const;
+  bool FindOpening(Index line, size_t position, Index *match_line,
+                   Index *match_column) const;
+
+  // Gets the last line of the region indented under a line, -1 if no line
+  // is indented under it.
+  Index FindIndentationEnd(Index line, int indent) const;
+
+  void GetBracketFolds(Index first_line, Index end_line,
+                       vector<FoldRange> *folds) const;
+  void GetIndentationFolds(Index first_line, Index end_line,
+                           vector<FoldRange> *folds) const;
+
+  // Searches the lines from the one at offset in a treap.
+  //
+  // SearchForward finds the first line from from on where sum plus the count
+  // of brackets of a kind, opening ones adding one and closing ones
+  // subtracting one, gets down to target. SearchBackward finds the last line
+  // before to where it gets up to target counting backwards. Both add to sum
+  // the counts of the lines they go past.
+  static Index SearchForward(const Node *node, Index offset, Index from,
+                             int kind, int target, int *sum);
+  static Index SearchBackward(const Node *node, Index offset, Index to,
+                              int kind, int target, int *sum);
+
+  // Finds the first line from from on, or the last one before to, with an
+  // indentation of at most indent.
+  static Index FirstIndentAtMost(const Node *node, Index offset, Index from,
+                                 int indent);
+  static Index LastIndentAtMost(const Node *node, Index offset, Index to,
+                                int indent);
+
+  // Appends the nodes of the lines in [first, end) of a treap.
+  static void CollectLines(const Node *node, Index offset, Index first,
+                           Index end, vector<const Node*> *nodes);
+
+  static void DeleteTree(Node *node);
+
+  // Gets a random priority.
+  uint32_t NextPriority();
+
+  Node *root_;
+  uint32_t random_;
+
+  // Not copyable.
+  StructureTree(const StructureTree&);
+  void operator=(const StructureTree&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_STRUCTURE_TREE_H_
@@ -0,0 +1,293 @@
+/**
+ * @file structure_tree_test.cc
+ * @brief Unit tests for a StructureTree.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "structure_tree.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::map;
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+// Keeps lines both in a StructureTree and in a vector to check the tree
+// against.
+class Lines {
+ public:
+  void Insert(Index line, const vector<string>& added) {
+    tree_.InsertLines(line, added.size());
+    lines_.insert(lines_.begin() + line, added.begin(), added.end());
+    for (size_t i = 0; i < added.size(); ++i) {
+      Set(line + i, added[i]);
+    }
+  }
+
+  void Erase(Index line, Length count) {
+    tree_.EraseLines(line, count);
+    lines_.erase(lines_.begin() + line, lines_.begin() + line + count);
+  }
+
+  void Set(Index line, const string& data) {
+    lines_[line] = data;
+    vector<Bracket> brackets;
+    int indent = -1;
+    for (size_t i = 0; i < data.size(); ++i) {
+      if ((indent < 0) && (data[i] != ' ')) {
+        indent = i;
+      }
+      if (strchr("()[]{}", data[i]) != NULL) {
+        Bracket bracket;
+        bracket.column = i;
+        bracket.c = data[i];
+        brackets.push_back(bracket);
+      }
+    }
+    tree_.SetLine(line, data.size() + 1, indent, brackets);
+  }
+
+  // Finds the match of a bracket walking the whole text.
+  bool FindMatch(Index index, Index *match) const {
+    string text = Text();
+    const char *open = "([{";
+    const char *close = ")]}";
+    const char *found = strchr(open, text[index]);
+    int step = 1;
+    if (found == NULL) {
+      found = strchr(close, text[index]);
+      step = -1;
+    }
+    if ((text[index] == '\n') || (found == NULL)) {
+      return false;
+    }
+    char opening = open[found - ((step > 0) ? open : close)];
+    char closing = close[found - ((step > 0) ? open : close)];
+    int depth = 0;
+    for (Index i = index; (i >= 0) && (i < static_cast<Index>(text.size()));
+         i += step) {
+      if (text[i] == opening) {
+        depth += step;
+      } else if (text[i] == closing) {
+        depth -= step;
+      }
+      if (depth == 0) {
+        *match = i;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Gets the folds walking the whole text.
+  vector<FoldRange> GetFolds(Index first, Index end, FoldMode mode) const {
+    map<Index, Index> ends;
+    string text = Text();
+    Index start = 0;
+    for (Index line = 0; line < static_cast<Index>(lines_.size()); ++line) {
+      if (mode == FOLD_BRACKETS) {
+        for (size_t i = 0; i < lines_[line].size(); ++i) {
+          Index match;
+          if ((strchr("([{", lines_[line][i]) != NULL) &&
+              FindMatch(start + i, &match)) {
+            Index match_line = 0;
+            for (Index j = 0; j < match; ++j) {
+              match_line += (text[j] == '\n') ? 1 : 0;
+            }
+            if (match_line > line) {
+              ends[line] = std::max(ends[line], match_line);
+            }
+          }
+        }
+      } else if (Indent(line) >= 0) {
+        Index next = line + 1;
+        while ((next < static_cast<Index>(lines_.size())) &&
+               ((Indent(next) < 0) || (Indent(next) > Indent(line)))) {
+          ++next;
+        }
+        Index last = next - 1;
+        while ((last > line) && (Indent(last) < 0)) {
+          --last;
+        }
+        if (last > line) {
+          ends[line] = last;
+        }
+      }
+      start += lines_[line].size() + 1;
+    }
+
+    vector<FoldRange> folds;
+    for (map<Index, Index>::iterator it = ends.begin(); it != ends.end();
+         ++it) {
+      if ((it->first < end) && (it->second >= first)) {
+        folds.push_back(FoldRange(it->first, it->second));
+      }
+    }
+    return folds;
+  }
+
+  string Text() const {
+    string text;
+    for (size_t i = 0; i < lines_.size(); ++i) {
+      text += lines_[i] + "\n";
+    }
+    return text;
+  }
+
+  int Indent(Index line) const {
+    size_t indent = lines_[line].find_first_not_of(' ');
+    return (indent == string::npos) ? -1 : indent;
+  }
+
+  StructureTree tree_;
+  vector<string> lines_;
+};
+
+vector<string> Split(const string& text) {
+  vector<string> lines;
+  size_t start = 0;
+  for (size_t end = text.find('\n'); end != string::npos;
+       end = text.find('\n', start)) {
+    lines.push_back(text.substr(start, end - start));
+    start = end + 1;
+  }
+  lines.push_back(text.substr(start));
+  return lines;
+}
+
+}  // namespace
+
+TEST(StructureTreeTest, Brackets) {
+  Lines lines;
+  lines.Insert(0, Split("int f(int x) {\n"
+                        "  if (x) {\n"
+                        "    g(a[x], (x));\n"
+                        "  }\n"
+                        "  return (x];\n"
+                        "}"));
+  EXPECT_EQ(6, lines.tree_.num_lines());
+  EXPECT_EQ(64, lines.tree_.size());
+  Index match;
+  EXPECT_TRUE(lines.tree_.FindMatch(5, &match));
+  EXPECT_EQ(11, match);
+  EXPECT_TRUE(lines.tree_.FindMatch(13, &match));
+  EXPECT_EQ(62, match);
+  EXPECT_TRUE(lines.tree_.FindMatch(62, &match));
+  EXPECT_EQ(13, match);
+  EXPECT_TRUE(lines.tree_.FindMatch(31, &match));
+  EXPECT_EQ(41, match);
+
+  // Not a bracket or no match
+  EXPECT_FALSE(lines.tree_.FindMatch(0, &match));
+  EXPECT_FALSE(lines.tree_.FindMatch(57, &match));
+  EXPECT_FALSE(lines.tree_.FindMatch(59, &match));
+  EXPECT_FALSE(lines.tree_.FindMatch(64, &match));
+
+  vector<FoldRange> folds;
+  lines.tree_.GetFolds(0, 6, FOLD_BRACKETS, &folds);
+  ASSERT_EQ(2U, folds.size());
+  EXPECT_EQ(FoldRange(0, 5), folds[0]);
+  EXPECT_EQ(FoldRange(1, 3), folds[1]);
+  folds.clear();
+  lines.tree_.GetFolds(2, 3, FOLD_BRACKETS, &folds);
+  ASSERT_EQ(2U, folds.size());
+  EXPECT_EQ(FoldRange(0, 5), folds[0]);
+  EXPECT_EQ(FoldRange(1, 3), folds[1]);
+
+  // Closing a bracket in another line changes the matches after it
+  lines.Set(4, "  return (x]);");
+  EXPECT_TRUE(lines.tree_.FindMatch(13, &match));
+  EXPECT_EQ(63, match);
+  lines.Erase(1, 3);
+  folds.clear();
+  lines.tree_.GetFolds(0, 3, FOLD_BRACKETS, &folds);
+  ASSERT_EQ(1U, folds.size());
+  EXPECT_EQ(FoldRange(0, 2), folds[0]);
+}
+
+TEST(StructureTreeTest, Indentation) {
+  Lines lines;
+  lines.Insert(0, Split("def f(x):\n"
+                        "  if x:\n"
+                        "    return 1\n"
+                        "\n"
+                        "  return 2\n"
+                        "\n"
+                        "x = 1"));
+  vector<FoldRange> folds;
+  lines.tree_.GetFolds(0, 7, FOLD_INDENTATION, &folds);
+  ASSERT_EQ(2U, folds.size());
+  EXPECT_EQ(FoldRange(0, 4), folds[0]);
+  EXPECT_EQ(FoldRange(1, 2), folds[1]);
+
+  // Blank lines in view are still in the regions around them
+  folds.clear();
+  lines.tree_.GetFolds(3, 4, FOLD_INDENTATION, &folds);
+  ASSERT_EQ(1U, folds.size());
+  EXPECT_EQ(FoldRange(0, 4), folds[0]);
+  folds.clear();
+  lines.tree_.GetFolds(5, 7, FOLD_INDENTATION, &folds);
+  EXPECT_TRUE(folds.empty());
+}
+
+TEST(StructureTreeTest, RandomEdits) {
+  Lines lines;
+  lines.Insert(0, vector<string>(1));
+  srand(50);
+  for (int i = 0; i < 300; ++i) {
+    Index line = rand() % lines.lines_.size();
+    int edit = rand() % 3;
+    if ((edit == 0) || (lines.lines_.size() < 5)) {
+      vector<string> added;
+      for (int j = rand() % 5; j >= 0; --j) {
+        string data(rand() % 6, ' ');
+        for (int k = rand() % 6; k > 0; --k) {
+          data.push_back("(){}[]x "[rand() % 8]);
+        }
+        added.push_back(data);
+      }
+      lines.Insert(line, added);
+    } else if (edit == 1) {
+      lines.Erase(line, std::min(static_cast<Length>(rand() % 3),
+                                 static_cast<Length>(lines.lines_.size() -
+                                                     line - 1)));
+    } else {
+      lines.Set(line, string(rand() % 4, ' ') + "}{)(" + string(rand() % 2,
+                                                                '['));
+    }
+    ASSERT_EQ(static_cast<Length>(lines.lines_.size()),
+              lines.tree_.num_lines());
+
+    string text = lines.Text();
+    ASSERT_EQ(static_cast<Length>(text.size()), lines.tree_.size());
+    for (Index index = 0; index < static_cast<Index>(text.size()); ++index) {
+      Index expected = -1;
+      Index match = -1;
+      EXPECT_EQ(lines.FindMatch(index, &expected),
+                lines.tree_.FindMatch(index, &match)) << index;
+      EXPECT_EQ(expected, match) << index;
+    }
+    for (int mode = FOLD_BRACKETS; mode <= FOLD_INDENTATION; ++mode) {
+      Index first = rand() % lines.lines_.size();
+      Index end = first + 1 + rand() % 10;
+      vector<FoldRange> folds;
+      lines.tree_.GetFolds(first, end, static_cast<FoldMode>(mode), &folds);
+      EXPECT_TRUE(lines.GetFolds(first, end, static_cast<FoldMode>(mode)) ==
+                  folds) << first << " " << end;
+    }
+  }
+}
+
+}  // namespace kamiah
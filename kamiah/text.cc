@@ -0,0 +1,491 @@
+/**
+ * @file text.cc
+ * @brief Implementation of a Text.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "text.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "text_kernels.h"
+
+using std::max;
+using std::min;
+
+namespace kamiah {
+
+namespace {
+
+// Gets the largest power of two that is not larger than n, 0 if n is 0.
+size_t HighestPowerOfTwo(size_t n) {
+  size_t power = 1;
+  while ((n != 0) && (power <= n / 2)) {
+    power *= 2;
+  }
+  return (n == 0) ? 0 : power;
+}
+
+}  // namespace
+
+Text::Counts::Counts() : size(0), newlines(0), code_points(0), utf16_units(0) {
+}
+
+Text::Counts::Counts(const string& data)
+    : size(data.size()), newlines(CountNewlines(data.data(), data.size())),
+      code_points(CountCodePoints(data.data(), data.size())),
+      utf16_units(CountUtf16Units(data.data(), data.size())) {
+}
+
+Text::Counts::Counts(const char *data, size_t size)
+    : size(size), newlines(CountNewlines(data, size)),
+      code_points(CountCodePoints(data, size)),
+      utf16_units(CountUtf16Units(data, size)) {
+}
+
+void Text::Counts::Add(const Counts& other) {
+  size += other.size;
+  newlines += other.newlines;
+  code_points += other.code_points;
+  utf16_units += other.utf16_units;
+}
+
+void Text::Counts::Subtract(const Counts& other) {
+  size -= other.size;
+  newlines -= other.newlines;
+  code_points -= other.code_points;
+  utf16_units -= other.utf16_units;
+}
+
+struct Text::Chunk {
+  Chunk(const char *chunk_data, size_t size)
+      : refs(1), data(chunk_data, size), counts(data) {
+  }
+
+  // Number of Texts that share the chunk.
+  int refs;
+  string data;
+  Counts counts;
+};
+
+Text::Text() : size_(0) {
+}
+
+Text::Text(const char *data, Length size) : size_(0) {
+  Insert(0, data, size);
+}
+
+Text::Text(const Text& other)
+    : chunks_(other.chunks_), size_(other.size_), index_(other.index_) {
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    Ref(chunks_[i]);
+  }
+}
+
+Text& Text::operator=(const Text& other) {
+  for (size_t i = 0; i < other.chunks_.size(); ++i) {
+    Ref(other.chunks_[i]);
+  }
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    Unref(chunks_[i]);
+  }
+  chunks_ = other.chunks_;
+  size_ = other.size_;
+  index_ = other.index_;
+  return *this;
+}
+
+Text::~Text() {
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    Unref(chunks_[i]);
+  }
+}
+
+void Text::Insert(Index index, const char *data, Length size) {
+  if (size <= 0) {
+    return;
+  }
+  size_ += size;
+  if (chunks_.empty()) {
+    chunks_.push_back(new Chunk(data, size));
+    SplitChunk(0);
+    RebuildIndex();
+    return;
+  }
+
+  Index offset;
+  size_t i = FindChunk(index, &offset);
+  Chunk *chunk = MutableChunk(i);
+  Counts counts(data, size);
+  chunk->data.insert(offset, data, size);
+  chunk->counts.Add(counts);
+  if (chunk->data.size() > kMaxChunkSize) {
+    SplitChunk(i);
+    RebuildIndex();
+  } else {
+    UpdateIndex(i, counts, false);
+  }
+}
+
+void Text::Erase(Index index, Length length) {
+  if ((index >= size_) || (length <= 0)) {
+    return;
+  }
+  length = min(length, size_ - index);
+  size_ -= length;
+  size_t num_chunks = chunks_.size();
+
+  // The end of the first chunk
+  Index offset;
+  size_t first = FindChunk(index, &offset);
+  size_t i = first;
+  Length first_size = chunks_[i]->data.size();
+  Counts erased;
+  if ((offset > 0) || (length < first_size)) {
+    Chunk *chunk = MutableChunk(i);
+    erased = Counts(chunk->data.data() + offset,
+                    min(length, first_size - offset));
+    chunk->data.erase(offset, erased.size);
+    chunk->counts.Subtract(erased);
+    length -= erased.size;
+    ++i;
+  }
+  bool only_first = (length == 0);
+
+  // Whole chunks
+  size_t end = i;
+  while ((end < chunks_.size()) &&
+         (length >= static_cast<Length>(chunks_[end]->data.size()))) {
+    length -= chunks_[end]->data.size();
+    Unref(chunks_[end]);
+    ++end;
+  }
+  chunks_.erase(chunks_.begin() + i, chunks_.begin() + end);
+
+  // The start of the last chunk
+  if (length > 0) {
+    Chunk *chunk = MutableChunk(i);
+    chunk->counts.Subtract(Counts(chunk->data.data(), length));
+    chunk->data.erase(0, length);
+  }
+
+  MergeChunk(i);
+  if (first < i) {
+    MergeChunk(first);
+  }
+
+  // Only the sums of the first chunk change unless chunks were removed
+  if (only_first && (chunks_.size() == num_chunks)) {
+    UpdateIndex(first, erased, true);
+  } else {
+    RebuildIndex();
+  }
+}
+
+void Text::CopyTo(char *out) const {
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    out = std::copy(chunks_[i]->data.begin(), chunks_[i]->data.end(), out);
+  }
+}
+
+void Text::AppendTo(string *out) const {
+  out->reserve(out->size() + size_);
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    out->append(chunks_[i]->data);
+  }
+}
+
+void Text::AppendRangeTo(Index index, Length length, string *out) const {
+  if ((index >= size_) || (length <= 0)) {
+    return;
+  }
+  length = min(length, size_ - index);
+  out->reserve(out->size() + length);
+
+  Index offset;
+  for (size_t i = FindChunk(index, &offset); length > 0; ++i) {
+    Length appended = min(length, chunk_size(i) - offset);
+    out->append(chunks_[i]->data, offset, appended);
+    length -= appended;
+    offset = 0;
+  }
+}
+
+char Text::at(Index index) const {
+  Index offset;
+  size_t i = FindChunk(index, &offset);
+  return chunks_[i]->data[offset];
+}
+
+Length Text::size() const {
+  return size_;
+}
+
+Length Text::num_lines() const {
+  return Totals().newlines + 1;
+}
+
+Index Text::LineStart(Index line) const {
+  if (line <= 0) {
+    return 0;
+  }
+
+  // Find the chunk with the newline that ends the previous line
+  Counts before;
+  size_t i = Seek(&Counts::newlines, line - 1, &before);
+  if (i == chunks_.size()) {
+    return size_;
+  }
+
+  const char *data = chunks_[i]->data.data();
+  const char *newline = data;
+  for (Length newlines = line - 1 - before.newlines; ; --newlines) {
+    newline = static_cast<const char*>(
+        memchr(newline, '\n', chunks_[i]->data.size() - (newline - data)));
+    if (newlines == 0) {
+      break;
+    }
+    ++newline;
+  }
+  return before.size + (newline - data) + 1;
+}
+
+Index Text::LineOf(Index index) const {
+  index = max<Index>(0, min(index, size_));
+  Counts before;
+  size_t i = Seek(&Counts::size, index, &before);
+  if (i == chunks_.size()) {
+    return before.newlines;
+  }
+  return before.newlines +
+      CountNewlines(chunks_[i]->data.data(), index - before.size);
+}
+
+Length Text::length(Unit unit) const {
+  if (unit == UNIT_BYTES) {
+    return size_;
+  }
+  return Totals().*UnitCount(unit);
+}
+
+bool Text::ToBytes(Unit unit, Index offset, Index *index) const {
+  if (offset < 0) {
+    return false;
+  }
+  if (unit == UNIT_BYTES) {
+    *index = offset;
+    return offset <= size_;
+  }
+
+  // Find the chunk with the start of the character at the offset
+  Length Counts::*count = UnitCount(unit);
+  Counts before;
+  size_t i = Seek(count, offset, &before);
+  if (i == chunks_.size()) {
+    *index = size_;
+    return offset == before.*count;
+  }
+
+  // Count the characters that start in the chunk until the offset
+  const string& data = chunks_[i]->data;
+  Length units = before.*count;
+  for (size_t j = 0; j < data.size(); ++j) {
+    unsigned char c = data[j];
+    if ((c & 0xC0) == 0x80) {
+      continue;
+    }
+    if (units == offset) {
+      *index = before.size + j;
+      return true;
+    }
+    units += ((unit == UNIT_UTF16) && (c >= 0xF0)) ? 2 : 1;
+    if (units > offset) {
+      return false;
+    }
+  }
+  return false;
+}
+
+Index Text::FromBytes(Unit unit, Index index) const {
+  if (unit == UNIT_BYTES) {
+    return index;
+  }
+  index = max<Index>(0, min(index, size_));
+  Length Counts::*count = UnitCount(unit);
+  Counts before;
+  size_t i = Seek(&Counts::size, index, &before);
+  if (i == chunks_.size()) {
+    return before.*count;
+  }
+  const char *data = chunks_[i]->data.data();
+  Length size = index - before.size;
+  return before.*count + ((unit == UNIT_UTF16) ? CountUtf16Units(data, size)
+                                               : CountCodePoints(data, size));
+}
+
+size_t Text::num_chunks() const {
+  return chunks_.size();
+}
+
+const char* Text::chunk_data(size_t i) const {
+  return chunks_[i]->data.data();
+}
+
+Length Text::chunk_size(size_t i) const {
+  return chunks_[i]->data.size();
+}
+
+size_t Text::FindChunk(Index index, Index *offset) const {
+  Counts before;
+  size_t i = Seek(&Counts::size, index, &before);
+  index -= before.size;
+
+  // The end of the text is at the end of the last chunk
+  if ((i == chunks_.size()) && (i > 0)) {
+    --i;
+    index += chunks_[i]->data.size();
+  }
+  *offset = index;
+  return i;
+}
+
+Length Text::Counts::*Text::UnitCount(Unit unit) {
+  switch (unit) {
+    case UNIT_CODE_POINTS:
+      return &Counts::code_points;
+    case UNIT_UTF16:
+      return &Counts::utf16_units;
+    default:
+      return &Counts::size;
+  }
+}
+
+size_t Text::Seek(Length Counts::*count, Length target,
+                  Counts *before) const {
+  size_t i = 0;
+  *before = Counts();
+  for (size_t step = HighestPowerOfTwo(chunks_.size()); step > 0;
+       step /= 2) {
+    if ((i + step <= chunks_.size()) &&
+        (before->*count + index_[i + step].*count <= target)) {
+      i += step;
+      before->Add(index_[i]);
+    }
+  }
+  return i;
+}
+
+Text::Counts Text::Totals() const {
+  Counts totals;
+  for (size_t i = chunks_.size(); i > 0; i -= i & -i) {
+    totals.Add(index_[i]);
+  }
+  return totals;
+}
+
+void Text::RebuildIndex() {
+  size_t n = chunks_.size();
+  index_.assign(n + 1, Counts());
+  for (size_t i = 1; i <= n; ++i) {
+    index_[i].Add(chunks_[i - 1]->counts);
+    size_t parent = i + (i & -i);
+    if (parent <= n) {
+      index_[parent].Add(index_[i]);
+    }
+  }
+}
+
+void Text::UpdateIndex(size_t i, const Counts& counts, bool subtract) {
+  for (size_t j = i + 1; j < index_.size(); j += j & -j) {
+    if (subtract) {
+      index_[j].Subtract(counts);
+    } else {
+      index_[j].Add(counts);
+    }
+  }
+}
+
+Text::Chunk* Text::MutableChunk(size_t i) {
+  Chunk *chunk = chunks_[i];
+
+  // Only this Text can add references, so a chunk that is not shared now
+  // will not be shared while it is modified.
+  if (__sync_fetch_and_add(&chunk->refs, 0) != 1) {
+    Chunk *copy = new Chunk(chunk->data.data(), chunk->data.size());
+    Unref(chunk);
+    chunks_[i] = copy;
+    chunk = copy;
+  }
+  return chunk;
+}
+
+void Text::SplitChunk(size_t i) {
+  Chunk *chunk = chunks_[i];
+  size_t size = chunk->data.size();
+  if (size <= kMaxChunkSize) {
+    return;
+  }
+
+  // Split into pieces of the same size
+  size_t pieces = (size + kMaxChunkSize - 1) / kMaxChunkSize;
+  vector<Chunk*> split;
+  split.reserve(pieces);
+  size_t start = 0;
+  for (size_t piece = 1; piece <= pieces; ++piece) {
+    size_t end = size * piece / pieces;
+    split.push_back(new Chunk(chunk->data.data() + start, end - start));
+    start = end;
+  }
+  Unref(chunk);
+  chunks_[i] = split[0];
+  chunks_.insert(chunks_.begin() + i + 1, split.begin() + 1, split.end());
+}
+
+void Text::MergeChunk(size_t i) {
+  if (i >= chunks_.size()) {
+    return;
+  }
+  size_t size = chunks_[i]->data.size();
+  if (size == 0) {
+    Unref(chunks_[i]);
+    chunks_.erase(chunks_.begin() + i);
+    return;
+  }
+  if (size >= kMaxChunkSize / 4) {
+    return;
+  }
+
+  // Merge with the smallest neighbor if they fit in one chunk
+  size_t left = i;
+  if ((i > 0) && ((i + 1 == chunks_.size()) ||
+                  (chunks_[i - 1]->data.size() <
+                   chunks_[i + 1]->data.size()))) {
+    left = i - 1;
+  } else if (i + 1 == chunks_.size()) {
+    return;
+  }
+  if (chunks_[left]->data.size() + chunks_[left + 1]->data.size() >
+      kMaxChunkSize) {
+    return;
+  }
+  Chunk *chunk = MutableChunk(left);
+  chunk->data.append(chunks_[left + 1]->data);
+  chunk->counts.Add(chunks_[left + 1]->counts);
+  Unref(chunks_[left + 1]);
+  chunks_.erase(chunks_.begin() + left + 1);
+}
+
+void Text::Ref(Chunk *chunk) {
+  __sync_fetch_and_add(&chunk->refs, 1);
+}
+
+void Text::Unref(Chunk *chunk) {
+  if (__sync_sub_and_fetch(&chunk->refs, 1) == 0) {
+    delete chunk;
+  }
+}
+
+}  // namespace kamiah
@@ -0,0 +1,248 @@
+/**
+ * @file text.h
+ * @brief Definition of a Text, the copy-on-write contents of a Document.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_TEXT_H_
+#define KAMIAH_TEXT_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief A Text is a string split into reference-counted chunks of at most
+ *     kMaxChunkSize characters.
+ *
+ * Copying a Text only copies pointers to its chunks, and a chunk is only
+ * copied when a Text that shares it is edited. This makes it cheap to take a
+ * point-in-time copy of a large Text: edits to the original then copy at
+ * most the chunks they touch.
+ *
+ * Each chunk also counts its lines, code points and UTF-16 code units, and
+ * the Text keeps running sums of the counts of its chunks in a Fenwick tree.
+ * Finding the chunk of a character, the line of a character, the start of a
+ * line or converting between units takes O(log n) plus a scan of a single
+ * chunk, and an edit within one chunk updates the sums in O(log n). Lines
+ * end with '\n'.
+ *
+ * Copies can be used from different threads since shared chunks are never
+ * modified. A single Text is thread-compatible.
+ */
+class Text {
+ public:
+  // Max number of characters in a chunk.
+  static const size_t kMaxChunkSize = 4096;
+
+  Text();
+  Text(const char *data, Length size);
+  Text(const Text& other);
+  Text& operator=(const Text& other);
+  ~Text();
+
+  /**
+   * @brief Inserts characters into the text.
+   *
+   * @param index Where to insert the characters, between 0 and size().
+   * @param data The characters to insert.
+   * @param size The number of characters to insert.
+   */
+  void Insert(Index index, const char *data, Length size);
+
+  /**
+   * @brief Erases characters from the text. Like string::erase(), erasing
+   *     past the end erases up to the end.
+   *
+   * @param index The first character to erase, between 0 and size().
+   * @param length The number of characters to erase.
+   */
+  void Erase(Index index, Length length);
+
+  /**
+   * @brief Copies the text into a caller-owned buffer.
+   *
+   * @param out Buffer of at least size() bytes.
+   */
+  void CopyTo(char *out) const;
+
+  /**
+   * @brief Appends the text to a string.
+   *
+   * @param out String to append the text to.
+   */
+  void AppendTo(string *out) const;
+
+  /**
+   * @brief Appends part of the text to a string. Like string::substr(),
+   *     ranges past the end stop at the end.
+   *
+   * @param index The first character to append, between 0 and size().
+   * @param length The number of characters to append.
+   * @param out String to append the characters to.
+   */
+  void AppendRangeTo(Index index, Length length, string *out) const;
+
+  /**
+   * @brief Gets a character of the text.
+   *
+   * @param index The index of the character, less than size().
+   * @return The character.
+   */
+  char at(Index index) const;
+
+  /**
+   * @brief Gets the number of characters in the text.
+   *
+   * @return The number of characters in the text.
+   */
+  Length size() const;
+
+  /**
+   * @brief Gets the number of lines in the text, one more than the number of
+   *     '\n' in it. An empty text has one empty line.
+   *
+   * @return The number of lines.
+   */
+  Length num_lines() const;
+
+  /**
+   * @brief Gets where a line starts.
+   *
+   * @param line The line, between 0 and num_lines() - 1.
+   * @return The index of the first character of the line.
+   */
+  Index LineStart(Index line) const;
+
+  /**
+   * @brief Gets the line a character is in. A '\n' is in the line it ends.
+   *
+   * @param index The character, between 0 and size().
+   * @return The line of the character.
+   */
+  Index LineOf(Index index) const;
+
+  /**
+   * @brief Gets the length of the text in some unit.
+   *
+   * @param unit The unit to count.
+   * @return The number of units in the text.
+   */
+  Length length(Unit unit) const;
+
+  /**
+   * @brief Converts an offset in some unit to a byte index.
+   *
+   * @param unit The unit of the offset.
+   * @param offset The offset, between 0 and length(unit).
+   * @param index Where to write the index of the character at the offset.
+   * @return True iff the offset is in the text and not in the middle of a
+   *     UTF-16 surrogate pair.
+   */
+  bool ToBytes(Unit unit, Index offset, Index *index) const;
+
+  /**
+   * @brief Converts a byte index to an offset in some unit.
+   *
+   * @param unit The unit of the offset.
+   * @param index The index, between 0 and size(). An index in the middle of a
+   *     character converts to the offset after it.
+   * @return The offset of the index.
+   */
+  Index FromBytes(Unit unit, Index index) const;
+
+  /**
+   * @brief Gets the number of chunks the text is split into. Together, the
+   *     chunks in order make up the text.
+   *
+   * @return The number of chunks.
+   */
+  size_t num_chunks() const;
+
+  /**
+   * @brief Gets the characters of a chunk. They are valid until the text is
+   *     next modified.
+   *
+   * @param i The index of the chunk, less than num_chunks().
+   * @return The first character of the chunk.
+   */
+  const char* chunk_data(size_t i) const;
+
+  /**
+   * @brief Gets the number of characters in a chunk.
+   *
+   * @param i The index of the chunk, less than num_chunks().
+   * @return The number of characters in the chunk.
+   */
+  Length chunk_size(size_t i) const;
+
+ private:
+  struct Chunk;
+
+  // Counts of a chunk or of a run of chunks.
+  struct Counts {
+    Counts();
+    explicit Counts(const string& data);
+    Counts(const char *data, size_t size);
+
+    void Add(const Counts& other);
+    void Subtract(const Counts& other);
+
+    Length size;
+    Length newlines;
+    Length code_points;
+    Length utf16_units;
+  };
+
+  // Gets the count of a unit.
+  static Length Counts::*UnitCount(Unit unit);
+
+  // Finds the last chunk such that the chunks before it have at most target
+  // of a count. Writes the counts of the chunks before it to before. Returns
+  // num_chunks() if all the chunks together have at most target.
+  size_t Seek(Length Counts::*count, Length target, Counts *before) const;
+
+  // Gets the counts of the whole text.
+  Counts Totals() const;
+
+  // Finds the chunk that holds a character and the offset of the character
+  // in it. An index of size() is found at the end of the last chunk.
+  size_t FindChunk(Index index, Index *offset) const;
+
+  // Makes the chunk at i safe to modify, copying it if it is shared.
+  Chunk* MutableChunk(size_t i);
+
+  // Splits the chunk at i into chunks of at most kMaxChunkSize.
+  void SplitChunk(size_t i);
+
+  // Merges the chunk at i into a neighbor if it became too small.
+  void MergeChunk(size_t i);
+
+  // Recomputes the sums of the chunks after chunks were added or removed.
+  void RebuildIndex();
+
+  // Adds to the counts of the chunk at i.
+  void UpdateIndex(size_t i, const Counts& counts, bool subtract);
+
+  static void Ref(Chunk *chunk);
+  static void Unref(Chunk *chunk);
+
+  vector<Chunk*> chunks_;
+  Length size_;
+
+  // Fenwick tree, indexed from 1, of the counts of the chunks.
+  vector<Counts> index_;
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_TEXT_H_
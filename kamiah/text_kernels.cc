@@ -0,0 +1,432 @@
+/**
+ * @file text_kernels.cc
+ * @brief Implementation of the text kernels.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "text_kernels.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Intrinsics can only be used in functions with a target attribute, without
+// enabling the instruction set for the whole file, since GCC 4.9
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (__GNUC__ > 4) || \
+     ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define KAMIAH_X86_KERNELS
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace kamiah {
+
+namespace {
+
+// Gets the length of the UTF-8 sequence at the start of data, 0 if it is not
+// valid. data must not be empty.
+size_t SequenceLength(const unsigned char *data, size_t size) {
+  unsigned char c = data[0];
+  if (c < 0x80) {
+    return 1;
+  }
+
+  // The range of the second byte excludes overlong encodings, surrogates and
+  // code points past U+10FFFF
+  size_t length;
+  unsigned char min = 0x80;
+  unsigned char max = 0xBF;
+  if ((c >= 0xC2) && (c <= 0xDF)) {
+    length = 2;
+  } else if ((c >= 0xE0) && (c <= 0xEF)) {
+    length = 3;
+    if (c == 0xE0) {
+      min = 0xA0;
+    } else if (c == 0xED) {
+      max = 0x9F;
+    }
+  } else if ((c >= 0xF0) && (c <= 0xF4)) {
+    length = 4;
+    if (c == 0xF0) {
+      min = 0x90;
+    } else if (c == 0xF4) {
+      max = 0x8F;
+    }
+  } else {
+    return 0;
+  }
+  if ((size < length) || (data[1] < min) || (data[1] > max)) {
+    return 0;
+  }
+  for (size_t i = 2; i < length; ++i) {
+    if ((data[i] & 0xC0) != 0x80) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+// Validates the non-ASCII sequences starting at i, stopping at the next
+// ASCII character. Returns false if one is not valid.
+bool ValidateNonAscii(const unsigned char *data, size_t size, size_t *i) {
+  while ((*i < size) && (data[*i] >= 0x80)) {
+    size_t length = SequenceLength(data + *i, size - *i);
+    if (length == 0) {
+      return false;
+    }
+    *i += length;
+  }
+  return true;
+}
+
+Length CountNewlinesScalar(const char *data, size_t size) {
+  Length newlines = 0;
+  const char *limit = data + size;
+  while ((data = static_cast<const char*>(memchr(data, '\n',
+                                                 limit - data))) != NULL) {
+    ++newlines;
+    ++data;
+  }
+  return newlines;
+}
+
+bool IsValidUtf8Scalar(const char *data, size_t size) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+  while (i < size) {
+    if (bytes[i] < 0x80) {
+      ++i;
+    } else if (!ValidateNonAscii(bytes, size, &i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Length CountCodePointsScalar(const char *data, size_t size) {
+  Length code_points = 0;
+  for (size_t i = 0; i < size; ++i) {
+    code_points += (data[i] & 0xC0) != 0x80;
+  }
+  return code_points;
+}
+
+// Code points past U+FFFF are a surrogate pair in UTF-16 and start with a
+// byte of 0xF0 or more in UTF-8.
+Length CountUtf16UnitsScalar(const char *data, size_t size) {
+  Length units = 0;
+  for (size_t i = 0; i < size; ++i) {
+    unsigned char c = data[i];
+    units += ((c & 0xC0) != 0x80) + (c >= 0xF0);
+  }
+  return units;
+}
+
+const char* FindScalar(const char *data, size_t size, const char *pattern,
+                       size_t pattern_size) {
+  if (pattern_size == 0) {
+    return data;
+  }
+  if (pattern_size > size) {
+    return NULL;
+  }
+  const char *limit = data + size - pattern_size + 1;
+  while ((data = static_cast<const char*>(memchr(data, pattern[0],
+                                                 limit - data))) != NULL) {
+    if (memcmp(data + 1, pattern + 1, pattern_size - 1) == 0) {
+      return data;
+    }
+    ++data;
+  }
+  return NULL;
+}
+
+const TextKernels kScalarKernels = {
+  "scalar",
+  &CountNewlinesScalar,
+  &IsValidUtf8Scalar,
+  &CountCodePointsScalar,
+  &CountUtf16UnitsScalar,
+  &FindScalar,
+};
+
+#ifdef KAMIAH_X86_KERNELS
+
+// The SIMD kernels compare a block of bytes at a time and count the matches
+// in the resulting mask. UTF-8 validation skips blocks of ASCII and checks
+// the sequences in between one at a time. Finding a string compares the
+// first and last bytes of the string at every position of a block and only
+// compares the rest at the positions where both match.
+
+__attribute__((target("sse4.2,popcnt")))
+Length CountNewlinesSse42(const char *data, size_t size) {
+  const __m128i newline = _mm_set1_epi8('\n');
+  Length newlines = 0;
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    newlines += __builtin_popcount(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+  }
+  return newlines + CountNewlinesScalar(data + i, size - i);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+bool IsValidUtf8Sse42(const char *data, size_t size) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+  while (i + 16 <= size) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    int non_ascii = _mm_movemask_epi8(block);
+    if (non_ascii == 0) {
+      i += 16;
+      continue;
+    }
+    i += __builtin_ctz(non_ascii);
+    if (!ValidateNonAscii(bytes, size, &i)) {
+      return false;
+    }
+  }
+  return IsValidUtf8Scalar(data + i, size - i);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+Length CountCodePointsSse42(const char *data, size_t size) {
+  // Continuation bytes are 0x80 to 0xBF, -128 to -65 as signed bytes
+  const __m128i last_continuation = _mm_set1_epi8(-65);
+  Length code_points = 0;
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    code_points += __builtin_popcount(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(block, last_continuation)));
+  }
+  return code_points + CountCodePointsScalar(data + i, size - i);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+Length CountUtf16UnitsSse42(const char *data, size_t size) {
+  // Bytes of 0xF0 or more are negative and more than -17 as signed bytes
+  const __m128i last_continuation = _mm_set1_epi8(-65);
+  const __m128i before_four_byte_lead = _mm_set1_epi8(-17);
+  Length units = 0;
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    units += __builtin_popcount(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(block, last_continuation)));
+    units += __builtin_popcount(
+        _mm_movemask_epi8(_mm_cmpgt_epi8(block, before_four_byte_lead)) &
+        _mm_movemask_epi8(block));
+  }
+  return units + CountUtf16UnitsScalar(data + i, size - i);
+}
+
+__attribute__((target("sse4.2,popcnt")))
+const char* FindSse42(const char *data, size_t size, const char *pattern,
+                      size_t pattern_size) {
+  if ((pattern_size == 0) || (pattern_size > size)) {
+    return FindScalar(data, size, pattern, pattern_size);
+  }
+  const __m128i first = _mm_set1_epi8(pattern[0]);
+  const __m128i last = _mm_set1_epi8(pattern[pattern_size - 1]);
+  size_t i = 0;
+  for (; i + pattern_size + 15 <= size; i += 16) {
+    __m128i block_first =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    __m128i block_last = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(data + i + pattern_size - 1));
+    int candidates = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+    while (candidates != 0) {
+      const char *candidate = data + i + __builtin_ctz(candidates);
+      if (memcmp(candidate + 1, pattern + 1, pattern_size - 1) == 0) {
+        return candidate;
+      }
+      candidates &= candidates - 1;
+    }
+  }
+  return FindScalar(data + i, size - i, pattern, pattern_size);
+}
+
+__attribute__((target("avx2,popcnt")))
+Length CountNewlinesAvx2(const char *data, size_t size) {
+  const __m256i newline = _mm256_set1_epi8('\n');
+  Length newlines = 0;
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    newlines += __builtin_popcount(static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline))));
+  }
+  return newlines + CountNewlinesSse42(data + i, size - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+bool IsValidUtf8Avx2(const char *data, size_t size) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+  while (i + 32 <= size) {
+    __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    unsigned non_ascii = static_cast<unsigned>(_mm256_movemask_epi8(block));
+    if (non_ascii == 0) {
+      i += 32;
+      continue;
+    }
+    i += __builtin_ctz(non_ascii);
+    if (!ValidateNonAscii(bytes, size, &i)) {
+      return false;
+    }
+  }
+  return IsValidUtf8Sse42(data + i, size - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+Length CountCodePointsAvx2(const char *data, size_t size) {
+  const __m256i last_continuation = _mm256_set1_epi8(-65);
+  Length code_points = 0;
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    code_points += __builtin_popcount(static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpgt_epi8(block, last_continuation))));
+  }
+  return code_points + CountCodePointsSse42(data + i, size - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+Length CountUtf16UnitsAvx2(const char *data, size_t size) {
+  const __m256i last_continuation = _mm256_set1_epi8(-65);
+  const __m256i before_four_byte_lead = _mm256_set1_epi8(-17);
+  Length units = 0;
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    units += __builtin_popcount(static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpgt_epi8(block, last_continuation))));
+    units += __builtin_popcount(static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpgt_epi8(block, before_four_byte_lead)) &
+        _mm256_movemask_epi8(block)));
+  }
+  return units + CountUtf16UnitsSse42(data + i, size - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+const char* FindAvx2(const char *data, size_t size, const char *pattern,
+                     size_t pattern_size) {
+  if ((pattern_size == 0) || (pattern_size > size)) {
+    return FindScalar(data, size, pattern, pattern_size);
+  }
+  const __m256i first = _mm256_set1_epi8(pattern[0]);
+  const __m256i last = _mm256_set1_epi8(pattern[pattern_size - 1]);
+  size_t i = 0;
+  for (; i + pattern_size + 31 <= size; i += 32) {
+    __m256i block_first =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i block_last = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(data + i + pattern_size - 1));
+    unsigned candidates = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                         _mm256_cmpeq_epi8(block_last, last))));
+    while (candidates != 0) {
+      const char *candidate = data + i + __builtin_ctz(candidates);
+      if (memcmp(candidate + 1, pattern + 1, pattern_size - 1) == 0) {
+        return candidate;
+      }
+      candidates &= candidates - 1;
+    }
+  }
+  return FindSse42(data + i, size - i, pattern, pattern_size);
+}
+
+const TextKernels kSse42Kernels = {
+  "sse4.2",
+  &CountNewlinesSse42,
+  &IsValidUtf8Sse42,
+  &CountCodePointsSse42,
+  &CountUtf16UnitsSse42,
+  &FindSse42,
+};
+
+const TextKernels kAvx2Kernels = {
+  "avx2",
+  &CountNewlinesAvx2,
+  &IsValidUtf8Avx2,
+  &CountCodePointsAvx2,
+  &CountUtf16UnitsAvx2,
+  &FindAvx2,
+};
+
+// Bits of the features used by the kernels in the registers returned by
+// cpuid.
+const unsigned kCpuidSse42 = 1 << 20;  // Leaf 1, ecx
+const unsigned kCpuidPopcnt = 1 << 23;  // Leaf 1, ecx
+const unsigned kCpuidOsxsave = 1 << 27;  // Leaf 1, ecx
+const unsigned kCpuidAvx = 1 << 28;  // Leaf 1, ecx
+const unsigned kCpuidAvx2 = 1 << 5;  // Leaf 7, ebx
+
+// Bits of XCR0 set when the OS saves the XMM and YMM registers.
+const uint64_t kXcr0SseAvx = 0x6;
+
+// Reads XCR0, the register state saved by the OS. The instruction is
+// spelled out for assemblers that do not know xgetbv.
+uint64_t GetXcr0() {
+  uint32_t eax;
+  uint32_t edx;
+  __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0"
+                       : "=a"(eax), "=d"(edx) : "c"(0));
+  return (static_cast<uint64_t>(edx) << 32) | eax;
+}
+
+#endif  // KAMIAH_X86_KERNELS
+
+const TextKernels* SelectTextKernels() {
+  vector<const TextKernels*> kernels;
+  GetSupportedTextKernels(&kernels);
+  return kernels.back();
+}
+
+}  // namespace
+
+void GetSupportedTextKernels(vector<const TextKernels*> *kernels) {
+  kernels->clear();
+  kernels->push_back(&kScalarKernels);
+#ifdef KAMIAH_X86_KERNELS
+  unsigned eax;
+  unsigned ebx;
+  unsigned ecx;
+  unsigned edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+      ((ecx & kCpuidSse42) == 0) || ((ecx & kCpuidPopcnt) == 0)) {
+    return;
+  }
+  kernels->push_back(&kSse42Kernels);
+
+  // The CPU can have AVX2 and the OS still not save the YMM registers
+  if (((ecx & kCpuidOsxsave) == 0) || ((ecx & kCpuidAvx) == 0) ||
+      ((GetXcr0() & kXcr0SseAvx) != kXcr0SseAvx) ||
+      (__get_cpuid_max(0, NULL) < 7)) {
+    return;
+  }
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  if ((ebx & kCpuidAvx2) != 0) {
+    kernels->push_back(&kAvx2Kernels);
+  }
+#endif
+}
+
+const TextKernels& GetTextKernels() {
+  static const TextKernels *kernels = SelectTextKernels();
+  return *kernels;
+}
+
+}  // namespace kamiah
@@ -0,0 +1,131 @@
+/**
+ * @file text_kernels.h
+ * @brief Kernels that scan text: counting newlines, code points and UTF-16
+ *     code units, validating UTF-8 and finding strings.
+ *
+ * Each kernel has a portable implementation and, on x86-64, SSE4.2 and AVX2
+ * implementations that scan 16 or 32 bytes at a time. The fastest one the
+ * CPU and the OS support is picked the first time a kernel is used. The
+ * SIMD implementations need GCC 4.9 or later (or Clang) to be built, older
+ * compilers only get the portable one.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_TEXT_KERNELS_H_
+#define KAMIAH_TEXT_KERNELS_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "types.h"
+
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief A set of implementations of the text kernels for one instruction
+ *     set.
+ */
+struct TextKernels {
+  // Name of the instruction set.
+  const char *name;
+
+  // Counts the '\n' in data.
+  Length (*count_newlines)(const char *data, size_t size);
+
+  // Whether data is valid UTF-8: no overlong encodings, surrogates, code
+  // points past U+10FFFF or truncated sequences.
+  bool (*is_valid_utf8)(const char *data, size_t size);
+
+  // Counts the code points in data, which must be valid UTF-8.
+  Length (*count_code_points)(const char *data, size_t size);
+
+  // Counts the UTF-16 code units of the code points in data, which must be
+  // valid UTF-8. Code points past U+FFFF take two units.
+  Length (*count_utf16_units)(const char *data, size_t size);
+
+  // Finds the first occurrence of pattern in data, NULL if there is none.
+  const char* (*find)(const char *data, size_t size, const char *pattern,
+                      size_t pattern_size);
+};
+
+/**
+ * @brief Gets the kernels of every instruction set the CPU supports, the
+ *     portable ones first and the fastest ones last. Meant for tests and
+ *     benchmarks.
+ *
+ * @param kernels Where to write the supported kernels.
+ */
+void GetSupportedTextKernels(vector<const TextKernels*> *kernels);
+
+/**
+ * @brief Gets the fastest kernels the CPU supports.
+ *
+ * @return The kernels used by the functions below.
+ */
+const TextKernels& GetTextKernels();
+
+/**
+ * @brief Counts the newlines in some text.
+ *
+ * @param data The text.
+ * @param size The number of bytes in data.
+ * @return The number of '\n' in data.
+ */
+inline Length CountNewlines(const char *data, size_t size) {
+  return GetTextKernels().count_newlines(data, size);
+}
+
+/**
+ * @brief Checks whether some text is valid UTF-8.
+ *
+ * @param data The text.
+ * @param size The number of bytes in data.
+ * @return True iff data is valid UTF-8.
+ */
+inline bool IsValidUtf8(const char *data, size_t size) {
+  return GetTextKernels().is_valid_utf8(data, size);
+}
+
+/**
+ * @brief Counts the code points in some UTF-8 text.
+ *
+ * @param data The text, valid UTF-8.
+ * @param size The number of bytes in data.
+ * @return The number of code points in data.
+ */
+inline Length CountCodePoints(const char *data, size_t size) {
+  return GetTextKernels().count_code_points(data, size);
+}
+
+/**
+ * @brief Counts the UTF-16 code units needed for some UTF-8 text.
+ *
+ * @param data The text, valid UTF-8.
+ * @param size The number of bytes in data.
+ * @return The number of UTF-16 code units of the code points in data.
+ */
+inline Length CountUtf16Units(const char *data, size_t size) {
+  return GetTextKernels().count_utf16_units(data, size);
+}
+
+/**
+ * @brief Finds the first occurrence of a string in some text.
+ *
+ * @param data The text.
+ * @param size The number of bytes in data.
+ * @param pattern The string to find.
+ * @param pattern_size The number of bytes in pattern.
+ * @return The first occurrence of pattern in data, NULL if there is none.
+ */
+inline const char* FindString(const char *data, size_t size,
+                              const char *pattern, size_t pattern_size) {
+  return GetTextKernels().find(data, size, pattern, pattern_size);
+}
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_TEXT_KERNELS_H_
@@ -0,0 +1,228 @@
+/**
+ * @file text_kernels_test.cc
+ * @brief Unit tests for the text kernels.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "text_kernels.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+// Appends a code point to a string as UTF-8, without checking it.
+void AppendUtf8(uint32_t code_point, string *out) {
+  if (code_point < 0x80) {
+    out->push_back(code_point);
+  } else if (code_point < 0x800) {
+    out->push_back(0xC0 | (code_point >> 6));
+    out->push_back(0x80 | (code_point & 0x3F));
+  } else if (code_point < 0x10000) {
+    out->push_back(0xE0 | (code_point >> 12));
+    out->push_back(0x80 | ((code_point >> 6) & 0x3F));
+    out->push_back(0x80 | (code_point & 0x3F));
+  } else {
+    out->push_back(0xF0 | (code_point >> 18));
+    out->push_back(0x80 | ((code_point >> 12) & 0x3F));
+    out->push_back(0x80 | ((code_point >> 6) & 0x3F));
+    out->push_back(0x80 | (code_point & 0x3F));
+  }
+}
+
+// Makes random valid UTF-8 text, mostly ASCII with some newlines.
+string RandomText(size_t num_code_points) {
+  string text;
+  for (size_t i = 0; i < num_code_points; ++i) {
+    uint32_t code_point;
+    switch (rand() % 8) {
+      case 0:
+        code_point = '\n';
+        break;
+      case 1:
+        code_point = 0x80 + rand() % (0x800 - 0x80);
+        break;
+      case 2:
+        // Not a surrogate
+        code_point = 0x800 + rand() % (0xD800 - 0x800);
+        break;
+      case 3:
+        code_point = 0x10000 + rand() % (0x110000 - 0x10000);
+        break;
+      default:
+        code_point = ' ' + rand() % 95;
+        break;
+    }
+    AppendUtf8(code_point, &text);
+  }
+  return text;
+}
+
+}  // namespace
+
+class TextKernelsTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    GetSupportedTextKernels(&kernels_);
+  }
+
+  vector<const TextKernels*> kernels_;
+};
+
+TEST_F(TextKernelsTest, FastestIsUsed) {
+  ASSERT_FALSE(kernels_.empty());
+  EXPECT_STREQ("scalar", kernels_[0]->name);
+  EXPECT_EQ(kernels_.back(), &GetTextKernels());
+}
+
+TEST_F(TextKernelsTest, CountNewlines) {
+  string text = "papaya\nkamiah\n\nkapoho\n";
+  for (size_t i = 0; i < kernels_.size(); ++i) {
+    SCOPED_TRACE(kernels_[i]->name);
+    EXPECT_EQ(0, kernels_[i]->count_newlines("", 0));
+    EXPECT_EQ(4, kernels_[i]->count_newlines(text.data(), text.size()));
+    string lines(1000, '\n');
+    EXPECT_EQ(1000, kernels_[i]->count_newlines(lines.data(), lines.size()));
+    EXPECT_EQ(997, kernels_[i]->count_newlines(lines.data() + 1, 997));
+  }
+}
+
+TEST_F(TextKernelsTest, ValidUtf8) {
+  const char *valid[] = {
+    "",
+    "papaya",
+    "\x7F",
+    "\xC2\x80",
+    "\xDF\xBF",
+    "\xE0\xA0\x80",
+    "\xED\x9F\xBF",
+    "\xEE\x80\x80",
+    "\xEF\xBF\xBF",
+    "\xF0\x90\x80\x80",
+    "\xF4\x8F\xBF\xBF",
+  };
+  const char *invalid[] = {
+    "\x80",
+    "\xBF",
+    "\xC0\x80",
+    "\xC1\xBF",
+    "\xC2",
+    "\xC2\x7F",
+    "\xE0\x9F\xBF",
+    "\xED\xA0\x80",
+    "\xED\xBF\xBF",
+    "\xEF\xBF",
+    "\xF0\x8F\xBF\xBF",
+    "\xF4\x90\x80\x80",
+    "\xF5\x80\x80\x80",
+    "\xFF",
+  };
+  for (size_t i = 0; i < kernels_.size(); ++i) {
+    SCOPED_TRACE(kernels_[i]->name);
+    for (size_t j = 0; j < sizeof(valid) / sizeof(valid[0]); ++j) {
+      // Also at the end of blocks of ASCII
+      string text = string(j * 7, 'a') + valid[j];
+      EXPECT_TRUE(kernels_[i]->is_valid_utf8(valid[j], strlen(valid[j])))
+          << j;
+      EXPECT_TRUE(kernels_[i]->is_valid_utf8(text.data(), text.size()))
+          << j;
+    }
+    for (size_t j = 0; j < sizeof(invalid) / sizeof(invalid[0]); ++j) {
+      string text = string(j * 7, 'a') + invalid[j];
+      EXPECT_FALSE(kernels_[i]->is_valid_utf8(invalid[j], strlen(invalid[j])))
+          << j;
+      EXPECT_FALSE(kernels_[i]->is_valid_utf8(text.data(), text.size()))
+          << j;
+    }
+  }
+}
+
+TEST_F(TextKernelsTest, CountCodePoints) {
+  for (size_t i = 0; i < kernels_.size(); ++i) {
+    SCOPED_TRACE(kernels_[i]->name);
+    EXPECT_EQ(0, kernels_[i]->count_code_points("", 0));
+    EXPECT_EQ(6, kernels_[i]->count_code_points("papaya", 6));
+    EXPECT_EQ(3, kernels_[i]->count_code_points("p\xC3\xA1\xF0\x9F\x8D\x88",
+                                                7));
+  }
+}
+
+TEST_F(TextKernelsTest, CountUtf16Units) {
+  for (size_t i = 0; i < kernels_.size(); ++i) {
+    SCOPED_TRACE(kernels_[i]->name);
+    EXPECT_EQ(0, kernels_[i]->count_utf16_units("", 0));
+    EXPECT_EQ(6, kernels_[i]->count_utf16_units("papaya", 6));
+    EXPECT_EQ(4, kernels_[i]->count_utf16_units("p\xC3\xA1\xF0\x9F\x8D\x88",
+                                                7));
+    EXPECT_EQ(2, kernels_[i]->count_utf16_units("\xEF\xBF\xBF\xC2\x80", 5));
+  }
+}
+
+TEST_F(TextKernelsTest, Find) {
+  string text = string(100, 'a') + "papaya" + string(100, 'a') + "papayas";
+  for (size_t i = 0; i < kernels_.size(); ++i) {
+    SCOPED_TRACE(kernels_[i]->name);
+    EXPECT_EQ(text.data() + 100,
+              kernels_[i]->find(text.data(), text.size(), "papaya", 6));
+    EXPECT_EQ(text.data() + 206,
+              kernels_[i]->find(text.data(), text.size(), "papayas", 7));
+    EXPECT_EQ(text.data() + 206,
+              kernels_[i]->find(text.data() + 101, text.size() - 101,
+                                "papaya", 6));
+    EXPECT_EQ(NULL, kernels_[i]->find(text.data(), 105, "papaya", 6));
+    EXPECT_EQ(NULL, kernels_[i]->find(text.data(), text.size(), "kamiah", 6));
+    EXPECT_EQ(text.data(), kernels_[i]->find(text.data(), text.size(), "", 0));
+    EXPECT_EQ(NULL, kernels_[i]->find("", 0, "p", 1));
+  }
+}
+
+TEST_F(TextKernelsTest, RandomText) {
+  srand(42);
+  for (int round = 0; round < 200; ++round) {
+    size_t num_code_points = rand() % 300;
+    string text = RandomText(num_code_points);
+    Length newlines = 0;
+    Length utf16_units = 0;
+    for (size_t j = 0; j < text.size(); ++j) {
+      newlines += text[j] == '\n';
+      unsigned char c = text[j];
+      utf16_units += ((c & 0xC0) != 0x80) + (c >= 0xF0);
+    }
+
+    // A random byte usually breaks the text
+    string broken = text;
+    if (!broken.empty()) {
+      broken[rand() % broken.size()] = 0x80 + rand() % 0x80;
+    }
+    for (size_t i = 0; i < kernels_.size(); ++i) {
+      SCOPED_TRACE(kernels_[i]->name);
+      EXPECT_TRUE(kernels_[i]->is_valid_utf8(text.data(), text.size()));
+      EXPECT_EQ(static_cast<Length>(num_code_points),
+                kernels_[i]->count_code_points(text.data(), text.size()));
+      EXPECT_EQ(newlines,
+                kernels_[i]->count_newlines(text.data(), text.size()));
+      EXPECT_EQ(utf16_units,
+                kernels_[i]->count_utf16_units(text.data(), text.size()));
+      string pattern = text.substr(rand() % (text.size() + 1), rand() % 40);
+      EXPECT_EQ(text.data() + text.find(pattern),
+                kernels_[i]->find(text.data(), text.size(), pattern.data(),
+                                  pattern.size()));
+      EXPECT_EQ(kernels_[0]->is_valid_utf8(broken.data(), broken.size()),
+                kernels_[i]->is_valid_utf8(broken.data(), broken.size()));
+    }
+  }
+}
+
+}  // namespace kamiah
@@ -0,0 +1,348 @@
+/**
+ * @file text_test.cc
+ * @brief Unit tests for a Text.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "text.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::min;
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+string ToString(const Text& text) {
+  string out;
+  text.AppendTo(&out);
+  return out;
+}
+
+// Checks that the chunks of a text are well-formed and make up expected.
+void ExpectText(const string& expected, const Text& text) {
+  ASSERT_EQ(static_cast<Length>(expected.size()), text.size());
+  EXPECT_EQ(expected, ToString(text));
+
+  Length total = 0;
+  for (size_t i = 0; i < text.num_chunks(); ++i) {
+    EXPECT_LT(0, text.chunk_size(i));
+    EXPECT_GE(static_cast<Length>(Text::kMaxChunkSize), text.chunk_size(i));
+    total += text.chunk_size(i);
+  }
+  EXPECT_EQ(text.size(), total);
+
+  string copied(expected.size(), '\0');
+  if (!copied.empty()) {
+    text.CopyTo(&copied[0]);
+  }
+  EXPECT_EQ(expected, copied);
+}
+
+// Checks the line index of a text against a scan of expected.
+void ExpectLines(const string& expected, const Text& text) {
+  vector<Index> starts(1, 0);
+  for (size_t i = 0; i < expected.size(); ++i) {
+    if (expected[i] == '\n') {
+      starts.push_back(i + 1);
+    }
+  }
+  ASSERT_EQ(static_cast<Length>(starts.size()), text.num_lines());
+  for (size_t line = 0; line < starts.size(); ++line) {
+    EXPECT_EQ(starts[line], text.LineStart(line));
+    EXPECT_EQ(static_cast<Index>(line), text.LineOf(starts[line]));
+  }
+
+  // Some of the characters in between
+  size_t line = 0;
+  for (size_t i = 0; i <= expected.size(); i += 1 + i % 7) {
+    while ((line + 1 < starts.size()) &&
+           (starts[line + 1] <= static_cast<Index>(i))) {
+      ++line;
+    }
+    EXPECT_EQ(static_cast<Index>(line), text.LineOf(i));
+  }
+}
+
+}  // namespace
+
+TEST(TextTest, Empty) {
+  Text text;
+  ExpectText("", text);
+  EXPECT_EQ(0U, text.num_chunks());
+
+  // Nothing to erase
+  text.Erase(0, 10);
+  ExpectText("", text);
+}
+
+TEST(TextTest, InsertAndErase) {
+  Text text("papaya", 6);
+  text.Insert(0, "bef_", 4);
+  text.Insert(10, "_aft", 4);
+  ExpectText("bef_papaya_aft", text);
+
+  text.Erase(0, 4);
+  ExpectText("papaya_aft", text);
+
+  // Erasing past the end erases up to the end
+  text.Erase(6, 100);
+  ExpectText("papaya", text);
+  text.Erase(0, 6);
+  ExpectText("", text);
+  EXPECT_EQ(0U, text.num_chunks());
+}
+
+TEST(TextTest, LargeTextIsChunked) {
+  string data(10 * Text::kMaxChunkSize + 7, 'x');
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = 'a' + (i % 26);
+  }
+  Text text(data.data(), data.size());
+  ExpectText(data, text);
+  EXPECT_EQ(11U, text.num_chunks());
+
+  // Erasing across chunks
+  Index start = Text::kMaxChunkSize / 2;
+  Length length = 5 * Text::kMaxChunkSize;
+  text.Erase(start, length);
+  data.erase(start, length);
+  ExpectText(data, text);
+}
+
+TEST(TextTest, CopiesShareChunks) {
+  string data(4 * Text::kMaxChunkSize, 'x');
+  Text text(data.data(), data.size());
+  Text copy(text);
+  ASSERT_EQ(text.num_chunks(), copy.num_chunks());
+  for (size_t i = 0; i < text.num_chunks(); ++i) {
+    EXPECT_EQ(text.chunk_data(i), copy.chunk_data(i));
+  }
+
+  // Only the edited chunk is copied
+  text.Insert(1, "papaya", 6);
+  ExpectText(data, copy);
+  string edited = data;
+  edited.insert(1, "papaya");
+  ExpectText(edited, text);
+  // The edited chunk was full, so it was split in two
+  ASSERT_EQ(copy.num_chunks() + 1, text.num_chunks());
+  EXPECT_NE(text.chunk_data(0), copy.chunk_data(0));
+  for (size_t i = 1; i < copy.num_chunks(); ++i) {
+    EXPECT_EQ(text.chunk_data(i + 1), copy.chunk_data(i));
+  }
+
+  // Edits to the copy do not affect the original either
+  copy.Erase(0, data.size());
+  ExpectText("", copy);
+  ExpectText(edited, text);
+
+  copy = text;
+  ExpectText(edited, copy);
+  copy = copy;
+  ExpectText(edited, copy);
+}
+
+TEST(TextTest, RandomEdits) {
+  srand(37);
+  Text text;
+  string expected;
+  Text snapshot;
+  string snapshot_expected;
+  for (int i = 0; i < 5000; ++i) {
+    Index index = expected.empty() ? 0 : rand() % (expected.size() + 1);
+    if ((rand() % 3 != 0) || expected.empty()) {
+      // Mostly small inserts, sometimes larger than a chunk
+      Length size = (rand() % 50 == 0) ? rand() % (2 * Text::kMaxChunkSize)
+                                       : rand() % 20;
+      string inserted(size, 'a' + (i % 26));
+      text.Insert(index, inserted.data(), size);
+      expected.insert(index, inserted);
+    } else {
+      Length length = (rand() % 50 == 0) ? rand() % (2 * Text::kMaxChunkSize)
+                                         : rand() % 20;
+      text.Erase(index, length);
+      expected.erase(index, length);
+    }
+    if (i % 500 == 0) {
+      ExpectText(expected, text);
+      ExpectText(snapshot_expected, snapshot);
+      snapshot = text;
+      snapshot_expected = expected;
+    }
+  }
+  ExpectText(expected, text);
+  ExpectText(snapshot_expected, snapshot);
+}
+
+TEST(TextTest, Lines) {
+  Text text;
+  EXPECT_EQ(1, text.num_lines());
+  EXPECT_EQ(0, text.LineStart(0));
+  EXPECT_EQ(0, text.LineOf(0));
+
+  string data = "papaya\nkamiah\n\nkapoho";
+  text.Insert(0, data.data(), data.size());
+  ExpectLines(data, text);
+  EXPECT_EQ(4, text.num_lines());
+  EXPECT_EQ(7, text.LineStart(1));
+  EXPECT_EQ(14, text.LineStart(2));
+  EXPECT_EQ(15, text.LineStart(3));
+  EXPECT_EQ(0, text.LineOf(6));
+  EXPECT_EQ(1, text.LineOf(7));
+  EXPECT_EQ(3, text.LineOf(data.size()));
+
+  text.Erase(6, 1);
+  data.erase(6, 1);
+  ExpectLines(data, text);
+  EXPECT_EQ(3, text.num_lines());
+
+  string range;
+  text.AppendRangeTo(6, 6, &range);
+  EXPECT_EQ("kamiah", range);
+  text.AppendRangeTo(14, 100, &range);
+  EXPECT_EQ("kamiahkapoho", range);
+}
+
+TEST(TextTest, RandomEditsWithLines) {
+  srand(41);
+  Text text;
+  string expected;
+  Text snapshot;
+  string snapshot_expected;
+  for (int i = 0; i < 3000; ++i) {
+    Index index = expected.empty() ? 0 : rand() % (expected.size() + 1);
+    if ((rand() % 3 != 0) || expected.empty()) {
+      Length size = (rand() % 50 == 0) ? rand() % (2 * Text::kMaxChunkSize)
+                                       : rand() % 20;
+      string inserted(size, 'a' + (i % 26));
+      for (Length j = 0; j < size; ++j) {
+        if (rand() % 8 == 0) {
+          inserted[j] = '\n';
+        }
+      }
+      text.Insert(index, inserted.data(), size);
+      expected.insert(index, inserted);
+    } else {
+      Length length = (rand() % 50 == 0) ? rand() % (2 * Text::kMaxChunkSize)
+                                         : rand() % 20;
+      text.Erase(index, length);
+      expected.erase(index, length);
+    }
+    if (i % 300 == 0) {
+      ExpectLines(expected, text);
+      ExpectLines(snapshot_expected, snapshot);
+      snapshot = text;
+      snapshot_expected = expected;
+
+      // A range across chunks
+      Index start = expected.size() / 3;
+      string range;
+      text.AppendRangeTo(start, expected.size() / 2, &range);
+      EXPECT_EQ(expected.substr(start, expected.size() / 2), range);
+    }
+  }
+  ExpectText(expected, text);
+  ExpectLines(expected, text);
+  ExpectLines(snapshot_expected, snapshot);
+}
+
+TEST(TextTest, Units) {
+  // "p", "\xC3\xA1" (2 bytes), "\xE2\x82\xAC" (3 bytes) and "\xF0\x9F\x8D\x88"
+  // (4 bytes, a surrogate pair in UTF-16)
+  string data = "p\xC3\xA1\xE2\x82\xAC\xF0\x9F\x8D\x88";
+  Text text(data.data(), data.size());
+  EXPECT_EQ(10, text.length(UNIT_BYTES));
+  EXPECT_EQ(4, text.length(UNIT_CODE_POINTS));
+  EXPECT_EQ(5, text.length(UNIT_UTF16));
+
+  Index bytes[] = {0, 1, 3, 6, 10};
+  Index utf16[] = {0, 1, 2, 3, 5};
+  for (Index i = 0; i < 5; ++i) {
+    Index index;
+    EXPECT_TRUE(text.ToBytes(UNIT_CODE_POINTS, i, &index));
+    EXPECT_EQ(bytes[i], index);
+    EXPECT_TRUE(text.ToBytes(UNIT_UTF16, utf16[i], &index));
+    EXPECT_EQ(bytes[i], index);
+    EXPECT_EQ(i, text.FromBytes(UNIT_CODE_POINTS, bytes[i]));
+    EXPECT_EQ(utf16[i], text.FromBytes(UNIT_UTF16, bytes[i]));
+  }
+
+  // In the middle of the surrogate pair, or past the end
+  Index index;
+  EXPECT_FALSE(text.ToBytes(UNIT_UTF16, 4, &index));
+  EXPECT_FALSE(text.ToBytes(UNIT_UTF16, 6, &index));
+  EXPECT_FALSE(text.ToBytes(UNIT_CODE_POINTS, 5, &index));
+  EXPECT_FALSE(text.ToBytes(UNIT_BYTES, 11, &index));
+  EXPECT_FALSE(text.ToBytes(UNIT_CODE_POINTS, -1, &index));
+}
+
+TEST(TextTest, RandomEditsWithUnits) {
+  const char *characters[] = {
+    "a", "\n", "\xC3\xA1", "\xE2\x82\xAC", "\xF0\x9F\x8D\x88",
+  };
+  const Length utf16_units[] = {1, 1, 1, 1, 2};
+
+  // The text as its characters, to edit by code point
+  srand(43);
+  Text text;
+  vector<int> expected;
+  for (int i = 0; i < 2000; ++i) {
+    size_t at = rand() % (expected.size() + 1);
+    Index index;
+    ASSERT_TRUE(text.ToBytes(UNIT_CODE_POINTS, at, &index));
+    if ((rand() % 3 != 0) || expected.empty()) {
+      Length size = (rand() % 50 == 0) ? rand() % 2000 : rand() % 20;
+      vector<int> inserted;
+      string data;
+      for (Length j = 0; j < size; ++j) {
+        inserted.push_back(rand() % 5);
+        data += characters[inserted.back()];
+      }
+      text.Insert(index, data.data(), data.size());
+      expected.insert(expected.begin() + at, inserted.begin(),
+                      inserted.end());
+    } else {
+      size_t length = min<size_t>(rand() % 20, expected.size() - at);
+      Index end;
+      ASSERT_TRUE(text.ToBytes(UNIT_CODE_POINTS, at + length, &end));
+      text.Erase(index, end - index);
+      expected.erase(expected.begin() + at, expected.begin() + at + length);
+    }
+
+    if (i % 200 == 0) {
+      Index byte = 0;
+      Index utf16 = 0;
+      for (size_t j = 0; j <= expected.size(); ++j) {
+        Index index;
+        EXPECT_TRUE(text.ToBytes(UNIT_CODE_POINTS, j, &index));
+        EXPECT_EQ(byte, index);
+        EXPECT_TRUE(text.ToBytes(UNIT_UTF16, utf16, &index));
+        EXPECT_EQ(byte, index);
+        EXPECT_EQ(static_cast<Index>(j),
+                  text.FromBytes(UNIT_CODE_POINTS, byte));
+        EXPECT_EQ(utf16, text.FromBytes(UNIT_UTF16, byte));
+        if (j < expected.size()) {
+          byte += strlen(characters[expected[j]]);
+          utf16 += utf16_units[expected[j]];
+        }
+      }
+      EXPECT_EQ(static_cast<Length>(expected.size()),
+                text.length(UNIT_CODE_POINTS));
+      EXPECT_EQ(utf16, text.length(UNIT_UTF16));
+    }
+  }
+}
+
+}  // namespace kamiah
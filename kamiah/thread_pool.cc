@@ -0,0 +1,80 @@
+/**
+ * @file thread_pool.cc
+ * @brief Implementation of a ThreadPool.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "thread_pool.h"
+
+namespace kamiah {
+
+ThreadPool::ThreadPool(int num_threads)
+    : work_cv_(&mu_), idle_cv_(&mu_), running_(0), stopping_(false) {
+  for (int i = 0; i < num_threads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, &WorkerThread, this) == 0) {
+      threads_.push_back(thread);
+    }
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    MutexLock l(&mu_);
+    stopping_ = true;
+    work_cv_.SignalAll();
+  }
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    pthread_join(threads_[i], NULL);
+  }
+}
+
+void ThreadPool::Schedule(Task *task) {
+  MutexLock l(&mu_);
+  tasks_.push_back(task);
+  work_cv_.Signal();
+}
+
+void ThreadPool::Wait() {
+  MutexLock l(&mu_);
+  while (!tasks_.empty() || (running_ > 0)) {
+    idle_cv_.Wait();
+  }
+}
+
+int ThreadPool::num_threads() const {
+  return threads_.size();
+}
+
+void *ThreadPool::WorkerThread(void *pool) {
+  static_cast<ThreadPool*>(pool)->Work();
+  return NULL;
+}
+
+void ThreadPool::Work() {
+  MutexLock l(&mu_);
+  while (true) {
+    if (tasks_.empty()) {
+      if (stopping_) {
+        return;
+      }
+      work_cv_.Wait();
+      continue;
+    }
+
+    Task *task = tasks_.front();
+    tasks_.pop_front();
+    ++running_;
+    mu_.Unlock();
+    task->Run();
+    delete task;
+    mu_.Lock();
+    --running_;
+    if (tasks_.empty() && (running_ == 0)) {
+      idle_cv_.SignalAll();
+    }
+  }
+}
+
+}  // namespace kamiah
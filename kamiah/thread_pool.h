@@ -0,0 +1,95 @@
+/**
+ * @file thread_pool.h
+ * @brief Definition of a ThreadPool.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_THREAD_POOL_H_
+#define KAMIAH_THREAD_POOL_H_
+
+#include <pthread.h>
+
+#include <deque>
+#include <vector>
+
+#include "mutex.h"
+#include "scheduler.h"
+
+using std::deque;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief A ThreadPool runs Tasks on a fixed number of threads.
+ *
+ * Tasks are started in FIFO order, but run concurrently and may finish in
+ * any order.
+ *
+ * This class is thread-safe.
+ */
+class ThreadPool {
+ public:
+  /**
+   * @brief Starts the threads of the pool.
+   *
+   * @param num_threads The number of threads, at least 1.
+   */
+  explicit ThreadPool(int num_threads);
+
+  /**
+   * @brief Runs all the scheduled tasks and stops the threads.
+   */
+  ~ThreadPool();
+
+  /**
+   * @brief Schedules the specified task to run.
+   *
+   * @param task The task to run. The pool takes ownership of it and deletes
+   *     it after it has been run.
+   */
+  void Schedule(Task *task);
+
+  /**
+   * @brief Waits until all the tasks scheduled so far have been run.
+   */
+  void Wait();
+
+  /**
+   * @brief Gets the number of threads of the pool.
+   *
+   * @return The number of threads.
+   */
+  int num_threads() const;
+
+ private:
+  static void *WorkerThread(void *pool);
+
+  // Runs tasks until the pool is destroyed.
+  void Work();
+
+  vector<pthread_t> threads_;
+
+  Mutex mu_;
+
+  // Signalled when there are tasks to run or the pool is stopping.
+  CondVar work_cv_;
+
+  // Signalled when the pool becomes idle.
+  CondVar idle_cv_;
+
+  deque<Task*> tasks_;
+
+  // Number of tasks being run.
+  int running_;
+  bool stopping_;
+
+  // Not copyable.
+  ThreadPool(const ThreadPool&);
+  void operator=(const ThreadPool&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_THREAD_POOL_H_
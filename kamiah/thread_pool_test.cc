@@ -0,0 +1,92 @@
+/**
+ * @file thread_pool_test.cc
+ * @brief Unit tests for a ThreadPool.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "thread_pool.h"
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+namespace {
+
+class IncrementTask : public Task {
+ public:
+  explicit IncrementTask(volatile int *count) : count_(count) {}
+
+  virtual void Run() {
+    __sync_fetch_and_add(count_, 1);
+  }
+
+ private:
+  volatile int *count_;
+};
+
+// Blocks until released, counting how many are blocked at once.
+class BlockingTask : public Task {
+ public:
+  BlockingTask(volatile int *blocked, volatile bool *release)
+      : blocked_(blocked), release_(release) {}
+
+  virtual void Run() {
+    __sync_fetch_and_add(blocked_, 1);
+    while (!*release_) {
+      usleep(100);
+    }
+  }
+
+ private:
+  volatile int *blocked_;
+  volatile bool *release_;
+};
+
+}  // namespace
+
+TEST(ThreadPoolTest, RunsAllTasks) {
+  volatile int count = 0;
+  ThreadPool pool(4);
+  EXPECT_EQ(4, pool.num_threads());
+  for (int i = 0; i < 1000; ++i) {
+    pool.Schedule(new IncrementTask(&count));
+  }
+  pool.Wait();
+  EXPECT_EQ(1000, count);
+
+  // Reusable after waiting
+  pool.Schedule(new IncrementTask(&count));
+  pool.Wait();
+  EXPECT_EQ(1001, count);
+}
+
+TEST(ThreadPoolTest, RunsTasksConcurrently) {
+  volatile int blocked = 0;
+  volatile bool release = false;
+  ThreadPool pool(3);
+  for (int i = 0; i < 3; ++i) {
+    pool.Schedule(new BlockingTask(&blocked, &release));
+  }
+  for (int i = 0; (i < 10000) && (blocked < 3); ++i) {
+    usleep(100);
+  }
+  EXPECT_EQ(3, blocked);
+  release = true;
+  pool.Wait();
+}
+
+TEST(ThreadPoolTest, DestructorRunsPendingTasks) {
+  volatile int count = 0;
+  {
+    ThreadPool pool(1);
+    for (int i = 0; i < 100; ++i) {
+      pool.Schedule(new IncrementTask(&count));
+    }
+  }
+  EXPECT_EQ(100, count);
+}
+
+}  // namespace kamiah
@@ -0,0 +1,392 @@
+/**
+ * @file trigram_index.cc
+ * @brief Implementation of a TrigramIndex.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "trigram_index.h"
+
+#include <ctype.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "text_kernels.h"
+
+using std::back_inserter;
+using std::binary_search;
+using std::max;
+using std::min;
+using std::set_difference;
+using std::sort;
+using std::unique;
+
+namespace kamiah {
+
+struct TrigramIndex::Block {
+  explicit Block(Length block_size) : size(block_size), position(0) {
+  }
+
+  Length size;
+
+  // Where the block is in blocks_.
+  size_t position;
+
+  // The trigrams that start in the block, sorted.
+  vector<Trigram> trigrams;
+};
+
+namespace {
+
+// Gets the trigrams that start in the first size characters of data, the
+// rest of data being the characters that follow them.
+template <typename T>
+void GetTrigrams(const string& data, size_t size, vector<T> *trigrams) {
+  for (size_t i = 0; (i < size) && (i + 2 < data.size()); ++i) {
+    trigrams->push_back((static_cast<unsigned char>(data[i]) << 16) |
+                        (static_cast<unsigned char>(data[i + 1]) << 8) |
+                        static_cast<unsigned char>(data[i + 2]));
+  }
+  sort(trigrams->begin(), trigrams->end());
+  trigrams->erase(unique(trigrams->begin(), trigrams->end()),
+                  trigrams->end());
+}
+
+}  // namespace
+
+TrigramIndex::TrigramIndex(const Text& text) {
+  // The last block takes what is left, unless it would be too small
+  Length size = text.size();
+  Length start = 0;
+  while (size - start >= kBlockSize + kMinBlockSize) {
+    blocks_.push_back(new Block(kBlockSize));
+    start += kBlockSize;
+  }
+  blocks_.push_back(new Block(size - start));
+  Renumber(0);
+
+  start = 0;
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    Reindex(text, blocks_[i], start);
+    start += blocks_[i]->size;
+  }
+}
+
+TrigramIndex::~TrigramIndex() {
+  for (size_t i = 0; i < blocks_.size(); ++i) {
+    delete blocks_[i];
+  }
+}
+
+void TrigramIndex::Update(const Text& text, Index index, Length erased,
+                          Length inserted) {
+  // Find the block the edit starts in
+  size_t first = 0;
+  Index start = 0;
+  while ((first + 1 < blocks_.size()) &&
+         (start + blocks_[first]->size <= index)) {
+    start += blocks_[first]->size;
+    ++first;
+  }
+
+  // Resize the blocks the edit is in, dropping those that were erased
+  bool renumber = false;
+  Index offset = index - start;
+  size_t i = first;
+  while (erased > 0) {
+    Length removed = min(erased, blocks_[i]->size - offset);
+    blocks_[i]->size -= removed;
+    erased -= removed;
+    offset = 0;
+    if ((blocks_[i]->size == 0) && (blocks_.size() > 1)) {
+      RemoveBlock(i);
+      renumber = true;
+    } else {
+      ++i;
+    }
+  }
+  if (first == blocks_.size()) {
+    --first;
+    start -= blocks_[first]->size;
+  }
+  blocks_[first]->size += inserted;
+
+  // The trigrams that start up to two characters before the edit changed
+  Index low = index - 2;
+  Index high = index + inserted;
+  while ((first > 0) && (start > low)) {
+    --first;
+    start -= blocks_[first]->size;
+  }
+  size_t last = first;
+  Index end = start + blocks_[first]->size;
+  while ((last + 1 < blocks_.size()) && (end <= high)) {
+    ++last;
+    end += blocks_[last]->size;
+  }
+
+  // Split the blocks that grew too big and merge those that got too small
+  for (i = first; i <= last; ) {
+    Block *block = blocks_[i];
+    if (block->size > kMaxBlockSize) {
+      InsertBlock(i + 1, new Block(block->size - kBlockSize));
+      block->size = kBlockSize;
+      ++last;
+      renumber = true;
+    } else if ((block->size < kMinBlockSize) && (i + 1 < blocks_.size())) {
+      block->size += blocks_[i + 1]->size;
+      RemoveBlock(i + 1);
+      if (last > i) {
+        --last;
+      }
+      renumber = true;
+      continue;
+    }
+    ++i;
+  }
+  if (renumber) {
+    Renumber(first);
+  }
+
+  for (i = first; i <= last; ++i) {
+    Reindex(text, blocks_[i], start);
+    start += blocks_[i]->size;
+  }
+}
+
+void TrigramIndex::Find(const Text& text, const string& pattern,
+                        vector<Index> *matches) const {
+  if (pattern.empty()) {
+    return;
+  }
+
+  // A match that starts in a block has its first kMinBlockSize characters
+  // in that block and the next one
+  vector<Trigram> trigrams;
+  GetTrigrams(pattern, kMinBlockSize, &trigrams);
+  vector<size_t> candidates;
+  if (trigrams.empty()) {
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+      candidates.push_back(i);
+    }
+  } else {
+    const set<Block*> *rarest = NULL;
+    for (size_t i = 0; i < trigrams.size(); ++i) {
+      map<Trigram, set<Block*> >::const_iterator it =
+          postings_.find(trigrams[i]);
+      if (it == postings_.end()) {
+        return;
+      }
+      if ((rarest == NULL) || (it->second.size() < rarest->size())) {
+        rarest = &it->second;
+      }
+    }
+    for (set<Block*>::const_iterator it = rarest->begin();
+         it != rarest->end(); ++it) {
+      candidates.push_back((*it)->position);
+      if ((*it)->position > 0) {
+        candidates.push_back((*it)->position - 1);
+      }
+    }
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()),
+                     candidates.end());
+  }
+
+  // Search the blocks that have all the trigrams, with the next block
+  Index start = 0;
+  size_t position = 0;
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    for (; position < candidates[i]; ++position) {
+      start += blocks_[position]->size;
+    }
+    const Block *block = blocks_[position];
+    const Block *next = (position + 1 < blocks_.size())
+        ? blocks_[position + 1] : NULL;
+    bool found = true;
+    for (size_t j = 0; found && (j < trigrams.size()); ++j) {
+      found = binary_search(block->trigrams.begin(), block->trigrams.end(),
+                            trigrams[j]) ||
+          ((next != NULL) && binary_search(next->trigrams.begin(),
+                                           next->trigrams.end(),
+                                           trigrams[j]));
+    }
+    if (found) {
+      FindInText(text, pattern, start, start + block->size, matches);
+    }
+  }
+}
+
+size_t TrigramIndex::num_blocks() const {
+  return blocks_.size();
+}
+
+void TrigramIndex::Reindex(const Text& text, Block *block, Index start) {
+  string data;
+  text.AppendRangeTo(start, block->size + 2, &data);
+  vector<Trigram> trigrams;
+  GetTrigrams(data, block->size, &trigrams);
+
+  // Only update the postings of the trigrams that changed
+  vector<Trigram> changed;
+  set_difference(block->trigrams.begin(), block->trigrams.end(),
+                 trigrams.begin(), trigrams.end(), back_inserter(changed));
+  for (size_t i = 0; i < changed.size(); ++i) {
+    map<Trigram, set<Block*> >::iterator it = postings_.find(changed[i]);
+    it->second.erase(block);
+    if (it->second.empty()) {
+      postings_.erase(it);
+    }
+  }
+  changed.clear();
+  set_difference(trigrams.begin(), trigrams.end(),
+                 block->trigrams.begin(), block->trigrams.end(),
+                 back_inserter(changed));
+  for (size_t i = 0; i < changed.size(); ++i) {
+    postings_[changed[i]].insert(block);
+  }
+  block->trigrams.swap(trigrams);
+}
+
+void TrigramIndex::InsertBlock(size_t position, Block *block) {
+  blocks_.insert(blocks_.begin() + position, block);
+}
+
+void TrigramIndex::RemoveBlock(size_t position) {
+  Block *block = blocks_[position];
+  for (size_t i = 0; i < block->trigrams.size(); ++i) {
+    map<Trigram, set<Block*> >::iterator it =
+        postings_.find(block->trigrams[i]);
+    it->second.erase(block);
+    if (it->second.empty()) {
+      postings_.erase(it);
+    }
+  }
+  blocks_.erase(blocks_.begin() + position);
+  delete block;
+}
+
+void TrigramIndex::Renumber(size_t first) {
+  for (size_t i = first; i < blocks_.size(); ++i) {
+    blocks_[i]->position = i;
+  }
+}
+
+void FindInText(const Text& text, const string& pattern, Index start,
+                Index end, vector<Index> *matches) {
+  Length size = pattern.size();
+  Index chunk_start = 0;
+  string window;
+  for (size_t i = 0; (i < text.num_chunks()) && (chunk_start < end); ++i) {
+    Length chunk_size = text.chunk_size(i);
+    Index chunk_end = chunk_start + chunk_size;
+    if (chunk_end <= start) {
+      chunk_start = chunk_end;
+      continue;
+    }
+
+    // Occurrences inside the chunk, found without copying it
+    Index from = max(start, chunk_start);
+    const char *data = text.chunk_data(i);
+    const char *limit = data + chunk_size;
+    for (const char *found = data + (from - chunk_start);
+         (found = FindString(found, limit - found, pattern.data(),
+                             size)) != NULL; ++found) {
+      if (chunk_start + (found - data) >= end) {
+        break;
+      }
+      matches->push_back(chunk_start + (found - data));
+    }
+
+    // Occurrences that continue past the end of the chunk
+    Index window_start = max(from, chunk_end - size + 1);
+    Index window_end = min(end, chunk_end);
+    if ((window_start < window_end) && (chunk_end < text.size())) {
+      window.clear();
+      text.AppendRangeTo(window_start, chunk_end - window_start + size - 1,
+                         &window);
+      for (size_t j = window.find(pattern);
+           (j != string::npos) &&
+               (window_start + static_cast<Index>(j) < window_end);
+           j = window.find(pattern, j + 1)) {
+        matches->push_back(window_start + j);
+      }
+    }
+    chunk_start = chunk_end;
+  }
+}
+
+string GetRequiredLiteral(const string& regex) {
+  string best;
+  string literal;
+  int depth = 0;
+  for (size_t i = 0; i < regex.size(); ++i) {
+    char c = regex[i];
+    bool is_literal = false;
+    switch (c) {
+      case '|':
+        // Any alternative can match
+        return "";
+      case '(':
+        ++depth;
+        break;
+      case ')':
+        --depth;
+        break;
+      case '[':
+        // Skip the bracket expression, where a leading ']' is literal
+        i += ((i + 1 < regex.size()) && (regex[i + 1] == '^')) ? 2 : 1;
+        if ((i < regex.size()) && (regex[i] == ']')) {
+          ++i;
+        }
+        while ((i < regex.size()) && (regex[i] != ']')) {
+          ++i;
+        }
+        break;
+      case '*':
+      case '?':
+      case '{':
+        // The previous character is optional
+        if (!literal.empty()) {
+          literal.erase(literal.size() - 1);
+        }
+        if (c == '{') {
+          while ((i < regex.size()) && (regex[i] != '}')) {
+            ++i;
+          }
+        }
+        break;
+      case '+':
+      case '.':
+      case '^':
+      case '$':
+        break;
+      case '\\':
+        // Escaped punctuation is literal, other escapes are classes
+        ++i;
+        if ((i < regex.size()) && ispunct(static_cast<unsigned char>(
+                regex[i]))) {
+          c = regex[i];
+          is_literal = true;
+        }
+        break;
+      default:
+        is_literal = true;
+        break;
+    }
+
+    // Only characters outside of groups are required
+    if (is_literal && (depth == 0)) {
+      literal.push_back(c);
+      continue;
+    }
+    if (literal.size() > best.size()) {
+      best = literal;
+    }
+    literal.clear();
+  }
+  return (literal.size() > best.size()) ? literal : best;
+}
+
+}  // namespace kamiah
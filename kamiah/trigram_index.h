@@ -0,0 +1,147 @@
+/**
+ * @file trigram_index.h
+ * @brief Definition of a TrigramIndex, an index of the trigrams in a Text
+ *     used to search it without scanning all of it.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_TRIGRAM_INDEX_H_
+#define KAMIAH_TRIGRAM_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "text.h"
+#include "types.h"
+
+using std::map;
+using std::set;
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief A TrigramIndex splits a Text into blocks of a few KB and keeps, for
+ *     every trigram (three consecutive bytes), the blocks it starts in.
+ *
+ * A search only looks at the blocks that have the trigrams of the text
+ * searched for, so on a large Text most blocks are skipped. Edits re-index
+ * only the blocks around them and only update the postings of the trigrams
+ * that changed, so typing costs about the size of one block.
+ *
+ * The index does not keep a reference to the Text: the Text is passed to
+ * every call and must be the one the index was built from, with every edit
+ * since reported through Update().
+ *
+ * This class is thread-compatible.
+ */
+class TrigramIndex {
+ public:
+  // Size of the blocks the Text is split into. Blocks other than the last
+  // have between kMinBlockSize and kMaxBlockSize characters.
+  static const Length kBlockSize = 4096;
+  static const Length kMinBlockSize = kBlockSize / 2;
+  static const Length kMaxBlockSize = kBlockSize * 2;
+
+  /**
+   * @brief Builds the index of a Text.
+   *
+   * @param text The Text to index.
+   */
+  explicit TrigramIndex(const Text& text);
+  ~TrigramIndex();
+
+  /**
+   * @brief Updates the index after an edit of the Text.
+   *
+   * @param text The Text after the edit.
+   * @param index Where the edit was.
+   * @param erased The number of characters deleted at index.
+   * @param inserted The number of characters inserted at index.
+   */
+  void Update(const Text& text, Index index, Length erased, Length inserted);
+
+  /**
+   * @brief Finds all the occurrences of a string in the Text, overlapping
+   *     ones included.
+   *
+   * @param text The indexed Text.
+   * @param pattern The string to find. Strings shorter than a trigram are
+   *     found by scanning the Text.
+   * @param matches Vector to append the index of every occurrence to, in
+   *     order.
+   */
+  void Find(const Text& text, const string& pattern,
+            vector<Index> *matches) const;
+
+  /**
+   * @brief Gets the number of blocks the Text is split into.
+   *
+   * @return The number of blocks.
+   */
+  size_t num_blocks() const;
+
+ private:
+  typedef uint32_t Trigram;
+  struct Block;
+
+  // Computes the trigrams that start in a block and updates the postings of
+  // those that changed.
+  void Reindex(const Text& text, Block *block, Index start);
+
+  // Inserts a block at a position.
+  void InsertBlock(size_t position, Block *block);
+
+  // Removes the block at a position and its postings.
+  void RemoveBlock(size_t position);
+
+  // Numbers the blocks from a position on.
+  void Renumber(size_t first);
+
+  // Blocks in the order they are in the Text.
+  vector<Block*> blocks_;
+
+  // The blocks each trigram starts in.
+  map<Trigram, set<Block*> > postings_;
+
+  // Not copyable.
+  TrigramIndex(const TrigramIndex&);
+  void operator=(const TrigramIndex&);
+};
+
+/**
+ * @brief Finds the occurrences of a string that start in a range of a Text,
+ *     without an index. The chunks of the Text are scanned in place with
+ *     the text kernels.
+ *
+ * @param text The Text to search.
+ * @param pattern The string to find, not empty.
+ * @param start The first index an occurrence can start at.
+ * @param end The index after the last one an occurrence can start at.
+ * @param matches Vector to append the index of every occurrence to, in
+ *     order.
+ */
+void FindInText(const Text& text, const string& pattern, Index start,
+                Index end, vector<Index> *matches);
+
+/**
+ * @brief Gets the longest string that every match of a POSIX extended
+ *     regular expression contains, so that only the text around it needs to
+ *     be matched against the expression.
+ *
+ * @param regex The regular expression.
+ * @return The string, empty if there is none (for example if the
+ *     expression has alternatives).
+ */
+string GetRequiredLiteral(const string& regex);
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_TRIGRAM_INDEX_H_
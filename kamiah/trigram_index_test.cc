@@ -0,0 +1,134 @@
+/**
+ * @file trigram_index_test.cc
+ * @brief Unit tests for a TrigramIndex.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "trigram_index.h"
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+// Finds all the occurrences of pattern in data.
+vector<Index> FindAll(const string& data, const string& pattern) {
+  vector<Index> matches;
+  for (size_t i = data.find(pattern); i != string::npos;
+       i = data.find(pattern, i + 1)) {
+    matches.push_back(i);
+  }
+  return matches;
+}
+
+}  // namespace
+
+TEST(TrigramIndexTest, Empty) {
+  Text text;
+  TrigramIndex index(text);
+  vector<Index> matches;
+  index.Find(text, "papaya", &matches);
+  index.Find(text, "p", &matches);
+  EXPECT_TRUE(matches.empty());
+  EXPECT_EQ(1U, index.num_blocks());
+}
+
+TEST(TrigramIndexTest, Find) {
+  string data;
+  for (int i = 0; i < 5000; ++i) {
+    data += "kamiah ";
+  }
+  data.replace(100, 6, "papaya");
+  data.replace(20000, 6, "papaya");
+  data.replace(data.size() - 6, 6, "papaya");
+  Text text(data.data(), data.size());
+  TrigramIndex index(text);
+  EXPECT_LT(1U, index.num_blocks());
+
+  vector<Index> matches;
+  index.Find(text, "papaya", &matches);
+  EXPECT_EQ(FindAll(data, "papaya"), matches);
+  matches.clear();
+  index.Find(text, "kapoho", &matches);
+  EXPECT_TRUE(matches.empty());
+  index.Find(text, "pa", &matches);
+  EXPECT_EQ(FindAll(data, "pa"), matches);
+  matches.clear();
+  index.Find(text, "h kamiah k", &matches);
+  EXPECT_EQ(FindAll(data, "h kamiah k"), matches);
+}
+
+TEST(TrigramIndexTest, GetRequiredLiteral) {
+  EXPECT_EQ("papaya", GetRequiredLiteral("papaya"));
+  EXPECT_EQ("kamiah", GetRequiredLiteral("^pa.*kamiah[0-9]+$"));
+  EXPECT_EQ("kamia", GetRequiredLiteral("kamiah?"));
+  EXPECT_EQ("int main()", GetRequiredLiteral("int main\\(\\)"));
+  EXPECT_EQ("ide", GetRequiredLiteral("(papaya)*ide"));
+  EXPECT_EQ("ide", GetRequiredLiteral("[]papaya]ide"));
+  EXPECT_EQ("", GetRequiredLiteral("papaya|kamiah"));
+  EXPECT_EQ("", GetRequiredLiteral("\\w+"));
+}
+
+TEST(TrigramIndexTest, RandomEdits) {
+  // A small alphabet so that trigrams repeat across blocks
+  const char characters[] = "abc\n";
+  srand(47);
+  string data;
+  for (int i = 0; i < 20000; ++i) {
+    data.push_back(characters[rand() % 4]);
+  }
+  Text text(data.data(), data.size());
+  TrigramIndex index(text);
+  for (int i = 0; i < 2000; ++i) {
+    Index at = rand() % (data.size() + 1);
+    if (rand() % 2 == 0) {
+      // Mostly typing, sometimes pasting
+      string inserted;
+      for (int j = (rand() % 10 == 0) ? rand() % 20000 : rand() % 3;
+           j >= 0; --j) {
+        inserted.push_back(characters[rand() % 4]);
+      }
+      text.Insert(at, inserted.data(), inserted.size());
+      data.insert(at, inserted);
+      index.Update(text, at, 0, inserted.size());
+    } else {
+      Length erased = (rand() % 10 == 0) ? rand() % 20000 : rand() % 3;
+      if (erased > static_cast<Length>(data.size()) - at) {
+        erased = data.size() - at;
+      }
+      text.Erase(at, erased);
+      data.erase(at, erased);
+      index.Update(text, at, erased, 0);
+    }
+
+    if (i % 100 == 0) {
+      for (int j = 0; j < 5; ++j) {
+        string pattern;
+        for (int k = rand() % 8; k >= 0; --k) {
+          pattern.push_back(characters[rand() % 4]);
+        }
+        vector<Index> matches;
+        index.Find(text, pattern, &matches);
+        ASSERT_EQ(FindAll(data, pattern), matches) << pattern;
+      }
+    }
+  }
+
+  // Long patterns span blocks
+  string pattern = data.substr(data.size() / 3, 9000);
+  vector<Index> matches;
+  index.Find(text, pattern, &matches);
+  EXPECT_EQ(FindAll(data, pattern), matches);
+}
+
+}  // namespace kamiah
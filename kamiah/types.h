@@ -5,6 +5,9 @@
  * @author Victor Marmol (vmarmol@gmail.com)
  */
 
+#ifndef KAMIAH_TYPES_H_
+#define KAMIAH_TYPES_H_
+
 #include <stdint.h>
 
 namespace kamiah {
@@ -14,4 +17,14 @@ typedef int64_t Index;
 typedef int64_t Length;
 typedef int64_t DocID;
 
+// Units of the offsets into the text of a Document. The text is UTF-8, and
+// browsers address it in UTF-16 code units.
+enum Unit { UNIT_BYTES, UNIT_CODE_POINTS, UNIT_UTF16 };
+
+// Which way a position in a text goes when text is inserted at it:
+// BIAS_LEFT stays before the inserted text and BIAS_RIGHT moves after it.
+enum Bias { BIAS_LEFT, BIAS_RIGHT };
+
 }  // namespace kamiah
+
+#endif  // KAMIAH_TYPES_H_
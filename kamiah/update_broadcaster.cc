@@ -0,0 +1,108 @@
+/**
+ * @file update_broadcaster.cc
+ * @brief Implementation of an UpdateBroadcaster.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "update_broadcaster.h"
+
+#include <string.h>
+
+namespace kamiah {
+
+UpdateBroadcaster::UpdateBroadcaster(const DiffEncoder *encoder)
+    : encoder_(encoder), block_(NULL), block_used_(0), bytes_encoded_(0) {
+}
+
+UpdateBroadcaster::~UpdateBroadcaster() {
+  if (block_ != NULL) {
+    block_->Unref();
+  }
+}
+
+void UpdateBroadcaster::Subscribe(UpdateSubscriber *subscriber) {
+  subscribers_.push_back(subscriber);
+}
+
+bool UpdateBroadcaster::Unsubscribe(UpdateSubscriber *subscriber) {
+  for (vector<UpdateSubscriber*>::iterator it = subscribers_.begin();
+       it != subscribers_.end(); ++it) {
+    if (*it == subscriber) {
+      subscribers_.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+void UpdateBroadcaster::OnDiffApplied(const Document& doc, const Diff& diff) {
+  // Serialize once
+  scratch_.clear();
+  encoder_->Encode(doc.doc_id(), diff, &scratch_);
+  bytes_encoded_ += scratch_.size();
+
+  EncodedDiff encoded;
+  encoded.version = diff.version();
+  encoded.update = Publish(scratch_);
+  recent_.push_back(encoded);
+  if (recent_.size() > Document::kMaxCacheSize) {
+    recent_.pop_front();
+  }
+
+  // Fan out
+  for (size_t i = 0; i < subscribers_.size(); ++i) {
+    subscribers_[i]->OnUpdate(doc.doc_id(), encoded.version, encoded.update);
+  }
+}
+
+bool UpdateBroadcaster::GetUpdates(Version from_version,
+                                   vector<BufferSlice> *updates) const {
+  if (recent_.empty() || (from_version < recent_.front().version)) {
+    return false;
+  }
+
+  for (deque<EncodedDiff>::const_iterator it = recent_.begin();
+       it != recent_.end(); ++it) {
+    if (it->version >= from_version) {
+      updates->push_back(it->update);
+    }
+  }
+  return true;
+}
+
+size_t UpdateBroadcaster::num_subscribers() const {
+  return subscribers_.size();
+}
+
+int64_t UpdateBroadcaster::bytes_encoded() const {
+  return bytes_encoded_;
+}
+
+BufferSlice UpdateBroadcaster::Publish(const string& encoded) {
+  // Large diffs get a block of their own
+  if (encoded.size() > kBlockSize) {
+    SharedBuffer *buffer = SharedBuffer::New(encoded.size());
+    memcpy(buffer->mutable_data(), encoded.data(), encoded.size());
+    BufferSlice slice(buffer, 0, encoded.size());
+    buffer->Unref();
+    return slice;
+  }
+
+  // Start a new block if this one is full. The old block lives on for as
+  // long as there are slices of it.
+  if ((block_ == NULL) || (block_used_ + encoded.size() > kBlockSize)) {
+    if (block_ != NULL) {
+      block_->Unref();
+    }
+    block_ = SharedBuffer::New(kBlockSize);
+    block_used_ = 0;
+  }
+
+  memcpy(block_->mutable_data() + block_used_, encoded.data(), encoded.size());
+  BufferSlice slice(block_, block_used_, encoded.size());
+  block_used_ += encoded.size();
+  return slice;
+}
+
+}  // namespace kamiah
@@ -0,0 +1,145 @@
+/**
+ * @file update_broadcaster.h
+ * @brief Definition of an UpdateBroadcaster.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_UPDATE_BROADCASTER_H_
+#define KAMIAH_UPDATE_BROADCASTER_H_
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "diff.h"
+#include "diff_encoder.h"
+#include "document.h"
+#include "shared_buffer.h"
+#include "types.h"
+
+using std::deque;
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief An UpdateSubscriber receives the serialized updates of a Document.
+ */
+class UpdateSubscriber {
+ public:
+  virtual ~UpdateSubscriber() {}
+
+  /**
+   * @brief Called with each diff applied to the Document.
+   *
+   * @param doc_id The ID of the Document.
+   * @param version The version of the diff.
+   * @param update The serialized diff. The slice may be kept after returning.
+   */
+  virtual void OnUpdate(DocID doc_id, Version version,
+                        const BufferSlice& update) = 0;
+};
+
+/**
+ * @brief An UpdateBroadcaster serializes every diff applied to a Document
+ *     exactly once and fans it out to all the subscribers of the Document.
+ *
+ * Serialized diffs are packed back to back into blocks of kBlockSize bytes
+ * and every subscriber receives a slice of the same block, so the cost of
+ * serializing an update does not grow with the number of subscribers. The
+ * serialized form of the last Document::kMaxCacheSize diffs is kept so that
+ * subscribers that fall behind can catch up without re-serializing.
+ *
+ * An UpdateBroadcaster observes a single Document.
+ *
+ * This class is thread-compatible.
+ */
+class UpdateBroadcaster : public DocumentObserver {
+ public:
+  // Size of the blocks serialized diffs are packed into.
+  static const size_t kBlockSize = 16 * 1024;
+
+  /**
+   * @brief Constructs an UpdateBroadcaster.
+   *
+   * @param encoder The encoder used to serialize diffs. Not owned.
+   */
+  explicit UpdateBroadcaster(const DiffEncoder *encoder);
+  virtual ~UpdateBroadcaster();
+
+  /**
+   * @brief Adds a subscriber that will receive all updates from now on.
+   *
+   * @param subscriber The subscriber to add. Not owned.
+   */
+  void Subscribe(UpdateSubscriber *subscriber);
+
+  /**
+   * @brief Removes a subscriber.
+   *
+   * @param subscriber The subscriber to remove.
+   * @return True iff the subscriber was subscribed.
+   */
+  bool Unsubscribe(UpdateSubscriber *subscriber);
+
+  /**
+   * @brief Serializes the diff and sends it to all the subscribers.
+   */
+  virtual void OnDiffApplied(const Document& doc, const Diff& diff);
+
+  /**
+   * @brief Gets the serialized diffs from the specified version to the latest
+   *     version seen. Same semantics as Document::GetUpdates().
+   *
+   * @param from_version The version from which to start getting updates.
+   * @param updates Vector in which to write the serialized diffs.
+   * @return True if the updates were populated or no updates are necessary.
+   *     False if the diffs are no longer cached.
+   */
+  bool GetUpdates(Version from_version, vector<BufferSlice> *updates) const;
+
+  /**
+   * @brief Gets the number of subscribers.
+   *
+   * @return The number of subscribers.
+   */
+  size_t num_subscribers() const;
+
+  /**
+   * @brief Gets the total number of bytes serialized so far.
+   *
+   * @return The total number of bytes serialized so far.
+   */
+  int64_t bytes_encoded() const;
+
+ private:
+  struct EncodedDiff {
+    Version version;
+    BufferSlice update;
+  };
+
+  // Copies the serialized diff into the current block and gets its slice.
+  BufferSlice Publish(const string& encoded);
+
+  const DiffEncoder *encoder_;
+  vector<UpdateSubscriber*> subscribers_;
+  deque<EncodedDiff> recent_;
+
+  // Block currently being filled and the number of bytes used in it.
+  SharedBuffer *block_;
+  size_t block_used_;
+
+  // Reused to serialize each diff.
+  string scratch_;
+  int64_t bytes_encoded_;
+
+  // Not copyable.
+  UpdateBroadcaster(const UpdateBroadcaster&);
+  void operator=(const UpdateBroadcaster&);
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_UPDATE_BROADCASTER_H_
@@ -0,0 +1,188 @@
+/**
+ * @file update_broadcaster_test.cc
+ * @brief Unit tests for an UpdateBroadcaster.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "update_broadcaster.h"
+
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+// Encodes diffs as "<doc_id>:<version>:<text or length>" and counts calls.
+class TestEncoder : public DiffEncoder {
+ public:
+  TestEncoder() : calls_(0) {}
+
+  virtual void Encode(DocID doc_id, const Diff& diff, string *out) const {
+    ++calls_;
+    char header[64];
+    snprintf(header, sizeof(header), "%ld:%ld:", (long) doc_id,
+             (long) diff.version());
+    out->append(header);
+    if (diff.type() == Diff::INSERT) {
+      out->append(diff.text());
+    } else {
+      snprintf(header, sizeof(header), "%ld", (long) diff.length());
+      out->append(header);
+    }
+  }
+
+  mutable int calls_;
+};
+
+class RecordingSubscriber : public UpdateSubscriber {
+ public:
+  virtual void OnUpdate(DocID doc_id, Version version,
+                        const BufferSlice& update) {
+    EXPECT_EQ(1, doc_id);
+    versions_.push_back(version);
+    updates_.push_back(update);
+  }
+
+  vector<Version> versions_;
+  vector<BufferSlice> updates_;
+};
+
+class UpdateBroadcasterTest : public ::testing::Test {
+ protected:
+  UpdateBroadcasterTest() : doc_(1), broadcaster_(&encoder_) {
+    doc_.AddObserver(&broadcaster_);
+  }
+
+  void Apply(Diff diff) {
+    EXPECT_TRUE(doc_.ApplyDiff(&diff));
+  }
+
+  TestEncoder encoder_;
+  Document doc_;
+  UpdateBroadcaster broadcaster_;
+};
+
+TEST_F(UpdateBroadcasterTest, FanOut) {
+  RecordingSubscriber first;
+  RecordingSubscriber second;
+  broadcaster_.Subscribe(&first);
+  broadcaster_.Subscribe(&second);
+  EXPECT_EQ(2U, broadcaster_.num_subscribers());
+
+  Apply(Diff(0, "papaya"));
+  Apply(Diff(0, 2));
+
+  ASSERT_EQ(2U, first.updates_.size());
+  ASSERT_EQ(2U, second.updates_.size());
+  EXPECT_EQ(1, first.versions_[0]);
+  EXPECT_EQ(2, first.versions_[1]);
+  EXPECT_EQ("1:1:papaya", first.updates_[0].ToString());
+  EXPECT_EQ("1:2:2", first.updates_[1].ToString());
+
+  // Both subscribers got the very same bytes
+  EXPECT_EQ(first.updates_[0].data(), second.updates_[0].data());
+  EXPECT_EQ(first.updates_[1].data(), second.updates_[1].data());
+}
+
+TEST_F(UpdateBroadcasterTest, EncodesOncePerDiff) {
+  const int kNumSubscribers = 100;
+  RecordingSubscriber subscribers[kNumSubscribers];
+  for (int i = 0; i < kNumSubscribers; ++i) {
+    broadcaster_.Subscribe(&subscribers[i]);
+  }
+
+  Apply(Diff(0, "papaya"));
+  Apply(Diff(0, "papaya"));
+
+  EXPECT_EQ(2, encoder_.calls_);
+  EXPECT_EQ((int64_t) (2 * strlen("1:1:papaya")),
+            broadcaster_.bytes_encoded());
+  for (int i = 0; i < kNumSubscribers; ++i) {
+    EXPECT_EQ(2U, subscribers[i].updates_.size());
+  }
+}
+
+TEST_F(UpdateBroadcasterTest, SmallDiffsShareABlock) {
+  RecordingSubscriber subscriber;
+  broadcaster_.Subscribe(&subscriber);
+
+  Apply(Diff(0, "papaya"));
+  Apply(Diff(0, "papaya"));
+
+  ASSERT_EQ(2U, subscriber.updates_.size());
+  EXPECT_EQ(subscriber.updates_[0].buffer(), subscriber.updates_[1].buffer());
+  EXPECT_EQ(subscriber.updates_[0].data() + subscriber.updates_[0].size(),
+            subscriber.updates_[1].data());
+}
+
+TEST_F(UpdateBroadcasterTest, BlocksOutliveBroadcaster) {
+  RecordingSubscriber subscriber;
+  {
+    TestEncoder encoder;
+    Document doc(1);
+    UpdateBroadcaster broadcaster(&encoder);
+    doc.AddObserver(&broadcaster);
+    broadcaster.Subscribe(&subscriber);
+
+    // Fill more than one block, including a diff larger than a block
+    string big(UpdateBroadcaster::kBlockSize, 'a');
+    Diff big_diff(0, big);
+    EXPECT_TRUE(doc.ApplyDiff(&big_diff));
+    for (int i = 0; i < 2000; ++i) {
+      Diff diff(0, "papaya-papaya");
+      EXPECT_TRUE(doc.ApplyDiff(&diff));
+    }
+    EXPECT_TRUE(doc.RemoveObserver(&broadcaster));
+  }
+
+  ASSERT_EQ(2001U, subscriber.updates_.size());
+  size_t block_size = UpdateBroadcaster::kBlockSize;
+  EXPECT_EQ(block_size + strlen("1:1:"),
+            subscriber.updates_[0].size());
+  EXPECT_EQ("1:2001:papaya-papaya", subscriber.updates_.back().ToString());
+  EXPECT_NE(subscriber.updates_[1].buffer(),
+            subscriber.updates_.back().buffer());
+}
+
+TEST_F(UpdateBroadcasterTest, Unsubscribe) {
+  RecordingSubscriber subscriber;
+  broadcaster_.Subscribe(&subscriber);
+  Apply(Diff(0, "papaya"));
+  EXPECT_TRUE(broadcaster_.Unsubscribe(&subscriber));
+  EXPECT_FALSE(broadcaster_.Unsubscribe(&subscriber));
+  Apply(Diff(0, "papaya"));
+
+  EXPECT_EQ(1U, subscriber.updates_.size());
+  EXPECT_EQ(0U, broadcaster_.num_subscribers());
+}
+
+TEST_F(UpdateBroadcasterTest, GetUpdates) {
+  vector<BufferSlice> updates;
+  EXPECT_FALSE(broadcaster_.GetUpdates(0, &updates));
+
+  Version num_diffs = Document::kMaxCacheSize + 2;
+  for (Version i = 0; i < num_diffs; ++i) {
+    Apply(Diff(0, "papaya"));
+  }
+
+  // Same as the Document
+  EXPECT_TRUE(broadcaster_.GetUpdates(num_diffs + 1, &updates));
+  EXPECT_TRUE(updates.empty());
+  EXPECT_TRUE(broadcaster_.GetUpdates(num_diffs - 1, &updates));
+  ASSERT_EQ(2U, updates.size());
+  EXPECT_EQ("1:11:papaya", updates[0].ToString());
+  EXPECT_EQ("1:12:papaya", updates[1].ToString());
+
+  updates.clear();
+  EXPECT_FALSE(broadcaster_.GetUpdates(2, &updates));
+  EXPECT_TRUE(updates.empty());
+  EXPECT_TRUE(broadcaster_.GetUpdates(3, &updates));
+  size_t max_cache = Document::kMaxCacheSize;
+  EXPECT_EQ(max_cache, updates.size());
+
+  // Catching up does not serialize again
+  EXPECT_EQ(num_diffs, encoder_.calls_);
+}
+
+}  // namespace kamiah
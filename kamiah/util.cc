@@ -0,0 +1,85 @@
+/**
+ * @file util.cc
+ * @brief Implementation of the shared helpers.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace kamiah {
+
+namespace {
+
+// Table of the CRC-32 of every byte.
+class Crc32Table {
+ public:
+  Crc32Table() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xedb88320 : (crc >> 1);
+      }
+      table_[i] = crc;
+    }
+  }
+
+  uint32_t Extend(uint32_t crc, const char *data, size_t size) const {
+    crc ^= 0xffffffff;
+    for (size_t i = 0; i < size; ++i) {
+      crc = table_[(crc ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+  }
+
+ private:
+  uint32_t table_[256];
+};
+
+const Crc32Table kCrc32;
+
+}  // namespace
+
+bool WriteAll(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool SyncDirectory(const string& path) {
+  size_t slash = path.rfind('/');
+  string dir = (slash == string::npos) ? "." : path.substr(0, slash + 1);
+  int fd = open(dir.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  bool synced = (fsync(fd) == 0);
+  close(fd);
+  return synced;
+}
+
+uint32_t ExtendCrc32(uint32_t crc, const char *data, size_t size) {
+  return kCrc32.Extend(crc, data, size);
+}
+
+int64_t NowMicros() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+}  // namespace kamiah
@@ -0,0 +1,61 @@
+/**
+ * @file util.h
+ * @brief Helpers shared by the modules that write files, check them and keep
+ *     time.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_UTIL_H_
+#define KAMIAH_UTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+using std::string;
+
+namespace kamiah {
+
+/**
+ * @brief Writes all of data to a file descriptor, retrying partial and
+ *     interrupted writes.
+ *
+ * @param fd The file descriptor.
+ * @param data The bytes to write.
+ * @param size The number of bytes to write.
+ * @return True iff all the bytes were written.
+ */
+bool WriteAll(int fd, const char *data, size_t size);
+
+/**
+ * @brief Syncs the directory that holds a file so that the creation of the
+ *     file, or a rename into the directory, is durable.
+ *
+ * @param path The path of the file.
+ * @return True iff the directory was synced.
+ */
+bool SyncDirectory(const string& path);
+
+/**
+ * @brief Computes the CRC-32 (IEEE 802.3) of some bytes, or extends the CRC
+ *     of the bytes before them.
+ *
+ * @param crc The CRC of the bytes before data, 0 if there are none.
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @return The CRC of the bytes before data followed by data.
+ */
+uint32_t ExtendCrc32(uint32_t crc, const char *data, size_t size);
+
+/**
+ * @brief Gets the time of a monotonic clock, to measure time intervals.
+ *
+ * @return The time in microseconds since an arbitrary point.
+ */
+int64_t NowMicros();
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_UTIL_H_
@@ -0,0 +1,61 @@
+/**
+ * @file util_test.cc
+ * @brief Unit tests for the shared helpers.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "util.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+using std::string;
+
+namespace kamiah {
+
+TEST(UtilTest, WriteAll) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  EXPECT_TRUE(WriteAll(fds[1], "hello", 5));
+  EXPECT_TRUE(WriteAll(fds[1], "", 0));
+  char buf[16];
+  ASSERT_EQ(5, read(fds[0], buf, sizeof(buf)));
+  EXPECT_EQ("hello", string(buf, 5));
+  close(fds[0]);
+  close(fds[1]);
+
+  // Closed
+  EXPECT_FALSE(WriteAll(fds[1], "x", 1));
+}
+
+TEST(UtilTest, SyncDirectory) {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/kamiah_util_test.%d",
+           static_cast<int>(getpid()));
+  EXPECT_TRUE(SyncDirectory(path));
+  EXPECT_TRUE(SyncDirectory("relative_file"));
+  EXPECT_FALSE(SyncDirectory("/tmp/kamiah_util_test_missing/file"));
+}
+
+TEST(UtilTest, ExtendCrc32) {
+  EXPECT_EQ(0U, ExtendCrc32(0, "", 0));
+  EXPECT_EQ(0xcbf43926U, ExtendCrc32(0, "123456789", 9));
+
+  // Extending gives the CRC of all the bytes
+  EXPECT_EQ(0xcbf43926U, ExtendCrc32(ExtendCrc32(0, "1234", 4), "56789", 5));
+}
+
+TEST(UtilTest, NowMicros) {
+  int64_t start = NowMicros();
+  usleep(10000);
+  int64_t elapsed = NowMicros() - start;
+  EXPECT_LE(10000, elapsed);
+  EXPECT_GT(10000000, elapsed);
+}
+
+}  // namespace kamiah
@@ -0,0 +1,358 @@
+/**
+ * @file websocket.cc
+ * @brief Implementation of the WebSocket handshake and framing.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "websocket.h"
+
+#include <string.h>
+
+namespace kamiah {
+
+namespace {
+
+// Appended to the key of the client to compute the accept key (RFC 6455).
+const char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+inline uint32_t RotateLeft(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+// Computes the SHA-1 digest of a string. Only used for handshakes, so it
+// favors simplicity over speed.
+void Sha1(const string& input, unsigned char digest[20]) {
+  uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+                   0xc3d2e1f0};
+
+  // Pad to a multiple of 64 bytes, ending with the length in bits
+  string message(input);
+  message.push_back('\x80');
+  while (message.size() % 64 != 56) {
+    message.push_back('\0');
+  }
+  uint64_t bits = static_cast<uint64_t>(input.size()) * 8;
+  for (int i = 7; i >= 0; --i) {
+    message.push_back(static_cast<char>(bits >> (i * 8)));
+  }
+
+  for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+    const unsigned char *p =
+        reinterpret_cast<const unsigned char*>(message.data() + chunk);
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = (static_cast<uint32_t>(p[i * 4]) << 24) |
+             (static_cast<uint32_t>(p[i * 4 + 1]) << 16) |
+             (static_cast<uint32_t>(p[i * 4 + 2]) << 8) |
+             static_cast<uint32_t>(p[i * 4 + 3]);
+    }
+    for (int i = 16; i < 80; ++i) {
+      w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5a827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ed9eba1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8f1bbcdc;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xca62c1d6;
+      }
+      uint32_t temp = RotateLeft(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = RotateLeft(b, 30);
+      b = a;
+      a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  for (int i = 0; i < 5; ++i) {
+    digest[i * 4] = h[i] >> 24;
+    digest[i * 4 + 1] = h[i] >> 16;
+    digest[i * 4 + 2] = h[i] >> 8;
+    digest[i * 4 + 3] = h[i];
+  }
+}
+
+void Base64Encode(const unsigned char *data, size_t size, string *out) {
+  static const char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  for (size_t i = 0; i < size; i += 3) {
+    uint32_t group = static_cast<uint32_t>(data[i]) << 16;
+    if (i + 1 < size) {
+      group |= static_cast<uint32_t>(data[i + 1]) << 8;
+    }
+    if (i + 2 < size) {
+      group |= data[i + 2];
+    }
+    out->push_back(kAlphabet[(group >> 18) & 0x3f]);
+    out->push_back(kAlphabet[(group >> 12) & 0x3f]);
+    out->push_back((i + 1 < size) ? kAlphabet[(group >> 6) & 0x3f] : '=');
+    out->push_back((i + 2 < size) ? kAlphabet[group & 0x3f] : '=');
+  }
+}
+
+inline char ToLower(char c) {
+  return ((c >= 'A') && (c <= 'Z')) ? c - 'A' + 'a' : c;
+}
+
+bool EqualsIgnoreCase(const string& a, const char *b) {
+  size_t size = strlen(b);
+  if (a.size() != size) {
+    return false;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    if (ToLower(a[i]) != ToLower(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether a comma-separated header value contains a token.
+bool HasToken(const string& value, const char *token) {
+  size_t start = 0;
+  while (start <= value.size()) {
+    size_t end = value.find(',', start);
+    if (end == string::npos) {
+      end = value.size();
+    }
+    size_t first = value.find_first_not_of(" \t", start);
+    size_t last = value.find_last_not_of(" \t", end - 1);
+    if ((first < end) && (last != string::npos) && (last >= first) &&
+        EqualsIgnoreCase(value.substr(first, last - first + 1), token)) {
+      return true;
+    }
+    start = end + 1;
+  }
+  return false;
+}
+
+// Masks or unmasks a payload in place. The key is applied 8 bytes at a time.
+void MaskPayload(char *data, size_t size, const unsigned char key[4]) {
+  unsigned char key8[8];
+  for (int i = 0; i < 8; ++i) {
+    key8[i] = key[i % 4];
+  }
+  uint64_t wide_key;
+  memcpy(&wide_key, key8, sizeof(wide_key));
+
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t chunk;
+    memcpy(&chunk, data + i, sizeof(chunk));
+    chunk ^= wide_key;
+    memcpy(data + i, &chunk, sizeof(chunk));
+  }
+  for (; i < size; ++i) {
+    data[i] ^= key[i % 4];
+  }
+}
+
+}  // namespace
+
+string WebSocketAcceptKey(const string& key) {
+  unsigned char digest[20];
+  Sha1(key + kWebSocketGuid, digest);
+  string accept_key;
+  Base64Encode(digest, sizeof(digest), &accept_key);
+  return accept_key;
+}
+
+FrameStatus ParseWebSocketHandshake(const char *data, size_t size,
+                                    string *key, size_t *request_size) {
+  string request(data, (size < kMaxHandshakeSize) ? size : kMaxHandshakeSize);
+  size_t method_size = (request.size() < 4) ? request.size() : 4;
+  if (request.compare(0, method_size, "GET ", method_size) != 0) {
+    return FRAME_INVALID;
+  }
+  size_t end = request.find("\r\n\r\n");
+  if (end == string::npos) {
+    return (size < kMaxHandshakeSize) ? FRAME_INCOMPLETE : FRAME_INVALID;
+  }
+
+  bool upgrade = false;
+  bool connection = false;
+  bool version = false;
+  key->clear();
+
+  // Skip the request line, the headers are all that matter
+  size_t line = request.find("\r\n") + 2;
+  while (line < end) {
+    size_t line_end = request.find("\r\n", line);
+    size_t colon = request.find(':', line);
+    if ((colon == string::npos) || (colon > line_end)) {
+      return FRAME_INVALID;
+    }
+
+    string name = request.substr(line, colon - line);
+    size_t value_start = request.find_first_not_of(" \t", colon + 1);
+    if ((value_start == string::npos) || (value_start > line_end)) {
+      value_start = line_end;
+    }
+    string value = request.substr(value_start, line_end - value_start);
+    while (!value.empty() &&
+           ((value[value.size() - 1] == ' ') ||
+            (value[value.size() - 1] == '\t'))) {
+      value.erase(value.size() - 1);
+    }
+
+    if (EqualsIgnoreCase(name, "Upgrade")) {
+      upgrade = HasToken(value, "websocket");
+    } else if (EqualsIgnoreCase(name, "Connection")) {
+      connection = HasToken(value, "Upgrade");
+    } else if (EqualsIgnoreCase(name, "Sec-WebSocket-Version")) {
+      version = (value == "13");
+    } else if (EqualsIgnoreCase(name, "Sec-WebSocket-Key")) {
+      *key = value;
+    }
+    line = line_end + 2;
+  }
+
+  if (!upgrade || !connection || !version || key->empty()) {
+    return FRAME_INVALID;
+  }
+  *request_size = end + 4;
+  return FRAME_OK;
+}
+
+void AppendWebSocketHandshakeResponse(const string& key, string *out) {
+  out->append("HTTP/1.1 101 Switching Protocols\r\n"
+              "Upgrade: websocket\r\n"
+              "Connection: Upgrade\r\n"
+              "Sec-WebSocket-Accept: ");
+  out->append(WebSocketAcceptKey(key));
+  out->append("\r\n\r\n");
+}
+
+FrameStatus ParseWebSocketFrame(char *data, size_t size,
+                                WebSocketFrame *frame) {
+  const unsigned char *p = reinterpret_cast<const unsigned char*>(data);
+  if (size < 2) {
+    return FRAME_INCOMPLETE;
+  }
+
+  // No extensions are negotiated, so the reserved bits must be clear
+  if ((p[0] & 0x70) != 0) {
+    return FRAME_INVALID;
+  }
+  frame->fin = (p[0] & 0x80) != 0;
+  frame->masked = (p[1] & 0x80) != 0;
+  int opcode = p[0] & 0x0f;
+  switch (opcode) {
+    case WS_CONTINUATION:
+    case WS_TEXT:
+    case WS_BINARY:
+      break;
+    case WS_CLOSE:
+    case WS_PING:
+    case WS_PONG:
+      // Control frames are never fragmented and have short payloads
+      if (!frame->fin || ((p[1] & 0x7f) > 125)) {
+        return FRAME_INVALID;
+      }
+      break;
+    default:
+      return FRAME_INVALID;
+  }
+  frame->opcode = static_cast<WebSocketOpcode>(opcode);
+
+  size_t header_size = 2;
+  uint64_t payload_size = p[1] & 0x7f;
+  if (payload_size == 126) {
+    header_size += 2;
+    if (size < header_size) {
+      return FRAME_INCOMPLETE;
+    }
+    payload_size = (static_cast<uint64_t>(p[2]) << 8) | p[3];
+  } else if (payload_size == 127) {
+    header_size += 8;
+    if (size < header_size) {
+      return FRAME_INCOMPLETE;
+    }
+    payload_size = 0;
+    for (int i = 0; i < 8; ++i) {
+      payload_size = (payload_size << 8) | p[2 + i];
+    }
+  }
+  if (payload_size > kMaxFrameSize) {
+    return FRAME_INVALID;
+  }
+
+  const unsigned char *mask_key = p + header_size;
+  if (frame->masked) {
+    header_size += 4;
+  }
+  if ((size < header_size) || (size - header_size < payload_size)) {
+    return FRAME_INCOMPLETE;
+  }
+
+  frame->payload = data + header_size;
+  frame->payload_size = payload_size;
+  frame->frame_size = header_size + payload_size;
+  if (frame->masked) {
+    MaskPayload(data + header_size, payload_size, mask_key);
+  }
+  return FRAME_OK;
+}
+
+void AppendWebSocketFrameHeader(WebSocketOpcode opcode, uint64_t payload_size,
+                                string *out) {
+  out->push_back(static_cast<char>(0x80 | opcode));
+  if (payload_size < 126) {
+    out->push_back(static_cast<char>(payload_size));
+  } else if (payload_size <= 0xffff) {
+    out->push_back(static_cast<char>(126));
+    out->push_back(static_cast<char>(payload_size >> 8));
+    out->push_back(static_cast<char>(payload_size));
+  } else {
+    out->push_back(static_cast<char>(127));
+    for (int i = 7; i >= 0; --i) {
+      out->push_back(static_cast<char>(payload_size >> (i * 8)));
+    }
+  }
+}
+
+void AppendWebSocketFrame(WebSocketOpcode opcode, const string& payload,
+                          string *out) {
+  AppendWebSocketFrameHeader(opcode, payload.size(), out);
+  out->append(payload);
+}
+
+void AppendMaskedWebSocketFrame(WebSocketOpcode opcode, bool fin,
+                                const string& payload, uint32_t mask_key,
+                                string *out) {
+  size_t start = out->size();
+  AppendWebSocketFrameHeader(opcode, payload.size(), out);
+  if (!fin) {
+    (*out)[start] &= 0x7f;
+  }
+  (*out)[start + 1] |= 0x80;
+
+  unsigned char key[4];
+  for (int i = 0; i < 4; ++i) {
+    key[i] = mask_key >> (24 - i * 8);
+    out->push_back(static_cast<char>(key[i]));
+  }
+  size_t payload_start = out->size();
+  out->append(payload);
+  MaskPayload(&(*out)[payload_start], payload.size(), key);
+}
+
+}  // namespace kamiah
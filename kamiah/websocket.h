@@ -0,0 +1,130 @@
+/**
+ * @file websocket.h
+ * @brief The parts of the WebSocket protocol (RFC 6455) used by the Server:
+ *     the opening handshake and framing.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_WEBSOCKET_H_
+#define KAMIAH_WEBSOCKET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "protocol.h"
+
+using std::string;
+
+namespace kamiah {
+
+// Largest opening handshake request that will be accepted.
+const size_t kMaxHandshakeSize = 8 * 1024;
+
+enum WebSocketOpcode {
+  WS_CONTINUATION = 0x0,
+  WS_TEXT = 0x1,
+  WS_BINARY = 0x2,
+  WS_CLOSE = 0x8,
+  WS_PING = 0x9,
+  WS_PONG = 0xa
+};
+
+/**
+ * @brief Computes the Sec-WebSocket-Accept value for a Sec-WebSocket-Key.
+ *
+ * @param key The Sec-WebSocket-Key sent by the client.
+ * @return The value of the Sec-WebSocket-Accept header of the response.
+ */
+string WebSocketAcceptKey(const string& key);
+
+/**
+ * @brief Parses the opening handshake request at the start of a buffer.
+ *
+ * @param data The start of the buffer.
+ * @param size The number of bytes in the buffer.
+ * @param key Where to write the Sec-WebSocket-Key of the request.
+ * @param request_size Where to write the number of bytes of the request.
+ * @return FRAME_OK if a valid request was parsed, FRAME_INCOMPLETE if more
+ *     bytes are needed, or FRAME_INVALID if the request is not a WebSocket
+ *     version 13 upgrade request.
+ */
+FrameStatus ParseWebSocketHandshake(const char *data, size_t size,
+                                    string *key, size_t *request_size);
+
+/**
+ * @brief Appends the response to an opening handshake request.
+ *
+ * @param key The Sec-WebSocket-Key of the request.
+ * @param out String to append the response to.
+ */
+void AppendWebSocketHandshakeResponse(const string& key, string *out);
+
+/**
+ * @brief A parsed WebSocket frame. The payload references the buffer it was
+ *     parsed from.
+ */
+struct WebSocketFrame {
+  bool fin;
+  WebSocketOpcode opcode;
+  bool masked;
+  const char *payload;
+  size_t payload_size;
+
+  // Total number of bytes of the frame, including its header.
+  size_t frame_size;
+};
+
+/**
+ * @brief Parses the WebSocket frame at the start of a buffer. Masked
+ *     payloads are unmasked in place.
+ *
+ * @param data The start of the buffer.
+ * @param size The number of bytes in the buffer.
+ * @param frame Where to write the frame.
+ * @return FRAME_OK if a frame was parsed, FRAME_INCOMPLETE if more bytes are
+ *     needed, or FRAME_INVALID if the buffer does not start with a valid
+ *     frame or the frame is larger than kMaxFrameSize.
+ */
+FrameStatus ParseWebSocketFrame(char *data, size_t size,
+                                WebSocketFrame *frame);
+
+/**
+ * @brief Appends the header of an unmasked, final frame to a string. The
+ *     payload must follow it. Servers send unmasked frames.
+ *
+ * @param opcode The opcode of the frame.
+ * @param payload_size The number of bytes of payload.
+ * @param out String to append the header to.
+ */
+void AppendWebSocketFrameHeader(WebSocketOpcode opcode, uint64_t payload_size,
+                                string *out);
+
+/**
+ * @brief Appends an unmasked, final frame to a string.
+ *
+ * @param opcode The opcode of the frame.
+ * @param payload The payload of the frame.
+ * @param out String to append the frame to.
+ */
+void AppendWebSocketFrame(WebSocketOpcode opcode, const string& payload,
+                          string *out);
+
+/**
+ * @brief Appends a masked frame to a string. Clients send masked frames.
+ *
+ * @param opcode The opcode of the frame.
+ * @param fin Whether this is the final frame of the message.
+ * @param payload The payload of the frame.
+ * @param mask_key The masking key.
+ * @param out String to append the frame to.
+ */
+void AppendMaskedWebSocketFrame(WebSocketOpcode opcode, bool fin,
+                                const string& payload, uint32_t mask_key,
+                                string *out);
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_WEBSOCKET_H_
@@ -0,0 +1,152 @@
+/**
+ * @file websocket_test.cc
+ * @brief Unit tests for the WebSocket handshake and framing.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "websocket.h"
+
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+namespace {
+
+const char kRequest[] =
+    "GET /kamiah HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Upgrade: websocket\r\n"
+    "Connection: keep-alive, Upgrade\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "\r\n";
+
+}  // namespace
+
+TEST(WebSocketTest, AcceptKey) {
+  // Example from RFC 6455
+  EXPECT_EQ("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=",
+            WebSocketAcceptKey("dGhlIHNhbXBsZSBub25jZQ=="));
+}
+
+TEST(WebSocketTest, Handshake) {
+  string request = string(kRequest) + "extra";
+  string key;
+  size_t request_size = 0;
+  ASSERT_EQ(FRAME_OK, ParseWebSocketHandshake(request.data(), request.size(),
+                                              &key, &request_size));
+  EXPECT_EQ("dGhlIHNhbXBsZSBub25jZQ==", key);
+  EXPECT_EQ(request.size() - 5, request_size);
+
+  for (size_t size = 0; size < request_size; ++size) {
+    EXPECT_EQ(FRAME_INCOMPLETE,
+              ParseWebSocketHandshake(request.data(), size, &key,
+                                      &request_size)) << size;
+  }
+
+  string response;
+  AppendWebSocketHandshakeResponse(key, &response);
+  EXPECT_EQ("HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n\r\n",
+            response);
+}
+
+TEST(WebSocketTest, InvalidHandshake) {
+  const char *invalid[] = {
+    "POST / HTTP/1.1\r\n\r\n",
+    "GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n",
+    "GET / HTTP/1.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Key: abc\r\nSec-WebSocket-Version: 8\r\n\r\n",
+    "GET / HTTP/1.1\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Key: abc\r\nSec-WebSocket-Version: 13\r\n\r\n",
+    "GET / HTTP/1.1\r\nno colon\r\n\r\n",
+  };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+    string request = invalid[i];
+    string key;
+    size_t request_size;
+    EXPECT_EQ(FRAME_INVALID,
+              ParseWebSocketHandshake(request.data(), request.size(), &key,
+                                      &request_size)) << request;
+  }
+
+  // Never ends
+  string request = "GET / HTTP/1.1\r\n" + string(kMaxHandshakeSize, 'a');
+  string key;
+  size_t request_size;
+  EXPECT_EQ(FRAME_INVALID, ParseWebSocketHandshake(
+      request.data(), request.size(), &key, &request_size));
+}
+
+TEST(WebSocketTest, UnmaskedFrames) {
+  // Payload sizes around the 7, 16 and 64 bit length encodings
+  const size_t kSizes[] = {0, 1, 125, 126, 127, 65535, 65536, 100000};
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); ++i) {
+    string payload(kSizes[i], 'x');
+    string data;
+    AppendWebSocketFrame(WS_TEXT, payload, &data);
+
+    WebSocketFrame frame;
+    for (size_t size = 0; size < data.size(); size += 1 + size / 2) {
+      EXPECT_EQ(FRAME_INCOMPLETE, ParseWebSocketFrame(&data[0], size, &frame));
+    }
+    ASSERT_EQ(FRAME_OK, ParseWebSocketFrame(&data[0], data.size(), &frame));
+    EXPECT_TRUE(frame.fin);
+    EXPECT_FALSE(frame.masked);
+    EXPECT_EQ(WS_TEXT, frame.opcode);
+    EXPECT_EQ(data.size(), frame.frame_size);
+    EXPECT_EQ(payload, string(frame.payload, frame.payload_size));
+  }
+}
+
+TEST(WebSocketTest, MaskedFrames) {
+  string payload = "{\"doc_id\":1,\"subscribe\":0} and some more text";
+  string data;
+  AppendMaskedWebSocketFrame(WS_TEXT, false, payload, 0x37fa213d, &data);
+  AppendMaskedWebSocketFrame(WS_CONTINUATION, true, "!", 0x01020304, &data);
+
+  // The payload is not sent in the clear
+  EXPECT_EQ(string::npos, data.find("doc_id"));
+
+  WebSocketFrame frame;
+  ASSERT_EQ(FRAME_OK, ParseWebSocketFrame(&data[0], data.size(), &frame));
+  EXPECT_FALSE(frame.fin);
+  EXPECT_TRUE(frame.masked);
+  EXPECT_EQ(WS_TEXT, frame.opcode);
+  EXPECT_EQ(payload, string(frame.payload, frame.payload_size));
+
+  size_t offset = frame.frame_size;
+  ASSERT_EQ(FRAME_OK, ParseWebSocketFrame(&data[offset], data.size() - offset,
+                                          &frame));
+  EXPECT_TRUE(frame.fin);
+  EXPECT_EQ(WS_CONTINUATION, frame.opcode);
+  EXPECT_EQ("!", string(frame.payload, frame.payload_size));
+  EXPECT_EQ(data.size() - offset, frame.frame_size);
+}
+
+TEST(WebSocketTest, InvalidFrames) {
+  const string invalid[] = {
+    // Reserved bits
+    string("\xc1\x00", 2),
+    // Unknown opcode
+    string("\x83\x00", 2),
+    // Fragmented control frame
+    string("\x09\x00", 2),
+    // Long control frame
+    string("\x89\x7e\x00\x80", 4),
+    // Larger than kMaxFrameSize
+    string("\x82\x7f\x00\x00\x00\x00\x10\x00\x00\x00", 10),
+  };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+    string data = invalid[i];
+    WebSocketFrame frame;
+    EXPECT_EQ(FRAME_INVALID, ParseWebSocketFrame(&data[0], data.size(),
+                                                 &frame)) << i;
+  }
+}
+
+}  // namespace kamiah
@@ -0,0 +1,197 @@
+/**
+ * @file wire_format.cc
+ * @brief Implementation of the binary serialization of Diffs.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "wire_format.h"
+
+namespace kamiah {
+
+namespace {
+
+// Maximum number of bytes in a 64-bit varint.
+const int kMaxVarint64Bytes = 10;
+
+// Encoding of Diff::Type.
+const char kInsertType = 0;
+const char kDeleteType = 1;
+
+uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ (value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Encodes a diff given the version and index to write for it.
+void EncodeDiffFields(const Diff& diff, int64_t version, int64_t index,
+                      string *out) {
+  PutSignedVarint64(version, out);
+  if (diff.type() == Diff::INSERT) {
+    out->push_back(kInsertType);
+    PutSignedVarint64(index, out);
+    PutVarint64(diff.text().size(), out);
+    out->append(diff.text());
+  } else {
+    out->push_back(kDeleteType);
+    PutSignedVarint64(index, out);
+    PutSignedVarint64(diff.length(), out);
+  }
+}
+
+// Decodes a diff. The version and index are left as they were encoded.
+bool DecodeDiffFields(const char **data, const char *limit, DiffView *view) {
+  const char *p = *data;
+  if (!GetSignedVarint64(&p, limit, &view->version) || (p == limit)) {
+    return false;
+  }
+
+  char type = *p++;
+  if (!GetSignedVarint64(&p, limit, &view->index)) {
+    return false;
+  }
+
+  if (type == kInsertType) {
+    uint64_t size;
+    if (!GetVarint64(&p, limit, &size) ||
+        (size > static_cast<uint64_t>(limit - p))) {
+      return false;
+    }
+    view->type = Diff::INSERT;
+    view->length = 0;
+    view->text = p;
+    view->text_size = size;
+    p += size;
+  } else if (type == kDeleteType) {
+    if (!GetSignedVarint64(&p, limit, &view->length)) {
+      return false;
+    }
+    view->type = Diff::DELETE;
+    view->text = NULL;
+    view->text_size = 0;
+  } else {
+    return false;
+  }
+
+  *data = p;
+  return true;
+}
+
+}  // namespace
+
+void PutVarint64(uint64_t value, string *out) {
+  char buf[kMaxVarint64Bytes];
+  int size = 0;
+  while (value >= 0x80) {
+    buf[size++] = static_cast<char>(value | 0x80);
+    value >>= 7;
+  }
+  buf[size++] = static_cast<char>(value);
+  out->append(buf, size);
+}
+
+void PutSignedVarint64(int64_t value, string *out) {
+  PutVarint64(ZigZag(value), out);
+}
+
+bool GetVarint64(const char **data, const char *limit, uint64_t *value) {
+  const char *p = *data;
+  uint64_t result = 0;
+  for (int shift = 0; (shift < 7 * kMaxVarint64Bytes) && (p < limit);
+       shift += 7) {
+    uint64_t byte = static_cast<unsigned char>(*p++);
+    result |= (byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      *value = result;
+      *data = p;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool GetSignedVarint64(const char **data, const char *limit, int64_t *value) {
+  uint64_t zigzag;
+  if (!GetVarint64(data, limit, &zigzag)) {
+    return false;
+  }
+  *value = UnZigZag(zigzag);
+  return true;
+}
+
+Diff DiffView::ToDiff() const {
+  if (type == Diff::INSERT) {
+    Diff diff(index, string(text, text_size));
+    diff.set_version(version);
+    return diff;
+  }
+
+  Diff diff(index, length);
+  diff.set_version(version);
+  return diff;
+}
+
+void EncodeDiff(const Diff& diff, string *out) {
+  EncodeDiffFields(diff, diff.version(), diff.index(), out);
+}
+
+bool DecodeDiff(const char **data, const char *limit, DiffView *view) {
+  return DecodeDiffFields(data, limit, view);
+}
+
+void EncodeUpdates(const list<Diff>& updates, string *out) {
+  PutVarint64(updates.size(), out);
+
+  Version last_version = 0;
+  Index last_index = 0;
+  for (list<Diff>::const_iterator it = updates.begin(); it != updates.end();
+       ++it) {
+    EncodeDiffFields(*it, it->version() - last_version,
+                     it->index() - last_index, out);
+    last_version = it->version();
+    last_index = it->index();
+  }
+}
+
+bool DecodeUpdates(const char **data, const char *limit,
+                   vector<DiffView> *updates) {
+  const char *p = *data;
+  uint64_t count;
+  if (!GetVarint64(&p, limit, &count)) {
+    return false;
+  }
+
+  // Every diff takes at least 4 bytes, do not trust a count that cannot fit
+  if (count > static_cast<uint64_t>(limit - p) / 4) {
+    return false;
+  }
+
+  updates->reserve(updates->size() + count);
+  Version last_version = 0;
+  Index last_index = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    DiffView view;
+    if (!DecodeDiffFields(&p, limit, &view)) {
+      return false;
+    }
+    view.version += last_version;
+    view.index += last_index;
+    last_version = view.version;
+    last_index = view.index;
+    updates->push_back(view);
+  }
+
+  *data = p;
+  return true;
+}
+
+void WireFormatEncoder::Encode(DocID doc_id, const Diff& diff,
+                               string *out) const {
+  PutVarint64(doc_id, out);
+  EncodeDiff(diff, out);
+}
+
+}  // namespace kamiah
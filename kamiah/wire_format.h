@@ -0,0 +1,156 @@
+/**
+ * @file wire_format.h
+ * @brief Compact binary serialization of Diffs and lists of updates.
+ *
+ * All integers are encoded as base-128 varints, signed ones zig-zag encoded
+ * first so that small negative values stay small. A single diff is encoded
+ * as:
+ *
+ *   version     zig-zag varint
+ *   type        one byte, 0 for INSERT and 1 for DELETE
+ *   index       zig-zag varint
+ *   INSERT:     varint text size followed by the text bytes
+ *   DELETE:     zig-zag varint length
+ *
+ * A batch of updates (the result of Document::GetUpdates()) is a varint
+ * count followed by the diffs, where the version and the index of each diff
+ * are encoded as the difference from those of the previous diff in the batch
+ * (the first one from zero). Consecutive versions take a single byte, and so
+ * do the indices of consecutive keystrokes.
+ *
+ * Decoding is zero-copy: a DiffView references the text in the buffer it was
+ * decoded from.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_WIRE_FORMAT_H_
+#define KAMIAH_WIRE_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "diff.h"
+#include "diff_encoder.h"
+#include "types.h"
+
+using std::list;
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief Appends a varint to a string.
+ *
+ * @param value The value to encode.
+ * @param out String to append the varint to.
+ */
+void PutVarint64(uint64_t value, string *out);
+
+/**
+ * @brief Appends a zig-zag encoded varint to a string.
+ *
+ * @param value The value to encode.
+ * @param out String to append the varint to.
+ */
+void PutSignedVarint64(int64_t value, string *out);
+
+/**
+ * @brief Reads a varint.
+ *
+ * @param data Pointer to the start of the varint. Advanced past it on
+ *     success.
+ * @param limit Pointer past the last readable byte.
+ * @param value Where to write the value.
+ * @return True iff a well-formed varint was read.
+ */
+bool GetVarint64(const char **data, const char *limit, uint64_t *value);
+
+/**
+ * @brief Reads a zig-zag encoded varint. Same semantics as GetVarint64().
+ */
+bool GetSignedVarint64(const char **data, const char *limit, int64_t *value);
+
+/**
+ * @brief A DiffView is a decoded Diff whose text references the buffer it
+ *     was decoded from. It is only valid for as long as that buffer is.
+ */
+struct DiffView {
+  Version version;
+  Diff::Type type;
+  Index index;
+
+  // Only used for DELETE diffs.
+  Length length;
+
+  // Only used for INSERT diffs.
+  const char *text;
+  size_t text_size;
+
+  /**
+   * @brief Copies the view into a Diff.
+   *
+   * @return A Diff with the contents of the view.
+   */
+  Diff ToDiff() const;
+};
+
+/**
+ * @brief Appends the encoding of a diff to a string.
+ *
+ * @param diff The diff to encode.
+ * @param out String to append the encoded diff to.
+ */
+void EncodeDiff(const Diff& diff, string *out);
+
+/**
+ * @brief Decodes a diff.
+ *
+ * @param data Pointer to the start of the encoded diff. Advanced past it on
+ *     success.
+ * @param limit Pointer past the last readable byte.
+ * @param view Where to write the decoded diff.
+ * @return True iff a well-formed diff was read.
+ */
+bool DecodeDiff(const char **data, const char *limit, DiffView *view);
+
+/**
+ * @brief Appends the encoding of a batch of updates to a string.
+ *
+ * @param updates The updates to encode, usually from Document::GetUpdates().
+ * @param out String to append the encoded batch to.
+ */
+void EncodeUpdates(const list<Diff>& updates, string *out);
+
+/**
+ * @brief Decodes a batch of updates.
+ *
+ * @param data Pointer to the start of the encoded batch. Advanced past it on
+ *     success.
+ * @param limit Pointer past the last readable byte.
+ * @param updates Vector in which to write the decoded diffs.
+ * @return True iff a well-formed batch was read. The contents of updates are
+ *     undefined otherwise.
+ */
+bool DecodeUpdates(const char **data, const char *limit,
+                   vector<DiffView> *updates);
+
+/**
+ * @brief A WireFormatEncoder encodes a diff as the varint DocID of its
+ *     Document followed by the encoding of the diff.
+ *
+ * This class is thread-safe.
+ */
+class WireFormatEncoder : public DiffEncoder {
+ public:
+  virtual void Encode(DocID doc_id, const Diff& diff, string *out) const;
+};
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_WIRE_FORMAT_H_
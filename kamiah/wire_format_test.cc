@@ -0,0 +1,225 @@
+/**
+ * @file wire_format_test.cc
+ * @brief Unit tests for the binary serialization of Diffs.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "wire_format.h"
+
+#include "gtest/gtest.h"
+
+namespace kamiah {
+
+// Decodes a single varint from the whole string.
+bool DecodeVarint(const string& encoded, uint64_t *value) {
+  const char *p = encoded.data();
+  const char *limit = p + encoded.size();
+  return GetVarint64(&p, limit, value) && (p == limit);
+}
+
+TEST(WireFormatTest, Varints) {
+  uint64_t values[] = { 0, 1, 127, 128, 300, 1ULL << 32, ~0ULL };
+  size_t sizes[] = { 1, 1, 1, 2, 2, 5, 10 };
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    string encoded;
+    PutVarint64(values[i], &encoded);
+    EXPECT_EQ(sizes[i], encoded.size());
+
+    uint64_t decoded;
+    EXPECT_TRUE(DecodeVarint(encoded, &decoded));
+    EXPECT_EQ(values[i], decoded);
+  }
+}
+
+TEST(WireFormatTest, SignedVarints) {
+  int64_t values[] = { 0, -1, 1, -64, 63, 64, -12345678 };
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    string encoded;
+    PutSignedVarint64(values[i], &encoded);
+
+    const char *p = encoded.data();
+    int64_t decoded;
+    EXPECT_TRUE(GetSignedVarint64(&p, p + encoded.size(), &decoded));
+    EXPECT_EQ(values[i], decoded);
+  }
+
+  // Small negative values stay small
+  string encoded;
+  PutSignedVarint64(-1, &encoded);
+  EXPECT_EQ(1U, encoded.size());
+}
+
+TEST(WireFormatTest, TruncatedVarint) {
+  string encoded;
+  PutVarint64(300, &encoded);
+  encoded.resize(1);
+
+  uint64_t value;
+  EXPECT_FALSE(DecodeVarint(encoded, &value));
+  EXPECT_FALSE(DecodeVarint("", &value));
+
+  // Too many continuation bytes
+  EXPECT_FALSE(DecodeVarint(string(11, '\x80'), &value));
+}
+
+TEST(WireFormatTest, InsertRoundTrip) {
+  Diff diff(100, "papaya");
+  diff.set_version(5);
+  string encoded;
+  EncodeDiff(diff, &encoded);
+
+  // version, type, index (2 bytes), text size and text
+  EXPECT_EQ(1 + 1 + 2 + 1 + strlen("papaya"), encoded.size());
+
+  const char *p = encoded.data();
+  DiffView view;
+  ASSERT_TRUE(DecodeDiff(&p, p + encoded.size(), &view));
+  EXPECT_EQ(encoded.data() + encoded.size(), p);
+  EXPECT_EQ(5, view.version);
+  EXPECT_EQ(Diff::INSERT, view.type);
+  EXPECT_EQ(100, view.index);
+  EXPECT_EQ("papaya", string(view.text, view.text_size));
+
+  // The text is not copied
+  EXPECT_EQ(encoded.data() + encoded.size() - strlen("papaya"), view.text);
+
+  Diff decoded = view.ToDiff();
+  EXPECT_EQ(5, decoded.version());
+  EXPECT_EQ(Diff::INSERT, decoded.type());
+  EXPECT_EQ(100, decoded.index());
+  EXPECT_EQ("papaya", decoded.text());
+}
+
+TEST(WireFormatTest, DeleteRoundTrip) {
+  // Diffs that have not been applied have no version yet
+  Diff diff(12, 10);
+  string encoded;
+  EncodeDiff(diff, &encoded);
+  EXPECT_EQ(4U, encoded.size());
+
+  const char *p = encoded.data();
+  DiffView view;
+  ASSERT_TRUE(DecodeDiff(&p, p + encoded.size(), &view));
+  Diff decoded = view.ToDiff();
+  EXPECT_EQ(-1, decoded.version());
+  EXPECT_EQ(Diff::DELETE, decoded.type());
+  EXPECT_EQ(12, decoded.index());
+  EXPECT_EQ(10, decoded.length());
+}
+
+TEST(WireFormatTest, MalformedDiffs) {
+  Diff diff(100, "papaya");
+  string encoded;
+  EncodeDiff(diff, &encoded);
+
+  // Every truncation is rejected
+  for (size_t size = 0; size < encoded.size(); ++size) {
+    const char *p = encoded.data();
+    DiffView view;
+    EXPECT_FALSE(DecodeDiff(&p, p + size, &view));
+    EXPECT_EQ(encoded.data(), p);
+  }
+
+  // Unknown type
+  encoded[1] = 7;
+  const char *p = encoded.data();
+  DiffView view;
+  EXPECT_FALSE(DecodeDiff(&p, p + encoded.size(), &view));
+}
+
+TEST(WireFormatTest, UpdatesRoundTrip) {
+  // Typing "papaya" one keystroke at a time and deleting "ya"
+  list<Diff> updates;
+  for (int i = 0; i < 6; ++i) {
+    Diff diff(1000 + i, string(1, "papaya"[i]));
+    diff.set_version(500 + i);
+    updates.push_back(diff);
+  }
+  Diff delete_diff(1004, 2);
+  delete_diff.set_version(506);
+  updates.push_back(delete_diff);
+
+  string encoded;
+  EncodeUpdates(updates, &encoded);
+
+  // Count, a first diff with the full version and index, then 5 bytes per
+  // keystroke and 4 for the delete.
+  string first;
+  EncodeDiff(updates.front(), &first);
+  EXPECT_EQ(1 + first.size() + 5 * 5 + 4, encoded.size());
+
+  const char *p = encoded.data();
+  vector<DiffView> views;
+  ASSERT_TRUE(DecodeUpdates(&p, p + encoded.size(), &views));
+  EXPECT_EQ(encoded.data() + encoded.size(), p);
+  ASSERT_EQ(updates.size(), views.size());
+
+  list<Diff>::const_iterator it = updates.begin();
+  for (size_t i = 0; i < views.size(); ++i, ++it) {
+    Diff decoded = views[i].ToDiff();
+    EXPECT_EQ(it->version(), decoded.version());
+    EXPECT_EQ(it->type(), decoded.type());
+    EXPECT_EQ(it->index(), decoded.index());
+    if (it->type() == Diff::INSERT) {
+      EXPECT_EQ(it->text(), decoded.text());
+    } else {
+      EXPECT_EQ(it->length(), decoded.length());
+    }
+  }
+}
+
+TEST(WireFormatTest, EmptyUpdates) {
+  string encoded;
+  EncodeUpdates(list<Diff>(), &encoded);
+  EXPECT_EQ(1U, encoded.size());
+
+  const char *p = encoded.data();
+  vector<DiffView> views;
+  EXPECT_TRUE(DecodeUpdates(&p, p + encoded.size(), &views));
+  EXPECT_TRUE(views.empty());
+}
+
+TEST(WireFormatTest, MalformedUpdates) {
+  list<Diff> updates;
+  updates.push_back(Diff(0, "papaya"));
+  updates.push_back(Diff(0, 2));
+  string encoded;
+  EncodeUpdates(updates, &encoded);
+
+  for (size_t size = 0; size < encoded.size(); ++size) {
+    const char *p = encoded.data();
+    vector<DiffView> views;
+    EXPECT_FALSE(DecodeUpdates(&p, p + size, &views));
+  }
+
+  // A count larger than what the buffer can hold
+  string bad_count;
+  PutVarint64(1000, &bad_count);
+  bad_count.append(16, '\0');
+  const char *p = bad_count.data();
+  vector<DiffView> views;
+  EXPECT_FALSE(DecodeUpdates(&p, p + bad_count.size(), &views));
+}
+
+TEST(WireFormatTest, WireFormatEncoder) {
+  WireFormatEncoder encoder;
+  Diff diff(3, "papaya");
+  diff.set_version(2);
+
+  string encoded;
+  encoder.Encode(13, diff, &encoded);
+
+  const char *p = encoded.data();
+  const char *limit = p + encoded.size();
+  uint64_t doc_id;
+  DiffView view;
+  ASSERT_TRUE(GetVarint64(&p, limit, &doc_id));
+  ASSERT_TRUE(DecodeDiff(&p, limit, &view));
+  EXPECT_EQ(13U, doc_id);
+  EXPECT_EQ(2, view.version);
+  EXPECT_EQ(3, view.index);
+  EXPECT_EQ(limit, p);
+}
+
+}  // namespace kamiah
@@ -0,0 +1,165 @@
+/**
+ * @file workspace_search.cc
+ * @brief Implementation of the search of many Documents.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "workspace_search.h"
+
+#include <algorithm>
+
+#include "mutex.h"
+#include "scheduler.h"
+#include "trigram_index.h"
+
+using std::min;
+
+namespace kamiah {
+
+namespace {
+
+// A part of a Document to search. Documents with a TrigramIndex are searched
+// as a whole and have an end of -1.
+struct Slice {
+  const Document *doc;
+  Index start;
+  Index end;
+};
+
+// State shared by the tasks of a search.
+class Search {
+ public:
+  Search(const vector<Slice>& slices, size_t max_matches,
+         SearchListener *listener, int num_tasks)
+      : slices_(slices), max_matches_(max_matches), listener_(listener),
+        done_cv_(&mu_), next_(0), found_(0), running_(num_tasks),
+        stopped_(false) {}
+
+  // Gets the next slice to search. Returns false once there are none left
+  // or the search stopped.
+  bool Next(const Slice **slice) {
+    MutexLock l(&mu_);
+    if (stopped_ || (next_ == slices_.size())) {
+      return false;
+    }
+    *slice = &slices_[next_++];
+    return true;
+  }
+
+  // Sends the matches of a slice to the listener, up to the limit.
+  void Report(DocID doc_id, vector<Index> *matches) {
+    MutexLock l(&mu_);
+    if (stopped_ || matches->empty()) {
+      return;
+    }
+    if ((max_matches_ > 0) && (found_ + matches->size() > max_matches_)) {
+      matches->resize(max_matches_ - found_);
+    }
+    found_ += matches->size();
+    if (!listener_->OnSearchMatches(doc_id, *matches) ||
+        (found_ == max_matches_)) {
+      stopped_ = true;
+    }
+  }
+
+  // Called by every task when it is done.
+  void Done() {
+    MutexLock l(&mu_);
+    if (--running_ == 0) {
+      done_cv_.SignalAll();
+    }
+  }
+
+  // Waits until all the tasks are done and gets the number of matches
+  // found.
+  size_t Wait() {
+    MutexLock l(&mu_);
+    while (running_ > 0) {
+      done_cv_.Wait();
+    }
+    return found_;
+  }
+
+ private:
+  const vector<Slice>& slices_;
+  size_t max_matches_;
+  SearchListener *listener_;
+
+  Mutex mu_;
+  CondVar done_cv_;
+  size_t next_;
+  size_t found_;
+  int running_;
+  bool stopped_;
+};
+
+// Searches slices until there are none left.
+class SearchTask : public Task {
+ public:
+  SearchTask(Search *search, const string& text)
+      : search_(search), text_(text) {}
+
+  virtual void Run() {
+    const Slice *slice;
+    vector<Index> matches;
+    while (search_->Next(&slice)) {
+      matches.clear();
+      if (slice->end < 0) {
+        slice->doc->Find(text_, &matches);
+      } else {
+        FindInText(slice->doc->text(), text_, slice->start, slice->end,
+                   &matches);
+      }
+      search_->Report(slice->doc->doc_id(), &matches);
+    }
+    search_->Done();
+  }
+
+ private:
+  Search *search_;
+  const string& text_;
+};
+
+}  // namespace
+
+SearchOptions::SearchOptions() : max_matches(0), slice_size(1 << 20) {
+}
+
+size_t SearchWorkspace(const vector<const Document*>& docs,
+                       const string& text, const SearchOptions& options,
+                       ThreadPool *pool, SearchListener *listener) {
+  if (text.empty()) {
+    return 0;
+  }
+  vector<Slice> slices;
+  for (size_t i = 0; i < docs.size(); ++i) {
+    Slice slice;
+    slice.doc = docs[i];
+    if (docs[i]->has_search_index()) {
+      slice.start = 0;
+      slice.end = -1;
+      slices.push_back(slice);
+      continue;
+    }
+    Length slice_size = (options.slice_size > 0) ? options.slice_size :
+        docs[i]->size();
+    for (Index start = 0; start < docs[i]->size(); start += slice_size) {
+      slice.start = start;
+      slice.end = min(start + slice_size, docs[i]->size());
+      slices.push_back(slice);
+    }
+  }
+  if (slices.empty()) {
+    return 0;
+  }
+
+  int num_tasks = min<size_t>(pool->num_threads(), slices.size());
+  Search search(slices, options.max_matches, listener, num_tasks);
+  for (int i = 0; i < num_tasks; ++i) {
+    pool->Schedule(new SearchTask(&search, text));
+  }
+  return search.Wait();
+}
+
+}  // namespace kamiah
@@ -0,0 +1,89 @@
+/**
+ * @file workspace_search.h
+ * @brief Search of a string in many Documents at once using all the threads
+ *     of a ThreadPool.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#ifndef KAMIAH_WORKSPACE_SEARCH_H_
+#define KAMIAH_WORKSPACE_SEARCH_H_
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "document.h"
+#include "thread_pool.h"
+#include "types.h"
+
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+/**
+ * @brief A SearchListener receives the matches of a search as they are
+ *     found.
+ */
+class SearchListener {
+ public:
+  virtual ~SearchListener() {}
+
+  /**
+   * @brief Called with some of the matches in a Document. The matches of a
+   *     Document may come in several calls and the calls for different
+   *     Documents may be interleaved. Calls are made from the threads of the
+   *     pool, but never concurrently.
+   *
+   * @param doc_id The Document the matches are in.
+   * @param matches The index of every match, in order.
+   * @return True to go on with the search, false to stop it.
+   */
+  virtual bool OnSearchMatches(DocID doc_id,
+                               const vector<Index>& matches) = 0;
+};
+
+/**
+ * @brief Options of a search.
+ */
+struct SearchOptions {
+  SearchOptions();
+
+  // Number of matches after which the search stops, 0 for no limit.
+  size_t max_matches;
+
+  // Documents without a TrigramIndex are split into slices of this many
+  // characters so that a large Document is searched by several threads. If
+  // zero or less, each Document is searched as a single slice.
+  Length slice_size;
+};
+
+/**
+ * @brief Finds all the occurrences of a string in some Documents.
+ *
+ * The Documents are split into slices that the threads of the pool take
+ * one at a time, so threads that finish early take on the work of the
+ * others. Documents with a TrigramIndex are searched with it and the rest
+ * are scanned in place with the SIMD text kernels. The search stops at the
+ * slice being searched by each thread once the limit of matches is reached
+ * or the listener asks to stop.
+ *
+ * The Documents are read from several threads, so they must not be
+ * modified until the search returns.
+ *
+ * @param docs The Documents to search.
+ * @param text The string to find, not empty.
+ * @param options The options of the search.
+ * @param pool The pool to search with. Not owned.
+ * @param listener The listener to send the matches to. Not owned.
+ * @return The number of matches sent to the listener.
+ */
+size_t SearchWorkspace(const vector<const Document*>& docs,
+                       const string& text, const SearchOptions& options,
+                       ThreadPool *pool, SearchListener *listener);
+
+}  // namespace kamiah
+
+#endif  // KAMIAH_WORKSPACE_SEARCH_H_
@@ -0,0 +1,152 @@
+/**
+ * @file workspace_search_test.cc
+ * @brief Unit tests for the search of many Documents.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "workspace_search.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+using std::map;
+using std::sort;
+using std::string;
+using std::vector;
+
+namespace kamiah {
+
+namespace {
+
+// Records the matches it receives and stops after a number of calls.
+class RecordingListener : public SearchListener {
+ public:
+  explicit RecordingListener(int max_calls)
+      : max_calls_(max_calls), num_calls(0) {}
+
+  virtual bool OnSearchMatches(DocID doc_id, const vector<Index>& found) {
+    matches[doc_id].insert(matches[doc_id].end(), found.begin(),
+                           found.end());
+    return ++num_calls != max_calls_;
+  }
+
+  int max_calls_;
+  int num_calls;
+  map<DocID, vector<Index> > matches;
+};
+
+}  // namespace
+
+class WorkspaceSearchTest : public ::testing::Test {
+ protected:
+  WorkspaceSearchTest() : pool_(4) {
+    // Documents of every size, some with an index
+    srand(48);
+    for (DocID doc_id = 0; doc_id < 50; ++doc_id) {
+      string data;
+      for (int i = (doc_id % 10 == 0) ? 200000 : rand() % 3000; i > 0; --i) {
+        data.push_back("papya\n"[rand() % 6]);
+      }
+      Document *doc = new Document(doc_id);
+      Diff diff(0, data);
+      EXPECT_TRUE(doc->ApplyDiff(&diff));
+      if (doc_id % 3 == 0) {
+        doc->EnableSearchIndex();
+      }
+      docs_.push_back(doc);
+      data_.push_back(data);
+    }
+  }
+
+  virtual ~WorkspaceSearchTest() {
+    for (size_t i = 0; i < docs_.size(); ++i) {
+      delete docs_[i];
+    }
+  }
+
+  // Finds all the occurrences of text in a Document without an index.
+  vector<Index> FindAll(DocID doc_id, const string& text) const {
+    vector<Index> matches;
+    const string& data = data_[doc_id];
+    for (size_t i = data.find(text); i != string::npos;
+         i = data.find(text, i + 1)) {
+      matches.push_back(i);
+    }
+    return matches;
+  }
+
+  ThreadPool pool_;
+  vector<const Document*> docs_;
+  vector<string> data_;
+};
+
+TEST_F(WorkspaceSearchTest, FindsAll) {
+  const char *texts[] = {"papaya", "y", "pa\npa", "kamiah"};
+  SearchOptions options;
+  options.slice_size = 10000;
+  for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); ++i) {
+    RecordingListener listener(-1);
+    size_t total = 0;
+    for (DocID doc_id = 0; doc_id < 50; ++doc_id) {
+      total += FindAll(doc_id, texts[i]).size();
+    }
+    EXPECT_EQ(total, SearchWorkspace(docs_, texts[i], options, &pool_,
+                                     &listener));
+    for (DocID doc_id = 0; doc_id < 50; ++doc_id) {
+      // Slices may be reported in any order
+      vector<Index>& matches = listener.matches[doc_id];
+      sort(matches.begin(), matches.end());
+      EXPECT_EQ(FindAll(doc_id, texts[i]), matches) << texts[i] << doc_id;
+    }
+  }
+}
+
+TEST_F(WorkspaceSearchTest, UnslicedDocuments) {
+  const Length kSliceSizes[] = {0, -1};
+  for (size_t i = 0; i < sizeof(kSliceSizes) / sizeof(kSliceSizes[0]); ++i) {
+    SearchOptions options;
+    options.slice_size = kSliceSizes[i];
+    RecordingListener listener(-1);
+    size_t total = 0;
+    for (DocID doc_id = 0; doc_id < 50; ++doc_id) {
+      total += FindAll(doc_id, "papaya").size();
+    }
+    EXPECT_EQ(total, SearchWorkspace(docs_, "papaya", options, &pool_,
+                                     &listener));
+    for (DocID doc_id = 0; doc_id < 50; ++doc_id) {
+      EXPECT_EQ(FindAll(doc_id, "papaya"), listener.matches[doc_id])
+          << kSliceSizes[i] << " " << doc_id;
+    }
+  }
+}
+
+TEST_F(WorkspaceSearchTest, Limits) {
+  SearchOptions options;
+  options.max_matches = 1000;
+  RecordingListener listener(-1);
+  EXPECT_EQ(1000U, SearchWorkspace(docs_, "pa", options, &pool_, &listener));
+  size_t total = 0;
+  for (map<DocID, vector<Index> >::iterator it = listener.matches.begin();
+       it != listener.matches.end(); ++it) {
+    total += it->second.size();
+  }
+  EXPECT_EQ(1000U, total);
+
+  // The listener can stop the search
+  RecordingListener stopping(3);
+  options.max_matches = 0;
+  SearchWorkspace(docs_, "pa", options, &pool_, &stopping);
+  EXPECT_EQ(3, stopping.num_calls);
+
+  EXPECT_EQ(0U, SearchWorkspace(vector<const Document*>(), "pa", options,
+                                &pool_, &listener));
+}
+
+}  // namespace kamiah
@@ -0,0 +1,18 @@
+# Generates the Makefile of the kamiah_ext Ruby extension, which compiles the
+# Kamiah engine sources it needs straight from ../../../kamiah (see
+# kamiah_engine.cc). Built by `rake kamiah:compile`.
+#
+# Author: Victor Marmol (vmarmol@gmail.com)
+
+require 'mkmf'
+
+kamiah_dir = File.expand_path('../../../../kamiah', __FILE__)
+$INCFLAGS << " -I#{kamiah_dir}"
+$srcs = %w(kamiah_ext.c kamiah_engine.cc)
+$LIBS << ' -lstdc++ -lpthread'
+
+have_header('ruby/thread.h')
+have_func('rb_thread_call_without_gvl', 'ruby/thread.h')
+have_func('rb_thread_blocking_region', 'ruby.h')
+
+create_makefile('kamiah_ext')
@@ -0,0 +1,16 @@
+/**
+ * @file kamiah_engine.cc
+ * @brief The parts of the Kamiah engine used by the Ruby extension, compiled
+ *     from the sources in kamiah/ as a single translation unit.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include "diff.cc"
+#include "text_kernels.cc"
+#include "text.cc"
+#include "marker_tree.cc"
+#include "trigram_index.cc"
+#include "document.cc"
+#include "mutex.cc"
+#include "kamiah_c.cc"
@@ -0,0 +1,272 @@
+/**
+ * @file kamiah_ext.c
+ * @brief Ruby extension embedding Kamiah Documents in-process, on top of the
+ *     C API in kamiah_c.h.
+ *
+ * Defines Kamiah::Document. Diffs are Kamiah::Diff structs, defined in
+ * lib/kamiah.rb. The GVL is released while working on large Documents so
+ * that other Ruby threads keep running, which is safe because a
+ * kamiah_document_t has its own lock.
+ *
+ * @author Victor Marmol (vmarmol@gmail.com)
+ */
+
+#include <ruby.h>
+#include <ruby/encoding.h>
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#endif
+
+#include "kamiah_c.h"
+
+/* Below this many bytes of work it is cheaper to keep the GVL. */
+#define KAMIAH_NOGVL_THRESHOLD (64 * 1024)
+
+static VALUE cDocument;
+static VALUE cDiff;
+static ID id_insert;
+static ID id_delete;
+static ID id_type;
+static ID id_index;
+static ID id_length;
+static ID id_text;
+
+/* Runs func(arg) without the GVL if the work is large enough. func must not
+ * touch any Ruby objects. */
+static void *CallWithoutGvl(void *(*func)(void *), void *arg, size_t work) {
+  if (work < KAMIAH_NOGVL_THRESHOLD) {
+    return func(arg);
+  }
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+  return rb_thread_call_without_gvl(func, arg, NULL, NULL);
+#elif defined(HAVE_RB_THREAD_BLOCKING_REGION)
+  return (void *) rb_thread_blocking_region((rb_blocking_function_t *) func,
+                                            arg, NULL, NULL);
+#else
+  return func(arg);
+#endif
+}
+
+static void FreeDocument(void *doc) {
+  kamiah_document_free((kamiah_document_t *) doc);
+}
+
+static size_t DocumentMemsize(const void *doc) {
+  return (doc == NULL) ? 0 :
+      kamiah_document_size((kamiah_document_t *) doc);
+}
+
+static const rb_data_type_t kDocumentType = {
+  "Kamiah::Document",
+  {NULL, FreeDocument, DocumentMemsize,},
+};
+
+static kamiah_document_t *GetDocument(VALUE self) {
+  kamiah_document_t *doc;
+  TypedData_Get_Struct(self, kamiah_document_t, &kDocumentType, doc);
+  if (doc == NULL) {
+    rb_raise(rb_eRuntimeError, "uninitialized Kamiah::Document");
+  }
+  return doc;
+}
+
+static VALUE DocumentAlloc(VALUE klass) {
+  return TypedData_Wrap_Struct(klass, &kDocumentType, NULL);
+}
+
+/*
+ * call-seq: Kamiah::Document.new(doc_id)
+ *
+ * Creates an empty Document.
+ */
+static VALUE DocumentInitialize(VALUE self, VALUE doc_id) {
+  if (DATA_PTR(self) != NULL) {
+    rb_raise(rb_eRuntimeError, "Kamiah::Document already initialized");
+  }
+  DATA_PTR(self) = kamiah_document_new(NUM2LL(doc_id));
+  return self;
+}
+
+/*
+ * call-seq: doc.id -> Integer
+ */
+static VALUE DocumentId(VALUE self) {
+  return LL2NUM(kamiah_document_id(GetDocument(self)));
+}
+
+/*
+ * call-seq: doc.version -> Integer
+ */
+static VALUE DocumentVersion(VALUE self) {
+  return LL2NUM(kamiah_document_version(GetDocument(self)));
+}
+
+/*
+ * call-seq: doc.size -> Integer
+ *
+ * The number of bytes in the Document.
+ */
+static VALUE DocumentSize(VALUE self) {
+  return SIZET2NUM(kamiah_document_size(GetDocument(self)));
+}
+
+struct ApplyDiffArgs {
+  kamiah_document_t *doc;
+  kamiah_diff_t diff;
+  int64_t version;
+};
+
+static void *ApplyDiffWithoutGvl(void *arg) {
+  struct ApplyDiffArgs *args = (struct ApplyDiffArgs *) arg;
+  args->version = kamiah_document_apply_diff(args->doc, &args->diff);
+  return NULL;
+}
+
+/*
+ * call-seq: doc.apply_diff(diff) -> Integer or nil
+ *
+ * Applies a Kamiah::Diff. Returns the version of the applied diff, or nil if
+ * it was not applied. The version of diff is not modified.
+ */
+static VALUE DocumentApplyDiff(VALUE self, VALUE diff) {
+  struct ApplyDiffArgs args;
+  VALUE type = rb_funcall(diff, id_type, 0);
+  VALUE text = Qnil;
+
+  args.doc = GetDocument(self);
+  args.diff.version = 0;
+  args.diff.index = NUM2LL(rb_funcall(diff, id_index, 0));
+  if (SYMBOL_P(type) && (SYM2ID(type) == id_insert)) {
+    /* A frozen string shares the bytes of the original without copying them
+     * and, unlike it, cannot be modified while the GVL is released. */
+    text = rb_funcall(diff, id_text, 0);
+    StringValue(text);
+    text = rb_str_new_frozen(text);
+    args.diff.type = KAMIAH_INSERT;
+    args.diff.length = 0;
+    args.diff.text = RSTRING_PTR(text);
+    args.diff.text_size = RSTRING_LEN(text);
+  } else if (SYMBOL_P(type) && (SYM2ID(type) == id_delete)) {
+    args.diff.type = KAMIAH_DELETE;
+    args.diff.length = NUM2LL(rb_funcall(diff, id_length, 0));
+    args.diff.text = NULL;
+    args.diff.text_size = 0;
+  } else {
+    rb_raise(rb_eArgError, "diff type must be :insert or :delete");
+  }
+
+  CallWithoutGvl(&ApplyDiffWithoutGvl, &args, args.diff.text_size);
+  RB_GC_GUARD(text);
+  return (args.version < 0) ? Qnil : LL2NUM(args.version);
+}
+
+struct GetDataArgs {
+  kamiah_document_t *doc;
+  char *data;
+  size_t capacity;
+  size_t size;
+  int copied;
+};
+
+static void *GetDataWithoutGvl(void *arg) {
+  struct GetDataArgs *args = (struct GetDataArgs *) arg;
+  args->copied = kamiah_document_get_data(args->doc, args->data,
+                                          args->capacity, &args->size);
+  return NULL;
+}
+
+/*
+ * call-seq: doc.data -> String
+ *
+ * The contents of the Document, as UTF-8.
+ */
+static VALUE DocumentData(VALUE self) {
+  struct GetDataArgs args;
+  VALUE data;
+
+  /* Copy straight into the buffer of the new string. If the Document grows
+   * in between, try again with its new size. */
+  args.doc = GetDocument(self);
+  args.size = kamiah_document_size(args.doc);
+  do {
+    data = rb_str_new(NULL, args.size);
+    args.data = RSTRING_PTR(data);
+    args.capacity = args.size;
+    CallWithoutGvl(&GetDataWithoutGvl, &args, args.capacity);
+  } while (!args.copied);
+
+  rb_str_set_len(data, args.size);
+  rb_enc_associate(data, rb_utf8_encoding());
+  return data;
+}
+
+/* Converts updates to an Array of Kamiah::Diffs. */
+static VALUE BuildDiffs(VALUE arg) {
+  kamiah_updates_t *updates = (kamiah_updates_t *) arg;
+  VALUE diffs = rb_ary_new2(kamiah_updates_size(updates));
+  size_t i;
+
+  for (i = 0; i < kamiah_updates_size(updates); ++i) {
+    kamiah_diff_t diff;
+    VALUE text;
+    kamiah_updates_get(updates, i, &diff);
+    if (diff.type == KAMIAH_INSERT) {
+      text = rb_enc_str_new(diff.text, diff.text_size, rb_utf8_encoding());
+      rb_ary_push(diffs, rb_struct_new(cDiff, LL2NUM(diff.version),
+                                       ID2SYM(id_insert), LL2NUM(diff.index),
+                                       Qnil, text));
+    } else {
+      rb_ary_push(diffs, rb_struct_new(cDiff, LL2NUM(diff.version),
+                                       ID2SYM(id_delete), LL2NUM(diff.index),
+                                       LL2NUM(diff.length), Qnil));
+    }
+  }
+  return diffs;
+}
+
+static VALUE FreeUpdates(VALUE arg) {
+  kamiah_updates_free((kamiah_updates_t *) arg);
+  return Qnil;
+}
+
+/*
+ * call-seq: doc.updates(from_version) -> Array or nil
+ *
+ * The Kamiah::Diffs from from_version to the current version, or nil if
+ * they are no longer available and the data should be used instead.
+ */
+static VALUE DocumentUpdates(VALUE self, VALUE from_version) {
+  kamiah_updates_t *updates =
+      kamiah_document_get_updates(GetDocument(self), NUM2LL(from_version));
+
+  if (updates == NULL) {
+    return Qnil;
+  }
+
+  /* Building the Ruby objects may raise, which must not leak updates. */
+  return rb_ensure(&BuildDiffs, (VALUE) updates, &FreeUpdates,
+                   (VALUE) updates);
+}
+
+void Init_kamiah_ext(void) {
+  VALUE mKamiah = rb_define_module("Kamiah");
+  cDiff = rb_const_get(mKamiah, rb_intern("Diff"));
+  rb_gc_register_address(&cDiff);
+
+  id_insert = rb_intern("insert");
+  id_delete = rb_intern("delete");
+  id_type = rb_intern("type");
+  id_index = rb_intern("index");
+  id_length = rb_intern("length");
+  id_text = rb_intern("text");
+
+  cDocument = rb_define_class_under(mKamiah, "Document", rb_cObject);
+  rb_define_alloc_func(cDocument, &DocumentAlloc);
+  rb_define_method(cDocument, "initialize", &DocumentInitialize, 1);
+  rb_define_method(cDocument, "id", &DocumentId, 0);
+  rb_define_method(cDocument, "version", &DocumentVersion, 0);
+  rb_define_method(cDocument, "size", &DocumentSize, 0);
+  rb_define_method(cDocument, "apply_diff", &DocumentApplyDiff, 1);
+  rb_define_method(cDocument, "data", &DocumentData, 0);
+  rb_define_method(cDocument, "updates", &DocumentUpdates, 1);
+}
@@ -0,0 +1,26 @@
+# In-process bindings of Kamiah, the document engine of PapayaIDE. The native
+# part lives in ext/kamiah and is built with `rake kamiah:compile`.
+#
+#   doc = Kamiah::Document.new(1)
+#   doc.apply_diff(Kamiah::Diff.insert(0, 'papaya'))  # => 1
+#   doc.data                                          # => "papaya"
+#   doc.updates(1)                                    # => [#<struct ...>]
+#
+# Author: Victor Marmol (vmarmol@gmail.com)
+
+module Kamiah
+  # A unit of change to a Document. type is :insert (with a text) or :delete
+  # (with a length). version is set on the diffs returned by
+  # Document#updates.
+  Diff = Struct.new(:version, :type, :index, :length, :text) do
+    def self.insert(index, text)
+      new(nil, :insert, index, nil, text)
+    end
+
+    def self.delete(index, length)
+      new(nil, :delete, index, length, nil)
+    end
+  end
+end
+
+require 'kamiah_ext'